@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <boost/bind.hpp>
+#include <boost/coroutine/all.hpp>
+
+#include "util/hots_coro.h"
+
+/*
+ * Switch latency of the in-tree coroutine engine vs. boost's
+ * symmetric_coroutine. Coroutines 1..num_coro-1 pass control round-robin to
+ * the next coroutine, like slaves that send requests and yield in HoTS.
+ */
+#define NUM_SWITCHES (50 * 1000 * 1000)
+#define MAX_CORO 64
+
+typedef boost::coroutines::symmetric_coroutine<void>::call_type boost_call_t;
+typedef boost::coroutines::symmetric_coroutine<void>::yield_type boost_yield_t;
+
+int num_coro;
+long long num_switches;	/* Done so far, over all coroutines */
+
+hots_coro::call_type hots_coro_arr[MAX_CORO];
+boost_call_t boost_coro_arr[MAX_CORO];
+
+void hots_coro_func(hots_coro::yield_type &yield, int coro_id)
+{
+	while(num_switches < NUM_SWITCHES) {
+		num_switches++;
+		yield(hots_coro_arr[(coro_id + 1) % num_coro]);
+	}
+
+	yield();	/* Back to main() */
+}
+
+void boost_coro_func(boost_yield_t &yield, int coro_id)
+{
+	while(num_switches < NUM_SWITCHES) {
+		num_switches++;
+		yield(boost_coro_arr[(coro_id + 1) % num_coro]);
+	}
+
+	yield();	/* Back to main() */
+}
+
+double sec_since(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_REALTIME, &end);
+	return (end.tv_sec - start->tv_sec) +
+		(double) (end.tv_nsec - start->tv_nsec) / 1000000000;
+}
+
+int main(int argc, char *argv[])
+{
+	num_coro = (argc >= 2) ? atoi(argv[1]) : 20;
+	if(num_coro < 2 || num_coro > MAX_CORO) {
+		printf("Usage: ./main [num_coro in 2..%d]\n", MAX_CORO);
+		exit(-1);
+	}
+
+	struct timespec start;
+
+	/* In-tree engine */
+	for(int coro_i = 0; coro_i < num_coro; coro_i++) {
+		hots_coro_arr[coro_i] = hots_coro::call_type(
+			boost::bind(hots_coro_func, _1, coro_i),
+			hots_coro::attributes(hots_coro::fpu_not_preserved));
+	}
+
+	num_switches = 0;
+	clock_gettime(CLOCK_REALTIME, &start);
+	hots_coro_arr[0]();
+	double hots_ns = sec_since(&start) * 1000000000 / num_switches;
+
+	/* boost */
+	for(int coro_i = 0; coro_i < num_coro; coro_i++) {
+		boost_coro_arr[coro_i] = boost_call_t(
+			boost::bind(boost_coro_func, _1, coro_i),
+			boost::coroutines::attributes(
+				boost::coroutines::fpu_not_preserved));
+	}
+
+	num_switches = 0;
+	clock_gettime(CLOCK_REALTIME, &start);
+	boost_coro_arr[0]();
+	double boost_ns = sec_since(&start) * 1000000000 / num_switches;
+
+	printf("coro-bench: %d coroutines, %d switches. hots_coro = %.2f ns, "
+		"boost = %.2f ns per switch\n",
+		num_coro, NUM_SWITCHES, hots_ns, boost_ns);
+
+	return 0;
+}
@@ -4,8 +4,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "mica/util/config.h"
+
 #define CHECK_RESP 0
 #define USE_UNIQUE_WORKERS 1 /* All requests in batch are to different workers */
+#define USE_ZERO_COPY_RESP 0 /* Get responses in place (NULL resp_buf) */
 
 struct global_stats_t {
 	double req_rate;
@@ -86,7 +86,12 @@ void slave_func(coro_yield_t &yield, int coro_id)
 	rpc_req_t *req_arr[MAX_REQ_BATCH_SIZE] __attribute__((unused));
 	uint8_t *resp_buf[MAX_REQ_BATCH_SIZE];
 	for(size_t i = 0; i < req_batch_size; i++) {
+#if USE_ZERO_COPY_RESP == 1
+		static_assert(RPC_ENABLE_ZERO_COPY_RESP == 1, "");
+		resp_buf[i] = NULL;	/* The RPC layer points req->resp_buf at it */
+#else
 		resp_buf[i] = (uint8_t *) memalign(8, size_resp);
+#endif
 	}
 
 	/*
@@ -140,10 +145,15 @@ void slave_func(coro_yield_t &yield, int coro_id)
 		for(size_t i = 0; i < req_batch_size; i++) {
 			assert(req_arr[i]->resp_len == size_resp);
 			uint8_t req_magic = magic + iter_coro + i;
-			assert(resp_buf[i][0] == req_magic);
+			assert(req_arr[i]->resp_buf[0] == req_magic);
 		}
 #endif
 
+#if USE_ZERO_COPY_RESP == 1
+		/* Done with the zero-copy responses */
+		rpc->release_resps(coro_id);
+#endif
+
 		iter_coro++;
 		req_total += req_batch_size;
 		
@@ -186,6 +196,10 @@ void slave_func(coro_yield_t &yield, int coro_id)
 			clock_gettime(CLOCK_REALTIME, &msr_start);
 
 			rpc->print_stats();
+			if(wrkr_lid == 0) {
+				rpc->print_lat_stats();
+			}
+
 			req_total = 0;
 			lat_sum_us = 0;
 		}
@@ -254,6 +268,8 @@ void run_thread(struct thread_params *params)
 		base_port_index, num_ports,
 		num_qps, numa_node, postlist,
 		(max_size + sizeof(rpc_cmsg_reqhdr_t)) * req_batch_size);
+	_rpc_args.num_futures = 0;	/* Only regular batches: fewer RECVs */
+	_rpc_args.use_oneway = false;
 
 	cout << "Starting thread " << wrkr_gid << endl;
 	rpc = new Rpc(_rpc_args);
@@ -57,9 +57,15 @@ public:
 
 		for(int repl_i = 0; repl_i < num_replicas; repl_i++) {
 			rpc->register_rpc_handler(RPC_SAVING_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) saving_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) saving_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_SAVING_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 			rpc->register_rpc_handler(RPC_CHECKING_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) checking_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) checking_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_CHECKING_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 		}
 	}
 
@@ -128,6 +134,7 @@ public:
 	void populate_savings_and_checking_table(Mappings *mappings);
 	int load_into_table(Mappings *mappings, FixedTable *table,
 		int repl_i, hots_key_t hots_key, void *val_ptr, size_t val_size);
+	void register_procs(ProcServer *procserver) const;
 
 };
 
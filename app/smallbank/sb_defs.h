@@ -19,6 +19,14 @@
 #define sb_stat_inc(x, y) \
 	do {if (SB_COLLECT_STATS) x += y;} while (0)
 
+/*
+ * Run transactions whose accounts have the same primary as stored procedures
+ * at that primary (procserver/procserver.h). Both keys of an account have the
+ * same primary, so only AMG and SP transactions whose two accounts have
+ * different primaries run as regular transactions.
+ */
+#define SB_ENABLE_PROCS 0
+
 /* STORED PROCEDURE EXECUTION FREQUENCIES (0-100) */
 #define FREQUENCY_AMALGAMATE        15
 #define FREQUENCY_BALANCE			15
@@ -97,4 +105,13 @@ enum class sb_txn_type_t : int {
 	write_check,
 };
 
+/* Parameters of the stored procedure for a transaction; ID = txn type */
+struct sb_proc_params_t {
+	uint64_t acct_id_0;
+	uint64_t acct_id_1;	/* Only for amalgamate and send_payment */
+	float amount;
+	uint32_t unused;
+};
+static_assert(sizeof(sb_proc_params_t) % sizeof(uint64_t) == 0, "");
+
 #endif /* SB_DEFS */
@@ -128,4 +128,170 @@ void SB::populate_savings_and_checking_table(Mappings *mappings)
 
 }
 
+// Stored procedures (SB_ENABLE_PROCS). These run at the accounts' primary and
+// follow the transactions in worker.cc.
+
+static bool sb_proc_amalgamate(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *sav_obj_0 = ps->write(RPC_SAVING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	hots_obj_t *chk_obj_0 = ps->write(RPC_CHECKING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	hots_obj_t *chk_obj_1 = ps->write(RPC_CHECKING_REQ, p->acct_id_1,
+		tx_write_mode_t::update);
+	if(sav_obj_0 == NULL || chk_obj_0 == NULL || chk_obj_1 == NULL) {
+		return false;
+	}
+
+	sb_sav_val_t *sav_val_0 = (sb_sav_val_t *) sav_obj_0->val;
+	sb_chk_val_t *chk_val_0 = (sb_chk_val_t *) chk_obj_0->val;
+	sb_chk_val_t *chk_val_1 = (sb_chk_val_t *) chk_obj_1->val;
+	sb_dassert(sav_val_0->magic == sb_sav_magic);
+	sb_dassert(chk_val_0->magic == sb_chk_magic);
+	sb_dassert(chk_val_1->magic == sb_chk_magic);
+
+	chk_val_1->bal += (sav_val_0->bal + chk_val_0->bal);
+	sav_val_0->bal = 0;
+	chk_val_0->bal = 0;
+	return true;
+}
+
+/* Outputs the total balance */
+static bool sb_proc_balance(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *sav_obj = ps->read(RPC_SAVING_REQ, p->acct_id_0);
+	hots_obj_t *chk_obj = ps->read(RPC_CHECKING_REQ, p->acct_id_0);
+	if(sav_obj == NULL || chk_obj == NULL) {
+		return false;
+	}
+
+	sb_sav_val_t *sav_val = (sb_sav_val_t *) sav_obj->val;
+	sb_chk_val_t *chk_val = (sb_chk_val_t *) chk_obj->val;
+	sb_dassert(sav_val->magic == sb_sav_magic);
+	sb_dassert(chk_val->magic == sb_chk_magic);
+
+	float bal = sav_val->bal + chk_val->bal;
+	ps->set_output(&bal, sizeof(bal));
+	return true;
+}
+
+static bool sb_proc_deposit_checking(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *chk_obj = ps->write(RPC_CHECKING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	if(chk_obj == NULL) {
+		return false;
+	}
+
+	sb_chk_val_t *chk_val = (sb_chk_val_t *) chk_obj->val;
+	sb_dassert(chk_val->magic == sb_chk_magic);
+
+	chk_val->bal += p->amount;
+	return true;
+}
+
+static bool sb_proc_send_payment(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *chk_obj_0 = ps->write(RPC_CHECKING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	hots_obj_t *chk_obj_1 = ps->write(RPC_CHECKING_REQ, p->acct_id_1,
+		tx_write_mode_t::update);
+	if(chk_obj_0 == NULL || chk_obj_1 == NULL) {
+		return false;
+	}
+
+	sb_chk_val_t *chk_val_0 = (sb_chk_val_t *) chk_obj_0->val;
+	sb_chk_val_t *chk_val_1 = (sb_chk_val_t *) chk_obj_1->val;
+	sb_dassert(chk_val_0->magic == sb_chk_magic);
+	sb_dassert(chk_val_1->magic == sb_chk_magic);
+
+	if(chk_val_0->bal < p->amount) {
+		return false;
+	}
+
+	chk_val_0->bal -= p->amount;	/* Debit */
+	chk_val_1->bal += p->amount;	/* Credit */
+	return true;
+}
+
+static bool sb_proc_transact_saving(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *sav_obj = ps->write(RPC_SAVING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	if(sav_obj == NULL) {
+		return false;
+	}
+
+	sb_sav_val_t *sav_val = (sb_sav_val_t *) sav_obj->val;
+	sb_dassert(sav_val->magic == sb_sav_magic);
+
+	sav_val->bal += p->amount;
+	return true;
+}
+
+static bool sb_proc_write_check(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg)
+{
+	sb_proc_params_t *p = (sb_proc_params_t *) params;
+
+	hots_obj_t *sav_obj = ps->read(RPC_SAVING_REQ, p->acct_id_0);
+	hots_obj_t *chk_obj = ps->write(RPC_CHECKING_REQ, p->acct_id_0,
+		tx_write_mode_t::update);
+	if(sav_obj == NULL || chk_obj == NULL) {
+		return false;
+	}
+
+	sb_sav_val_t *sav_val = (sb_sav_val_t *) sav_obj->val;
+	sb_chk_val_t *chk_val = (sb_chk_val_t *) chk_obj->val;
+	sb_dassert(sav_val->magic == sb_sav_magic);
+	sb_dassert(chk_val->magic == sb_chk_magic);
+
+	if(sav_val->bal + chk_val->bal < p->amount) {
+		chk_val->bal -= (p->amount + 1);
+	} else {
+		chk_val->bal -= p->amount;
+	}
+
+	return true;
+}
+
+/* Register the primary tables and the procedures of all transaction types */
+void SB::register_procs(ProcServer *procserver) const
+{
+	assert(procserver != NULL);
+
+	procserver->register_table(RPC_SAVING_REQ, saving_table[0]);
+	procserver->register_table(RPC_CHECKING_REQ, checking_table[0]);
+
+	procserver->register_proc(static_cast<int>(sb_txn_type_t::amalgamate),
+		sb_proc_amalgamate, NULL);
+	procserver->register_proc(static_cast<int>(sb_txn_type_t::balance),
+		sb_proc_balance, NULL);
+	procserver->register_proc(
+		static_cast<int>(sb_txn_type_t::deposit_checking),
+		sb_proc_deposit_checking, NULL);
+	procserver->register_proc(static_cast<int>(sb_txn_type_t::send_payment),
+		sb_proc_send_payment, NULL);
+	procserver->register_proc(
+		static_cast<int>(sb_txn_type_t::transact_saving),
+		sb_proc_transact_saving, NULL);
+	procserver->register_proc(static_cast<int>(sb_txn_type_t::write_check),
+		sb_proc_write_check, NULL);
+}
+
 #endif /* SB_UTILS_H */
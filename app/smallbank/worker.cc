@@ -27,6 +27,7 @@ __thread coro_call_t *coro_arr;
 __thread coro_id_t *next_coro;
 __thread Rpc *rpc;
 __thread Logger *logger;
+__thread ProcServer *procserver;
 __thread Mappings *mappings;
 __thread SB *sb;
 __thread sb_txn_type_t *workgen_arr;
@@ -37,6 +38,8 @@ __thread long long stat_tx_attempted_tot = 0;	/* Collected in non-debug */
 __thread long long stat_tx_committed_tot = 0;	/* Collected in non-debug */
 __thread long long stat_tx_attempted[SB_TXN_TYPES];
 __thread long long stat_tx_committed[SB_TXN_TYPES];
+__thread long long stat_tx_proc_committed_tot = 0;	/* Stored procedures */
+__thread long long stat_tx_proc_aborted_tot = 0;
 
 __thread uint64_t tg_seed = 0xdeadbeef;	/* Thread-global random seed */
 __thread struct timespec msr_start, msr_end;
@@ -84,6 +87,39 @@ void master_func(coro_yield_t &yield, int coro_id)
 	}
 }
 
+/*
+ * Run a transaction on accounts @acct_id_0 and @acct_id_1 as a stored
+ * procedure if the accounts have the same primary. The saving and checking
+ * keys of an account are both its account ID. Returns false if the
+ * transaction must be run normally.
+ */
+bool txn_run_proc(coro_yield_t &yield, Tx *tx, sb_txn_type_t txn_type,
+	uint64_t acct_id_0, uint64_t acct_id_1, float amount)
+{
+	int primary_mn = tx->get_primary_mn(acct_id_0);
+	if(tx->get_primary_mn(acct_id_1) != primary_mn) {
+		return false;
+	}
+
+	sb_proc_params_t params;
+	params.acct_id_0 = acct_id_0;
+	params.acct_id_1 = acct_id_1;
+	params.amount = amount;
+
+	tx_status_t status = tx->run_proc(yield, primary_mn,
+		static_cast<int>(txn_type), &params, sizeof(params), NULL);
+
+	if(status == tx_status_t::committed) {
+		stat_tx_committed_tot++;
+		sb_stat_inc(stat_tx_committed[static_cast<int>(txn_type)], 1);
+		stat_tx_proc_committed_tot++;
+	} else {
+		stat_tx_proc_aborted_tot++;
+	}
+
+	return true;
+}
+
 void txn_amalgamate(coro_yield_t &yield, int coro_id, Tx *tx)
 {
 	sb_txn_type_t txn_type = sb_txn_type_t::amalgamate;
@@ -95,6 +131,12 @@ void txn_amalgamate(coro_yield_t &yield, int coro_id, Tx *tx)
 	uint64_t acct_id_0, acct_id_1;
 	sb->get_two_accounts(&tg_seed, &acct_id_0, &acct_id_1);
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id_0, acct_id_1, 0)) {
+		return;
+	}
+#endif
+
 	/* Read from savings and checking tables for acct_id_0 */
 	hots_obj_t sav_obj_0;
 	sb_sav_key_t sav_key_0;
@@ -160,6 +202,12 @@ void txn_balance(coro_yield_t &yield, int coro_id, Tx *tx)
 	uint64_t acct_id;
 	sb->get_account(&tg_seed, &acct_id);
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id, acct_id, 0)) {
+		return;
+	}
+#endif
+
 	/* Read from savings and checking tables */
 	hots_obj_t sav_obj;
 	sb_sav_key_t sav_key;
@@ -205,6 +253,12 @@ void txn_deposit_checking(coro_yield_t &yield, int coro_id, Tx *tx)
 	sb->get_account(&tg_seed, &acct_id);
 	float amount = 1.3;
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id, acct_id, amount)) {
+		return;
+	}
+#endif
+
 	/* Read from checking table */
 	hots_obj_t chk_obj;
 	sb_chk_key_t chk_key;
@@ -249,6 +303,12 @@ void txn_send_payment(coro_yield_t &yield, int coro_id, Tx *tx)
 	sb->get_two_accounts(&tg_seed, &acct_id_0, &acct_id_1);
 	float amount = 5.0;
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id_0, acct_id_1, amount)) {
+		return;
+	}
+#endif
+
 	/* Read from checking table */
 	hots_obj_t chk_obj_0, chk_obj_1;
 
@@ -306,6 +366,12 @@ void txn_transact_saving(coro_yield_t &yield, int coro_id, Tx *tx)
 	sb->get_account(&tg_seed, &acct_id);
 	float amount = 20.20;
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id, acct_id, amount)) {
+		return;
+	}
+#endif
+
 	/* Read from saving table */
 	hots_obj_t sav_obj;
 	sb_sav_key_t sav_key;
@@ -350,6 +416,12 @@ void txn_write_check(coro_yield_t &yield, int coro_id, Tx *tx)
 	sb->get_account(&tg_seed, &acct_id);
 	float amount = 5.0;
 
+#if SB_ENABLE_PROCS == 1
+	if(txn_run_proc(yield, tx, txn_type, acct_id, acct_id, amount)) {
+		return;
+	}
+#endif
+
 	/* Read from savings. Read checking record for update. */
 	hots_obj_t sav_obj;
 	sb_sav_key_t sav_key;
@@ -483,6 +555,13 @@ void slave_func(coro_yield_t &yield, int coro_id)
 				wrkr_gid, stat_tx_attempted_tot / msr_usec,
 				gs.tx_tput, gs.req_rate, gs.creq_rate);
 #endif
+
+#if SB_ENABLE_PROCS == 1
+			printf("Worker %d: stored procedures/s = "
+				"{%.3f M committed, %.3f M aborted}\n",
+				wrkr_gid, stat_tx_proc_committed_tot / msr_usec,
+				stat_tx_proc_aborted_tot / msr_usec);
+#endif
 			fflush(stdout);
 
 			if(wrkr_lid == 0) {
@@ -499,6 +578,11 @@ void slave_func(coro_yield_t &yield, int coro_id)
 				hrd_red_printf("Machine commit tput = %.2f M/s, "
 					"req rate = {%.2f M/s, %.2f M/s coalesced}.\n",
 					tx_tput_tot, req_rate_tot, creq_rate_tot);
+
+#if DS_FIXEDTABLE_COUNT_CONFLICTS == 1
+				ds_fixedtable_print_conflicts(sb->saving_table[0], msr_usec);
+				ds_fixedtable_print_conflicts(sb->checking_table[0], msr_usec);
+#endif
 				fflush(stdout);
 			}
 
@@ -506,6 +590,8 @@ void slave_func(coro_yield_t &yield, int coro_id)
 
 			stat_tx_attempted_tot = 0;
 			stat_tx_committed_tot = 0;
+			stat_tx_proc_committed_tot = 0;
+			stat_tx_proc_aborted_tot = 0;
 			memset((void *) stat_tx_attempted,
 				0, SB_TXN_TYPES * sizeof(long long));
 			memset((void *) stat_tx_committed,
@@ -578,6 +664,13 @@ void run_thread(struct thread_params *params)
 
 	// Initialize Rpc
 	int max_pkt_size = 400; /* XXX: What should this be? */
+#if SB_ENABLE_PROCS == 1
+	/* A stored procedure's response (e.g., a prepared write set) is larger */
+	max_pkt_size = std::max(max_pkt_size,
+		(int) (sizeof(rpc_cmsg_reqhdr_t) + sizeof(procsrv_resp_t)));
+	static_assert(sizeof(rpc_cmsg_reqhdr_t) + sizeof(procsrv_resp_t) <=
+		RPC_MAX_MAX_PKT_SIZE, "");
+#endif
 
 	struct rpc_args _rpc_args = rpc_args(wrkr_gid, wrkr_lid,
 		num_workers, workers_per_machine, num_coro,
@@ -588,7 +681,18 @@ void run_thread(struct thread_params *params)
 
 	/* Register logger */
 	rpc->register_rpc_handler(RPC_LOGGER_REQ,
-		logger_rpc_handler, (void *) logger);
+		logger_rpc_handler, (void *) logger, RPC_HANDLER_NON_IDEMPOTENT);
+	rpc->register_prefetch_handler(RPC_LOGGER_REQ,
+		logger_prefetch_handler);
+
+#if SB_ENABLE_PROCS == 1
+	/* Register stored procedures */
+	procserver = new ProcServer();
+	sb->register_procs(procserver);
+	rpc->register_rpc_handler(RPC_PROCSERVER_REQ,
+		procserver_rpc_handler, (void *) procserver,
+		RPC_HANDLER_NON_IDEMPOTENT);
+#endif
 
 	/* Initialize coroutines */
 	coro_arr = new coro_call_t[num_coro];
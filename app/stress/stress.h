@@ -44,8 +44,19 @@ public:
 		assert(rpc != NULL);
 
 		for(int repl_i = 0; repl_i < num_replicas; repl_i++) {
+#if STRESS_ENABLE_BATCH_HANDLER == 1
+			static_assert(RPC_ENABLE_BATCH_HANDLERS == 1, "");
+			rpc->register_batch_handler(RPC_STRESS_TABLE_REQ + repl_i,
+				ds_fixedtable_batch_handler,
+				ds_fixedtable_max_resp_len(table[repl_i]),
+				(void *) table[repl_i], RPC_HANDLER_NON_IDEMPOTENT);
+#else
 			rpc->register_rpc_handler(RPC_STRESS_TABLE_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_STRESS_TABLE_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
+#endif
 		}
 	}
 
@@ -28,6 +28,13 @@
 
 #define ROWS_PER_MACHINE 100
 
+/*
+ * Serve table requests with ds_fixedtable_batch_handler(), which gets all
+ * table requests of a poll_comps() pass and prefetches their buckets, instead
+ * of ds_fixedtable_rpc_handler() and the prefetch handler.
+ */
+#define STRESS_ENABLE_BATCH_HANDLER 1
+
 /* SHM keys for tables: (f + 1) keys per table at every machine */
 #define TABLE_BASE_SHM_KEY 2000
 
@@ -408,6 +408,10 @@ void slave_func(coro_yield_t &yield, int coro_id)
 				hrd_red_printf("Commit tput = %.2f M/s, "
 					"req rate = {%.2f M/s, %.2f M/s coalesced}.\n",
 					tx_tput_tot, req_rate_tot, creq_rate_tot);
+
+#if DS_FIXEDTABLE_COUNT_CONFLICTS == 1
+				ds_fixedtable_print_conflicts(stress->table[0], msr_usec);
+#endif
 				fflush(stdout);
 			}
 
@@ -501,7 +505,9 @@ void run_thread(struct thread_params *params)
 
 	/* Register logger */
 	rpc->register_rpc_handler(RPC_LOGGER_REQ,
-		logger_rpc_handler, (void *) logger);
+		logger_rpc_handler, (void *) logger, RPC_HANDLER_NON_IDEMPOTENT);
+	rpc->register_prefetch_handler(RPC_LOGGER_REQ,
+		logger_prefetch_handler);
 
 	/* Initialize coroutines */
 	coro_arr = new coro_call_t[num_coro];
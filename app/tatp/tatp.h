@@ -81,15 +81,30 @@ public:
 
 		for(int repl_i = 0; repl_i < num_replicas; repl_i++) {
 			rpc->register_rpc_handler(RPC_SUBSCRIBER_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) subscriber_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) subscriber_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_SUBSCRIBER_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 			rpc->register_rpc_handler(RPC_SEC_SUBSCRIBER_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) sec_subscriber_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) sec_subscriber_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_SEC_SUBSCRIBER_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 			rpc->register_rpc_handler(RPC_SPECIAL_FACILITY_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) special_facility_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) special_facility_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_SPECIAL_FACILITY_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 			rpc->register_rpc_handler(RPC_ACCESS_INFO_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) access_info_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) access_info_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_ACCESS_INFO_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 			rpc->register_rpc_handler(RPC_CALL_FORWARDING_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) call_forwarding_table[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) call_forwarding_table[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_CALL_FORWARDING_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 		}
 	}
 
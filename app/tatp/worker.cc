@@ -525,7 +525,7 @@ bool txn_delete_call_forwarding(coro_yield_t &yield, int coro_id, Tx *tx)
 
 	if(ex_result == tx_status_t::in_progress) {
 		/*
-		 * Delete-mode write set records are handled using get_for_upd, so
+		 * Delete-mode write set records are handled using get_for_del, so
 		 * we have a valid Call Forwarding record here.
 		 */
 		auto *callfwd_val = (tatp_callfwd_val_t *) &callfwd_obj.val;
@@ -537,7 +537,7 @@ bool txn_delete_call_forwarding(coro_yield_t &yield, int coro_id, Tx *tx)
 		return (commit_status == tx_status_t::committed);
 	} else {
 		/*
-		 * This happens when the get_for_upd on the Call Forwarding record
+		 * This happens when the get_for_del on the Call Forwarding record
 		 * fails. We cannot use abort_rdonly() here, but no RPC requests
 		 * will be sent anyway.
 		 */
@@ -778,7 +778,9 @@ void run_thread(struct thread_params *params)
 
 	/* Register logger */
 	rpc->register_rpc_handler(RPC_LOGGER_REQ,
-		logger_rpc_handler, (void *) logger);
+		logger_rpc_handler, (void *) logger, RPC_HANDLER_NON_IDEMPOTENT);
+	rpc->register_prefetch_handler(RPC_LOGGER_REQ,
+		logger_prefetch_handler);
 
 	/* Initialize coroutines */
 	coro_arr = new coro_call_t[num_coro];
@@ -23,14 +23,16 @@ struct global_stats_t {
 	double tx_tput;
 	double req_rate;
 	double creq_rate;
+	double local_req_rate;	/* Requests handled without the NIC */
 	double max_lat_thread; /* Max latency (us) for all coros in this thread */
-	double pad[4];
+	double pad[3];
 
 	global_stats_t()
 	{
 		tx_tput = 0;
 		req_rate = 0;
 		creq_rate = 0;
+		local_req_rate = 0;
 		max_lat_thread = 0;
 	}
 };
@@ -17,7 +17,7 @@
 #define USE_ZIPF 0	/* If 0, uniform random dist based on fastrand is used */
 #define MEASURE_LATENCY 0	/* Should we measure transaction latency? */
 
-/* Use the pre-emptable lockserver that directly uses Rpc's queue pairs */
+/* Use the Rpc lockserver, which queues conflicting lock requests */
 #define USE_RPC_LAYER_LOCKSERVER 0
 
 __thread int wrkr_gid;	/* Global ID of this worker */
@@ -32,6 +32,7 @@ __thread int num_keys_kilo;
 __thread size_t num_keys_global, val_size;
 __thread double zipf_theta;
 __thread int read_set_size, write_percentage;
+__thread bool wide_tx;	/* More than RPC_MAX_MSG_CORO keys per transaction */
 __thread global_stats_t *global_stats;
 
 /* High-level HoTS structures */
@@ -164,21 +165,23 @@ retry:
 		if((stat_tx_tot & M_4_) == M_4_) {
 			clock_gettime(CLOCK_REALTIME, &msr_end);
 
-			/* Each of the two calls below zeroes out the corresponding stat */
+			/* Each of the calls below zeroes out the corresponding stat */
 			long long num_reqs = rpc->get_stat_num_reqs();
 			long long num_creqs = rpc->get_stat_num_creqs();
+			long long num_local_reqs = rpc->get_stat_num_local_reqs();
 
 			double msr_usec = (msr_end.tv_sec - msr_start.tv_sec) * 1000000 + 
 				(double) (msr_end.tv_nsec - msr_start.tv_nsec) / 1000;
 			seconds_since_start += (msr_usec / 1000000);
 
 			printf("Worker %d: Tx/s = %.5f M, "
-				"reqs/s = {%.3f M, %.3f M coalesced}, "
+				"reqs/s = {%.3f M, %.3f M coalesced, %.3f M local}, "
 				"avg latency = %.1f us, tx commit/s = %.5f M (fraction = %.2f), "
 				"execution failed = %lu, commit failed = %lu, "
 				"Tx stats = %s\n",
 				wrkr_lid, stat_tx_tot / msr_usec,
 				num_reqs / msr_usec, num_creqs / msr_usec,
+				num_local_reqs / msr_usec,
 				stat_tx_tot_usec / stat_tx_tot,
 				stat_commit_success / msr_usec,
 				(double) stat_commit_success / stat_tx_tot,
@@ -191,6 +194,7 @@ retry:
 			gs.tx_tput = (double) stat_commit_success / msr_usec;
 			gs.req_rate = (double) num_reqs / msr_usec;
 			gs.creq_rate = (double) num_creqs / msr_usec;
+			gs.local_req_rate = (double) num_local_reqs / msr_usec;
 			if(seconds_since_start >= 30.0) {
 				gs.max_lat_thread = rpc->get_max_batch_latency_us();
 			} else {
@@ -201,6 +205,7 @@ retry:
 				double tx_tput_tot = 0;
 				double req_rate_tot = 0;
 				double creq_rate_tot = 0;
+				double local_req_rate_tot = 0;
 				double max_lat_node = 0;	/* Max latency among all threads */
 
 				for(int wrkr_i = 0; wrkr_i < workers_per_machine; wrkr_i++) {
@@ -208,6 +213,7 @@ retry:
 					tx_tput_tot += gs_i.tx_tput;
 					req_rate_tot += gs_i.req_rate;
 					creq_rate_tot += gs_i.creq_rate;
+					local_req_rate_tot += gs_i.local_req_rate;
 
 					if(gs_i.max_lat_thread > max_lat_node) {
 						max_lat_node = gs_i.max_lat_thread;
@@ -215,9 +221,9 @@ retry:
 				}
 
 				hrd_red_printf("Machine commit tput = %.2f M/s, "
-					"req rate = {%.2f M/s, %.2f M/s coalesced}. "
+					"req rate = {%.2f M/s, %.2f M/s coalesced, %.2f M/s local}. "
 					"Maximum batch latency = %.1f ms. Runtime = %.2f s\n",
-					tx_tput_tot, req_rate_tot, creq_rate_tot,
+					tx_tput_tot, req_rate_tot, creq_rate_tot, local_req_rate_tot,
 					max_lat_node / 1000, seconds_since_start);
 				fflush(stdout);
 			}
@@ -284,6 +290,11 @@ retry:
 					key_arr[i], &obj_arr[i]);
 			}
 
+			if(wide_tx) {
+				/* Wide transactions coalesce requests to the same machine */
+				continue;
+			}
+
 			assert(primary_mn <= 63);
 			if(is_set(machine_mask, primary_mn)) {
 				/*
@@ -341,21 +352,23 @@ retry:
 		if((stat_tx_tot & K_128_) == K_128_) {
 			clock_gettime(CLOCK_REALTIME, &msr_end);
 
-			/* Each of the two calls below zeroes out the corresponding stat */
+			/* Each of the calls below zeroes out the corresponding stat */
 			long long num_reqs = rpc->get_stat_num_reqs();
 			long long num_creqs = rpc->get_stat_num_creqs();
+			long long num_local_reqs = rpc->get_stat_num_local_reqs();
 
 			double msr_usec = (msr_end.tv_sec - msr_start.tv_sec) * 1000000 + 
 				(double) (msr_end.tv_nsec - msr_start.tv_nsec) / 1000;
 			seconds_since_start += (msr_usec / 1000000);
 
 			printf("Worker %d: Tx/s = %.5f M, "
-				"reqs/s = {%.3f M, %.3f M coalesced}, "
+				"reqs/s = {%.3f M, %.3f M coalesced, %.3f M local}, "
 				"avg latency = %.1f us, tx commit/s = %.5f M (fraction = %.2f), "
 				"execution failed = %lu, commit failed = %lu, "
 				"Tx stats = %s\n",
 				wrkr_lid, stat_tx_tot / msr_usec,
 				num_reqs / msr_usec, num_creqs / msr_usec,
+				num_local_reqs / msr_usec,
 				stat_tx_tot_usec / stat_tx_tot,
 				stat_commit_success / msr_usec,
 				(double) stat_commit_success / stat_tx_tot,
@@ -368,6 +381,7 @@ retry:
 			gs.tx_tput = (double) stat_commit_success / msr_usec;
 			gs.req_rate = (double) num_reqs / msr_usec;
 			gs.creq_rate = (double) num_creqs / msr_usec;
+			gs.local_req_rate = (double) num_local_reqs / msr_usec;
 			if(seconds_since_start >= 30.0) {
 				gs.max_lat_thread = rpc->get_max_batch_latency_us();
 			} else {
@@ -378,6 +392,7 @@ retry:
 				double tx_tput_tot = 0;
 				double req_rate_tot = 0;
 				double creq_rate_tot = 0;
+				double local_req_rate_tot = 0;
 				double max_lat_node = 0;	/* Max latency among all threads */
 
 				for(int wrkr_i = 0; wrkr_i < workers_per_machine; wrkr_i++) {
@@ -385,6 +400,7 @@ retry:
 					tx_tput_tot += gs_i.tx_tput;
 					req_rate_tot += gs_i.req_rate;
 					creq_rate_tot += gs_i.creq_rate;
+					local_req_rate_tot += gs_i.local_req_rate;
 
 					if(gs_i.max_lat_thread > max_lat_node) {
 						max_lat_node = gs_i.max_lat_thread;
@@ -392,9 +408,9 @@ retry:
 				}
 
 				hrd_red_printf("Machine commit tput = %.2f M/s, "
-					"req rate = {%.2f M/s, %.2f M/s coalesced}. "
+					"req rate = {%.2f M/s, %.2f M/s coalesced, %.2f M/s local}. "
 					"Maximum batch latency = %.1f ms. Runtime = %.2f s\n",
-					tx_tput_tot, req_rate_tot, creq_rate_tot,
+					tx_tput_tot, req_rate_tot, creq_rate_tot, local_req_rate_tot,
 					max_lat_node / 1000, seconds_since_start);
 				fflush(stdout);
 			}
@@ -446,11 +462,12 @@ void parse_config()
 	assert(num_keys_kilo >= 1 && num_keys_kilo <= 8192);
 	assert(val_size >= 1 && val_size <= HOTS_MAX_VALUE);
 	assert(zipf_theta >= 0 && zipf_theta <= .99);
-	assert(read_set_size >= 1 && read_set_size <= RPC_MAX_MSG_CORO);
+	assert(read_set_size >= 1 && read_set_size <= TX_MAX_KEYS);
 	assert(write_percentage >= 0 && write_percentage <= 100);
 
-	/* Ensure that we can avoid coalescing */
-	if(read_set_size > num_machines) {
+	/* Ensure that we can avoid coalescing, except for wide transactions */
+	wide_tx = (read_set_size > RPC_MAX_MSG_CORO);
+	if(!wide_tx && read_set_size > num_machines) {
 		fprintf(stderr, "Read set size too large to avoid coalescing\n");
 		assert(false);
 	}
@@ -474,10 +491,18 @@ void init_rpc()
 {
 	/* Largest packets are generated during logging. The commit record */
 	int max_pkt_size = Tx::max_pkt_size(read_set_size,  val_size);
+	int max_msg_size = max_pkt_size;
+
+	if(wide_tx) {
+		/* Coalesced messages are fragmented into packets of up to 4 KB */
+		max_msg_size = Tx::max_msg_size(read_set_size, val_size);
+		max_pkt_size = std::min(max_msg_size, RPC_MAX_MAX_PKT_SIZE);
+	}
 
 	struct rpc_args _rpc_args = rpc_args(wrkr_gid, wrkr_lid,
 		num_workers, workers_per_machine, num_coro,
-		base_port_index, num_ports, num_qps, numa_node, postlist, max_pkt_size);
+		base_port_index, num_ports, num_qps, numa_node, postlist, max_pkt_size,
+		max_msg_size);
 
 	rpc = new Rpc(_rpc_args);
 }
@@ -494,7 +519,8 @@ void run_thread(struct thread_params *params)
 
 	mappings = new Mappings(wrkr_gid,
 		num_machines, workers_per_machine, num_backups, use_lock_server);
-	logger = new Logger(wrkr_gid, wrkr_lid, num_machines, num_coro);
+	logger = new Logger(wrkr_gid, wrkr_lid, num_machines, num_coro,
+		std::max(read_set_size, LOGGER_KEYS_PER_RECORD));
 
 	printf("Worker %d: starting. Am I lock server = %d\n",
 		wrkr_gid, mappings->am_i_lock_server);
@@ -536,12 +562,17 @@ void run_thread(struct thread_params *params)
 
 		for(int repl_i = 0; repl_i < mappings->num_replicas; repl_i++) {
 			rpc->register_rpc_handler(RPC_MICA_REQ + repl_i,
-				ds_fixedtable_rpc_handler, (void *) params->fixedtable[repl_i]);
+				ds_fixedtable_rpc_handler, (void *) params->fixedtable[repl_i],
+				RPC_HANDLER_NON_IDEMPOTENT);
+			rpc->register_prefetch_handler(RPC_MICA_REQ + repl_i,
+				ds_fixedtable_prefetch_handler);
 		}
 
 		/* Register logger */
 		rpc->register_rpc_handler(RPC_LOGGER_REQ,
-			logger_rpc_handler, (void *) logger);
+			logger_rpc_handler, (void *) logger, RPC_HANDLER_NON_IDEMPOTENT);
+		rpc->register_prefetch_handler(RPC_LOGGER_REQ,
+			logger_prefetch_handler);
 
 		/* Initialize coroutines */
 		coro_arr = new coro_call_t[num_coro];
@@ -575,7 +606,8 @@ void run_thread(struct thread_params *params)
 #else
 		lockserver = params->lockserver;
 		rpc->register_rpc_handler(RPC_LOCKSERVER_REQ,
-			lockserver_rpc_handler, (void *) lockserver);
+			lockserver_rpc_handler, (void *) lockserver,
+			RPC_HANDLER_NON_IDEMPOTENT);
 
 		coro_call_t lockserver_coro = coro_call_t(lockserver_func,
 			attributes(fpu_not_preserved));
@@ -29,12 +29,20 @@ enum class ds_reqtype_t {
 	// Sent using generic GET request
 	get_rdonly,	/* Just GET */
 	get_for_upd,	/* GET for transaction update */
+	get_for_del,	/* GET for transaction delete */
 	lock_for_ins,	/* Lock a bucket for insert */
 	del,	/* Delete */
 	unlock, /* Unlock a bucket */
+	validate,	/* Get only the header of a key read earlier */
+	tictoc_lock,	/* Lock a bucket at commit and get its header */
+
+	// Sent using TicToc GET request
+	tictoc_validate,	/* Validate a version read earlier and extend its rts */
+	tictoc_del,	/* Delete at the commit timestamp */
 
 	// Sent using generic PUT request
 	put,	/* Insert or update */
+	tictoc_put,	/* Insert or update at the commit timestamp */
 
 	/*
 	 * Max 16 req types (4 bits) because of bitfield sizing in
@@ -50,7 +58,7 @@ enum class ds_resptype_t {
 	get_rdonly_not_found,
 	get_rdonly_locked,
 
-	get_for_upd_success,
+	get_for_upd_success,	/* Also for get_for_del */
 	get_for_upd_not_found,
 	get_for_upd_locked,
 
@@ -63,12 +71,18 @@ enum class ds_resptype_t {
 	put_success,
 	del_success,
 
+	validate_success,	/* Response is the header */
+	validate_locked,
+
+	tictoc_success,	/* For tictoc_lock, the response is the header */
+	tictoc_failed,	/* Locked, or (for tictoc_validate) a newer version */
+
 	/* Max 16 resp types (4 bits). See comment for ds_reqtype_t above. */
 };
 
 // Generic GET requests are used when the object's value need not be sent in the
-// request. This includes get_rdonly, get_for_upd, lock_for_ins, unlock,
-// and del.
+// request. This includes get_rdonly, get_for_upd, get_for_del, lock_for_ins,
+// unlock, del, and validate.
 
 /* IMPORTANT: GET request should be a prefix of PUT request */
 struct ds_generic_get_req_t {
@@ -96,6 +110,23 @@ struct ds_generic_put_req_t {
 static_assert(sizeof(ds_generic_put_req_t) == sizeof(ds_generic_get_req_t) +
 	HOTS_MAX_VALUE, "");
 
+// TicToc requests carry timestamps. tictoc_validate and tictoc_del requests
+// use the TicToc GET request below. A tictoc_put request is a generic PUT
+// request followed by the 64-bit commit timestamp.
+struct ds_tictoc_get_req_t {
+	uint32_t unused;
+	uint32_t caller_id;
+	uint64_t req_type :4;
+	uint64_t unused_val_size :12;
+	uint64_t keyhash :48;
+	hots_key_t key;
+	/* Identical to ds_generic_get_req_t up to here */
+	uint64_t wts;	/* tictoc_validate: wts of the version read earlier */
+	uint64_t commit_ts;
+};
+static_assert(sizeof(ds_tictoc_get_req_t) == sizeof(ds_generic_get_req_t) +
+	2 * sizeof(uint64_t), "");
+
 /*
  * For a given value size, a PUT request is the largest among all of ds_*
  * requests and responses. (A GET response only contains the header and the
@@ -103,6 +134,8 @@ static_assert(sizeof(ds_generic_put_req_t) == sizeof(ds_generic_get_req_t) +
  */
 #define ds_put_req_size(val_sz) (sizeof(ds_generic_put_req_t) - \
 	HOTS_MAX_VALUE + val_sz)
+#define ds_tictoc_put_req_size(val_sz) \
+	(ds_put_req_size(val_sz) + sizeof(uint64_t))
 
 /* Datastore request format checks : done once ever */
 static void ds_do_checks()
@@ -124,9 +157,12 @@ forceinline size_t ds_forge_generic_get_req(rpc_req_t *rpc_req,
 {
 	ds_dassert(req_type == ds_reqtype_t::get_rdonly ||
 		req_type == ds_reqtype_t::get_for_upd ||
+		req_type == ds_reqtype_t::get_for_del ||
 		req_type == ds_reqtype_t::lock_for_ins ||
 		req_type == ds_reqtype_t::del ||
-		req_type == ds_reqtype_t::unlock);
+		req_type == ds_reqtype_t::unlock ||
+		req_type == ds_reqtype_t::validate ||
+		req_type == ds_reqtype_t::tictoc_lock);
 
 	ds_dassert(rpc_req != NULL && rpc_req->req_buf != NULL);
 	ds_dassert(is_aligned(rpc_req->req_buf, sizeof(uint32_t)));
@@ -150,7 +186,8 @@ forceinline size_t ds_forge_generic_put_req(rpc_req_t *rpc_req,
 	uint32_t caller_id, hots_key_t key, uint64_t keyhash, hots_obj_t *obj,
 	ds_reqtype_t req_type)
 {
-	ds_dassert(req_type == ds_reqtype_t::put);
+	ds_dassert(req_type == ds_reqtype_t::put ||
+		req_type == ds_reqtype_t::tictoc_put);
 	
 	ds_dassert(rpc_req != NULL && rpc_req->req_buf != NULL);
 	ds_dassert(obj != NULL);
@@ -178,4 +215,41 @@ forceinline size_t ds_forge_generic_put_req(rpc_req_t *rpc_req,
 	}
 }
 
+/* Forge a TicToc GET request. Return size of the request. */
+forceinline size_t ds_forge_tictoc_get_req(rpc_req_t *rpc_req,
+	uint32_t caller_id, hots_key_t key, uint64_t keyhash, ds_reqtype_t req_type,
+	uint64_t wts, uint64_t commit_ts)
+{
+	ds_dassert(req_type == ds_reqtype_t::tictoc_validate ||
+		req_type == ds_reqtype_t::tictoc_del);
+
+	ds_dassert(rpc_req != NULL && rpc_req->req_buf != NULL);
+	ds_dassert(is_aligned(rpc_req->req_buf, sizeof(uint32_t)));
+	ds_dassert(rpc_req->available_bytes() >= sizeof(ds_tictoc_get_req_t));
+
+	ds_tictoc_get_req_t *tg_req = (ds_tictoc_get_req_t *) rpc_req->req_buf;
+	tg_req->caller_id = caller_id;
+	tg_req->req_type = static_cast<uint64_t>(req_type);
+	tg_req->keyhash = keyhash;
+	tg_req->key = key;
+	tg_req->wts = wts;
+	tg_req->commit_ts = commit_ts;
+
+	return sizeof(ds_tictoc_get_req_t);
+}
+
+/* Forge a tictoc_put request. Return size of the request. */
+forceinline size_t ds_forge_tictoc_put_req(rpc_req_t *rpc_req,
+	uint32_t caller_id, hots_key_t key, uint64_t keyhash, hots_obj_t *obj,
+	uint64_t commit_ts)
+{
+	size_t put_len = ds_forge_generic_put_req(rpc_req, caller_id, key,
+		keyhash, obj, ds_reqtype_t::tictoc_put);
+	ds_dassert(rpc_req->available_bytes() >= put_len + sizeof(uint64_t));
+
+	/* @put_len is a multiple of 8 bytes, and req_buf is 4-byte aligned */
+	*(uint64_t *) &rpc_req->req_buf[put_len] = commit_ts;
+	return put_len + sizeof(uint64_t);
+}
+
 #endif /* DS_H */
@@ -21,6 +21,19 @@
 
 #define DS_FIXEDTABLE_DPRINTF 0
 
+/*
+ * Per-slot versions and locks (kSlotLocks in mica/table/fixedtable.h). Updates
+ * lock only their key instead of its bucket, so keys sharing a bucket do not
+ * conflict. Not supported with TicToc (TX_ENABLE_TICTOC).
+ */
+#define DS_FIXEDTABLE_SLOT_LOCKS 0
+
+/*
+ * Count lock conflicts in FixedTable datastores. With slot locks, also count
+ * false conflicts: requests that would have failed with bucket locks.
+ */
+#define DS_FIXEDTABLE_COUNT_CONFLICTS 0
+
 // Debug macros
 #define ds_fixedtable_printf(fmt, ...) \
 	do { \
@@ -31,7 +44,11 @@
 	} while (0)
 
 /* Use default config with kFetchAddOnlyIfEven = true */
-typedef ::mica::table::BasicFixedTableConfig FixedTableConfig;
+struct FixedTableConfig : public ::mica::table::BasicFixedTableConfig {
+	static constexpr bool kSlotLocks = (DS_FIXEDTABLE_SLOT_LOCKS == 1);
+	static constexpr bool kCountConflicts =
+		(DS_FIXEDTABLE_COUNT_CONFLICTS == 1);
+};
 typedef ::mica::table::FixedTable<FixedTableConfig> FixedTable;
 typedef ::mica::table::Result MicaResult;	/* An enum */
 
@@ -67,6 +84,25 @@ static FixedTable* ds_fixedtable_init(const char *config_filepath,
 	return table;
 }
 
+/*
+ * Print the lock conflicts counted at the primary @table since the last call
+ * (DS_FIXEDTABLE_COUNT_CONFLICTS), and reset the counts. The counts are for
+ * all threads at this machine. False conflicts are only counted with slot
+ * locks: they are the requests that avoided a conflict.
+ */
+static void ds_fixedtable_print_conflicts(FixedTable *table, double msr_usec)
+{
+	assert(table->is_primary);
+
+	size_t locked, false_conflicts;
+	table->get_conflict_stats(&locked, &false_conflicts, true);
+
+	printf("HoTS: Table %s: lock conflicts = %.3f M/s, "
+		"false conflicts avoided = %.3f M/s (slot locks = %d)\n",
+		table->name.c_str(), locked / msr_usec, false_conflicts / msr_usec,
+		DS_FIXEDTABLE_SLOT_LOCKS);
+}
+
 /* Destroy the table */
 static void ds_fixedtable_free(FixedTable *table)
 {
@@ -56,10 +56,70 @@ forceinline size_t ds_fixedtable_rpc_handler(
 		}
 	}
 
-	case ds_reqtype_t::get_for_upd : {
+	case ds_reqtype_t::validate : {
+		ds_dassert(req_len == sizeof(ds_generic_get_req_t));
+		out_result = table->get_timestamp(caller_id, keyhash, key, _hdr);
+
+		if(out_result == MicaResult::kSuccess) {
+			ds_fixedtable_printf("DS FixedTable: validate request for "
+				"key %lu. Success.\n", key);
+			*resp_type = (uint16_t) ds_resptype_t::validate_success;
+			return sizeof(hots_hdr_t);	/* Only header */
+		} else {
+			ds_dassert(out_result == MicaResult::kLocked);
+			ds_fixedtable_printf("DS FixedTable: validate request for "
+				"key %lu. Failure = validate_locked.\n", key);
+			*resp_type = (uint16_t) ds_resptype_t::validate_locked;
+			return 0;	/* Must abort */
+		}
+	}
+
+	case ds_reqtype_t::tictoc_lock : {
+		ds_dassert(req_len == sizeof(ds_generic_get_req_t));
+		out_result = table->lock_bkt_get_timestamp(caller_id, keyhash, _hdr);
+
+		if(out_result == MicaResult::kSuccess) {
+			ds_fixedtable_printf("DS FixedTable: tictoc_lock request for "
+				"key %lu. Success.\n", key);
+			*resp_type = (uint16_t) ds_resptype_t::tictoc_success;
+			return sizeof(hots_hdr_t);	/* Only header */
+		} else {
+			ds_dassert(out_result == MicaResult::kLocked);
+			ds_fixedtable_printf("DS FixedTable: tictoc_lock request for "
+				"key %lu. Failure = locked.\n", key);
+			*resp_type = (uint16_t) ds_resptype_t::tictoc_failed;
+			return 0;	/* Must abort */
+		}
+	}
+
+	case ds_reqtype_t::tictoc_validate : {
+		ds_dassert(req_len == sizeof(ds_tictoc_get_req_t));
+		ds_tictoc_get_req_t *tg_req = (ds_tictoc_get_req_t *) req_buf;
+		out_result = table->extend_rts(caller_id, keyhash,
+			tg_req->wts, tg_req->commit_ts);
+
+		if(out_result == MicaResult::kSuccess) {
+			ds_fixedtable_printf("DS FixedTable: tictoc_validate request for "
+				"key %lu. Success.\n", key);
+			*resp_type = (uint16_t) ds_resptype_t::tictoc_success;
+		} else {
+			ds_dassert(out_result == MicaResult::kLocked ||
+				out_result == MicaResult::kRejected);
+			ds_fixedtable_printf("DS FixedTable: tictoc_validate request for "
+				"key %lu. Failure = %s.\n", key,
+				::mica::table::ResultString(out_result).c_str());
+			*resp_type = (uint16_t) ds_resptype_t::tictoc_failed;
+		}
+
+		return 0;
+	}
+
+	case ds_reqtype_t::get_for_upd :
+	case ds_reqtype_t::get_for_del : {
+		/* Only slot-locked tables lock the bucket differently for deletes */
 		ds_dassert(req_len == sizeof(ds_generic_get_req_t));
 		out_result = table->lock_bkt_and_get(caller_id, keyhash,
-			key, _hdr, _val_buf);
+			key, _hdr, _val_buf, req_type == ds_reqtype_t::get_for_del);
 
 		if(out_result == MicaResult::kSuccess) {
 			ds_fixedtable_printf("DS FixedTable: get_for_upd request for "
@@ -110,7 +170,7 @@ forceinline size_t ds_fixedtable_rpc_handler(
 
 	case ds_reqtype_t::unlock : {
 		ds_dassert(req_len == sizeof(ds_generic_get_req_t));
-		out_result = table->unlock_bucket_hash(caller_id, keyhash);
+		out_result = table->unlock_key(caller_id, keyhash, key);
 
 		if(unlikely(out_result != MicaResult::kSuccess)) {
 			fprintf(stderr, "HoTS: Datastore unlock_bkt for {table, key} = "
@@ -124,9 +184,17 @@ forceinline size_t ds_fixedtable_rpc_handler(
 		return 0;
 	}
 
-	case ds_reqtype_t::del : {
-		ds_dassert(req_len == sizeof(ds_generic_get_req_t));
-		out_result = table->del(caller_id, keyhash, key);
+	case ds_reqtype_t::del :
+	case ds_reqtype_t::tictoc_del : {
+		uint64_t commit_ts = FixedTable::kNoCommitTs;
+		if(req_type == ds_reqtype_t::tictoc_del) {
+			ds_dassert(req_len == sizeof(ds_tictoc_get_req_t));
+			commit_ts = ((ds_tictoc_get_req_t *) req_buf)->commit_ts;
+		} else {
+			ds_dassert(req_len == sizeof(ds_generic_get_req_t));
+		}
+
+		out_result = table->del(caller_id, keyhash, key, commit_ts);
 
 		/* del() returns kNotFound if we (wrongly) delete a non-existent key */
 		if(unlikely(out_result != MicaResult::kSuccess)) {
@@ -141,14 +209,25 @@ forceinline size_t ds_fixedtable_rpc_handler(
 		return 0;
 	}
 
-	case ds_reqtype_t::put : {
-		ds_dassert(req_len == ds_put_req_size(table->val_size));
-
+	case ds_reqtype_t::put :
+	case ds_reqtype_t::tictoc_put : {
 		ds_generic_put_req_t *req = (ds_generic_put_req_t *) req_buf;
 		ds_dassert(req->val_size == table->val_size);
+
+		/* A tictoc_put request carries the commit timestamp after the value */
+		uint64_t commit_ts = FixedTable::kNoCommitTs;
+		size_t put_len = ds_put_req_size(table->val_size);
+		if(req_type == ds_reqtype_t::tictoc_put) {
+			ds_dassert(req_len == ds_tictoc_put_req_size(table->val_size));
+			commit_ts = *(uint64_t *) &req_buf[put_len];
+		} else {
+			ds_dassert(req_len == put_len);
+		}
+		_unused(put_len);
 		
 		/* Only store the application-level opaque buffer. */
-		out_result = table->set(caller_id, keyhash, key, (char *) &req->val);
+		out_result = table->set(caller_id, keyhash, key, (char *) &req->val,
+			commit_ts);
 
 		if(unlikely(out_result != MicaResult::kSuccess)) {
 			fprintf(stderr, "HoTS: Datastore put() for {table, key, obj_size} = "
@@ -170,4 +249,41 @@ forceinline size_t ds_fixedtable_rpc_handler(
 	}	/* End switch */
 }
 
+/* Prefetch handler: prefetch the bucket for both GETs and PUTs */
+static void ds_fixedtable_prefetch_handler(const uint8_t *req_buf,
+	size_t req_len, void *_table)
+{
+	ds_generic_get_req_t *req = (ds_generic_get_req_t *) req_buf;
+	static_cast<FixedTable *>(_table)->prefetch_table(req->keyhash);
+}
+
+/* Maximum response size of ds_fixedtable_rpc_handler() */
+static inline size_t ds_fixedtable_max_resp_len(const FixedTable *table)
+{
+	return sizeof(hots_hdr_t) + table->val_size;
+}
+
+/*
+ * Batch handler for a FixedTable datastore. All buckets are prefetched before
+ * the requests are run, so the DRAM misses of the lookups overlap. Register
+ * with ds_fixedtable_max_resp_len() as the maximum response size.
+ */
+static void ds_fixedtable_batch_handler(rpc_batch_req_t *reqs, int num_reqs,
+	void *_table)
+{
+	ds_dassert(_table != NULL);
+	FixedTable *table = static_cast<FixedTable *>(_table);
+
+	for(int i = 0; i < num_reqs; i++) {
+		ds_generic_get_req_t *req = (ds_generic_get_req_t *) reqs[i].req_buf;
+		table->prefetch_table(req->keyhash);
+	}
+
+	for(int i = 0; i < num_reqs; i++) {
+		rpc_batch_req_t *req = &reqs[i];
+		req->resp_len = ds_fixedtable_rpc_handler(req->resp_buf,
+			&req->resp_type, req->req_buf, req->req_len, _table);
+	}
+}
+
 #endif /* DS_FIXEDTABLE_HANDLER_H */
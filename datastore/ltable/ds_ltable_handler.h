@@ -26,6 +26,7 @@ forceinline size_t ds_ltable_rpc_handler(
 	/* All these requests require fetching the object first so group them. */
 	case ds_reqtype_t::get_rdonly :
 	case ds_reqtype_t::get_for_upd :
+	case ds_reqtype_t::get_for_del :
 	case ds_reqtype_t::lock_for_ins : {
 		ds_generic_get_req_t *req = (ds_generic_get_req_t *) req_buf;
 		hots_key_t key = req->key;
@@ -71,7 +72,8 @@ forceinline size_t ds_ltable_rpc_handler(
 		}
 
 		// Handle get_for_upd request
-		if(req_type == ds_reqtype_t::get_for_upd) {
+		if(req_type == ds_reqtype_t::get_for_upd ||
+			req_type == ds_reqtype_t::get_for_del) {
 			if(!obj_found) {
 				*resp_type = (uint16_t) ds_resptype_t::get_for_upd_not_found;
 				return 0;
@@ -186,4 +188,15 @@ forceinline size_t ds_ltable_rpc_handler(
 	}	/* End switch */
 }
 
+/*
+ * Prefetch handler: prefetch the index bucket for both GETs and PUTs. The
+ * pool item is not prefetched since finding it requires reading the bucket.
+ */
+static void ds_ltable_prefetch_handler(const uint8_t *req_buf,
+	size_t req_len, void *_table)
+{
+	ds_generic_get_req_t *req = (ds_generic_get_req_t *) req_buf;
+	static_cast<LTable *>(_table)->prefetch_table(req->keyhash);
+}
+
 #endif /* DS_LTABLE_HANDLER_H */
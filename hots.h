@@ -5,12 +5,27 @@
 #include<malloc.h>
 #include<iostream>
 #include<boost/bind.hpp>
-#include<boost/coroutine/all.hpp>
 
 #include "modded_drivers.h"
 
+/*
+ * Use the in-tree coroutine engine (util/hots_coro.h) instead of boost's
+ * symmetric_coroutine. Apps must link util/hots_coro.o.
+ */
+#define HOTS_ENABLE_FAST_CORO 1
+
+#if HOTS_ENABLE_FAST_CORO == 1
+#include "util/hots_coro.h"
+#else
+#include<boost/coroutine/all.hpp>
+#endif
+
 using namespace std;
+#if HOTS_ENABLE_FAST_CORO == 1
+using namespace hots_coro;
+#else
 using namespace boost::coroutines;
+#endif
 
 /* Macros */
 #define bit_capacity(b) (1 << b)
@@ -33,14 +48,31 @@ using namespace boost::coroutines;
 	} while (false)
 
 
+/*
+ * Large clusters. The 32-bit RPC immediate has room for machine IDs up to 127
+ * and coroutine IDs up to 31. HOTS_ENABLE_EXT_HDR raises these limits, and
+ * RPC packets whose fields do not fit in the immediate carry them in an
+ * extension header (see rpc_ext_hdr_t). Other packets are unchanged.
+ */
+#define HOTS_ENABLE_EXT_HDR 0
+
 // High-level limits. Just increase for more.
+#if HOTS_ENABLE_EXT_HDR == 1
+#define HOTS_CORO_ID_BITS 6	/* Max 64 coroutines per worker */
+#else
 #define HOTS_CORO_ID_BITS 5	/* Max 32 coroutines per worker */
+#endif
 
 #define HOTS_MAX_BACKUPS 2	/* Maximum allowed value of f (fault tolerance) */
 #define HOTS_MAX_REPLICAS (1 + HOTS_MAX_BACKUPS) /* 1 + f */
 
+#if HOTS_ENABLE_EXT_HDR == 1
+#define HOTS_MAX_MACHINES 1022		/* Machine ID 1023 can be used as invalid */
+#define HOTS_MCHN_ID_BITS 10
+#else
 #define HOTS_MAX_MACHINES 126		/* Machine ID 127 can be used as invalid */
 #define HOTS_MCHN_ID_BITS 7
+#endif
 static_assert(bit_capacity(HOTS_MCHN_ID_BITS) >= HOTS_MAX_MACHINES, "");
 
 #define HOTS_MAX_WORKERS 8192	/* Maximum worker threads in cluster */
@@ -63,6 +95,14 @@ static_assert(bit_capacity(HOTS_WRKR_GID_BITS) >= HOTS_MAX_WORKERS, "");
 /* For lockserver, we allocate one hugepage buffer per machine */
 #define LOCKSERVER_SHM_KEY 201
 
+/* RPC shared RECV queues: 1 key per port */
+#define RPC_SRQ_BASE_SHM_KEY 202
+
+/* RPC shared-memory transport: 1 key per (src machine, dst machine, thread) */
+#define RPC_SHM_RING_BASE_SHM_KEY (1 << 24)
+#define RPC_SHM_RING_MAX_SHM_KEY (RPC_SHM_RING_BASE_SHM_KEY + \
+	(HOTS_MAX_MACHINES * HOTS_MAX_MACHINES * HOTS_MAX_SERVER_THREADS))
+
 
 // Datastores
 #define HOTS_MAX_VALUE 40	/* Max obj val_size. Doesn't affect performance. */
@@ -87,6 +127,28 @@ struct hots_hdr_t {
 
 static_assert(sizeof(hots_hdr_t) == sizeof(uint64_t), "");
 
+/*
+ * With TicToc concurrency control (TX_ENABLE_TICTOC in tx/tx_defs.h), the
+ * version is split into the write timestamp (wts) of the bucket's last write,
+ * and the distance from wts to the bucket's read timestamp (rts). The layout
+ * must match kTicTocWtsBits (mica/table/fixedtable.h). Without TicToc, the
+ * delta is always 0.
+ */
+#define HOTS_TICTOC_WTS_BITS 45
+#define HOTS_TICTOC_DELTA_BITS 15
+#define HOTS_TICTOC_MAX_TS ((1ull << HOTS_TICTOC_WTS_BITS) - 1)
+static_assert(HOTS_TICTOC_WTS_BITS + HOTS_TICTOC_DELTA_BITS == 60, "");
+
+static inline uint64_t hots_tictoc_wts(hots_hdr_t hdr)
+{
+	return hdr.version & HOTS_TICTOC_MAX_TS;
+}
+
+static inline uint64_t hots_tictoc_rts(hots_hdr_t hdr)
+{
+	return hots_tictoc_wts(hdr) + (hdr.version >> HOTS_TICTOC_WTS_BITS);
+}
+
 struct hots_obj_t {
 	// Not stored as value in data stores - filled in by datastore handlers
 	size_t val_size; /* Size of the application-level opaque @val buffer */
@@ -121,8 +183,13 @@ static inline void hots_format_real_obj(hots_obj_t &obj, size_t val_size)
 }
 
 // Coroutines
+#if HOTS_ENABLE_FAST_CORO == 1
+typedef hots_coro::call_type coro_call_t;
+typedef hots_coro::yield_type coro_yield_t;
+#else
 typedef symmetric_coroutine<void>::call_type coro_call_t;
 typedef symmetric_coroutine<void>::yield_type coro_yield_t;
+#endif
 typedef int coro_id_t;
 
 /*
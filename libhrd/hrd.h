@@ -38,6 +38,9 @@
  */
 #define HRD_MAX_INLINE 60
 
+/* Datagram SENDs may gather a trailer, which does not grow the WQE */
+#define HRD_DGRAM_MAX_SEND_SGE 2
+
 /* Useful when `x = (x + 1) % N` is done in a loop */
 #define HRD_MOD_ADD(x, N) do { \
 	x = x + 1; \
@@ -81,6 +84,27 @@ struct hrd_qp_attr {
 	int qpn;
 };
 
+/*
+ * A shared RECV queue (SRQ) with its RECV buffers, for the datagram QPs of
+ * several control blocks on one port. The control blocks use its device
+ * context and PD.
+ */
+struct hrd_srq_blk {
+	struct ibv_context *ctx;
+	int port_index;
+	int device_id;
+	int dev_port_id;
+	int numa_node_id;
+	struct ibv_pd *pd;
+
+	struct ibv_srq *srq;
+	int srq_depth;
+	volatile uint8_t *buf;	/* RECV buffers */
+	int buf_size;
+	int buf_shm_key;
+	struct ibv_mr *buf_mr;
+};
+
 struct hrd_ctrl_blk {
 
 	int local_hid;	/* Local ID on the machine this process runs on */
@@ -113,6 +137,10 @@ struct hrd_ctrl_blk {
 	int dgram_buf_shm_key;
 	struct ibv_mr *dgram_buf_mr;
 
+	/* If non-NULL, dgram QP 0 RECVs from this SRQ, and ctx and pd are its */
+	struct hrd_srq_blk *srq_blk;
+	int dgram_recv_cq_depth;	/* RECV CQ depth of dgram QP 0 with an SRQ */
+
 	uint8_t pad[64];
 };
 
@@ -126,6 +154,14 @@ struct hrd_ctrl_blk* hrd_ctrl_blk_init(int local_hid,
 
 int hrd_ctrl_blk_destroy(struct hrd_ctrl_blk *cb);
 
+/* Shared RECV queues */
+struct hrd_srq_blk* hrd_srq_blk_init(int port_index, int numa_node_id,
+	int srq_depth, int buf_size, int buf_shm_key);
+int hrd_srq_blk_destroy(struct hrd_srq_blk *srq_blk);
+struct hrd_ctrl_blk* hrd_ctrl_blk_init_srq(int local_hid,
+	struct hrd_srq_blk *srq_blk, int num_dgram_qps, int recv_cq_depth,
+	int dgram_buf_size, int dgram_buf_shm_key);
+
 /* Debug */
 void hrd_ibv_devinfo(void);
 
@@ -261,6 +261,12 @@ int hrd_ctrl_blk_destroy(struct hrd_ctrl_blk *cb)
 		}
 	}
 
+	/* The PD and device context of an SRQ's control block are the SRQ's */
+	if(cb->srq_blk != NULL) {
+		hrd_red_printf("HRD: Control block %d destroyed.\n", cb->local_hid);
+		return 0;
+	}
+
 	/* Destroy protection domain */
 	if(ibv_dealloc_pd(cb->pd)) {
 		fprintf(stderr, "HRD: Couldn't dealloc PD for cb %d\n", cb->local_hid);
@@ -289,6 +295,13 @@ void hrd_create_dgram_qps(struct hrd_ctrl_blk *cb)
 	for(i = 0; i < cb->num_dgram_qps; i++) {
 		int recv_queue_depth = (i == 0) ? HRD_RQ_DEPTH : 1;
 
+		/* With an SRQ, QP 0's RECV CQ must fit the RECVs it can get */
+		struct ibv_srq *srq = NULL;
+		if(i == 0 && cb->srq_blk != NULL) {
+			srq = cb->srq_blk->srq;
+			recv_queue_depth = cb->dgram_recv_cq_depth;
+		}
+
 		cb->dgram_send_cq[i] = ibv_create_cq(cb->ctx,
 			HRD_SQ_DEPTH, NULL, NULL, 0);
 		assert(cb->dgram_send_cq[i] != NULL);
@@ -304,9 +317,10 @@ void hrd_create_dgram_qps(struct hrd_ctrl_blk *cb)
 		create_attr.recv_cq = cb->dgram_recv_cq[i];
 		create_attr.qp_type = IBV_QPT_UD;
 		
+		create_attr.srq = srq;
 		create_attr.cap.max_send_wr = HRD_SQ_DEPTH;
-		create_attr.cap.max_recv_wr = recv_queue_depth;
-		create_attr.cap.max_send_sge = 1;
+		create_attr.cap.max_recv_wr = (srq == NULL) ? recv_queue_depth : 0;
+		create_attr.cap.max_send_sge = HRD_DGRAM_MAX_SEND_SGE;
 		create_attr.cap.max_recv_sge = 1;
 		create_attr.cap.max_inline_data = HRD_MAX_INLINE;
 
@@ -349,6 +363,184 @@ void hrd_create_dgram_qps(struct hrd_ctrl_blk *cb)
 	}
 }
 
+/*
+ * Allocate @size bytes for a registered buffer: from hugepages with SHM key
+ * @shm_key on @numa_node_id if @numa_node_id >= 0, else from the heap. The
+ * allocated size is a multiple of 2 MB for hugepages, and returned in
+ * @alloc_size.
+ */
+static volatile uint8_t* hrd_alloc_buf(int size, int numa_node_id,
+	int shm_key, int *alloc_size)
+{
+	volatile uint8_t *buf;
+	int reg_size = 0;
+
+	if(numa_node_id >= 0) {
+		while(reg_size < size) {
+			reg_size += M_2;
+		}
+
+		assert(shm_key >= 1);	/* SHM key 0 is hard to free later */
+		buf = (volatile uint8_t *) hrd_malloc_socket(shm_key, reg_size,
+			numa_node_id);
+	} else {
+		reg_size = size;
+		buf = (volatile uint8_t *) memalign(4096, reg_size);
+	}
+
+	assert(buf != NULL);
+	memset((char *) buf, 0, reg_size);
+
+	*alloc_size = reg_size;
+	return buf;
+}
+
+/*
+ * Create an SRQ with @srq_depth RECVs, and @buf_size bytes of registered
+ * memory for its RECV buffers, on port @port_index. The caller posts RECVs.
+ */
+struct hrd_srq_blk* hrd_srq_blk_init(int port_index, int numa_node_id,
+	int srq_depth, int buf_size, int buf_shm_key)
+{
+	hrd_red_printf("HRD: creating SRQ block: port %d, socket %d, "
+		"depth %d, buf %.3f MB (key %d)\n", port_index, numa_node_id,
+		srq_depth, (double) buf_size / M_1, buf_shm_key);
+
+	assert(port_index >= 0 && port_index <= 16);
+	assert(numa_node_id >= -1 && numa_node_id <= 8);
+	assert(srq_depth >= 1 && buf_size >= 0 && buf_size <= M_1024);
+
+	struct hrd_srq_blk *srq_blk = (struct hrd_srq_blk *)
+		malloc(sizeof(struct hrd_srq_blk));
+	assert(srq_blk != NULL);
+	memset(srq_blk, 0, sizeof(struct hrd_srq_blk));
+
+	srq_blk->port_index = port_index;
+	srq_blk->numa_node_id = numa_node_id;
+	srq_blk->srq_depth = srq_depth;
+	srq_blk->buf_shm_key = buf_shm_key;
+
+	/* hrd_resolve_port_index() fills in a control block's port fields */
+	struct hrd_ctrl_blk port_cb;
+	memset(&port_cb, 0, sizeof(struct hrd_ctrl_blk));
+	struct ibv_device *ib_dev = hrd_resolve_port_index(&port_cb, port_index);
+	CPE(!ib_dev, "HRD: IB device not found", 0);
+	srq_blk->device_id = port_cb.device_id;
+	srq_blk->dev_port_id = port_cb.dev_port_id;
+
+	srq_blk->ctx = ibv_open_device(ib_dev);
+	CPE(!srq_blk->ctx, "HRD: Couldn't get context", 0);
+
+	srq_blk->pd = ibv_alloc_pd(srq_blk->ctx);
+	CPE(!srq_blk->pd, "HRD: Couldn't allocate PD", 0);
+
+	struct ibv_srq_init_attr srq_attr;
+	memset(&srq_attr, 0, sizeof(struct ibv_srq_init_attr));
+	srq_attr.attr.max_wr = srq_depth;
+	srq_attr.attr.max_sge = 1;
+	srq_blk->srq = ibv_create_srq(srq_blk->pd, &srq_attr);
+	CPE(!srq_blk->srq, "HRD: Couldn't create SRQ", 0);
+
+	srq_blk->buf = hrd_alloc_buf(buf_size, numa_node_id, buf_shm_key,
+		&srq_blk->buf_size);
+	srq_blk->buf_mr = ibv_reg_mr(srq_blk->pd, (char *) srq_blk->buf,
+		srq_blk->buf_size, IBV_ACCESS_LOCAL_WRITE);
+	assert(srq_blk->buf_mr != NULL);
+
+	return srq_blk;
+}
+
+/*
+ * Free up the resources taken by @srq_blk, after all control blocks that use
+ * it are destroyed. Return -1 if something fails, else 0.
+ */
+int hrd_srq_blk_destroy(struct hrd_srq_blk *srq_blk)
+{
+	if(ibv_destroy_srq(srq_blk->srq)) {
+		fprintf(stderr, "HRD: Couldn't destroy SRQ\n");
+		return -1;
+	}
+
+	if(ibv_dereg_mr(srq_blk->buf_mr)) {
+		fprintf(stderr, "HRD: Couldn't deregister SRQ MR\n");
+		return -1;
+	}
+
+	if(srq_blk->numa_node_id >= 0) {
+		hrd_free(srq_blk->buf_shm_key, (void *) srq_blk->buf);
+	} else {
+		free((void *) srq_blk->buf);
+	}
+
+	if(ibv_dealloc_pd(srq_blk->pd)) {
+		fprintf(stderr, "HRD: Couldn't dealloc SRQ PD\n");
+		return -1;
+	}
+
+	if(ibv_close_device(srq_blk->ctx)) {
+		fprintf(stderr, "HRD: Couldn't release SRQ context\n");
+		return -1;
+	}
+
+	free(srq_blk);
+	return 0;
+}
+
+/*
+ * Create a control block with @num_dgram_qps datagram QPs whose QP 0 RECVs
+ * from the SRQ of @srq_blk, and a RECV CQ of @recv_cq_depth entries. The
+ * datagram buffer is registered with the SRQ's PD but holds no RECVs.
+ */
+struct hrd_ctrl_blk* hrd_ctrl_blk_init_srq(int local_hid,
+	struct hrd_srq_blk *srq_blk, int num_dgram_qps, int recv_cq_depth,
+	int dgram_buf_size, int dgram_buf_shm_key)
+{
+	hrd_red_printf("HRD: creating control block %d with SRQ: port %d, "
+		"dgram qps %d, dgram buf %.3f MB (key %d)\n", local_hid,
+		srq_blk->port_index, num_dgram_qps, (double) dgram_buf_size / M_1,
+		dgram_buf_shm_key);
+
+	assert(num_dgram_qps >= 1 && recv_cq_depth >= 1);
+	assert(dgram_buf_size >= 0 && dgram_buf_size <= M_1024);
+
+	struct hrd_ctrl_blk *cb = (struct hrd_ctrl_blk *)
+		malloc(sizeof(struct hrd_ctrl_blk));
+	memset(cb, 0, sizeof(struct hrd_ctrl_blk));
+
+	cb->local_hid = local_hid;
+	cb->port_index = srq_blk->port_index;
+	cb->device_id = srq_blk->device_id;
+	cb->dev_port_id = srq_blk->dev_port_id;
+	cb->numa_node_id = srq_blk->numa_node_id;
+	cb->ctx = srq_blk->ctx;
+	cb->pd = srq_blk->pd;
+	cb->srq_blk = srq_blk;
+	cb->dgram_recv_cq_depth = recv_cq_depth;
+
+	cb->num_dgram_qps = num_dgram_qps;
+	cb->dgram_buf_shm_key = dgram_buf_shm_key;
+
+	cb->dgram_qp = (struct ibv_qp **)
+		malloc(num_dgram_qps * sizeof(struct ibv_qp *));
+	cb->dgram_send_cq = (struct ibv_cq **)
+		malloc(num_dgram_qps * sizeof(struct ibv_cq *));
+	cb->dgram_recv_cq = (struct ibv_cq **)
+		malloc(num_dgram_qps * sizeof(struct ibv_cq *));
+	assert(cb->dgram_qp != NULL && cb->dgram_send_cq != NULL &&
+		cb->dgram_recv_cq != NULL);
+
+	hrd_create_dgram_qps(cb);
+
+	cb->dgram_buf = hrd_alloc_buf(dgram_buf_size, cb->numa_node_id,
+		dgram_buf_shm_key, &cb->dgram_buf_size);
+	cb->dgram_buf_mr = ibv_reg_mr(cb->pd, (char *) cb->dgram_buf,
+		cb->dgram_buf_size, IBV_ACCESS_LOCAL_WRITE |
+		IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE);
+	assert(cb->dgram_buf_mr != NULL);
+
+	return cb;
+}
+
 /* Create connected QPs and transition them to INIT */
 void hrd_create_conn_qps(struct hrd_ctrl_blk *cb)
 {
@@ -54,6 +54,12 @@ struct locksrv_req_t {
 #define locksrv_req_size(num_keys) (sizeof(locksrv_req_t) - \
 	(RPC_MAX_MSG_CORO * sizeof(uint32_t)) + ((num_keys) * sizeof(uint32_t)))
 
+/* A lock request that waits at an RPC-layer lockserver for its locks */
+struct locksrv_wait_t {
+	locksrv_req_t req;
+	int resp_token;	/* Token of the deferred response */
+};
+
 #define locksrv_lockmode_unlocked 1
 #define locksrv_lockmode_exclusive 2
 #define locksrv_lockmode_shared 3
@@ -272,6 +278,37 @@ public:
 		pthread_spin_unlock(&lock->spinlock);
 	}
 
+	/* Lock all keys of @ls_req, or none of them. Return true on success. */
+	forceinline bool lock_req(const locksrv_req_t *ls_req)
+	{
+		int num_keys = ls_req->num_keys;
+		for(int i = 0; i < num_keys; i++) {
+			bool ret = lock(ls_req->requester_id,
+				ls_req->key_arr[i].exclusive, ls_req->key_arr[i].hashfrag);
+			if(!ret) {
+				/* Unlock key i - 1 --> 0 (read set first) */
+				for(int j = i - 1; j >= 0; j--) {
+					unlock(ls_req->requester_id,
+						ls_req->key_arr[j].exclusive,
+						ls_req->key_arr[j].hashfrag);
+				}
+
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/* Unlock all keys of @ls_req. Unlock read set first. */
+	forceinline void unlock_req(const locksrv_req_t *ls_req)
+	{
+		for(int i = ls_req->num_keys - 1; i >= 0; i--) {
+			unlock(ls_req->requester_id,
+				ls_req->key_arr[i].exclusive, ls_req->key_arr[i].hashfrag);
+		}
+	}
+
 	// Accessors
 	int get_num_locks_mask()
 	{
@@ -302,32 +339,13 @@ forceinline size_t lockserver_rpc_handler(
 
 	if(req_type == locksrv_reqtype_t::lock) {
 		// Handle a lock request
-		for(int i = 0; i < num_keys; i++) {
-			bool ret = lockserver->lock(ls_req->requester_id,
-				ls_req->key_arr[i].exclusive, ls_req->key_arr[i].hashfrag);
-			if(!ret) {
-				/* Unlock key i - 1 --> 0 (read set first) */
-				for(int j = i - 1; j >= 0; j--) {
-					lockserver->unlock(ls_req->requester_id,
-						ls_req->key_arr[j].exclusive,
-						ls_req->key_arr[j].hashfrag);
-				}
-
-				*resp_type = (uint16_t) locksrv_resptype_t::fail;
-				return 0;
-			}
-		}
-
-		/* If we are here, we successfully locked all keys */
-		*resp_type = (uint16_t) locksrv_resptype_t::success;
+		bool success = lockserver->lock_req(ls_req);
+		*resp_type = (uint16_t) (success ? locksrv_resptype_t::success :
+			locksrv_resptype_t::fail);
 		return 0;
 	} else {
-		// Handle an unlock request. Unlock read set first.
-		for(int i = num_keys - 1; i >= 0; i--) {
-			lockserver->unlock(ls_req->requester_id,
-				ls_req->key_arr[i].exclusive, ls_req->key_arr[i].hashfrag);
-		}
-
+		// Handle an unlock request
+		lockserver->unlock_req(ls_req);
 		*resp_type = (uint16_t) locksrv_resptype_t::success;
 		return 0;
 	}
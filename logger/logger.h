@@ -13,12 +13,25 @@
 
 #define log_magic 17	/* Some 5-bit number */
 
+/*
+ * A transaction's log is split into records of up to LOGGER_KEYS_PER_RECORD
+ * write set keys, so that wide transactions can be logged.
+ */
+#define LOGGER_KEYS_PER_RECORD 32
+#define LOGGER_RECORD_ID_BITS 4
+#define LOGGER_MAX_RECORDS (1 << LOGGER_RECORD_ID_BITS)	/* Per transaction */
+static_assert((TX_MAX_KEYS + LOGGER_KEYS_PER_RECORD - 1) /
+	LOGGER_KEYS_PER_RECORD < LOGGER_MAX_RECORDS, "");
+
 struct log_record_t {
-	uint32_t mchn_id :HOTS_MCHN_ID_BITS;	/* Machine ID of the coordinator */
-	uint32_t coro_id :HOTS_CORO_ID_BITS; 	/* Coro ID of the coordinator */
-	uint32_t magic :5;	/* Debug-only */
-	uint32_t debug_size :13;	/* Total log record size; debug-only. */
-	uint32_t num_keys;
+	uint64_t mchn_id :HOTS_MCHN_ID_BITS;	/* Machine ID of the coordinator */
+	uint64_t coro_id :HOTS_CORO_ID_BITS; 	/* Coro ID of the coordinator */
+	uint64_t magic :5;	/* Debug-only */
+	uint64_t debug_size :13;	/* Total log record size; debug-only. */
+	uint64_t record_id :LOGGER_RECORD_ID_BITS;	/* Index in the txn's log */
+	uint64_t num_records :LOGGER_RECORD_ID_BITS;	/* Records in txn's log */
+	uint64_t num_keys :64 - HOTS_MCHN_ID_BITS - HOTS_CORO_ID_BITS - 18 -
+		2 * LOGGER_RECORD_ID_BITS;
 	/* 64 bits up to here */
 
 	uint8_t buf[RPC_MAX_MAX_PKT_SIZE];
@@ -26,6 +39,11 @@ struct log_record_t {
 static_assert(sizeof(log_record_t) ==
 	RPC_MAX_MAX_PKT_SIZE + sizeof(uint64_t), "");
 
+/* Each key takes the key, and the object's size, header, and value */
+static_assert(sizeof(uint64_t) + LOGGER_KEYS_PER_RECORD *
+	(sizeof(uint64_t) + hots_obj_size(HOTS_MAX_VALUE)) <=
+	sizeof(log_record_t), "");
+
 enum class logger_resptype_t : uint16_t {
 	success = 3,
 };
@@ -43,7 +61,9 @@ enum class logger_resptype_t : uint16_t {
  * valid. This is because the RPC handler that saves the log record is a single
  * function, and cannot return to the master coroutine's polling loop before
  * saving the entire log record. The handler can be interrupted if this machine
- * fails, but then we've lost the log record.
+ * fails, but then we've lost the log record. A transaction with more than
+ * LOGGER_KEYS_PER_RECORD write set keys is logged only if all @num_records of
+ * its records are valid.
  */
 class Logger {
 private:
@@ -51,22 +71,29 @@ private:
 	int wrkr_gid, wrkr_lid;	/* IDs of the worker that creates this Logger */
 	int num_machines;	/* Total machines in the swarm */
 	int num_coro;	/* Coroutines per thread */
+	int max_tx_keys;	/* Max write set keys per transaction */
 
 	// Derived
-	log_record_t *log;	/* One log record per coroutine in the cluster */
+	int records_per_coro;	/* Log records per coroutine in the cluster */
+	log_record_t *log;
 
 public:
 
-	Logger(int wrkr_gid, int wrkr_lid, int num_machines, int num_coro) :
+	Logger(int wrkr_gid, int wrkr_lid, int num_machines, int num_coro,
+		int max_tx_keys = LOGGER_KEYS_PER_RECORD) :
 		wrkr_gid(wrkr_gid), wrkr_lid(wrkr_lid), num_machines(num_machines),
-		num_coro(num_coro)
+		num_coro(num_coro), max_tx_keys(max_tx_keys)
 	{
+		assert(max_tx_keys >= 1 && max_tx_keys <= TX_MAX_KEYS);
+		records_per_coro = (max_tx_keys + LOGGER_KEYS_PER_RECORD - 1) /
+			LOGGER_KEYS_PER_RECORD;
+
 		/*
 		 * Initialize hugepage memory for log records. At each machine in the
 		 * swarm, there are @num_coro coroutines that will send log requests to
 		 * this Logger.
 		 */
-		size_t reqd_records = num_machines * num_coro;
+		size_t reqd_records = num_machines * num_coro * records_per_coro;
 		size_t reqd_size = reqd_records * sizeof(log_record_t);
 		while(reqd_size % M_2 != 0) {
 			reqd_size++;
@@ -80,13 +107,22 @@ public:
 		log = (log_record_t *) buf;
 	}
 
-	/* Get a pointer to the log record for this coroutine */
-	forceinline log_record_t* get_log_record(int mchn_id, int coro_id)
+	/* Maximum write set size of transactions that this Logger can log */
+	forceinline int get_max_tx_keys()
+	{
+		return max_tx_keys;
+	}
+
+	/* Get a pointer to log record @record_id for this coroutine */
+	forceinline log_record_t* get_log_record(int mchn_id, int coro_id,
+		int record_id = 0)
 	{
 		tx_dassert(mchn_id >= 0 && mchn_id < num_machines);
 		tx_dassert(coro_id >= 1 && coro_id < num_coro);
+		tx_dassert(record_id >= 0 && record_id < records_per_coro);
 
-		int record_idx = (mchn_id * num_coro) + coro_id;
+		int record_idx = ((mchn_id * num_coro) + coro_id) * records_per_coro +
+			record_id;
 		return &log[record_idx];
 	}
 
@@ -101,10 +137,9 @@ public:
 		tx_dassert(log_record->coro_id >= 1 &&
 			log_record->coro_id < num_coro);
 
-		int record_idx = (log_record->mchn_id * num_coro) +
-			log_record->coro_id;
-
-		rte_memcpy((void *) &log[record_idx], (void *) log_record, record_size);
+		log_record_t *dst = get_log_record(log_record->mchn_id,
+			log_record->coro_id, log_record->record_id);
+		rte_memcpy((void *) dst, (void *) log_record, record_size);
 	}
 };
 
@@ -123,4 +158,14 @@ forceinline size_t logger_rpc_handler(
 	return 0;
 }
 
+/* Prefetch handler: prefetch the start of the destination log record */
+static void logger_prefetch_handler(const uint8_t *req_buf, size_t req_len,
+	void *_logger)
+{
+	log_record_t *log_record = (log_record_t *) req_buf;
+	Logger *logger = static_cast<Logger *>(_logger);
+	__builtin_prefetch(logger->get_log_record(log_record->mchn_id,
+		log_record->coro_id, log_record->record_id), 1, 0);
+}
+
 #endif
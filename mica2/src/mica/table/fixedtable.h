@@ -19,6 +19,13 @@
 //  * extra_collision_avoidance (float): The amount of additional memory to
 //    resolve excessive hash collisions as a fraction of the main hash table.
 //  * numa_node (integer): The ID of the NUMA node to store the data.
+//
+// Locking granularity: by default, all keys in a bucket share the bucket's
+// timestamp (version + lock bit), so a lock on one key makes every other key
+// in the bucket look locked. With kSlotLocks, each slot also has its own
+// timestamp and locker, and updates lock only their key's slot. Inserts and
+// deletes still lock the bucket, and the bucket's timestamp versions the
+// absence of keys. See fixedtable_impl/slot.h.
 namespace mica {
 namespace table {
 struct BasicFixedTableConfig {
@@ -34,6 +41,14 @@ struct BasicFixedTableConfig {
   // Do fetch and add only if the 1st 64-bit word of the value is even
   static constexpr bool kFetchAddOnlyIfEven = true;
 
+  // Use per-slot versions and locks for updates (see above).
+  static constexpr bool kSlotLocks = false;
+
+  // Count lock conflicts, accessible via get_conflict_stats(). With
+  // kSlotLocks, also count requests that succeeded only because of slot
+  // locks, i.e., that would have hit a locked bucket.
+  static constexpr bool kCountConflicts = false;
+
   typedef ::mica::alloc::HrdAlloc Alloc;
 };
 
@@ -52,6 +67,17 @@ class FixedTable {
 
   static constexpr uint64_t kFtInvalidKey = 0xffffffffffffffffull;
 
+  // TicToc timestamps. Bits 1 to 60 of a bucket's timestamp hold the write
+  // timestamp (wts) of the bucket's last write, and the distance (delta) from
+  // wts to its read timestamp (rts). The layout is equal to
+  // HOTS_TICTOC_WTS_BITS (hots.h). Unlocking a bucket without a commit
+  // timestamp increments wts, so the delta stays 0 unless extend_rts() is used.
+  static constexpr uint32_t kTicTocWtsBits = 45;
+  static constexpr uint32_t kTicTocDeltaBits = 15;
+  static constexpr uint64_t kTicTocMaxTs = (1ull << kTicTocWtsBits) - 1;
+  static constexpr uint64_t kTicTocMaxDelta = (1ull << kTicTocDeltaBits) - 1;
+  static constexpr uint64_t kNoCommitTs = 0;  // Commit timestamps are >= 1
+
   // fixedtable_impl/init.h
   FixedTable(const ::mica::util::Config& config, size_t val_size,
              int bkt_shm_key, Alloc* alloc, bool is_primary);
@@ -67,9 +93,16 @@ class FixedTable {
   Result get(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
              uint64_t *out_timestamp, char* out_value) const;
 
+  // fixedtable_impl/get_bkt_timestamp.h
+  Result get_bkt_timestamp(uint32_t caller_id, uint64_t key_hash,
+                           uint64_t *out_timestamp) const;
+  Result get_timestamp(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
+                       uint64_t *out_timestamp) const;
+
   // fixedtable_impl/lock_bkt_and_get.h
   Result lock_bkt_and_get(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
-                          uint64_t *out_timestamp, char *value);
+                          uint64_t *out_timestamp, char *value,
+                          bool for_del = false);
 
   // fixedtable_impl/lock_bkt_for_ins.h
   Result lock_bkt_for_ins(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
@@ -77,20 +110,28 @@ class FixedTable {
 
   // fixedtable_impl/unlock_bkt.h
   Result unlock_bucket_hash(uint32_t caller_id, uint64_t key_hash);
+  Result unlock_key(uint32_t caller_id, uint64_t key_hash, ft_key_t key);
 
   // fixedtable_impl/lock_bkt.h
   Result lock_bucket_hash(uint32_t caller_id, uint64_t key_hash);
 
   // fixedtable_impl/set.h
   Result set(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
-             const char* value);
+             const char* value, uint64_t commit_ts = kNoCommitTs);
 
   // fixedtable_impl/set_spinlock.h - local use only
   Result set_spinlock(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
                       const char* value);
 
   // fixedtable_impl/del.h
-  Result del(uint32_t caller_id, uint64_t key_hash, ft_key_t key);
+  Result del(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
+             uint64_t commit_ts = kNoCommitTs);
+
+  // fixedtable_impl/tictoc.h
+  Result lock_bkt_get_timestamp(uint32_t caller_id, uint64_t key_hash,
+                                uint64_t *out_timestamp);
+  Result extend_rts(uint32_t caller_id, uint64_t key_hash, uint64_t wts,
+                    uint64_t commit_ts);
 
   // fixedtable_impl/prefetch.h
   void prefetch_table(uint64_t key_hash) const;
@@ -99,6 +140,8 @@ class FixedTable {
   void print_buckets() const;
   void print_stats() const;
   void reset_stats(bool reset_count);
+  void get_conflict_stats(size_t *out_locked, size_t *out_false_conflicts,
+                          bool reset);
 
  private:
   // Bucket configuration
@@ -130,6 +173,23 @@ class FixedTable {
   static_assert(sizeof(Bucket) == 2 * sizeof(uint64_t) +
     StaticConfig::kBucketCap * sizeof(ft_key_t), "");
 
+  // With kSlotLocks, the Slot array of a Bucket follows its value array. A
+  // slot's timestamp has the same layout as a bucket's, with kSlotTimestampTag
+  // set so that it never equals a bucket timestamp. On insert, the version's
+  // high bits are set from the bucket's version, so a re-inserted key does not
+  // reuse the versions of its earlier incarnation. A free slot is locked by
+  // kInvalidCallerId.
+  struct Slot {
+    uint64_t timestamp;
+    uint32_t locker_id;
+    uint32_t del_locked;  // The locker also locked the bucket to delete
+  };
+
+  static_assert(sizeof(Slot) == 2 * sizeof(uint64_t), "");
+
+  static constexpr uint64_t kSlotTimestampTag = (1ull << 60);
+  static constexpr uint32_t kSlotUpdateBits = 24;
+
   size_t bkt_size_with_val;	// Size of the buckets with value
 
   struct ExtraBucketFreeList {
@@ -149,6 +209,11 @@ class FixedTable {
     size_t delete_notfound;
   };
 
+  struct ConflictStats {
+    size_t locked;  // Requests that failed because of a lock
+    size_t false_conflicts;  // kSlotLocks: succeeded in a locked bucket
+  };
+
   // fixedtable_impl/bucket.h
   uint32_t calc_bucket_index(uint64_t key_hash) const;
   uint8_t* get_value(const Bucket *bucket, size_t item_index) const;
@@ -169,6 +234,25 @@ class FixedTable {
   void print_bucket(const Bucket* bucket) const;
   void stat_inc(size_t Stats::*counter) const;
   void stat_dec(size_t Stats::*counter) const;
+  void conflict_inc(size_t ConflictStats::*counter) const;
+
+  // fixedtable_impl/slot.h
+  Slot* get_slot(const Bucket* bucket, size_t item_index) const;
+  uint64_t read_slot_timestamp(const Slot* slot) const;
+  void init_slot(const Bucket* bucket, Bucket* located_bucket,
+                 size_t item_index);
+  void free_slot(Slot* slot);
+  bool lock_slot(uint32_t caller_id, Slot* slot);
+  void unlock_slot(uint32_t caller_id, Slot* slot);
+  void count_false_conflict(uint32_t caller_id, const Bucket* bucket) const;
+  Result slot_get(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
+                  uint64_t *out_timestamp, char* out_value) const;
+  Result slot_lock_and_get(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
+                           uint64_t *out_timestamp, char *value, bool for_del);
+  Result slot_unlock(uint32_t caller_id, uint64_t key_hash, ft_key_t key);
+  Result slot_set(uint32_t caller_id, uint64_t key_hash, ft_key_t key,
+                  const char* value);
+  Result slot_del(uint32_t caller_id, uint64_t key_hash, ft_key_t key);
 
   // fixedtable_impl/item.h
   void set_item(Bucket *located_bucket, size_t item_index,
@@ -177,11 +261,17 @@ class FixedTable {
   // fixedtable_impl/lock.h
   bool lock_bucket_ptr(uint32_t caller_id, Bucket* bucket);
   void unlock_bucket_ptr(uint32_t caller_id, Bucket* bucket);
+  void unlock_bucket_ptr_at(uint32_t caller_id, Bucket* bucket,
+                            uint64_t commit_ts);
   void lock_extra_bucket_free_list();
   void unlock_extra_bucket_free_list();
   uint64_t read_timestamp(const Bucket* bucket) const;
   bool is_locked(uint64_t timestamp) const;
   bool is_unlocked(uint64_t timestamp) const;
+  bool same_version(uint64_t timestamp_1, uint64_t timestamp_2) const;
+  static uint64_t tictoc_wts(uint64_t timestamp);
+  static uint64_t tictoc_delta(uint64_t timestamp);
+  static uint64_t tictoc_timestamp(uint64_t wts, uint64_t delta, bool locked);
 
   ::mica::util::Config config_;
 public:
@@ -206,6 +296,7 @@ private:
   ExtraBucketFreeList extra_bucket_free_list_;
 
   mutable Stats stats_;
+  mutable ConflictStats conflict_stats_;
 } __attribute__((aligned(128)));  // To prevent false sharing caused by
                                   // adjacent cacheline prefetching.
 }
@@ -222,10 +313,13 @@ private:
 #include "mica/table/fixedtable_impl/set.h"
 #include "mica/table/fixedtable_impl/set_spinlock.h"
 #include "mica/table/fixedtable_impl/get.h"
+#include "mica/table/fixedtable_impl/get_bkt_timestamp.h"
 #include "mica/table/fixedtable_impl/lock_bkt_and_get.h"
 #include "mica/table/fixedtable_impl/lock_bkt_for_ins.h"
 #include "mica/table/fixedtable_impl/lock_bkt.h"
 #include "mica/table/fixedtable_impl/unlock_bkt.h"
+#include "mica/table/fixedtable_impl/tictoc.h"
+#include "mica/table/fixedtable_impl/slot.h"
 #include "mica/table/fixedtable_impl/prefetch.h"
 
 #endif
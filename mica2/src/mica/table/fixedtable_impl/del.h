@@ -6,7 +6,12 @@ namespace mica {
 namespace table {
 template <class StaticConfig>
 Result FixedTable<StaticConfig>::del(uint32_t caller_id, uint64_t key_hash,
-                                     ft_key_t key) {
+                                     ft_key_t key, uint64_t commit_ts) {
+  if (StaticConfig::kSlotLocks) {
+    assert(commit_ts == kNoCommitTs);  // TicToc needs bucket timestamps
+    return slot_del(caller_id, key_hash, key);
+  }
+
   // Can be called at both primary and backup datastores
   uint32_t bucket_index = calc_bucket_index(key_hash);
   Bucket* bucket = get_bucket(bucket_index);
@@ -34,8 +39,12 @@ Result FixedTable<StaticConfig>::del(uint32_t caller_id, uint64_t key_hash,
   if(is_primary) {
     // unlock_bucket_ptr() will only release the lock that was previously
     // acquired at the primary for this key's deletion. Other locks acquired by
-    // @caller_id on this bucket are still held.
-    unlock_bucket_ptr(caller_id, bucket);
+    // @caller_id on this bucket are still held. See set() for @commit_ts.
+    if(commit_ts == kNoCommitTs) {
+      unlock_bucket_ptr(caller_id, bucket);
+    } else {
+      unlock_bucket_ptr_at(caller_id, bucket, commit_ts);
+    }
   }
 
   stat_inc(&Stats::delete_found);
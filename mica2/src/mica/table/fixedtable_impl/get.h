@@ -14,6 +14,10 @@ template <class StaticConfig>
 Result FixedTable<StaticConfig>::get(uint32_t caller_id, uint64_t key_hash,
                                      ft_key_t key, uint64_t *out_timestamp,
                                      char* out_value) const {
+  if (StaticConfig::kSlotLocks) {
+    return slot_get(caller_id, key_hash, key, out_timestamp, out_value);
+  }
+
   assert(is_primary);
 
   uint32_t bucket_index = calc_bucket_index(key_hash);
@@ -30,11 +34,13 @@ Result FixedTable<StaticConfig>::get(uint32_t caller_id, uint64_t key_hash,
       // Key does not exist. We still need to set the timestamp.
       *out_timestamp = timestamp_start;
 
-      if (timestamp_start != read_timestamp(bucket)) {
+      if (!same_version(timestamp_start, read_timestamp(bucket))) {
         // The bucket got locked by some other caller ID (it could not have been
         // this @caller_id. In this case, the timestamp copied to @out_timestamp
-        // must not be used.
+        // must not be used. A TicToc rts extension alone does not matter: the
+        // copied timestamp just has a smaller rts.
         stat_inc(&Stats::get_locked);
+        conflict_inc(&ConflictStats::locked);
         return Result::kLocked;
       }
 
@@ -46,8 +52,9 @@ Result FixedTable<StaticConfig>::get(uint32_t caller_id, uint64_t key_hash,
     uint8_t *_val = get_value(located_bucket, item_index);
     ::mica::util::memcpy(out_value, _val, val_size);
 
-    if (timestamp_start != read_timestamp(bucket)) {
+    if (!same_version(timestamp_start, read_timestamp(bucket))) {
       stat_inc(&Stats::get_locked);
+      conflict_inc(&ConflictStats::locked);
       return Result::kLocked;
     }
 
@@ -78,6 +85,7 @@ Result FixedTable<StaticConfig>::get(uint32_t caller_id, uint64_t key_hash,
   } else {
     // Some other caller held the lock when we checked
     stat_inc(&Stats::get_locked);
+    conflict_inc(&ConflictStats::locked);
     return Result::kLocked;
   }
 }
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef MICA_TABLE_FIXED_TABLE_IMPL_GET_BKT_TIMESTAMP_H_
+#define MICA_TABLE_FIXED_TABLE_IMPL_GET_BKT_TIMESTAMP_H_
+
+namespace mica {
+namespace table {
+template <class StaticConfig>
+/**
+ * Read the timestamp of @key_hash's bucket without looking up a key. Every
+ * modification of a bucket locks and unlocks it, which changes the
+ * timestamp, so a key read earlier by get() is unchanged (including its
+ * existence) iff the bucket's timestamp is unchanged.
+ */
+Result FixedTable<StaticConfig>::get_bkt_timestamp(uint32_t caller_id,
+                                                   uint64_t key_hash,
+                                                   uint64_t *out_timestamp)
+    const {
+  assert(is_primary);
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  const Bucket* bucket = get_bucket(bucket_index);
+
+  uint64_t timestamp = read_timestamp(bucket);
+
+  // As in get(), a bucket locked by @caller_id stays locked while we run
+  if (is_unlocked(timestamp) || bucket->locker_id == caller_id) {
+    *out_timestamp = timestamp;
+    return Result::kSuccess;
+  }
+
+  stat_inc(&Stats::get_locked);
+  conflict_inc(&ConflictStats::locked);
+  return Result::kLocked;
+}
+
+template <class StaticConfig>
+/**
+ * Read the timestamp that versions @key: its bucket's timestamp, or with
+ * kSlotLocks, its slot's timestamp (or its bucket's if @key does not exist).
+ */
+Result FixedTable<StaticConfig>::get_timestamp(uint32_t caller_id,
+                                               uint64_t key_hash, ft_key_t key,
+                                               uint64_t *out_timestamp) const {
+  if (StaticConfig::kSlotLocks) {
+    Result result = slot_get(caller_id, key_hash, key, out_timestamp, NULL);
+    return result == Result::kNotFound ? Result::kSuccess : result;
+  }
+
+  return get_bkt_timestamp(caller_id, key_hash, out_timestamp);
+}
+}
+}
+
+#endif
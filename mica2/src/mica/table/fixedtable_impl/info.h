@@ -45,6 +45,22 @@ void FixedTable<StaticConfig>::reset_stats(bool reset_count) {
     ::mica::util::memset(&stats_, 0, sizeof(stats_));
     if (!reset_count) stats_.count = count;
   }
+
+  ::mica::util::memset(&conflict_stats_, 0, sizeof(conflict_stats_));
+}
+
+template <class StaticConfig>
+void FixedTable<StaticConfig>::get_conflict_stats(size_t *out_locked,
+                                                  size_t *out_false_conflicts,
+                                                  bool reset) {
+  *out_locked = conflict_stats_.locked;
+  *out_false_conflicts = conflict_stats_.false_conflicts;
+
+  if (reset) {
+    __sync_sub_and_fetch(&conflict_stats_.locked, *out_locked);
+    __sync_sub_and_fetch(&conflict_stats_.false_conflicts,
+                         *out_false_conflicts);
+  }
 }
 
 template <class StaticConfig>
@@ -56,6 +72,14 @@ template <class StaticConfig>
 void FixedTable<StaticConfig>::stat_dec(size_t Stats::*counter) const {
   if (StaticConfig::kCollectStats) __sync_sub_and_fetch(&(stats_.*counter), 1);
 }
+
+template <class StaticConfig>
+void FixedTable<StaticConfig>::conflict_inc(size_t ConflictStats::*counter)
+    const {
+  if (StaticConfig::kCountConflicts) {
+    __sync_add_and_fetch(&(conflict_stats_.*counter), 1);
+  }
+}
 }
 }
 
@@ -11,8 +11,11 @@ FixedTable<StaticConfig>::FixedTable(const ::mica::util::Config& config,
      alloc_(alloc), is_primary(is_primary) {
   assert(val_size % sizeof(uint64_t) == 0); // Make buckets 8-byte aligned
 
-  // The Bucket struct does not contain values
+  // The Bucket struct does not contain values (or slots)
   bkt_size_with_val = sizeof(Bucket) + (val_size * StaticConfig::kBucketCap);
+  if (StaticConfig::kSlotLocks) {
+    bkt_size_with_val += sizeof(Slot) * StaticConfig::kBucketCap;
+  }
 
   name = config.get("name").get_str();
   assert(bkt_shm_key > 0 && bkt_shm_key < 1024 * 1024);
@@ -93,6 +96,7 @@ void FixedTable<StaticConfig>::reset() {
     for (size_t item_index = 0; item_index < StaticConfig::kBucketCap;
         item_index++) {
       bucket->key_arr[item_index] = kFtInvalidKey;
+      if (StaticConfig::kSlotLocks) free_slot(get_slot(bucket, item_index));
     }
   }
 
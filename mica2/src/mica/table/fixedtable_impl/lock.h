@@ -22,22 +22,54 @@ bool FixedTable<StaticConfig>::is_locked(uint64_t timestamp) const {
   return ((timestamp & 1ull) == 1ull);
 }
 
+// Check if two timestamps have the same lock bit and wts. They may differ in
+// the TicToc delta, which extend_rts() changes without locking the bucket.
+template <class StaticConfig>
+bool FixedTable<StaticConfig>::same_version(uint64_t timestamp_1,
+                                            uint64_t timestamp_2) const {
+  uint64_t delta_mask = kTicTocMaxDelta << (1 + kTicTocWtsBits);
+  return (((timestamp_1 ^ timestamp_2) & ~delta_mask) == 0);
+}
+
+template <class StaticConfig>
+uint64_t FixedTable<StaticConfig>::tictoc_wts(uint64_t timestamp) {
+  return (timestamp >> 1) & kTicTocMaxTs;
+}
+
+template <class StaticConfig>
+uint64_t FixedTable<StaticConfig>::tictoc_delta(uint64_t timestamp) {
+  return (timestamp >> (1 + kTicTocWtsBits)) & kTicTocMaxDelta;
+}
+
+template <class StaticConfig>
+uint64_t FixedTable<StaticConfig>::tictoc_timestamp(uint64_t wts,
+                                                    uint64_t delta,
+                                                    bool locked) {
+  assert(wts <= kTicTocMaxTs && delta <= kTicTocMaxDelta);
+  return (kTimestampCanary << 61) | (delta << (1 + kTicTocWtsBits)) |
+      (wts << 1) | (locked ? 1ull : 0ull);
+}
+
 template <class StaticConfig>
 bool FixedTable<StaticConfig>::lock_bucket_ptr(uint32_t caller_id,
                                                Bucket* bucket) {
   assert(caller_id != kInvalidCallerId);
 
-  // Optimistically assume that the timestamp is even and try to make it odd
-  uint64_t ts = *(volatile uint64_t*)&bucket->timestamp & ~1ull;
-  uint64_t new_ts = ts | 1ull;
-  if (__sync_bool_compare_and_swap((volatile uint64_t*)&bucket->timestamp,
-                                   ts, new_ts)) {
-    assert(bucket->locker_id == kInvalidCallerId);
-    assert(bucket->num_locks == 0);
-
-    bucket->locker_id = caller_id;  // Record the locker ID
-    bucket->num_locks = 1;
-    return true;
+  // Try to make an even timestamp odd. Retry if the CAS failed only because
+  // extend_rts() changed the unlocked timestamp.
+  uint64_t ts = *(volatile uint64_t*)&bucket->timestamp;
+  while (is_unlocked(ts)) {
+    if (__sync_bool_compare_and_swap((volatile uint64_t*)&bucket->timestamp,
+                                     ts, ts | 1ull)) {
+      assert(bucket->locker_id == kInvalidCallerId);
+      assert(bucket->num_locks == 0);
+
+      bucket->locker_id = caller_id;  // Record the locker ID
+      bucket->num_locks = 1;
+      return true;
+    }
+
+    ts = *(volatile uint64_t*)&bucket->timestamp;
   }
 
   // Locking failed. Check if the lock is held by this caller.
@@ -83,6 +115,40 @@ void FixedTable<StaticConfig>::unlock_bucket_ptr(uint32_t caller_id,
   }
 }
 
+// Like unlock_bucket_ptr(), but install a new version with wts = rts =
+// @commit_ts. If @caller_id holds more locks on the bucket, they are for keys
+// of the same transaction, so they will be released at the same timestamp.
+template <class StaticConfig>
+void FixedTable<StaticConfig>::unlock_bucket_ptr_at(uint32_t caller_id,
+                                                    Bucket* bucket,
+                                                    uint64_t commit_ts) {
+  assert(caller_id != kInvalidCallerId);
+  assert(is_locked(bucket->timestamp));
+  assert(bucket->locker_id == caller_id);
+  assert(bucket->num_locks > 0);
+
+  // Timestamps never decrease: the coordinator picked @commit_ts above the
+  // rts that it saw after locking the bucket, and rts cannot grow while the
+  // bucket is locked. An earlier release of this transaction set wts already.
+  uint64_t ts = bucket->timestamp;
+  assert(commit_ts > tictoc_wts(ts) + tictoc_delta(ts) ||
+         commit_ts == tictoc_wts(ts));
+  (void) ts;
+
+  if(bucket->num_locks == 1) {
+    bucket->locker_id = kInvalidCallerId;
+    bucket->num_locks = 0;
+
+    ::mica::util::memory_barrier();
+    *(volatile uint64_t*)&bucket->timestamp =
+        tictoc_timestamp(commit_ts, 0, false);
+  } else {
+    bucket->num_locks--;
+    *(volatile uint64_t*)&bucket->timestamp =
+        tictoc_timestamp(commit_ts, 0, true);
+  }
+}
+
 template <class StaticConfig>
 void FixedTable<StaticConfig>::lock_extra_bucket_free_list() {
   while (true) {
@@ -5,9 +5,16 @@
 namespace mica {
 namespace table {
 
+// @for_del is only used with kSlotLocks: deletes lock the whole bucket.
 template <class StaticConfig>
 Result FixedTable<StaticConfig>::lock_bkt_and_get(uint32_t caller_id,
-    uint64_t key_hash, ft_key_t key, uint64_t *out_timestamp, char *value) {
+    uint64_t key_hash, ft_key_t key, uint64_t *out_timestamp, char *value,
+    bool for_del) {
+  if (StaticConfig::kSlotLocks) {
+    return slot_lock_and_get(caller_id, key_hash, key, out_timestamp, value,
+                             for_del);
+  }
+
   assert(is_primary);
 
   uint32_t bucket_index = calc_bucket_index(key_hash);
@@ -33,6 +40,7 @@ Result FixedTable<StaticConfig>::lock_bkt_and_get(uint32_t caller_id,
     unlock_bucket_ptr(caller_id, bucket);
     return Result::kNotFound;
   } else {
+    conflict_inc(&ConflictStats::locked);
     return Result::kLocked;
   }
 
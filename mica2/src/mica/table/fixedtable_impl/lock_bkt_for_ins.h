@@ -31,6 +31,7 @@ Result FixedTable<StaticConfig>::lock_bkt_for_ins(uint32_t caller_id,
     unlock_bucket_ptr(caller_id, bucket);
     return Result::kExists;
   } else {
+    conflict_inc(&ConflictStats::locked);
     return Result::kLocked;
   }
 
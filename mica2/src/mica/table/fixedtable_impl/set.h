@@ -6,7 +6,13 @@ namespace mica {
 namespace table {
 template <class StaticConfig>
 Result FixedTable<StaticConfig>::set(uint32_t caller_id, uint64_t key_hash,
-                                     ft_key_t key, const char* value) {
+                                     ft_key_t key, const char* value,
+                                     uint64_t commit_ts) {
+  if (StaticConfig::kSlotLocks) {
+    assert(commit_ts == kNoCommitTs);  // TicToc needs bucket timestamps
+    return slot_set(caller_id, key_hash, key, value);
+  }
+
   // Can be called at both primary and backup datastores
   uint32_t bucket_index = calc_bucket_index(key_hash);
   Bucket* bucket = get_bucket(bucket_index);
@@ -40,8 +46,13 @@ Result FixedTable<StaticConfig>::set(uint32_t caller_id, uint64_t key_hash,
   if(is_primary) {
     // unlock_bucket_ptr() will only release the lock that was previously
     // acquired at the primary for this set(). Other locks acquired by
-    // @caller_id on this bucket are still held.
-    unlock_bucket_ptr(caller_id, bucket);
+    // @caller_id on this bucket are still held. With a TicToc @commit_ts,
+    // the new version gets wts = rts = @commit_ts.
+    if(commit_ts == kNoCommitTs) {
+      unlock_bucket_ptr(caller_id, bucket);
+    } else {
+      unlock_bucket_ptr_at(caller_id, bucket, commit_ts);
+    }
   }
 
   return Result::kSuccess;
@@ -28,6 +28,7 @@ Result FixedTable<StaticConfig>::set_spinlock(uint32_t caller_id,
     }
 
     stat_inc(&Stats::set_new);
+    if (StaticConfig::kSlotLocks) init_slot(bucket, located_bucket, item_index);
   }
 
   // Here, @located_bucket either contains @key at index @item_index, or is
@@ -0,0 +1,364 @@
+#pragma once
+#ifndef MICA_TABLE_FIXED_TABLE_IMPL_SLOT_H_
+#define MICA_TABLE_FIXED_TABLE_IMPL_SLOT_H_
+
+// Per-slot versions and locks (kSlotLocks). Updates lock only their key's
+// slot, so they do not conflict with other keys in the bucket. Inserts and
+// deletes lock the bucket (and, for deletes, the slot), and do not move keys
+// between slots, so a key stays in its slot while it exists.
+//
+// Requests for a key that is not found are versioned by the bucket's
+// timestamp, which changes with every insert and delete.
+namespace mica {
+namespace table {
+
+template <class StaticConfig>
+typename FixedTable<StaticConfig>::Slot* FixedTable<StaticConfig>::get_slot(
+    const Bucket* bucket, size_t item_index) const {
+  assert(StaticConfig::kSlotLocks);
+  return reinterpret_cast<Slot*>((uint8_t*)bucket + sizeof(Bucket) +
+                                 (StaticConfig::kBucketCap * val_size) +
+                                 (item_index * sizeof(Slot)));
+}
+
+template <class StaticConfig>
+uint64_t FixedTable<StaticConfig>::read_slot_timestamp(const Slot* slot) const {
+  uint64_t ts = *(volatile uint64_t*)&slot->timestamp;
+  ::mica::util::memory_barrier();
+  return ts;
+}
+
+// Initialize the slot of a key being inserted. @bucket is the key's (locked)
+// primary bucket, whose version becomes the high bits of the slot's version.
+template <class StaticConfig>
+void FixedTable<StaticConfig>::init_slot(const Bucket* bucket,
+                                         Bucket* located_bucket,
+                                         size_t item_index) {
+  Slot* slot = get_slot(located_bucket, item_index);
+  uint64_t epoch = bucket->timestamp >> 1;
+
+  slot->locker_id = kInvalidCallerId;
+  slot->del_locked = 0;
+  slot->timestamp = (kTimestampCanary << 61) | kSlotTimestampTag |
+      ((epoch << (1 + kSlotUpdateBits)) & (kSlotTimestampTag - 1));
+}
+
+// Mark a slot free. Readers that found its old key before it was removed see
+// it locked by another caller.
+template <class StaticConfig>
+void FixedTable<StaticConfig>::free_slot(Slot* slot) {
+  slot->locker_id = kInvalidCallerId;
+  slot->del_locked = 0;
+
+  ::mica::util::memory_barrier();
+  *(volatile uint64_t*)&slot->timestamp =
+      (kTimestampCanary << 61) | kSlotTimestampTag | 1ull;
+}
+
+// Slot locks are not recursive: a transaction locks each key at most once.
+template <class StaticConfig>
+bool FixedTable<StaticConfig>::lock_slot(uint32_t caller_id, Slot* slot) {
+  assert(caller_id != kInvalidCallerId);
+
+  uint64_t ts = *(volatile uint64_t*)&slot->timestamp;
+  if (is_locked(ts)) return false;
+
+  if (__sync_bool_compare_and_swap((volatile uint64_t*)&slot->timestamp, ts,
+                                   ts | 1ull)) {
+    slot->locker_id = caller_id;
+    slot->del_locked = 0;
+    return true;
+  }
+
+  return false;
+}
+
+template <class StaticConfig>
+void FixedTable<StaticConfig>::unlock_slot(uint32_t caller_id, Slot* slot) {
+  assert(caller_id != kInvalidCallerId);
+  assert(is_locked(slot->timestamp));
+  assert(slot->locker_id == caller_id);
+  (void) caller_id;
+
+  slot->locker_id = kInvalidCallerId;
+  slot->del_locked = 0;
+
+  // no need to use atomic add
+  ::mica::util::memory_barrier();
+  (*(volatile uint64_t*)&slot->timestamp)++;
+}
+
+// Count a request that succeeded although another caller holds a lock in the
+// bucket's chain. With bucket locks, it would have failed.
+template <class StaticConfig>
+void FixedTable<StaticConfig>::count_false_conflict(uint32_t caller_id,
+                                                    const Bucket* bucket)
+    const {
+  if (!StaticConfig::kCountConflicts) return;
+
+  uint64_t timestamp = read_timestamp(bucket);
+  if (is_locked(timestamp) && bucket->locker_id != caller_id) {
+    conflict_inc(&ConflictStats::false_conflicts);
+    return;
+  }
+
+  const Bucket* current_bucket = bucket;
+  while (true) {
+    for (size_t item_index = 0; item_index < StaticConfig::kBucketCap;
+         item_index++) {
+      if (current_bucket->key_arr[item_index] == kFtInvalidKey) continue;
+
+      const Slot* slot = get_slot(current_bucket, item_index);
+      if (is_locked(read_slot_timestamp(slot)) &&
+          slot->locker_id != caller_id) {
+        conflict_inc(&ConflictStats::false_conflicts);
+        return;
+      }
+    }
+
+    if (!has_extra_bucket(current_bucket)) break;
+    current_bucket = get_extra_bucket(current_bucket->next_extra_bucket_index);
+  }
+}
+
+template <class StaticConfig>
+/**
+ * get() with slot locks. If @out_value is NULL, only the timestamp is read,
+ * which is how get_timestamp() validates keys.
+ */
+Result FixedTable<StaticConfig>::slot_get(uint32_t caller_id,
+                                          uint64_t key_hash, ft_key_t key,
+                                          uint64_t *out_timestamp,
+                                          char* out_value) const {
+  assert(is_primary);
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  const Bucket* bucket = get_bucket(bucket_index);
+
+  // Read the bucket's timestamp first, to check the absence of @key below
+  uint64_t bucket_timestamp = read_timestamp(bucket);
+
+  const Bucket* located_bucket;
+  size_t item_index = find_item_index(bucket, key, &located_bucket);
+
+  if (item_index == StaticConfig::kBucketCap) {
+    // A bucket locked by another caller may be getting @key inserted
+    if (is_locked(bucket_timestamp) && bucket->locker_id != caller_id) {
+      stat_inc(&Stats::get_locked);
+      conflict_inc(&ConflictStats::locked);
+      return Result::kLocked;
+    }
+
+    *out_timestamp = bucket_timestamp;
+
+    if (is_unlocked(bucket_timestamp) &&
+        read_timestamp(bucket) != bucket_timestamp) {
+      stat_inc(&Stats::get_locked);
+      conflict_inc(&ConflictStats::locked);
+      return Result::kLocked;
+    }
+
+    stat_inc(&Stats::get_notfound);
+    return Result::kNotFound;
+  }
+
+  const Slot* slot = get_slot(located_bucket, item_index);
+  uint64_t timestamp_start = read_slot_timestamp(slot);
+
+  if (is_locked(timestamp_start) && slot->locker_id != caller_id) {
+    stat_inc(&Stats::get_locked);
+    conflict_inc(&ConflictStats::locked);
+    return Result::kLocked;
+  }
+
+  *out_timestamp = timestamp_start;
+  if (out_value != NULL) {
+    uint8_t *_val = get_value(located_bucket, item_index);
+    ::mica::util::memcpy(out_value, _val, val_size);
+  }
+
+  // If the slot is unlocked, @key may have been updated, or deleted and the
+  // slot reused, while we read it. A slot locked by @caller_id cannot change.
+  if (is_unlocked(timestamp_start)) {
+    if (read_slot_timestamp(slot) != timestamp_start ||
+        located_bucket->key_arr[item_index] != key) {
+      stat_inc(&Stats::get_locked);
+      conflict_inc(&ConflictStats::locked);
+      return Result::kLocked;
+    }
+  }
+
+  count_false_conflict(caller_id, bucket);
+  stat_inc(&Stats::get_found);
+  return Result::kSuccess;
+}
+
+template <class StaticConfig>
+/**
+ * lock_bkt_and_get() with slot locks. Updates lock only @key's slot. Deletes
+ * (@for_del) also lock the bucket because they change the bucket's keys.
+ */
+Result FixedTable<StaticConfig>::slot_lock_and_get(uint32_t caller_id,
+    uint64_t key_hash, ft_key_t key, uint64_t *out_timestamp, char *value,
+    bool for_del) {
+  assert(is_primary);
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  if (for_del && !lock_bucket_ptr(caller_id, bucket)) {
+    conflict_inc(&ConflictStats::locked);
+    return Result::kLocked;
+  }
+
+  Bucket* located_bucket;
+  size_t item_index = find_item_index(bucket, key, &located_bucket);
+
+  if (item_index == StaticConfig::kBucketCap) {
+    if (for_del) unlock_bucket_ptr(caller_id, bucket);
+    return Result::kNotFound;
+  }
+
+  Slot* slot = get_slot(located_bucket, item_index);
+  if (!lock_slot(caller_id, slot)) {
+    if (for_del) unlock_bucket_ptr(caller_id, bucket);
+    conflict_inc(&ConflictStats::locked);
+    return Result::kLocked;
+  }
+
+  // @key may have been deleted, and the slot reused, before we locked it
+  if (located_bucket->key_arr[item_index] != key) {
+    unlock_slot(caller_id, slot);
+    if (for_del) unlock_bucket_ptr(caller_id, bucket);
+    conflict_inc(&ConflictStats::locked);
+    return Result::kLocked;
+  }
+
+  slot->del_locked = for_del ? 1 : 0;
+
+  *out_timestamp = slot->timestamp;
+  uint8_t *_val = get_value(located_bucket, item_index);
+  ::mica::util::memcpy(value, _val, val_size);
+
+  count_false_conflict(caller_id, bucket);
+  return Result::kSuccess;
+}
+
+template <class StaticConfig>
+/**
+ * Release the locks taken for @key by slot_lock_and_get() or
+ * lock_bkt_for_ins().
+ */
+Result FixedTable<StaticConfig>::slot_unlock(uint32_t caller_id,
+                                             uint64_t key_hash, ft_key_t key) {
+  assert(is_primary);
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  Bucket* located_bucket;
+  size_t item_index = find_item_index(bucket, key, &located_bucket);
+
+  if (item_index == StaticConfig::kBucketCap) {
+    // Locked for insert
+    unlock_bucket_ptr(caller_id, bucket);
+    return Result::kSuccess;
+  }
+
+  Slot* slot = get_slot(located_bucket, item_index);
+  bool del_locked = (slot->del_locked == 1);
+  unlock_slot(caller_id, slot);
+
+  if (del_locked) unlock_bucket_ptr(caller_id, bucket);
+  return Result::kSuccess;
+}
+
+template <class StaticConfig>
+Result FixedTable<StaticConfig>::slot_set(uint32_t caller_id,
+                                          uint64_t key_hash, ft_key_t key,
+                                          const char* value) {
+  // Can be called at both primary and backup datastores
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  Bucket* located_bucket;
+  size_t item_index = find_item_index(bucket, key, &located_bucket);
+
+  if (item_index < StaticConfig::kBucketCap) {
+    // Update. We must be holding the slot lock at primaries.
+    Slot* slot = get_slot(located_bucket, item_index);
+    if (is_primary) {
+      assert(is_locked(slot->timestamp));
+      assert(slot->locker_id == caller_id);
+      assert(slot->del_locked == 0);
+    }
+
+    uint8_t *_val = get_value(located_bucket, item_index);
+    ::mica::util::memcpy(_val, value, val_size);
+
+    if (is_primary) unlock_slot(caller_id, slot);
+    return Result::kSuccess;
+  }
+
+  // Insert. We must be holding the bucket lock at primaries.
+  if (is_primary) {
+    assert(is_locked(bucket->timestamp));
+    assert(bucket->locker_id == caller_id);
+  }
+
+  item_index = get_empty(bucket, &located_bucket);
+  if (item_index == StaticConfig::kBucketCap) {
+    // No more space. This should be fatal.
+    if (is_primary) unlock_bucket_ptr(caller_id, bucket);
+    return Result::kInsufficientSpaceIndex;
+  }
+
+  stat_inc(&Stats::set_new);
+
+  // Readers that find @key must see its slot and value
+  init_slot(bucket, located_bucket, item_index);
+  uint8_t *_val = get_value(located_bucket, item_index);
+  ::mica::util::memcpy(_val, value, val_size);
+  ::mica::util::memory_barrier();
+  located_bucket->key_arr[item_index] = key;
+
+  if (is_primary) unlock_bucket_ptr(caller_id, bucket);
+  return Result::kSuccess;
+}
+
+template <class StaticConfig>
+Result FixedTable<StaticConfig>::slot_del(uint32_t caller_id,
+                                          uint64_t key_hash, ft_key_t key) {
+  // Can be called at both primary and backup datastores
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  Bucket* located_bucket;
+  size_t item_index = find_item_index(bucket, key, &located_bucket);
+
+  // The key must exist - we checked this when we acquired the locks at the
+  // primary
+  assert(item_index < StaticConfig::kBucketCap);
+
+  Slot* slot = get_slot(located_bucket, item_index);
+  if (is_primary) {
+    assert(is_locked(bucket->timestamp));
+    assert(bucket->locker_id == caller_id);
+    assert(is_locked(slot->timestamp));
+    assert(slot->locker_id == caller_id && slot->del_locked == 1);
+  }
+
+  // Keys are not moved to fill the hole: others may hold their slot locks
+  located_bucket->key_arr[item_index] = kFtInvalidKey;
+  free_slot(slot);
+  stat_dec(&Stats::count);
+
+  if (is_primary) unlock_bucket_ptr(caller_id, bucket);
+
+  stat_inc(&Stats::delete_found);
+  return Result::kSuccess;
+}
+}
+}
+
+#endif
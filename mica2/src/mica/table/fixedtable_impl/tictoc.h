@@ -0,0 +1,86 @@
+#pragma once
+#ifndef MICA_TABLE_FIXED_TABLE_IMPL_TICTOC_H_
+#define MICA_TABLE_FIXED_TABLE_IMPL_TICTOC_H_
+
+// Bucket operations for TicToc commit. See kTicTocWtsBits for the timestamp
+// layout.
+namespace mica {
+namespace table {
+template <class StaticConfig>
+/**
+ * Lock @key_hash's bucket at commit time, and return the locked timestamp.
+ * The key is not looked up: the coordinator compares the returned wts with the
+ * wts that it read earlier. The rts in the returned timestamp is final until
+ * the bucket is unlocked.
+ */
+Result FixedTable<StaticConfig>::lock_bkt_get_timestamp(uint32_t caller_id,
+    uint64_t key_hash, uint64_t *out_timestamp) {
+  assert(is_primary);
+  assert(!StaticConfig::kSlotLocks);  // TicToc uses bucket timestamps
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  if (!lock_bucket_ptr(caller_id, bucket)) {
+    stat_inc(&Stats::get_locked);
+    return Result::kLocked;
+  }
+
+  *out_timestamp = bucket->timestamp;
+  return Result::kSuccess;
+}
+
+template <class StaticConfig>
+/**
+ * Check that the bucket's version with write timestamp @wts, read earlier by
+ * @caller_id, is still valid at @commit_ts, and extend its rts to @commit_ts
+ * if needed. Returns kRejected if the bucket has a newer version, and kLocked
+ * if another caller has locked it and it could not be extended.
+ */
+Result FixedTable<StaticConfig>::extend_rts(uint32_t caller_id,
+                                            uint64_t key_hash, uint64_t wts,
+                                            uint64_t commit_ts) {
+  assert(is_primary);
+  assert(!StaticConfig::kSlotLocks);
+
+  uint32_t bucket_index = calc_bucket_index(key_hash);
+  Bucket* bucket = get_bucket(bucket_index);
+
+  while (true) {
+    uint64_t ts = read_timestamp(bucket);
+    if (tictoc_wts(ts) != wts) {
+      return Result::kRejected;
+    }
+
+    uint64_t delta = tictoc_delta(ts);
+    if (wts + delta >= commit_ts) {
+      return Result::kSuccess;  // Already valid at @commit_ts
+    }
+
+    if (is_locked(ts)) {
+      // A bucket locked by @caller_id stays locked while we run. The caller
+      // will write it at @commit_ts, so its version is valid until then.
+      return bucket->locker_id == caller_id ? Result::kSuccess :
+          Result::kLocked;
+    }
+
+    // If the delta does not fit, move wts up. The value is unchanged, but
+    // other readers of this version will fail validation.
+    uint64_t new_wts = wts;
+    uint64_t new_delta = commit_ts - wts;
+    if (new_delta > kTicTocMaxDelta) {
+      new_wts = commit_ts - kTicTocMaxDelta;
+      new_delta = kTicTocMaxDelta;
+    }
+
+    uint64_t new_ts = tictoc_timestamp(new_wts, new_delta, false);
+    if (__sync_bool_compare_and_swap((volatile uint64_t*)&bucket->timestamp,
+                                     ts, new_ts)) {
+      return Result::kSuccess;
+    }
+  }
+}
+}
+}
+
+#endif
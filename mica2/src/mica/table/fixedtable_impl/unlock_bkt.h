@@ -19,6 +19,16 @@ Result FixedTable<StaticConfig>::unlock_bucket_hash(uint32_t caller_id,
   unlock_bucket_ptr(caller_id, bucket);
   return Result::kSuccess;
 }
+
+template <class StaticConfig>
+// Release the lock taken for @key during a transaction. Without kSlotLocks,
+// this is the bucket lock.
+Result FixedTable<StaticConfig>::unlock_key(uint32_t caller_id,
+                                            uint64_t key_hash, ft_key_t key) {
+  if (StaticConfig::kSlotLocks) return slot_unlock(caller_id, key_hash, key);
+
+  return unlock_bucket_hash(caller_id, key_hash);
+}
 }
 }
 
@@ -0,0 +1,385 @@
+#ifndef PROCSERVER_H
+#define PROCSERVER_H
+
+#include <stdio.h>
+
+#include "hots.h"
+#include "rpc/rpc.h"
+#include "tx/tx_defs.h"
+#include "libhrd/hrd.h"
+#include "util/rte_memcpy.h"
+#include "datastore/fixedtable/ds_fixedtable.h"
+
+/*
+ * Stored procedures for single-partition transactions. When all keys of a
+ * transaction have the same primary, the coordinator sends a registered
+ * procedure ID and its parameters to that primary (Tx::run_proc()). The
+ * primary's ProcServer reads and locks the keys in its FixedTables, runs the
+ * procedure, and validates the keys it read, all in one RPC handler.
+ *
+ * RPC handlers cannot send requests, so the primary cannot log to backups.
+ * Without backups, the primary applies the writes and the transaction commits
+ * in one round trip. Otherwise, the primary keeps the write set locked and
+ * returns it, and the coordinator logs and commits it as usual.
+ */
+#define PROCSERVER_MAX_PROCS 16	/* Registered procedures per ProcServer */
+#define PROCSERVER_MAX_KEYS 8	/* Max keys (read set + write set) per call */
+#define PROCSERVER_MAX_PARAMS 64	/* Max procedure parameter bytes */
+#define PROCSERVER_MAX_OUT 32	/* Max procedure output bytes */
+#define PROCSERVER_MAX_TABLES \
+	(RPC_MAX_REQ_TYPE / RPC_PRIMARY_DS_REQ_SPACING + 1)
+
+enum class procsrv_resptype_t : uint16_t {
+	committed = 3,	/* Writes applied at the primary */
+	prepared = 4,	/* Write set locked and returned to the coordinator */
+	aborted = 5,	/* Nothing is locked */
+};
+
+struct procsrv_req_t {
+	uint32_t caller_id;	/* Keys are locked on behalf of the coordinator */
+	uint8_t proc_id;
+	uint8_t commit_at_primary;	/* No backups: apply the writes at primary */
+	uint16_t params_len;	/* Multiple of 8 bytes */
+	uint8_t params[PROCSERVER_MAX_PARAMS];
+};
+
+#define procsrv_req_size(params_len) \
+	(sizeof(procsrv_req_t) - PROCSERVER_MAX_PARAMS + (params_len))
+
+/* A write set key in a prepared response. The value follows. */
+struct procsrv_write_t {
+	uint64_t rpc_reqtype :16;
+	uint64_t write_mode :8;	/* tx_write_mode_t */
+	uint64_t val_size :40;
+	hots_key_t key;
+	hots_hdr_t hdr;	/* Locked header, as returned by get_for_upd */
+};
+
+struct procsrv_resp_t {
+	uint16_t out_len;
+	uint16_t num_writes;	/* Non-zero only for prepared responses */
+	uint32_t unused;
+	uint8_t out[PROCSERVER_MAX_OUT];
+	uint8_t writes[PROCSERVER_MAX_KEYS *
+		(sizeof(procsrv_write_t) + HOTS_MAX_VALUE)];
+};
+
+/* Size of a procsrv_resp_t with @writes_len bytes of write set keys */
+#define procsrv_resp_size(writes_len) \
+	(sizeof(procsrv_resp_t) - sizeof(((procsrv_resp_t *) 0)->writes) + \
+	(writes_len))
+
+class ProcServer;
+
+/*
+ * A stored procedure. It accesses keys through ProcServer::read() and
+ * ProcServer::write(), and modifies the values of written keys in place.
+ * Returns false to abort, which it must do if read() or write() fails.
+ */
+typedef bool (*procsrv_func_t)(ProcServer *ps, const uint8_t *params,
+	size_t params_len, void *arg);
+
+/* A key accessed by the running procedure */
+struct procsrv_item_t {
+	rpc_reqtype_t rpc_reqtype;
+	hots_key_t key;
+	uint64_t keyhash;
+	FixedTable *table;
+	tx_write_mode_t write_mode;	/* ignore for read set keys */
+	bool locked;	/* Unlock on abort */
+	uint64_t exec_version;	/* Version read, for validation */
+	hots_obj_t obj;
+};
+
+/*
+ * Each worker thread that serves procedures creates one ProcServer. All
+ * requests from a coordinator are served by the same thread, so the running
+ * procedure's locks are held by the coordinator's caller ID.
+ */
+class ProcServer {
+private:
+	FixedTable *table_arr[PROCSERVER_MAX_TABLES];	/* By primary RPC type */
+	procsrv_func_t proc_arr[PROCSERVER_MAX_PROCS];
+	void *proc_arg_arr[PROCSERVER_MAX_PROCS];
+
+	// The running procedure
+	uint32_t caller_id;
+	bool must_abort;	/* A read or lock failed */
+	size_t num_items;
+	procsrv_item_t item_arr[PROCSERVER_MAX_KEYS];
+	uint8_t *out;
+	size_t out_len;
+
+	forceinline procsrv_item_t* add_item(rpc_reqtype_t rpc_reqtype,
+		hots_key_t key, tx_write_mode_t write_mode)
+	{
+		tx_dassert(num_items < PROCSERVER_MAX_KEYS);
+		tx_dassert(rpc_reqtype % RPC_PRIMARY_DS_REQ_SPACING == 0);
+
+#if TX_DEBUG_ASSERT == 1
+		for(size_t i = 0; i < num_items; i++) {
+			assert(item_arr[i].rpc_reqtype != rpc_reqtype ||
+				item_arr[i].key != key);
+		}
+#endif
+
+		procsrv_item_t *item = &item_arr[num_items];
+		num_items++;
+
+		item->rpc_reqtype = rpc_reqtype;
+		item->key = key;
+		item->keyhash = ds_keyhash(key);
+		item->table = table_arr[rpc_reqtype / RPC_PRIMARY_DS_REQ_SPACING];
+		tx_dassert(item->table != NULL);
+		item->write_mode = write_mode;
+		item->locked = false;
+		return item;
+	}
+
+	/* Check that the buckets (or slots) of read keys did not change */
+	forceinline bool validate()
+	{
+		for(size_t i = 0; i < num_items; i++) {
+			procsrv_item_t &item = item_arr[i];
+			if(item.write_mode != tx_write_mode_t::ignore) {
+				continue;
+			}
+
+			/* Like Tx::validate(), ignore the lock bit if we hold the lock */
+			hots_hdr_t hdr;
+			MicaResult out_result = item.table->get_timestamp(caller_id,
+				item.keyhash, item.key, (uint64_t *) &hdr);
+			if(out_result != MicaResult::kSuccess ||
+					hdr.version != item.exec_version) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/* Release the write set locks of an aborted procedure */
+	forceinline void unlock_all()
+	{
+		for(size_t i = 0; i < num_items; i++) {
+			procsrv_item_t &item = item_arr[i];
+			if(!item.locked) {
+				continue;
+			}
+
+			MicaResult out_result = item.table->unlock_key(caller_id,
+				item.keyhash, item.key);
+			if(unlikely(out_result != MicaResult::kSuccess)) {
+				fprintf(stderr, "HoTS: ProcServer unlock for {table, key} = "
+					"{%s, %" PRIu64 "} failed with code %s\n",
+					item.table->name.c_str(), item.key,
+					::mica::table::ResultString(out_result).c_str());
+				exit(-1);
+			}
+		}
+	}
+
+	/* Install the write set of a committed procedure, releasing its locks */
+	forceinline void apply_writes()
+	{
+		for(size_t i = 0; i < num_items; i++) {
+			procsrv_item_t &item = item_arr[i];
+			if(item.write_mode == tx_write_mode_t::ignore) {
+				continue;
+			}
+
+			MicaResult out_result;
+			if(item.write_mode == tx_write_mode_t::del) {
+				out_result = item.table->del(caller_id, item.keyhash, item.key);
+			} else {
+				out_result = item.table->set(caller_id, item.keyhash, item.key,
+					(char *) item.obj.val);
+			}
+
+			if(unlikely(out_result != MicaResult::kSuccess)) {
+				fprintf(stderr, "HoTS: ProcServer write for {table, key} = "
+					"{%s, %" PRIu64 "} failed with code %s\n",
+					item.table->name.c_str(), item.key,
+					::mica::table::ResultString(out_result).c_str());
+				exit(-1);
+			}
+		}
+	}
+
+public:
+	ProcServer()
+	{
+		/* Validation compares full versions, which TicToc's rts changes */
+		assert(TX_ENABLE_TICTOC == 0);
+
+		for(int i = 0; i < PROCSERVER_MAX_TABLES; i++) {
+			table_arr[i] = NULL;
+		}
+
+		for(int i = 0; i < PROCSERVER_MAX_PROCS; i++) {
+			proc_arr[i] = NULL;
+			proc_arg_arr[i] = NULL;
+		}
+	}
+
+	/* Serve keys of primary RPC type @rpc_reqtype from primary @table */
+	void register_table(rpc_reqtype_t rpc_reqtype, FixedTable *table)
+	{
+		assert(rpc_reqtype % RPC_PRIMARY_DS_REQ_SPACING == 0);
+		assert(table != NULL);
+		table_arr[rpc_reqtype / RPC_PRIMARY_DS_REQ_SPACING] = table;
+	}
+
+	void register_proc(int proc_id, procsrv_func_t func, void *arg)
+	{
+		assert(proc_id >= 0 && proc_id < PROCSERVER_MAX_PROCS);
+		assert(func != NULL && proc_arr[proc_id] == NULL);
+		proc_arr[proc_id] = func;
+		proc_arg_arr[proc_id] = arg;
+	}
+
+	// Procedure API
+
+	/*
+	 * Read @key. Returns NULL if the procedure must abort. Keys that do not
+	 * exist are returned with val_size = 0.
+	 */
+	forceinline hots_obj_t* read(rpc_reqtype_t rpc_reqtype, hots_key_t key)
+	{
+		procsrv_item_t *item = add_item(rpc_reqtype, key,
+			tx_write_mode_t::ignore);
+
+		MicaResult out_result = item->table->get(caller_id, item->keyhash,
+			key, (uint64_t *) &item->obj.hdr, (char *) item->obj.val);
+
+		if(out_result == MicaResult::kLocked) {
+			must_abort = true;
+			return NULL;
+		}
+
+		item->obj.val_size = (out_result == MicaResult::kSuccess) ?
+			item->table->val_size : 0;
+		item->exec_version = item->obj.hdr.version;
+		return &item->obj;
+	}
+
+	/*
+	 * Lock @key for an update, delete, or insert, and return its object.
+	 * Inserted objects are zeroed. Returns NULL if the procedure must abort.
+	 */
+	forceinline hots_obj_t* write(rpc_reqtype_t rpc_reqtype, hots_key_t key,
+		tx_write_mode_t write_mode)
+	{
+		tx_dassert(write_mode != tx_write_mode_t::ignore);
+		procsrv_item_t *item = add_item(rpc_reqtype, key, write_mode);
+		FixedTable *table = item->table;
+
+		MicaResult out_result;
+		if(write_mode != tx_write_mode_t::insert) {
+			out_result = table->lock_bkt_and_get(caller_id, item->keyhash,
+				key, (uint64_t *) &item->obj.hdr, (char *) item->obj.val,
+				write_mode == tx_write_mode_t::del);
+		} else {
+			out_result = table->lock_bkt_for_ins(caller_id, item->keyhash,
+				key, (uint64_t *) &item->obj.hdr);
+			memset((void *) item->obj.val, 0, table->val_size);
+		}
+
+		if(out_result != MicaResult::kSuccess) {
+			must_abort = true;
+			return NULL;
+		}
+
+		item->locked = true;
+		item->obj.val_size = table->val_size;
+		return &item->obj;
+	}
+
+	/* Set the procedure's output, which is returned to the coordinator */
+	forceinline void set_output(const void *buf, size_t len)
+	{
+		tx_dassert(len <= PROCSERVER_MAX_OUT);
+		memcpy((void *) out, buf, len);
+		out_len = len;
+	}
+
+	// RPC handler
+
+	forceinline size_t run(uint8_t *resp_buf, rpc_resptype_t *resp_type,
+		const procsrv_req_t *req, size_t req_len)
+	{
+		_unused(req_len);
+		tx_dassert(req_len == procsrv_req_size(req->params_len));
+		tx_dassert(req->proc_id < PROCSERVER_MAX_PROCS &&
+			proc_arr[req->proc_id] != NULL);
+
+		procsrv_resp_t *resp = (procsrv_resp_t *) resp_buf;
+
+		caller_id = req->caller_id;
+		must_abort = false;
+		num_items = 0;
+		out = resp->out;
+		out_len = 0;
+
+		bool commit = proc_arr[req->proc_id](this, req->params,
+			req->params_len, proc_arg_arr[req->proc_id]);
+
+		if(!commit || must_abort || !validate()) {
+			unlock_all();
+			*resp_type = (uint16_t) procsrv_resptype_t::aborted;
+			return 0;
+		}
+
+		resp->out_len = out_len;
+		resp->num_writes = 0;
+
+		size_t num_writes = 0;
+		for(size_t i = 0; i < num_items; i++) {
+			if(item_arr[i].write_mode != tx_write_mode_t::ignore) {
+				num_writes++;
+			}
+		}
+
+		if(num_writes == 0 || req->commit_at_primary == 1) {
+			apply_writes();
+			*resp_type = (uint16_t) procsrv_resptype_t::committed;
+			return procsrv_resp_size(0);
+		}
+
+		/* Return the locked write set for logging and replication */
+		uint8_t *_buf = resp->writes;
+		for(size_t i = 0; i < num_items; i++) {
+			procsrv_item_t &item = item_arr[i];
+			if(item.write_mode == tx_write_mode_t::ignore) {
+				continue;
+			}
+
+			procsrv_write_t *write = (procsrv_write_t *) _buf;
+			write->rpc_reqtype = item.rpc_reqtype;
+			write->write_mode = static_cast<uint64_t>(item.write_mode);
+			write->val_size = item.obj.val_size;
+			write->key = item.key;
+			write->hdr = item.obj.hdr;
+			_buf += sizeof(procsrv_write_t);
+
+			rte_memcpy((void *) _buf, (void *) item.obj.val,
+				item.obj.val_size);
+			_buf += item.obj.val_size;
+		}
+
+		resp->num_writes = num_writes;
+		*resp_type = (uint16_t) procsrv_resptype_t::prepared;
+		return procsrv_resp_size((size_t) (_buf - resp->writes));
+	}
+};
+
+forceinline size_t procserver_rpc_handler(
+	uint8_t *resp_buf, rpc_resptype_t *resp_type,
+	const uint8_t *req_buf, size_t req_len, void *_procserver)
+{
+	ProcServer *procserver = static_cast<ProcServer *>(_procserver);
+	return procserver->run(resp_buf, resp_type,
+		(const procsrv_req_t *) req_buf, req_len);
+}
+
+#endif /* PROCSERVER_H */
@@ -1,44 +1,95 @@
 #include "libhrd/hrd.h"
 #include "rpc/rpc.h"
 
-Rpc::Rpc(struct rpc_args args) : info(args)
+#if RPC_ENABLE_SRQ == 1
+std::mutex Rpc::srq_lock;
+struct hrd_srq_blk *Rpc::srq_blk_arr[HOTS_MAX_PORTS] = {NULL};
+int Rpc::srq_users[HOTS_MAX_PORTS] = {0};
+#endif
+
+/* Measure the TSC frequency against CLOCK_REALTIME for 10 ms */
+static double measure_tsc_ghz()
 {
-	hrd_red_printf("Rpc: Initializing for worker %d, required recvs = %d\n",
-		info.wrkr_gid, required_recvs());
-	fflush(stdout);
+	struct timespec start, end;
+	double ns;
+
+	clock_gettime(CLOCK_REALTIME, &start);
+	long long start_tsc = hrd_get_cycles();
+	do {
+		clock_gettime(CLOCK_REALTIME, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1000000000.0 +
+			(end.tv_nsec - start.tv_nsec);
+	} while(ns < 10000000);
+
+	return (hrd_get_cycles() - start_tsc) / ns;
+}
 
+Rpc::Rpc(struct rpc_args args) : info(args)
+{
 	/* Sanity checks */
 	check_defines();
 	check_info();
 
+	hrd_red_printf("Rpc: Initializing for worker %d, required recvs = %d\n",
+		info.wrkr_gid, required_recvs());
+	fflush(stdout);
+
 	pr_port = info.base_port_index + (info.wrkr_lid % info.num_ports);
 	assert(pr_port < HOTS_MAX_PORTS);
 
 	int shm_key = RPC_BASE_SHM_KEY + info.wrkr_lid;
 	assert(shm_key < RPC_MAX_SHM_KEY);
 
+	size_t rpc_buf_size = RPC_RECV_BUF_SIZE + mbuf_space() + ext_hdr_space();
+
+#if RPC_ENABLE_SRQ == 1
+	/* A completion takes a RECV from the SRQ, so this bounds our RECV CQ */
+	cb = hrd_ctrl_blk_init_srq(info.wrkr_gid, /* local hid */
+		srq_get(pr_port), info.num_qps,	/* SRQ, dgram qps */
+		RPC_SRQ_DEPTH,	/* RECV CQ depth */
+		rpc_buf_size, shm_key);	/* buf size, dgram buf shm key */
+
+	lkey = cb->dgram_buf_mr->lkey;
+	rpc_buf = (uint8_t *) cb->dgram_buf;
+#elif RPC_SHM_ONLY == 0
 	cb = hrd_ctrl_blk_init(info.wrkr_gid, /* local hid */
 		pr_port, 0, /* port index, numa node */
 		0, 0, /* conn qps, UC */
 		NULL, 0, -1, /* conn prealloc buf, buf size, conn buf shm key */
 		NULL, info.num_qps,	/* dgram prealloc buf, dgram qps */
-		RPC_RECV_BUF_SIZE + RPC_MBUF_SPACE + RPC_NON_INLINE_SPACE, /* buf size */
+		rpc_buf_size, /* buf size */
 		shm_key);	/* dgram buf shm key */
 
 	/* Save lkey to avoid indexing into dgram_buf_mr repeatedly */
 	lkey = cb->dgram_buf_mr->lkey;
+	rpc_buf = (uint8_t *) cb->dgram_buf;
+#else
+	/* No RDMA device: mbufs need not be registered */
+	rpc_buf = (uint8_t *) memalign(4096, rpc_buf_size);
+	assert(rpc_buf != NULL);
+	memset(rpc_buf, 0, rpc_buf_size);
+	lkey = 0;
+#endif
 
 	init_non_zero_members();
 	init_coroutine_metadata();
 
+	/* Create the SHM rings to us before any co-located peer can send to us */
+	init_shm_transport();
+
+#if RPC_SHM_ONLY == 0
 	/* Initialize RECV freelist and constant fields of wr's */
+#if RPC_ENABLE_SRQ == 0
 	init_recv_wrs();
+#endif
 	init_send_wrs();
 
 	check_modded();
 
 	/* Publish the QP */
+#if RPC_ENABLE_SRQ == 0
 	post_recvs(HRD_RQ_DEPTH);	/* Fill RECVs before publishing */
+#endif
 
 	/* Publish 0th QP for remote workers to post SENDs to */
 	char my_qp_name[HRD_QP_NAME_SIZE];
@@ -81,12 +132,77 @@ Rpc::Rpc(struct rpc_args args) : info(args)
 	fflush(stdout);
 
 	hrd_close_memcached();	/* Close memcached connections for this thread */
+#endif
+}
+
+/*
+ * Find the machines that are on this host and set up SHM rings for them. With
+ * RPC_SHM_ONLY, all machines are on this host and memcached is not used.
+ * Otherwise, machines publish their hostname and the ones with our hostname are
+ * treated as co-located.
+ */
+void Rpc::init_shm_transport()
+{
+#if RPC_ENABLE_SHM_TRANSPORT == 1
+	char my_host[HRD_QP_NAME_SIZE] = {0};
+	gethostname(my_host, sizeof(my_host) - 1);
+
+#if RPC_SHM_ONLY == 0
+	char my_host_key[HRD_QP_NAME_SIZE];
+	sprintf(my_host_key, "rpc-host-%d-%d", info.machine_id, info.wrkr_lid);
+	hrd_publish(my_host_key, my_host, strlen(my_host) + 1);
+#endif
+
+	for(int mc_i = 0; mc_i < info.num_machines; mc_i++) {
+#if RPC_SHM_ONLY == 0
+		char rem_host_key[HRD_QP_NAME_SIZE];
+		sprintf(rem_host_key, "rpc-host-%d-%d", mc_i, info.wrkr_lid);
+
+		char *rem_host = NULL;
+		while(hrd_get_published(rem_host_key, (void **) &rem_host) <= 0) {
+			usleep(20000);
+		}
+
+		is_shm_peer[mc_i] = (strcmp(rem_host, my_host) == 0);
+		free(rem_host);
+#else
+		is_shm_peer[mc_i] = true;
+#endif
+
+		if(is_shm_peer[mc_i]) {
+			shm_peer_list[num_shm_peers] = mc_i;
+			num_shm_peers++;
+
+			/* Ring from @mc_i to us: we are the consumer, so we reset it */
+			shm_rx_ring[mc_i] = rpc_shm_ring_get(
+				rpc_shm_ring_key(mc_i, info.machine_id, info.wrkr_lid));
+			rpc_shm_ring_reset(shm_rx_ring[mc_i]);
+		}
+	}
+
+	/* Attach to rings to co-located machines after they have reset them */
+	for(int i = 0; i < num_shm_peers; i++) {
+		int mc_i = shm_peer_list[i];
+		shm_tx_ring[mc_i] = rpc_shm_ring_get(
+			rpc_shm_ring_key(info.machine_id, mc_i, info.wrkr_lid));
+		rpc_shm_ring_wait_ready(shm_tx_ring[mc_i]);
+	}
+
+	hrd_red_printf("Rpc: Worker %d using SHM transport for %d of %d machines\n",
+		info.wrkr_gid, num_shm_peers, info.num_machines);
+#endif
 }
 
-/* Register a handler and an optional argument for a request type. */
+/*
+ * Register a handler and an optional argument for a request type. Set
+ * RPC_HANDLER_NON_IDEMPOTENT in @flags if running a request twice is not safe
+ * (e.g., puts, unlocks, and log appends), so that its retransmissions get
+ * the cached response instead. Set RPC_HANDLER_MAY_DEFER if the handler may
+ * call defer_resp(); requests of this type are then never run locally.
+ */
 void Rpc::register_rpc_handler(int req_type,
 	size_t (*func)(uint8_t *resp_buf, rpc_resptype_t *resp_type,
-		const uint8_t *req_buf, size_t req_len, void *), void *arg)
+		const uint8_t *req_buf, size_t req_len, void *), void *arg, int flags)
 {
 	assert(func != NULL);
 	if(!RPC_IS_VALID_TYPE(req_type)) {
@@ -94,7 +210,8 @@ void Rpc::register_rpc_handler(int req_type,
 		exit(-1);
 	}
 
-	if(rpc_handler[req_type] != NULL || rpc_handler_arg[req_type] != NULL) {
+	if(rpc_handler[req_type] != NULL || rpc_handler_arg[req_type] != NULL ||
+			rpc_batch_handler[req_type] != NULL) {
 		printf("Rpc: Error. Function for handler type %d already registered.\n",
 			req_type);
 		exit(-1);
@@ -107,6 +224,75 @@ void Rpc::register_rpc_handler(int req_type,
 
 	rpc_handler[req_type] = func;	/* Actually register */
 	rpc_handler_arg[req_type] = arg;
+	rpc_handler_flags[req_type] = flags;
+}
+
+/*
+ * Register a batch handler for a request type. The handler's responses must
+ * not exceed @max_resp_len bytes, which are reserved for each response.
+ * @flags are as for register_rpc_handler().
+ */
+void Rpc::register_batch_handler(int req_type,
+	void (*func)(rpc_batch_req_t *reqs, int num_reqs, void *arg),
+	size_t max_resp_len, void *arg, int flags)
+{
+#if RPC_ENABLE_BATCH_HANDLERS == 0
+	printf("Rpc: Error. Batch handlers are disabled.\n");
+	exit(-1);
+#endif
+
+	assert(func != NULL);
+	assert(max_resp_len % sizeof(uint64_t) == 0 &&
+		max_resp_len <= RPC_MAX_REQ_SIZE);
+	if(!RPC_IS_VALID_TYPE(req_type)) {
+		printf("Rpc: Error. Cannot register handler for non-request types.\n");
+		exit(-1);
+	}
+
+	if(rpc_handler[req_type] != NULL || rpc_batch_handler[req_type] != NULL) {
+		printf("Rpc: Error. Function for handler type %d already registered.\n",
+			req_type);
+		exit(-1);
+	}
+
+	if(flags & RPC_HANDLER_MAY_DEFER) {
+		printf("Rpc: Error. Batch handlers cannot defer responses.\n");
+		exit(-1);
+	}
+
+	rpc_batch_handler[req_type] = func;
+	rpc_batch_max_resp_len[req_type] = max_resp_len;
+	rpc_handler_arg[req_type] = arg;
+	rpc_handler_flags[req_type] = flags;
+}
+
+/*
+ * Register a prefetch handler for a request type whose (batch) handler is
+ * already registered. The prefetch handler gets the handler's argument, and
+ * must not modify any state.
+ */
+void Rpc::register_prefetch_handler(int req_type,
+	void (*func)(const uint8_t *req_buf, size_t req_len, void *arg))
+{
+	assert(func != NULL);
+	if(!RPC_IS_VALID_TYPE(req_type)) {
+		printf("Rpc: Error. Cannot register handler for non-request types.\n");
+		exit(-1);
+	}
+
+	if(rpc_handler[req_type] == NULL && rpc_batch_handler[req_type] == NULL) {
+		printf("Rpc: Error. Prefetch handler for type %d registered before "
+			"its handler.\n", req_type);
+		exit(-1);
+	}
+
+	if(rpc_prefetch_handler[req_type] != NULL) {
+		printf("Rpc: Error. Prefetch handler for type %d already registered.\n",
+			req_type);
+		exit(-1);
+	}
+
+	rpc_prefetch_handler[req_type] = func;
 }
 
 void Rpc::print_stats()
@@ -115,11 +301,54 @@ void Rpc::print_stats()
 	printf("Rpc: Stats disabled, ");
 #else
 	printf("Rpc: Worker %d: Average response batch size = %.2f, "
-		"wasted poll cq = %lu, ", info.wrkr_gid,
-		(float) stat_num_cresps / stat_resp_post_send_calls,
-		stat_wasted_poll_cq);
+		"average postlist = %.2f, wasted poll cq = %lu, SHM msgs = %lu, "
+		"fragments = %lu, credit waits = %lu, packed msgs = %lu, "
+		"average handler batch = %.2f, ",
+		info.wrkr_gid, (float) stat_num_cresps / stat_resp_post_send_calls,
+		(float) stat_num_send_wrs / stat_resp_post_send_calls,
+		stat_wasted_poll_cq, stat_num_shm_msgs, stat_num_frags,
+		stat_credit_waits, stat_num_packed,
+		(float) stat_batch_reqs / stat_batch_calls);
 #endif
 
+	/* Retransmissions are rare and important, so always report them */
+	if(stat_num_retx != 0 || stat_dup_reqs != 0 || stat_stale_resps != 0) {
+		printf("(%lu retransmitted requests, %lu duplicate requests, "
+			"%lu stale responses) ", stat_num_retx, stat_dup_reqs,
+			stat_stale_resps);
+		stat_num_retx = 0;
+		stat_dup_reqs = 0;
+		stat_stale_resps = 0;
+	}
+
+	if(stat_reasm_restarts != 0) {
+		printf("(%lu restarted reassemblies) ", stat_reasm_restarts);
+		stat_reasm_restarts = 0;
+	}
+
+	/* Waits for SEND completions should be rare, so always report them */
+	if(stat_send_stalls != 0) {
+		printf("(%lu SEND completion stalls) ", stat_send_stalls);
+		stat_send_stalls = 0;
+	}
+
+	if(stat_send_backlog != 0) {
+		printf("(%lu SENDs queued behind SEND completions) ",
+			stat_send_backlog);
+		stat_send_backlog = 0;
+	}
+
+	if(stat_hold_copies != 0) {
+		printf("(%lu zero-copy responses copied out) ", stat_hold_copies);
+		stat_hold_copies = 0;
+	}
+
+	/* Drops at SHM rings are rare and important, so always report them */
+	if(stat_shm_ring_full != 0) {
+		printf("(%lu drops at full SHM rings) ", stat_shm_ring_full);
+		stat_shm_ring_full = 0;
+	}
+
 	/* Print timer info in the same line as stats */
 #if RPC_COLLECT_TIMER_INFO == 0
 	printf("timer info not available\n");
@@ -131,7 +360,14 @@ void Rpc::print_stats()
 	/* Do not zero-out request stats that are used directly by apps */
 	stat_num_cresps = 0;
 	stat_resp_post_send_calls = 0;
+	stat_num_send_wrs = 0;
 	stat_wasted_poll_cq = 0;
+	stat_num_shm_msgs = 0;
+	stat_num_frags = 0;
+	stat_credit_waits = 0;
+	stat_num_packed = 0;
+	stat_batch_calls = 0;
+	stat_batch_reqs = 0;
 	stat_num_recvs = 0;
 	tot_cycles_post_recv = 0;
 }
@@ -144,7 +380,19 @@ void Rpc::check_defines()
 	ct_assert(RPC_COLLECT_STATS == 1);
 #endif
 	ct_assert(HRD_SQ_DEPTH >= 2 * RPC_UNSIG_BATCH);	/* Queue capacity check */
-	ct_assert(HRD_RQ_DEPTH >= 2 * RPC_UNSIG_BATCH);	/* Non-inlined buffers */
+
+	/* A full backlog is drained by the window that the wait opens */
+	ct_assert(RPC_SEND_BACKLOG >= 1 && RPC_SEND_BACKLOG <= RPC_UNSIG_BATCH);
+
+	/*
+	 * Spare response buffers: Every UD SEND (including each fragment and
+	 * packed packet) takes at most one spare buffer. A QP has < 2 *
+	 * RPC_UNSIG_BATCH SENDs that are not known to be complete, plus up to
+	 * RPC_SEND_BACKLOG queued SENDs whose original buffers are not reclaimed
+	 * yet. So reclaim_resp_bufs() always finds a buffer.
+	 */
+	ct_assert(HRD_RQ_DEPTH >
+		RPC_MAX_QPS * (2 * RPC_UNSIG_BATCH + RPC_SEND_BACKLOG));
 	
 	/* Checks for immediate bit encoding */
 	ct_assert(bit_capacity(RPC_NUM_REQS_BITS) >= RPC_MAX_MSG_CORO);
@@ -164,8 +412,22 @@ void Rpc::check_info()
 	range_assert(info.numa_node, 0, 1);
 	range_assert(info.postlist, 1, RPC_MAX_POSTLIST);
 	range_assert(info.max_pkt_size, 1, RPC_MAX_MAX_PKT_SIZE);
+	range_assert(info.max_msg_size, info.max_pkt_size, RPC_MAX_MAX_MSG_SIZE);
+	range_assert(info.num_futures, 0, RPC_MAX_FUTURES);
+	assert(!info.use_oneway || RPC_ENABLE_ONEWAY == 1);
+
+	if(info.max_msg_size > info.max_pkt_size) {
+		/* Fragments must carry some data, and fit in the reassembly bitmap */
+		size_t _frag_data_size =
+			(info.max_pkt_size - sizeof(rpc_frag_hdr_t)) & ~7ull;
+		assert(info.max_pkt_size >= 64);
+		assert((info.max_msg_size + _frag_data_size - 1) / _frag_data_size <=
+			RPC_MAX_FRAGS);
+	}
 
+#if RPC_ENABLE_SRQ == 0
 	assert(required_recvs() <= HRD_RQ_DEPTH);
+#endif
 }
 
 /* Most class members are zero-ed in the declaration. Init the rest here. */
@@ -173,20 +435,67 @@ void Rpc::init_non_zero_members()
 {
 	pr_port = info.wrkr_gid % info.num_ports;
 
-	/* RECV targets lie in separate cachelines for low L3--PCIe traffic */
-	recv_step = 0;
-	while(recv_step < info.max_pkt_size + HOTS_GRH_BYTES) {
-		 recv_step += 64;
-	}
-	assert(recv_step <= RPC_MAX_MAX_PKT_SIZE);
+	recv_step = recv_buf_step();
 
 	/* RECV slack */
+#if RPC_ENABLE_SRQ == 0
 	recv_slack = HRD_RQ_DEPTH - required_recvs() - 1;
 	if(recv_slack >= RPC_MIN_RECV_SLACK) {
 		recv_slack = RPC_MIN_RECV_SLACK;
 	}
 	assert(recv_slack >= RPC_MIN_RECV_SLACK);
 
+	/*
+	 * Held RECV buffers block reposting, so they must not eat the slack: past
+	 * this many, zero-copy responses are copied out instead.
+	 */
+	recv_hold_max = recv_slack / 2;
+#else
+	/* The SRQ is shared, so we repost RECVs in chains, without slack */
+	for(int wr_i = 0; wr_i < HRD_RQ_DEPTH; wr_i++) {
+		srq_recv_wr[wr_i].sg_list = &srq_recv_sgl[wr_i];
+		srq_recv_wr[wr_i].num_sge = 1;
+		srq_recv_wr[wr_i].next = (wr_i < HRD_RQ_DEPTH - 1) ?
+			&srq_recv_wr[wr_i + 1] : NULL;
+	}
+#endif
+
+	/* Fragments are 8-byte aligned in the message, like requests */
+	frag_data_size = (info.max_pkt_size - sizeof(rpc_frag_hdr_t)) & ~7ull;
+
+	/* For building fragments and packed packets for SHM rings */
+	shm_stage_buf = (uint8_t *) memalign(64, info.max_pkt_size);
+	assert(shm_stage_buf != NULL);
+
+	/* For SENDs queued behind a closed signaling window */
+	backlog_step = (info.max_pkt_size + 63) & ~63ull;
+	backlog_buf = (uint8_t *) memalign(64,
+		info.num_qps * RPC_SEND_BACKLOG * backlog_step);
+	assert(backlog_buf != NULL);
+
+	if(info.max_msg_size > info.max_pkt_size) {
+		/* Request reassembly buffers are allocated on first use */
+		req_reasm = (rpc_reasm_t *) calloc(num_remote_batches(),
+			sizeof(rpc_reasm_t));
+		assert(req_reasm != NULL);
+	}
+
+	for(int mc_i = 0; mc_i < info.num_machines; mc_i++) {
+		credits[mc_i] = peer_credits();
+	}
+
+	/* Response cache buffers are allocated on first use */
+	resp_cache = (rpc_resp_cache_t *) calloc(num_remote_batches(),
+		sizeof(rpc_resp_cache_t));
+	assert(resp_cache != NULL);
+
+	/* Deferred response buffers are allocated on first use */
+	for(int i = 0; i < RPC_MAX_DEFERRED; i++) {
+		deferred_arr[i].buf = NULL;
+		deferred_free[i] = RPC_MAX_DEFERRED - 1 - i;
+	}
+	num_deferred_free = RPC_MAX_DEFERRED;
+
 	// Loss detection
 	clock_gettime(CLOCK_REALTIME, &rpc_init_time);
 	clock_gettime(CLOCK_REALTIME, &ld_stopwatch);
@@ -195,6 +504,11 @@ void Rpc::init_non_zero_members()
 	sprintf(ld_filename, "/tmp/fasst-rpc-pkt-loss-wrkr-%d", info.wrkr_gid);
 	ld_fp = fopen(ld_filename, "w");
 	assert(ld_fp != NULL);
+
+	// Latency histograms
+	memset(batch_start_tsc, 0, sizeof(batch_start_tsc));
+	reset_lat_stats();
+	tsc_ghz = (RPC_COLLECT_LAT_HIST == 1) ? measure_tsc_ghz() : 1.0;
 }
 
 /* This must be called after initializing libhrd control blocks */
@@ -204,11 +518,11 @@ void Rpc::init_coroutine_metadata()
 	resp_batch.num_cresps = 0;
 
 	// We registered memory for RPC mbufs with the control blocks. Use it here.
-	uint8_t *_base = (uint8_t *) &cb->dgram_buf[RPC_RECV_BUF_SIZE];
+	uint8_t *_base = &rpc_buf[RPC_RECV_BUF_SIZE];
 	size_t _off = 0;
-	size_t _step = info.max_pkt_size;
-	_step = (_step + 63) & ~63ull;	/* Round to next mul of 64 */
-	assert(_step >= info.max_pkt_size && _step % 64 == 0);
+	size_t _step = mbuf_step();
+	size_t _space = mbuf_space();
+	assert(_step >= info.max_msg_size && _step % 64 == 0);
 
 	// Initialize resp_batch (for master coroutine) with @HRD_RQ_DEPTH messages
 	for(int msg_i = 0; msg_i < HRD_RQ_DEPTH; msg_i++) {
@@ -222,71 +536,127 @@ void Rpc::init_coroutine_metadata()
 		cmsg->req_mbuf.alloc_len = 0;
 		cmsg->req_mbuf.cur_buf = NULL;
 
-		assert(_off < RPC_MBUF_SPACE - _step);	/* Check space */
+		assert(_off + _step <= _space);	/* Check space */
 		cmsg->resp_mbuf.alloc_with_buf((uint8_t *) &_base[_off],
-			info.max_pkt_size);
+			info.max_msg_size);
 		_off += _step;
 	}
 
-	// Initialize req_batch structs (for slave coroutines)
+	// Initialize req_batch structs (regular and one-way, for slave coroutines)
 	for(int coro_i = 1; coro_i < info.num_coro; coro_i++) {
 		assert(coro_i != RPC_MASTER_CORO_ID);
 
-		rpc_req_batch_t *req_batch = &req_batch_arr[coro_i];
-
-		/* Manually reset the req batch - can't use @req_batch->clear() here */
-		req_batch->num_reqs = 0;
-		req_batch->num_reqs_done = 0;
-		req_batch->num_uniq_mn = 0;
-		for(int mc_i = 0; mc_i < HOTS_MAX_MACHINES; mc_i++) {
-			req_batch->cmsg_for_mc[mc_i] = -1;
-		}
+		for(int b = 0; b < RPC_BATCHES_PER_CORO; b++) {
+			int batch_i = coro_i + b * RPC_MAX_CORO;
+			rpc_req_batch_t *req_batch = &req_batch_arr[batch_i];
+
+			/* Manually reset the batch - can't use @req_batch->clear() here */
+			req_batch->num_reqs = 0;
+			req_batch->num_reqs_done = 0;
+			req_batch->num_uniq_mn = 0;
+			req_batch->resp_rcvd_mask = 0;
+			req_batch->credit_wait_mask = 0;
+			req_batch->may_defer_mask = 0;
+			req_batch->num_zero_copy = 0;
+			req_batch->num_held_recvs = 0;
+			for(int mc_i = 0; mc_i < HOTS_MAX_MACHINES; mc_i++) {
+				req_batch->cmsg_for_mc[mc_i] = -1;
+			}
 
-		/* Slaves need both request and response coalesced mbufs */
-		for(int msg_i = 0; msg_i < RPC_MAX_MSG_CORO; msg_i++) {
-			rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[msg_i];
-			/* remote_wn must be invalidated for correct coalescing */
-			cmsg->remote_mn = RPC_INVALID_MN;
-			cmsg->num_centry = 0;
-
-			/* Allocate request mbuf */
-			assert(_off < RPC_MBUF_SPACE - _step);	/* Check space */
-			cmsg->req_mbuf.alloc_with_buf((uint8_t *) &_base[_off],
-				info.max_pkt_size);
-			_off += _step;
+			/* Slaves need both request and response coalesced mbufs */
+			for(int msg_i = 0; msg_i < RPC_MAX_MSG_CORO; msg_i++) {
+				rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[msg_i];
+				/* remote_wn must be invalidated for correct coalescing */
+				cmsg->remote_mn = RPC_INVALID_MN;
+				cmsg->num_centry = 0;
+
+				/* Allocate request mbuf */
+				assert(_off + _step <= _space);	/* Check space */
+				cmsg->req_mbuf.alloc_with_buf((uint8_t *) &_base[_off],
+					info.max_msg_size);
+				_off += _step;
 			
-			/* Allocate response mbuf - response is copied into this */
-			assert(_off < RPC_MBUF_SPACE - _step);	/* Check space */
-			cmsg->resp_mbuf.alloc_with_buf((uint8_t *) &_base[_off],
-				info.max_pkt_size);
-			_off += _step;
+				/*
+				 * Allocate response mbuf - response is copied or reassembled
+				 * into this
+				 */
+				assert(_off + _step <= _space);	/* Check space */
+				cmsg->resp_mbuf.alloc_with_buf((uint8_t *) &_base[_off],
+					info.max_msg_size);
+				_off += _step;
+
+				resp_reasm[batch_i][msg_i].buf = cmsg->resp_mbuf.alloc_buf;
+				resp_reasm[batch_i][msg_i].reset();
+				resp_reasm[batch_i][msg_i].req_seq = 0;
+			}
 		}
 	}
 
-	// Initialize non-inline buffers for resp_batch
-
-	/* Reset _base and _off to a different memory region. _step remains same */
-	_base = (uint8_t *) &cb->dgram_buf[RPC_RECV_BUF_SIZE + RPC_MBUF_SPACE];
-	_off = 0;
-	resp_batch.non_inline_index = 0;
+	// Initialize spare response buffers for resp_batch
+	resp_batch.num_free_bufs = HRD_RQ_DEPTH;
 	for(int index = 0; index < HRD_RQ_DEPTH; index++) {
-		assert(_off < RPC_NON_INLINE_SPACE - _step);
-		resp_batch.non_inline_bufs[index] = (uint8_t *) &_base[_off];
+		assert(_off + _step <= _space);
+		resp_batch.free_bufs[index] = (uint8_t *) &_base[_off];
 		_off += _step;
 	}
+
+#if HOTS_ENABLE_EXT_HDR == 1
+	ext_hdr_buf = (rpc_ext_hdr_t *) &_base[_space];
+#endif
+}
+
+/* Size of a RECV buffer. RECV targets lie in separate cachelines. */
+size_t Rpc::recv_buf_step()
+{
+	size_t step = 0;
+	while(step < info.max_pkt_size + HOTS_GRH_BYTES + RPC_EXT_HDR_BYTES) {
+		step += 64;
+	}
+
+	assert(step <= RPC_MAX_MAX_PKT_SIZE);
+	return step;
+}
+
+/* Size of an mbuf or spare buffer in registered memory */
+size_t Rpc::mbuf_step()
+{
+	return (info.max_msg_size + 63) & ~63ull;	/* Round to next mul of 64 */
+}
+
+/*
+ * Registered memory for mbufs: response mbufs for the master, request and
+ * response mbufs for slaves' request batches, and spare buffers for non-inline
+ * SENDs.
+ */
+size_t Rpc::mbuf_space()
+{
+	size_t num_bufs = HRD_RQ_DEPTH +	/* Master's response mbufs */
+		(info.num_coro - 1) * RPC_BATCHES_PER_CORO *
+			RPC_MAX_MSG_CORO * 2 +	/* Slaves' mbufs */
+		HRD_RQ_DEPTH;	/* Spare buffers */
+
+	return num_bufs * mbuf_step();
+}
+
+/* Registered memory for extension headers of UD SENDs, after the mbufs */
+size_t Rpc::ext_hdr_space()
+{
+	return RPC_MAX_QPS * HRD_SQ_DEPTH * RPC_EXT_HDR_BYTES;
 }
 
 /* Initialize constant fields of send wr's */
 void Rpc::init_send_wrs()
 {
-	for(int wr_i = 0; wr_i < RPC_MAX_POSTLIST; wr_i++) {
-		send_sgl[wr_i].lkey = lkey;
+	for(int sge_i = 0; sge_i < RPC_MAX_POSTLIST * RPC_SEND_SGES; sge_i++) {
+		send_sgl[sge_i].lkey = lkey;
+	}
 
+	for(int wr_i = 0; wr_i < RPC_MAX_POSTLIST; wr_i++) {
 		send_wr[wr_i].next = &send_wr[wr_i + 1];
 		send_wr[wr_i].wr.ud.remote_qkey = HRD_DEFAULT_QKEY;
 		send_wr[wr_i].opcode = IBV_WR_SEND_WITH_IMM;
 		send_wr[wr_i].num_sge = 1;
-		send_wr[wr_i].sg_list = &send_sgl[wr_i];
+		send_wr[wr_i].sg_list = &send_sgl[wr_i * RPC_SEND_SGES];
 	}
 }
 
@@ -304,7 +674,7 @@ void Rpc::init_recv_wrs()
 
 		recv_sgl[wr_i].length = recv_step;
 		recv_sgl[wr_i].lkey = cb->dgram_buf_mr->lkey;
-		recv_sgl[wr_i].addr = (uintptr_t) &cb->dgram_buf[offset];
+		recv_sgl[wr_i].addr = (uintptr_t) &rpc_buf[offset];
 
 		recv_wr[wr_i].wr_id = recv_sgl[wr_i].addr;/* Debug */
 		recv_wr[wr_i].sg_list = &recv_sgl[wr_i];
@@ -316,6 +686,65 @@ void Rpc::init_recv_wrs()
 	}
 }
 
+#if RPC_ENABLE_SRQ == 1
+/*
+ * Get the SRQ of @port for this process, creating it and posting all its
+ * RECVs if we are its first user.
+ */
+struct hrd_srq_blk* Rpc::srq_get(int port)
+{
+	std::lock_guard<std::mutex> guard(srq_lock);
+	size_t step = recv_buf_step();
+
+	if(srq_users[port] == 0) {
+		struct hrd_srq_blk *srq_blk = hrd_srq_blk_init(port,
+			0, RPC_SRQ_DEPTH,	/* numa node, SRQ depth */
+			RPC_SRQ_DEPTH * step, RPC_SRQ_BASE_SHM_KEY + port);
+
+		/* Post RECVs in chains, like the datapath */
+		struct ibv_recv_wr wr[RPC_MAX_POSTLIST], *bad_wr;
+		struct ibv_sge sgl[RPC_MAX_POSTLIST];
+		for(int i = 0; i < RPC_SRQ_DEPTH; i += RPC_MAX_POSTLIST) {
+			int num_wrs = std::min(RPC_MAX_POSTLIST, RPC_SRQ_DEPTH - i);
+			for(int w_i = 0; w_i < num_wrs; w_i++) {
+				size_t offset = ((i + w_i) * step) + (64 - HOTS_GRH_BYTES);
+				sgl[w_i].addr = (uintptr_t) &srq_blk->buf[offset];
+				sgl[w_i].length = step;
+				sgl[w_i].lkey = srq_blk->buf_mr->lkey;
+
+				wr[w_i].wr_id = sgl[w_i].addr;
+				wr[w_i].sg_list = &sgl[w_i];
+				wr[w_i].num_sge = 1;
+				wr[w_i].next = (w_i < num_wrs - 1) ? &wr[w_i + 1] : NULL;
+			}
+
+			int ret = ibv_post_srq_recv(srq_blk->srq, &wr[0], &bad_wr);
+			CPE(ret, "Rpc: ibv_post_srq_recv error", ret);
+		}
+
+		srq_blk_arr[port] = srq_blk;
+	}
+
+	/* Users of an SRQ must have the same max_pkt_size. Rough check. */
+	assert((size_t) srq_blk_arr[port]->buf_size >= RPC_SRQ_DEPTH * step);
+	srq_users[port]++;
+	return srq_blk_arr[port];
+}
+
+/* Stop using the SRQ of @port; its last user destroys it */
+void Rpc::srq_put(int port)
+{
+	std::lock_guard<std::mutex> guard(srq_lock);
+	assert(srq_users[port] > 0);
+
+	srq_users[port]--;
+	if(srq_users[port] == 0) {
+		hrd_srq_blk_destroy(srq_blk_arr[port]);
+		srq_blk_arr[port] = NULL;
+	}
+}
+#endif
+
 /* Check if it is safe to use modded driver if it is requested. */
 void Rpc::check_modded() {
 	if(RPC_ENABLE_MODDED_DRIVER == 1 && info.wrkr_lid == 0) {
@@ -335,14 +764,28 @@ void Rpc::check_modded() {
 
 /*
  * We should have enough RECVs for the following:
- * 1. (info.num_coro - 1) * RPC_MAX_MSG_CORO responses to our requests.
- * 2. o(num_machines * (info.num_coro - 1)) reqs from remote threads.
+ * 1. Response packets to each request batch that our slaves use: one
+ *    coalesced response per machine, each with up to max_msg_size bytes.
+ * 2. num_machines * peer_credits() request packets from remote threads. Flow
+ *    control ensures that no remote thread exceeds its credits.
  */
 int Rpc::required_recvs()
 {
 	int num_machines = info.num_workers / info.workers_per_machine;
-	return (info.num_coro - 1) * RPC_MAX_MSG_CORO +
-		num_machines * (info.num_coro - 1);
+	int resps_per_batch = num_machines < RPC_MAX_MSG_CORO ?
+		num_machines : RPC_MAX_MSG_CORO;
+
+	int pkts_per_resp = 1;
+	if(info.max_msg_size > info.max_pkt_size) {
+		/* frag_data_size is not initialized yet */
+		size_t _frag_data_size =
+			(info.max_pkt_size - sizeof(rpc_frag_hdr_t)) & ~7ull;
+		pkts_per_resp = (int) ((info.max_msg_size + _frag_data_size - 1) /
+			_frag_data_size);
+	}
+
+	return (info.num_coro - 1) * batches_in_use() * resps_per_batch *
+		pkts_per_resp + num_machines * peer_credits();
 }
 
 /* Basic checks for a RECVd immediate. Debug-only. */
@@ -368,19 +811,17 @@ void Rpc::check_coalesced_msg(uint8_t *cbuf, int num_centry)
 		rpc_dassert(RPC_IS_VALID_TYPE(cmsg_reqhdr->req_type));
 		rpc_dassert(cmsg_reqhdr->coro_seqnum <= RPC_MAX_MSG_CORO);
 		rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
-		rpc_dassert(cmsg_reqhdr->size >= 0 &&
-			/*
-			 * Individual (non-coalesced) requests/responses need to be
-			 * strictly smaller than max_pkt_size because of the prefixed
-			 * coalesced message request header.
-			 */
-			cmsg_reqhdr->size < info.max_pkt_size &&
-			cmsg_reqhdr->size % sizeof(uint64_t) == 0);
-
-		offset += sizeof(rpc_cmsg_reqhdr_t) + cmsg_reqhdr->size;
+		/*
+		 * Individual (non-coalesced) requests/responses need to be strictly
+		 * smaller than max_msg_size because of the prefixed coalesced message
+		 * request header.
+		 */
+		rpc_dassert(cmsg_reqhdr->get_size() < info.max_msg_size);
+
+		offset += sizeof(rpc_cmsg_reqhdr_t) + cmsg_reqhdr->get_size();
 	}
 
-	rpc_dassert(offset <= info.max_pkt_size);
+	rpc_dassert(offset <= info.max_msg_size);
 }
 
 // Accessors
@@ -421,6 +862,13 @@ size_t Rpc::get_stat_num_creqs()
 	return ret;
 }
 
+size_t Rpc::get_stat_num_local_reqs()
+{
+	size_t ret = stat_num_local_reqs;
+	stat_num_local_reqs = 0;
+	return ret;
+}
+
 /* Get the maximum batch latency (us) of all coroutines of this RPC endpoint */
 double Rpc::get_max_batch_latency_us()
 {
@@ -450,8 +898,133 @@ void Rpc::reset_max_batch_latency()
 #endif
 }
 
+const rpc_lat_hist_t* Rpc::get_batch_lat_hist()
+{
+	return &lat_batch;
+}
+
+const rpc_lat_hist_t* Rpc::get_machine_lat_hist(int mn)
+{
+	assert(mn >= 0 && mn < info.num_machines);
+	return &lat_mn[mn];
+}
+
+const rpc_lat_hist_t* Rpc::get_req_type_lat_hist(int req_type)
+{
+	assert(req_type >= 0 && req_type < RPC_MAX_REQ_TYPE);
+	return &lat_req_type[req_type];
+}
+
+const rpc_lat_hist_t* Rpc::get_handler_lat_hist(int req_type)
+{
+	assert(req_type >= 0 && req_type < RPC_MAX_REQ_TYPE);
+	return &lat_handler[req_type];
+}
+
+double Rpc::cycles_to_us(size_t cycles)
+{
+	return cycles / (tsc_ghz * 1000);
+}
+
+/* Print a histogram's sample count, average and percentiles in us */
+static void print_lat_hist(const char *label, const rpc_lat_hist_t *hist,
+	double tsc_ghz)
+{
+	double cycles_per_us = tsc_ghz * 1000;
+	printf("\t%s: %lu samples, avg %.1f us, "
+		"50%% < %.1f us, 99%% < %.1f us, 99.9%% < %.1f us\n",
+		label, hist->num_samples,
+		hist->tot_cycles / cycles_per_us / hist->num_samples,
+		hist->percentile(50) / cycles_per_us,
+		hist->percentile(99) / cycles_per_us,
+		hist->percentile(99.9) / cycles_per_us);
+}
+
+void Rpc::print_lat_stats()
+{
+#if RPC_COLLECT_LAT_HIST == 0
+	printf("Rpc: Latency histograms disabled\n");
+#else
+	char label[100];
+
+	printf("Rpc: Worker %d latency:\n", info.wrkr_gid);
+	if(lat_batch.num_samples > 0) {
+		print_lat_hist("Request batches", &lat_batch, tsc_ghz);
+	}
+
+	for(int mn = 0; mn < info.num_machines; mn++) {
+		if(lat_mn[mn].num_samples > 0) {
+			sprintf(label, "RTT to machine %d", mn);
+			print_lat_hist(label, &lat_mn[mn], tsc_ghz);
+		}
+	}
+
+	for(int req_type = 0; req_type < RPC_MAX_REQ_TYPE; req_type++) {
+		if(lat_req_type[req_type].num_samples > 0) {
+			sprintf(label, "RTT of %s requests",
+				rpc_type_to_string(req_type).c_str());
+			print_lat_hist(label, &lat_req_type[req_type], tsc_ghz);
+		}
+
+		if(lat_handler[req_type].num_samples > 0) {
+			sprintf(label, "Handler time of %s requests",
+				rpc_type_to_string(req_type).c_str());
+			print_lat_hist(label, &lat_handler[req_type], tsc_ghz);
+		}
+	}
+
+	reset_lat_stats();
+#endif
+}
+
+void Rpc::reset_lat_stats()
+{
+	lat_batch.reset();
+	for(int mn = 0; mn < HOTS_MAX_MACHINES; mn++) {
+		lat_mn[mn].reset();
+	}
+
+	for(int req_type = 0; req_type < RPC_MAX_REQ_TYPE; req_type++) {
+		lat_req_type[req_type].reset();
+		lat_handler[req_type].reset();
+	}
+}
+
 Rpc::~Rpc()
 {
 	hrd_red_printf("Rpc: Destroying for worker %d\n", info.wrkr_gid);
+
+	for(int i = 0; i < num_shm_peers; i++) {
+		int mc_i = shm_peer_list[i];
+		shmdt(shm_tx_ring[mc_i]);
+		shmdt(shm_rx_ring[mc_i]);
+	}
+
+	if(req_reasm != NULL) {
+		for(int i = 0; i < num_remote_batches(); i++) {
+			free(req_reasm[i].buf);
+		}
+		free(req_reasm);
+	}
+	free(shm_stage_buf);
+	free(backlog_buf);
+
+	for(int i = 0; i < num_remote_batches(); i++) {
+		free(resp_cache[i].buf);
+	}
+	free(resp_cache);
+
+	for(int i = 0; i < RPC_MAX_DEFERRED; i++) {
+		free(deferred_arr[i].buf);
+	}
+
+#if RPC_ENABLE_SRQ == 1
+	int srq_port = cb->port_index;
+	hrd_ctrl_blk_destroy(cb);	/* Destroy the control block before its SRQ */
+	srq_put(srq_port);
+#elif RPC_SHM_ONLY == 0
 	hrd_ctrl_blk_destroy(cb);	/* Destroy the control block */
+#else
+	free(rpc_buf);
+#endif
 }
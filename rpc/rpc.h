@@ -2,17 +2,16 @@
 #define RPC_H
 
 #include <list>
+#include <mutex>
 
 #include "libhrd/hrd.h"
 #include "hots.h"
 #include "rpc/rpc_types.h"
 #include "rpc/rpc_defs.h"
+#include "rpc/rpc_shm.h"
 
 #include "lockserver/lockserver.h"
 
-/* For prefetching */
-#include "datastore/fixedtable/ds_fixedtable.h"	/* Only prefetch FixedTable */
-
 class Rpc {
 private:
 	struct rpc_args info;	/* Information about this RPC endpoint */
@@ -24,20 +23,77 @@ private:
 		const uint8_t *req_buf, size_t req_len, void *arg) =
 		{NULL};
 	void *rpc_handler_arg[RPC_MAX_REQ_TYPE] = {NULL};
+	int rpc_handler_flags[RPC_MAX_REQ_TYPE] = {0};	/* RPC_HANDLER_* */
+
+	// Prefetch handlers warm up the data that a request's handler will touch.
+	// They run for all requests of a poll_comps() pass before any handler.
+	void (*rpc_prefetch_handler[RPC_MAX_REQ_TYPE])(
+		const uint8_t *req_buf, size_t req_len, void *arg) = {NULL};
+
+	// Batch handlers get all requests of a type from a poll_comps() pass. The
+	// requests wait in batch_ent until run_batch_reqs().
+	void (*rpc_batch_handler[RPC_MAX_REQ_TYPE])(
+		rpc_batch_req_t *reqs, int num_reqs, void *arg) = {NULL};
+	size_t rpc_batch_max_resp_len[RPC_MAX_REQ_TYPE] = {0};
+	rpc_batch_ent_t batch_ent[RPC_MAX_BATCH_REQS];
+	int num_batch_ent = 0;
+	int batch_type_list[RPC_MAX_REQ_TYPE];	/* Types with waiting requests */
+	int num_batch_types = 0;
+	bool batch_type_used[RPC_MAX_REQ_TYPE] = {false};
+	int batch_cmsg_list[HRD_RQ_DEPTH];	/* Responses with waiting requests */
+	int num_batch_cmsg = 0;
+	rpc_batch_req_t batch_req_arr[RPC_MAX_BATCH_REQS];	/* Handler args */
+
+	// Deferred responses (see defer_resp())
+	rpc_deferred_t deferred_arr[RPC_MAX_DEFERRED];
+	int deferred_free[RPC_MAX_DEFERRED];	/* Free deferred_arr slots */
+	int num_deferred_free = 0;
+	int deferred_new[HRD_RQ_DEPTH];	/* Slots still in resp_batch */
+	int num_deferred_new = 0;
+	int deferred_done[RPC_MAX_DEFERRED];	/* Slots ready to be sent */
+	int num_deferred_done = 0;
+	int defer_slot = -1;	/* Slot of the coalesced request being processed */
+	int defer_seqnum = -1;	/* coro_seqnum of the request whose handler runs */
 
 	// Coroutine stuff
-	rpc_req_batch_t req_batch_arr[RPC_MAX_CORO];	/* For slaves*/
+	rpc_req_batch_t req_batch_arr[RPC_MAX_BATCH];	/* For slaves*/
 	rpc_resp_batch_t resp_batch;	/* For master coroutine */
 	coro_id_t next_coro[RPC_MAX_CORO];
 
+	/* Slave coroutines whose request batch completed locally in send_reqs() */
+	coro_id_t local_done_coro[RPC_MAX_CORO];
+	int num_local_done = 0;
+
 	// Packet loss detection (ld)
 	size_t ld_iters = 0;
 	struct timespec ld_stopwatch; /* Counts RPC_LOSS_DETECTION_MS at runtime */
-	size_t ld_num_resps_ever[RPC_MAX_CORO] = {0};
+	size_t ld_num_resps_ever[RPC_MAX_BATCH] = {0};
 	size_t ld_num_resps_ever_prev[RPC_MAX_CORO] = {0};
 	FILE *ld_fp; /* File to record any detected losses */
 	struct timespec rpc_init_time;	/* Creation time of this RPC endpoint */
 
+	// Packet loss recovery (retx)
+	size_t retx_iters = 0;
+	size_t retx_now_ms = 0;	/* Coarse time since init; updated every step */
+	uint32_t req_seq[RPC_MAX_BATCH] = {0};	/* Sequence number of each batch */
+	bool retx_armed[RPC_MAX_BATCH] = {false};	/* Waiting for responses */
+	size_t retx_start_ms[RPC_MAX_BATCH] = {0};	/* Last (re)transmission time */
+
+	/* Last response sent to each remote request batch (see remote_batch()) */
+	rpc_resp_cache_t *resp_cache = NULL;
+
+	/* One-way batches that were sent and not cleared yet */
+	bool oneway_sent[RPC_MAX_CORO] = {false};
+
+#if RPC_MAX_FUTURES > 0
+	/* Futures that were sent and not cleared yet */
+	bool future_sent[RPC_MAX_CORO][RPC_MAX_FUTURES] = {{false}};
+
+	/* Futures that a yielded coroutine waits for (see wait_futures()) */
+	uint32_t fut_wait_mask[RPC_MAX_CORO] = {0};
+	bool fut_wait_all[RPC_MAX_CORO] = {false};
+#endif
+
 #if RPC_MSR_MAX_BATCH_LATENCY
 	// Tracking information to measure max batch latency
 	struct timespec max_batch_lat_start[RPC_MAX_CORO];
@@ -48,6 +104,7 @@ private:
 	int pr_port;	/* Port used by this RPC endpoint. */
 	struct hrd_ctrl_blk *cb = NULL;	/* A control block on @pr_port */
 	uint32_t lkey;	/* Saved lkey of the primary port  */
+	uint8_t *rpc_buf = NULL;	/* RECV + mbuf memory; cb->dgram_buf if RDMA */
 
 	/* For remote QPs */
 	struct ibv_ah *ah[HOTS_MAX_MACHINES] = {NULL};
@@ -56,8 +113,77 @@ private:
 	// send()
 	int active_qp = 0;	/* The active QP for post_send() */
 	int nb_pending[RPC_MAX_QPS] = {0};	/* For selective signalling */
+	struct ibv_wc send_wc[1];	/* At most 1 unreaped signaled SEND per QP */
 	struct ibv_send_wr send_wr[RPC_MAX_POSTLIST + 1]; /* +1 for blind ->next */
-	struct ibv_sge send_sgl[RPC_MAX_POSTLIST];	/* No need for +1 here */
+	struct ibv_sge send_sgl[RPC_MAX_POSTLIST * RPC_SEND_SGES];	/* No +1 */
+	int send_wr_i = 0;	/* Number of assembled but unposted send wr's */
+
+	/*
+	 * SEND completion tracking, per QP. Signaled SENDs carry their sequence
+	 * number in wr_id, and are reaped by reap_send_comps().
+	 */
+	size_t send_seq[RPC_MAX_QPS] = {0};	/* Sequence number of the next SEND */
+	size_t send_seq_done[RPC_MAX_QPS] = {0};	/* SENDs before this are done */
+	size_t signaled_seq[RPC_MAX_QPS] = {0};	/* The last signaled SEND */
+	bool signaled_pending[RPC_MAX_QPS] = {false};	/* ...is not reaped yet */
+
+	/*
+	 * SENDs queued while their QP's signaling window is closed, in a ring per
+	 * QP. Queued SEND i of QP q keeps its data in @backlog_buf at
+	 * ((q * RPC_SEND_BACKLOG) + i % RPC_SEND_BACKLOG) * @backlog_step.
+	 */
+	rpc_backlog_send_t send_backlog[RPC_MAX_QPS][RPC_SEND_BACKLOG];
+	size_t backlog_head[RPC_MAX_QPS] = {0};	/* Next SEND to post */
+	size_t backlog_tail[RPC_MAX_QPS] = {0};	/* Next free entry */
+	uint8_t *backlog_buf = NULL;
+	size_t backlog_step = 0;	/* max_pkt_size rounded up to 64 */
+
+#if HOTS_ENABLE_EXT_HDR == 1
+	/*
+	 * Extension headers of UD SENDs, in registered memory. SEND
+	 * (qp, seq) uses slot (qp, seq % HRD_SQ_DEPTH), which is free because a
+	 * QP has < HRD_SQ_DEPTH SENDs that are not known to be complete.
+	 */
+	rpc_ext_hdr_t *ext_hdr_buf = NULL;
+#endif
+
+	/* Response buffers used by non-inline SENDs, in SEND order per QP */
+	rpc_busy_buf_t busy_buf[RPC_MAX_QPS][HRD_RQ_DEPTH];
+	size_t busy_head[RPC_MAX_QPS] = {0}, busy_tail[RPC_MAX_QPS] = {0};
+
+	// Flow control
+	int credits[HOTS_MAX_MACHINES] = {0};	/* Request packets we may send */
+
+	/* Coalesced requests waiting for credits, in FIFO order per machine */
+	rpc_cmsg_ref_t credit_wait[HOTS_MAX_MACHINES][RPC_MAX_BATCH];
+	size_t credit_wait_head[HOTS_MAX_MACHINES] = {0};
+	size_t credit_wait_tail[HOTS_MAX_MACHINES] = {0};
+	int num_credit_waits = 0;	/* Total over all machines */
+
+	// Fragmentation of coalesced messages larger than max_pkt_size
+	size_t frag_data_size = 0;	/* Message bytes carried by one fragment */
+	uint8_t *shm_stage_buf = NULL;	/* Staging buffer for SHM packets */
+
+	// Packing of coalesced messages for different coroutines into a packet
+	rpc_cmsg_ref_t pack_req[HOTS_MAX_MACHINES][RPC_MAX_BATCH];
+	int num_pack_req[HOTS_MAX_MACHINES] = {0};
+	int pack_mn_list[HOTS_MAX_MACHINES];	/* Machines with num_pack_req > 0 */
+	int num_pack_mn = 0;
+	rpc_pack_msg_t pack_msg_arr[HRD_RQ_DEPTH];	/* Scratch for send_packed() */
+
+	/* Reassembly of fragmented requests (per remote request batch) */
+	rpc_reasm_t *req_reasm = NULL;
+
+	/* Reassembly of fragmented responses, into the slaves' response mbufs */
+	rpc_reasm_t resp_reasm[RPC_MAX_BATCH][RPC_MAX_MSG_CORO];
+
+	// Shared-memory transport for machines on this host
+	bool is_shm_peer[HOTS_MAX_MACHINES] = {false};
+	int num_shm_peers = 0;
+	int shm_peer_list[HOTS_MAX_MACHINES] = {0};
+	rpc_shm_ring_t *shm_tx_ring[HOTS_MAX_MACHINES] = {NULL};	/* To peer */
+	rpc_shm_ring_t *shm_rx_ring[HOTS_MAX_MACHINES] = {NULL};	/* From peer */
+	size_t shm_rx_polled[HOTS_MAX_MACHINES] = {0};	/* Unreleased slots */
 
 	// recv()
 	size_t recv_step = -1;	/* Step size into cb->dgram_buf for RECV posting */
@@ -68,45 +194,107 @@ private:
 	/* Once post_recvs_fast() is used, regular post_recv() must not be used */
 	bool fast_recv_used = false;
 
+	/*
+	 * RECVs are reposted in ring order, starting from @recv_head. A RECV buffer
+	 * that holds zero-copy responses is not reposted until its @recv_hold count
+	 * drops to zero, which also delays reposting the RECVs after it.
+	 */
+	uint8_t recv_hold[HRD_RQ_DEPTH] = {0};
+	int num_recvs_held = 0;	/* Number of RECV buffers with non-zero hold */
+	int recv_hold_max = 0;	/* Cap on num_recvs_held; set from recv_slack */
+
 	struct ibv_recv_wr recv_wr[HRD_RQ_DEPTH];
 	struct ibv_sge recv_sgl[HRD_RQ_DEPTH];
 	struct ibv_wc wc[HRD_RQ_DEPTH];
 
+#if RPC_ENABLE_SRQ == 1
+	/*
+	 * The SRQ of each port is shared by the Rpc endpoints of this process on
+	 * that port. The first endpoint creates it and posts all its RECVs, and
+	 * the last one destroys it.
+	 */
+	static std::mutex srq_lock;
+	static struct hrd_srq_blk *srq_blk_arr[HOTS_MAX_PORTS];
+	static int srq_users[HOTS_MAX_PORTS];
+
+	/* RECVs consumed by us that are not yet reposted to the SRQ */
+	int srq_recvs_to_post = 0;
+	struct ibv_recv_wr srq_recv_wr[HRD_RQ_DEPTH];
+	struct ibv_sge srq_recv_sgl[HRD_RQ_DEPTH];
+#endif
+
 	/* Lockserver */
-	std::list<locksrv_req_t> locksrv_req_list;
+	Lockserver *locksrv = NULL;
+	std::list<locksrv_wait_t> locksrv_wait_list;	/* Lock requests to retry */
 
 	// Stats and cycle counts
 	size_t stat_num_reqs; /* Number of NON-COALESCED reqs. Useful for apps. */
 	size_t stat_num_creqs; /* Number of COALESCED reqs. Useful for apps. */
+	size_t stat_num_local_reqs = 0; /* NON-COALESCED reqs handled locally */
 
 	/* For average postlist size in coalesced response send()s */
 	size_t stat_resp_post_send_calls = 0;
+	size_t stat_num_send_wrs = 0;	/* UD SENDs posted (requests + responses) */
 	size_t stat_num_cresps = 0;	/* Number of COALESCED responses */
 
 	size_t tot_cycles_poll_recv_cq = 0;
 	size_t tot_cycles_post_recv = 0, stat_num_recvs = 0;
 
 	size_t stat_wasted_poll_cq = 0;
+	size_t stat_send_stalls = 0;	/* Waits for SEND completions while posting */
+	size_t stat_send_backlog = 0;	/* SENDs queued behind a closed window */
+	size_t stat_hold_copies = 0;	/* Zero-copy responses copied over the cap */
+	size_t stat_num_shm_msgs = 0;	/* Messages sent over SHM rings */
+	size_t stat_shm_ring_full = 0;	/* Messages dropped at a full SHM ring */
+	size_t stat_num_frags = 0;	/* Fragments sent */
+	size_t stat_reasm_restarts = 0;	/* Reassemblies restarted due to loss */
+	size_t stat_num_retx = 0;	/* Retransmitted coalesced requests */
+	size_t stat_dup_reqs = 0;	/* Duplicate coalesced requests received */
+	size_t stat_stale_resps = 0;	/* Duplicate or late responses dropped */
+	size_t stat_credit_waits = 0;	/* Coalesced requests that waited */
+	size_t stat_num_packed = 0;	/* Coalesced messages sent in packed pkts */
+	size_t stat_batch_calls = 0;	/* Batch handler invocations */
+	size_t stat_batch_reqs = 0;	/* Requests given to batch handlers */
+
+	// Latency histograms (see RPC_COLLECT_LAT_HIST)
+	double tsc_ghz;	/* TSC cycles per ns */
+	size_t batch_start_tsc[RPC_MAX_BATCH];	/* When each batch was sent */
+	rpc_lat_hist_t lat_batch;	/* RTT of slave request batches */
+	rpc_lat_hist_t lat_mn[HOTS_MAX_MACHINES];	/* RTT of coalesced requests */
+	rpc_lat_hist_t lat_req_type[RPC_MAX_REQ_TYPE];	/* RTT of requests */
+	rpc_lat_hist_t lat_handler[RPC_MAX_REQ_TYPE];	/* Handler time at responder */
 
 public:
 	Rpc(struct rpc_args);
 	void register_rpc_handler(int req_type,
 		size_t (*func)(uint8_t* resp_buf, rpc_resptype_t *resp_type,
 			const uint8_t* req_buf, size_t req_len, void *arg),
-		void *arg);
+		void *arg, int flags = 0);
+	void register_batch_handler(int req_type,
+		void (*func)(rpc_batch_req_t *reqs, int num_reqs, void *arg),
+		size_t max_resp_len, void *arg, int flags = 0);
+	void register_prefetch_handler(int req_type,
+		void (*func)(const uint8_t *req_buf, size_t req_len, void *arg));
 	int required_recvs();	/* Number of RECVs needed on each QP */
 	~Rpc();
 
+	// Deferred responses
+	int defer_resp();	/* Called by a handler; returns a token */
+	uint8_t* get_deferred_resp_buf(int token);
+	void complete_deferred_resp(int token, rpc_resptype_t resp_type);
+
 	// Datapath
 	int send_reqs(int coro_id);	/* Used by slave coro to send queued requests */
+	void send_oneway_reqs(int coro_id);	/* Send the one-way batch; no yield */
+	void send_future(int coro_id, int fut);	/* Send future @fut; no yield */
 	int send_resps();	/* Used by master coroutine to flush queued responses */
 	coro_id_t* poll_comps();	/* Process RECVs; return completed coroutines */
 	void ld_check_packet_loss();
+	void retx_check_timeouts();
 
 
 	// Lockserver
 	void locksrv_loop(Lockserver *lockserver);
-	void locksrv_process_queue(Lockserver *lockserver);
 
 
 	// Accessors / debug / stats
@@ -116,32 +304,228 @@ public:
 	coro_id_t *get_next_coro_arr();
 	size_t get_stat_num_reqs();
 	size_t get_stat_num_creqs();
+	size_t get_stat_num_local_reqs();
 	double get_max_batch_latency_us();
 	void reset_max_batch_latency();
 	void print_stats();
 
+	// Latency histograms
+	const rpc_lat_hist_t* get_batch_lat_hist();
+	const rpc_lat_hist_t* get_machine_lat_hist(int mn);
+	const rpc_lat_hist_t* get_req_type_lat_hist(int req_type);
+	const rpc_lat_hist_t* get_handler_lat_hist(int req_type);
+	double cycles_to_us(size_t cycles);
+	void print_lat_stats();	/* Print non-empty histograms, then reset all */
+	void reset_lat_stats();
+
 	/* Clear the current message batch for this coroutine. */
 	forceinline void clear_req_batch(int coro_id)
 	{
 		rpc_dassert(coro_id >= 1 && coro_id < info.num_coro);
 
 		rpc_req_batch_t *req_batch = &req_batch_arr[coro_id];
+		release_resps(coro_id);
 		req_batch->clear();
 	}
 
+	/*
+	 * Release the RECV buffers that hold this coroutine's zero-copy responses.
+	 * The zero-copy @resp_buf's of its current batch are invalid after this.
+	 */
+	forceinline void release_resps(int coro_id)
+	{
+		rpc_dassert(coro_id >= 1 && coro_id < info.num_coro);
+		release_batch_resps(coro_id);
+	}
+
+	/* Release the RECV buffers held by request batch @batch_id */
+	forceinline void release_batch_resps(int batch_id)
+	{
+		rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
+		for(int i = 0; i < req_batch->num_held_recvs; i++) {
+			int recv_i = req_batch->held_recv[i];
+			rpc_dassert(recv_hold[recv_i] > 0);
+
+			recv_hold[recv_i]--;
+			if(recv_hold[recv_i] == 0) {
+				num_recvs_held--;
+			}
+		}
+
+		req_batch->num_held_recvs = 0;
+	}
+
 	forceinline rpc_req_t* start_new_req(coro_id_t coro_id,
 		rpc_reqtype_t req_type, int resp_mn, uint8_t *resp_buf,
 		size_t max_resp_len)
 	{
 		rpc_dassert(coro_id >= 0 && coro_id < info.num_coro);
-		rpc_dassert(req_type <= RPC_MAX_REQ_TYPE);
-		rpc_dassert(resp_mn >= 0 && resp_mn < info.num_machines);
+#if RPC_ENABLE_ZERO_COPY_RESP == 1
+		rpc_dassert(resp_buf == NULL || is_aligned(resp_buf, 8));
+#else
 		rpc_dassert(resp_buf != NULL && is_aligned(resp_buf, 8));
+#endif
 		rpc_dassert(max_resp_len > 0);
 
+		return add_req(coro_id, req_type, resp_mn, resp_buf, max_resp_len);
+	}
+
+	/*
+	 * Check if coroutine @coro_id can start a one-way batch, i.e., if all
+	 * requests of its previous one-way batch have been acknowledged.
+	 */
+	forceinline bool oneway_ready(coro_id_t coro_id)
+	{
+		rpc_dassert(coro_id >= 1 && coro_id < info.num_coro);
+		if(RPC_ENABLE_ONEWAY == 0 || !info.use_oneway) {
+			return false;
+		}
+
+		rpc_req_batch_t *req_batch = &req_batch_arr[coro_id + RPC_MAX_CORO];
+		return !oneway_sent[coro_id] ||
+			req_batch->num_reqs_done == req_batch->num_reqs;
+	}
+
+	/*
+	 * Start a request in coroutine @coro_id's one-way batch, which is sent
+	 * with send_oneway_reqs(). The request is delivered reliably, but its
+	 * response is discarded, so the request's handler must not fail in a way
+	 * that the requester needs to know about. Requires oneway_ready().
+	 */
+	forceinline rpc_req_t* start_new_oneway_req(coro_id_t coro_id,
+		rpc_reqtype_t req_type, int resp_mn)
+	{
+		rpc_dassert(oneway_ready(coro_id));
+
+		int batch_id = coro_id + RPC_MAX_CORO;
+		if(oneway_sent[coro_id]) {
+			/* The previous one-way batch is acknowledged; reuse its mbufs */
+			req_batch_arr[batch_id].clear();
+			oneway_sent[coro_id] = false;
+		}
+
+		/* Responses are dropped, or written to the one-way response mbufs */
+		return add_req(batch_id, req_type, resp_mn, NULL, info.max_msg_size);
+	}
+
+	/*
+	 * Futures let a coroutine have several request batches outstanding. It
+	 * fills future @fut with start_new_future_req(), sends it with
+	 * send_future() without yielding, and later waits for it with
+	 * wait_futures(). The future's responses are valid until clear_future(),
+	 * which must be called before the future is reused.
+	 */
+	forceinline int future_batch(coro_id_t coro_id, int fut)
+	{
+		rpc_dassert(coro_id >= 1 && coro_id < info.num_coro);
+		rpc_dassert(fut >= 0 && fut < info.num_futures);
+		return coro_id + RPC_FUTURE_SLOT(fut) * RPC_MAX_CORO;
+	}
+
+#if RPC_MAX_FUTURES > 0
+	forceinline rpc_req_t* start_new_future_req(coro_id_t coro_id, int fut,
+		rpc_reqtype_t req_type, int resp_mn, uint8_t *resp_buf,
+		size_t max_resp_len)
+	{
+		rpc_dassert(!future_sent[coro_id][fut]);
+#if RPC_ENABLE_ZERO_COPY_RESP == 1
+		rpc_dassert(resp_buf == NULL || is_aligned(resp_buf, 8));
+#else
+		rpc_dassert(resp_buf != NULL && is_aligned(resp_buf, 8));
+#endif
+		rpc_dassert(max_resp_len > 0);
+
+		return add_req(future_batch(coro_id, fut), req_type, resp_mn,
+			resp_buf, max_resp_len);
+	}
+
+	/* Check if all responses of the sent future @fut have arrived */
+	forceinline bool future_done(coro_id_t coro_id, int fut)
+	{
+		rpc_dassert(future_sent[coro_id][fut]);
+
+		rpc_req_batch_t *req_batch = &req_batch_arr[future_batch(coro_id, fut)];
+		return req_batch->num_reqs_done == req_batch->num_reqs;
+	}
+
+	/*
+	 * Check if all (@wait_all) or any of the futures in bitmask @fut_mask are
+	 * done. If not, record the wait and return true: the coroutine must then
+	 * yield, and poll_comps() returns it when the wait is over.
+	 */
+	forceinline bool wait_futures(coro_id_t coro_id, uint32_t fut_mask,
+		bool wait_all)
+	{
+		rpc_dassert(fut_mask != 0 && fut_mask < (1u << RPC_MAX_FUTURES));
+		if(futures_done(coro_id, fut_mask, wait_all)) {
+			return false;
+		}
+
+		fut_wait_mask[coro_id] = fut_mask;
+		fut_wait_all[coro_id] = wait_all;
+		return true;
+	}
+
+	/* Release the responses of the completed future @fut for reuse */
+	forceinline void clear_future(coro_id_t coro_id, int fut)
+	{
+		rpc_dassert(future_done(coro_id, fut));
+
+		int batch_id = future_batch(coro_id, fut);
+		release_batch_resps(batch_id);
+		req_batch_arr[batch_id].clear();
+		future_sent[coro_id][fut] = false;
+	}
+#endif
+
+	/*
+	 * Start a new response for a machine that sent @num_reqs coalesced requests
+	 * with immediate = @req_imm.
+	 */
+	forceinline hots_mbuf_t* start_new_resp(int req_mn,
+		int num_reqs, rpc_imm_int_t req_imm)
+	{
+		rpc_dassert(resp_batch.num_cresps < HRD_RQ_DEPTH);
+
+		/* Copy over the request's immediate + modify some fields */
+		union rpc_imm resp_imm;
+		resp_imm.int_rep = req_imm;
+		rpc_dassert(resp_imm.is_req == 1);
+		resp_imm.is_req = 0;	/* Convert to response type */
+		resp_imm.is_frag = 0;	/* send_resps() fragments it if needed */
+		resp_imm.mchn_id = info.machine_id;
+
+		/* Choose a fresh coalesced message */
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_batch.num_cresps];
+		cmsg->remote_mn = req_mn;
+		cmsg->num_centry = num_reqs;
+		cmsg->resp_imm = resp_imm.int_rep;
+
+		resp_batch.num_cresps++;
+
+		/* Sanity-check and return its response mbuf */
+		hots_mbuf_t *resp_mbuf = &cmsg->resp_mbuf;
+
+		rpc_dassert(resp_mbuf->is_valid());
+		rpc_dassert(resp_mbuf->length() == 0);
+
+		return resp_mbuf;
+	}
+
+	// Debug and statistics
+	static void initialize_dummy_args(struct rpc_args *args);
+
+private:
+	/* Start a new request in request batch @batch_id (see RPC_MAX_BATCH) */
+	forceinline rpc_req_t* add_req(int batch_id, rpc_reqtype_t req_type,
+		int resp_mn, uint8_t *resp_buf, size_t max_resp_len)
+	{
+		rpc_dassert(req_type <= RPC_MAX_REQ_TYPE);
+		rpc_dassert(resp_mn >= 0 && resp_mn < info.num_machines);
+
 		stat_num_reqs++;	/* Useful for apps so don't use rpc_stat_inc */
 
-		rpc_req_batch_t *req_batch = &req_batch_arr[coro_id];
+		rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
 		rpc_dassert(req_batch->num_reqs_done == 0);	/* Sanity check */
 
 		/* Start a fresh request */
@@ -151,6 +535,8 @@ public:
 		rpc_req_t *req = &req_batch->req_arr[_num_reqs];
 		req->resp_buf = resp_buf;
 		req->max_resp_len = max_resp_len;
+		req->zero_copy = (resp_buf == NULL);
+		req_batch->num_zero_copy += (resp_buf == NULL) ? 1 : 0;
 		req_batch->num_reqs++;
 
 		// Choose a coalesced message
@@ -180,6 +566,12 @@ public:
 		rpc_dassert(cmsg->num_centry < RPC_MAX_MSG_CORO);
 		cmsg->num_centry++;	/* Increment requests in coalesced message */
 
+#if RPC_ENABLE_LOCAL_REQS == 1
+		if(unlikely(rpc_handler_flags[req_type] & RPC_HANDLER_MAY_DEFER)) {
+			req_batch->may_defer_mask |= (1u << cmsg_i);
+		}
+#endif
+
 		/* Sanity-check the chosen coalesced message */
 		rpc_dassert(cmsg->req_mbuf.is_valid());
 		rpc_dassert(cmsg->resp_mbuf.is_valid());
@@ -200,55 +592,128 @@ public:
 		req->_cmsg_reqhdr = cmsg_hdr;
 		req->_cmsg_req_mbuf = &cmsg->req_mbuf;	/* For bookkeeping */
 
-		rpc_dprintf("Rpc: Worker %d, coro %d created %s request for machine %d. "
-			"Cmsg index = %d\n", info.wrkr_gid, coro_id,
+		rpc_dprintf("Rpc: Worker %d, batch %d created %s request for machine "
+			"%d. Cmsg index = %d\n", info.wrkr_gid, batch_id,
 			rpc_type_to_string(req_type).c_str(), resp_mn, cmsg_i);
 
 		return req;
 	}
 
 	/*
-	 * Start a new response for a machine that sent @num_reqs coalesced requests
-	 * with immediate = @req_imm.
+	 * Index of the remote request batch of a message from machine @mn with
+	 * immediate @imm, in resp_cache and req_reasm.
 	 */
-	forceinline hots_mbuf_t* start_new_resp(int req_mn,
-		int num_reqs, uint32_t req_imm)
+	forceinline int remote_batch(int mn, union rpc_imm imm)
 	{
-		rpc_dassert(resp_batch.num_cresps < HRD_RQ_DEPTH);
+		return (mn * info.num_coro + imm.coro_id) * RPC_BATCHES_PER_CORO +
+			imm.batch_slot;
+	}
 
-		/* Copy over the request's immediate + modify some fields */
-		union rpc_imm resp_imm;
-		resp_imm.int_rep = req_imm;
-		rpc_dassert(resp_imm.is_req == 1);
-		resp_imm.is_req = 0;	/* Convert to response type */
-		resp_imm.mchn_id = info.machine_id;
+#if RPC_MAX_FUTURES > 0
+	/* Check if all (@wait_all) or any of the futures in @fut_mask are done */
+	forceinline bool futures_done(coro_id_t coro_id, uint32_t fut_mask,
+		bool wait_all)
+	{
+		for(int fut = 0; fut < RPC_MAX_FUTURES; fut++) {
+			if((fut_mask & (1u << fut)) != 0 &&
+					future_done(coro_id, fut) != wait_all) {
+				return !wait_all;
+			}
+		}
 
-		/* Choose a fresh coalesced message */
-		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_batch.num_cresps];
-		cmsg->remote_mn = req_mn;
-		cmsg->num_centry = num_reqs;
-		cmsg->resp_imm = resp_imm.int_rep;
+		return wait_all;
+	}
+#endif
 
-		resp_batch.num_cresps++;
+	/*
+	 * Check if the completion of a request batch in slot @batch_slot of
+	 * coroutine @coro_id ends the coroutine's wait.
+	 */
+	forceinline bool batch_wakes_coro(coro_id_t coro_id, int batch_slot)
+	{
+		if(likely(batch_slot == 0)) {
+			return true;
+		}
 
-		/* Sanity-check and return its response mbuf */
-		hots_mbuf_t *resp_mbuf = &cmsg->resp_mbuf;
+#if RPC_MAX_FUTURES > 0
+		uint32_t fut_mask = fut_wait_mask[coro_id];
+		if(fut_mask != 0 &&
+				futures_done(coro_id, fut_mask, fut_wait_all[coro_id])) {
+			fut_wait_mask[coro_id] = 0;
+			return true;
+		}
+#endif
 
-		rpc_dassert(resp_mbuf->is_valid());
-		rpc_dassert(resp_mbuf->length() == 0);
+		return false;
+	}
 
-		return resp_mbuf;
+	forceinline int num_remote_batches()
+	{
+		return info.num_machines * info.num_coro * RPC_BATCHES_PER_CORO;
 	}
 
-	// Debug and statistics
-	static void initialize_dummy_args(struct rpc_args *args);
+	/*
+	 * Check if a response with immediate @imm is for a coalesced request of
+	 * the current batch that has not received a response yet. Responses to
+	 * retransmitted requests can arrive twice, or after the batch completes.
+	 */
+	forceinline bool is_resp_expected(union rpc_imm imm)
+	{
+		int batch_id = rpc_imm_batch(imm);
+		rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
+		int cmsg_i = req_batch->cmsg_for_mc[imm.mchn_id];
+
+		return imm.req_seq == req_seq[batch_id] &&
+			req_batch->num_reqs_done < req_batch->num_reqs && cmsg_i >= 0 &&
+			(req_batch->resp_rcvd_mask & (1u << cmsg_i)) == 0;
+	}
+
+	/* Number of packets needed to send a coalesced message of @len bytes */
+	forceinline int msg_pkts(size_t len)
+	{
+		if(likely(len <= info.max_pkt_size)) {
+			return 1;
+		}
+
+		return (int) ((len + frag_data_size - 1) / frag_data_size);
+	}
+
+	/* Request batches per slave coroutine that apps can have outstanding */
+	forceinline int batches_in_use()
+	{
+		return 1 + (info.use_oneway ? 1 : 0) + info.num_futures;
+	}
+
+	/*
+	 * Request packets allowed per remote machine. Like required_recvs(), this
+	 * assumes that all workers use the same number of coroutines and batches.
+	 */
+	forceinline int peer_credits()
+	{
+		/* 1 outstanding cmsg per machine per slave request batch */
+		int batches = (info.num_coro - 1) * batches_in_use();
+#if RPC_ENABLE_CREDITS == 1
+		return batches < RPC_MAX_CREDITS ? batches : RPC_MAX_CREDITS;
+#else
+		return batches;
+#endif
+	}
 
-private:
 	/*
-	 * Given a coalesced request with num_reqs items, prefetch the index for
-	 * MICA requests. Works for both GETs and PUTs.
+	 * Check if we have credits to send @num_pkts request packets to machine
+	 * @mn. A message that needs more than all credits can be sent when no
+	 * other requests are outstanding at @mn.
 	 */
-	inline void prefetch_mica(uint8_t *wc_buf, int num_reqs)
+	forceinline bool has_credits(int mn, int num_pkts)
+	{
+		return credits[mn] >= num_pkts || credits[mn] == peer_credits();
+	}
+
+	/*
+	 * Given a coalesced request with num_reqs items, invoke the prefetch
+	 * handler of each request that has one.
+	 */
+	inline void prefetch_reqs(uint8_t *wc_buf, int num_reqs)
 	{
 		size_t wc_off = 0;	/* Offset into wc_buf */
 		rpc_cmsg_reqhdr_t *cmsg_reqhdr;
@@ -258,30 +723,64 @@ private:
 			cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &wc_buf[wc_off];
 			rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
 			uint32_t req_type = cmsg_reqhdr->req_type;
-			uint32_t req_len = cmsg_reqhdr->size;
-
-			/* Special logic for prefetching MICA tables */
-			if(req_type >= RPC_MICA_REQ_BASE) {
-				ds_generic_get_req_t *req = (ds_generic_get_req_t *)
-					&wc_buf[wc_off + sizeof(rpc_cmsg_reqhdr_t)];
-				uint64_t keyhash = req->keyhash;
-				FixedTable *table = (FixedTable *) rpc_handler_arg[req_type];
-				table->prefetch_table(keyhash);
+			uint32_t req_len = cmsg_reqhdr->get_size();
+			wc_off += sizeof(rpc_cmsg_reqhdr_t);
+
+			if(rpc_prefetch_handler[req_type] != NULL) {
+				rpc_prefetch_handler[req_type](&wc_buf[wc_off], req_len,
+					rpc_handler_arg[req_type]);
 			}
 
 			/* Move to next coalesced message unconditionally */
-			wc_off += sizeof(rpc_cmsg_reqhdr_t) + req_len;
+			wc_off += req_len;
 		}
 	}
 
 	void check_defines();
 	void check_info();
 
+	void send_req_batch(int batch_id);
+	void send_req_cmsg(int batch_id, rpc_cmsg_t *cmsg);
+	void run_local_reqs(int batch_id, rpc_cmsg_t *cmsg);
+	void run_batch_reqs();
+	void hold_deferred_resps();
+	void send_deferred_resps();
+	rpc_cmsg_reqhdr_t* deferred_resp_hdr(int token);
+	static size_t locksrv_rpc_handler(uint8_t *resp_buf,
+		rpc_resptype_t *resp_type, const uint8_t *req_buf, size_t req_len,
+		void *_rpc);
+	void locksrv_process_queue();
+	void retransmit_reqs(int batch_id);
+	void send_credit_waits();
+	void send_packed_reqs();
+	void send_packed(int mn, rpc_pack_msg_t *msg_arr, int num_msgs);
+	void send_packed_resps(int *num_mn_resps, int *mn_list, int num_mn,
+		bool can_pack);
+	void ud_backlog_send(int mn, const uint8_t *buf, size_t len,
+		rpc_imm_int_t imm);
+	void drain_send_backlog(int qp);
+	rpc_imm_int_t req_imm(int batch_id, rpc_cmsg_t *cmsg);
+	void process_msg(union rpc_imm wc_imm, uint8_t *wc_buf, size_t wc_len,
+		struct ibv_wc *recv_wc, int *cur_comp_coro);
+	void cache_resp(int req_mn, union rpc_imm imm, hots_mbuf_t *resp_mbuf);
+
+	/* Fragmentation and reassembly of messages larger than max_pkt_size */
+	void send_frags(int mn, const uint8_t *msg, size_t msg_len,
+		rpc_imm_int_t imm);
+	uint8_t* reassemble_frag(union rpc_imm imm, const uint8_t *frag_buf,
+		size_t frag_len, size_t *msg_len);
+
 	void check_imm(union rpc_imm imm);
 	void check_coalesced_msg(uint8_t *cbuf, int num_centry);
 	
+	size_t mbuf_step();
+	size_t mbuf_space();
+	size_t recv_buf_step();
+	size_t ext_hdr_space();
+
 	void init_non_zero_members();
 	void init_coroutine_metadata();
+	void init_shm_transport();
 
 	/* Initialize unchanging fields of wr's for performance */
 	void init_send_wrs();
@@ -322,6 +821,41 @@ private:
 		HRD_MOD_ADD(recv_head, HRD_RQ_DEPTH);	/* 1 step */
 	}
 
+#if RPC_ENABLE_SRQ == 1
+	struct hrd_srq_blk* srq_get(int port);
+	void srq_put(int port);
+
+	/* Queue the RECV buffer of UD RECV completion @recv_wc for reposting */
+	forceinline void srq_add_recv(struct ibv_wc *recv_wc)
+	{
+		rpc_dassert(srq_recvs_to_post < HRD_RQ_DEPTH);
+		struct ibv_sge *sgl = &srq_recv_sgl[srq_recvs_to_post];
+		sgl->addr = recv_wc->wr_id;	/* The wr_id of SRQ RECVs is the buffer */
+		sgl->length = recv_step;
+		sgl->lkey = cb->srq_blk->buf_mr->lkey;
+
+		srq_recv_wr[srq_recvs_to_post].wr_id = recv_wc->wr_id;
+		srq_recvs_to_post++;
+	}
+
+	/* Repost the RECVs queued by srq_add_recv() to the SRQ in one chain */
+	inline void srq_post_recvs()
+	{
+		rpc_dassert(srq_recvs_to_post > 0);
+		struct ibv_recv_wr *bad_wr;
+
+		int last_wr_i = srq_recvs_to_post - 1;
+		srq_recv_wr[last_wr_i].next = NULL;	/* Break the chain */
+		int ret = ibv_post_srq_recv(cb->srq_blk->srq, &srq_recv_wr[0], &bad_wr);
+		CPE(ret, "Rpc: ibv_post_srq_recv error", ret);
+
+		if(last_wr_i < HRD_RQ_DEPTH - 1) {
+			srq_recv_wr[last_wr_i].next = &srq_recv_wr[last_wr_i + 1];
+		}
+		srq_recvs_to_post = 0;
+	}
+#endif
+
 	inline void post_recvs_fast(int num_recvs)
 	{
 		fast_recv_used = true;
@@ -338,28 +872,306 @@ private:
 
 		int ret = ibv_post_recv(cb->dgram_qp[0], NULL, &bad_wr);
 		CPE(ret, "Rpc: Fast post recv: ibv_post_recv error", ret);
+
+		/* The driver posts RECVs in ring order, like post_recvs() */
+		recv_head = (recv_head + num_recvs) % HRD_RQ_DEPTH;
+	}
+
+	/* Number of RECVs that can be reposted, given the held RECV buffers */
+	forceinline int postable_recvs()
+	{
+		if(likely(num_recvs_held == 0)) {
+			return recvs_to_post;
+		}
+
+		int num_postable = 0;
+		int recv_i = recv_head;
+		while(num_postable < recvs_to_post && recv_hold[recv_i] == 0) {
+			num_postable++;
+			HRD_MOD_ADD(recv_i, HRD_RQ_DEPTH);
+		}
+
+		return num_postable;
+	}
+
+	/* Index of the RECV buffer that a UD RECV completion with @wr_id used */
+	forceinline int recv_index(uint64_t wr_id)
+	{
+		uint64_t recv_base = (uint64_t) &rpc_buf[64 - HOTS_GRH_BYTES];
+		rpc_dassert(wr_id >= recv_base && (wr_id - recv_base) % recv_step == 0);
+
+		int recv_i = (int) ((wr_id - recv_base) / recv_step);
+		rpc_dassert(recv_i >= 0 && recv_i < HRD_RQ_DEPTH);
+		return recv_i;
 	}
 
 	/*
-	 * 1. Compute work request flag based on QP window status and size.
-	 * 2. If QP unsignaling window is full, poll the QP for 1 completion.
+	 * Assemble a UD SEND of @len bytes at @buf to machine @mn. The SEND is
+	 * posted when a postlist's worth of wr's is assembled, or on the next
+	 * ud_flush_sends(). If the active QP's signaling window is closed, the
+	 * SEND is copied to the QP's backlog instead, so @buf can be reused.
 	 */
-	forceinline uint32_t set_flags(int qp, size_t size)
+	forceinline void ud_enqueue_send(int mn, uint8_t *buf, size_t len,
+		rpc_imm_int_t imm)
 	{
-		uint32_t flag = (nb_pending[qp] == 0) ? IBV_SEND_SIGNALED : 0;
+		int qp = active_qp;
+		if(unlikely(backlog_head[qp] != backlog_tail[qp] ||
+				send_window_closed(qp))) {
+			ud_backlog_send(mn, buf, len, imm);
+			return;
+		}
+
+		ud_assemble_send(mn, buf, len, imm);
+		if(send_wr_i == info.postlist) {
+			ud_flush_sends();
+		}
+	}
 
-		flag |= (size <= HRD_MAX_INLINE ? IBV_SEND_INLINE : 0);
+	/* True if the next SEND on @qp would have to wait for a SEND completion */
+	forceinline bool send_window_closed(int qp)
+	{
+		return nb_pending[qp] == 0 && signaled_pending[qp];
+	}
 
-		if(nb_pending[qp] == RPC_UNSIG_BATCH - 1) {
-			hrd_poll_cq(cb->dgram_send_cq[qp], 1, wc);
-			nb_pending[qp] = 0;
+	/* Assemble a UD SEND on the active QP, whose window must be open */
+	forceinline void ud_assemble_send(int mn, uint8_t *buf, size_t len,
+		rpc_imm_int_t imm)
+	{
+		int wr_i = send_wr_i;
+		rpc_dassert(wr_i >= 0 && wr_i < info.postlist);
+		rpc_dassert(len <= info.max_pkt_size);
+
+		/* Verify constant @sgl and @wr fields */
+		struct ibv_sge *sgl = &send_sgl[wr_i * RPC_SEND_SGES];
+		rpc_dassert(sgl[0].lkey == lkey);
+		rpc_dassert(send_wr[wr_i].next == &send_wr[wr_i + 1]); /* +1 is valid */
+		rpc_dassert(send_wr[wr_i].wr.ud.remote_qkey == HRD_DEFAULT_QKEY);
+		rpc_dassert(send_wr[wr_i].opcode == IBV_WR_SEND_WITH_IMM);
+		rpc_dassert(send_wr[wr_i].sg_list == sgl);
+
+		/* Encode variable fields */
+		sgl[0].addr = (uint64_t) buf;
+		sgl[0].length = len;
+
+		send_wr[wr_i].wr.ud.ah = ah[mn];
+		send_wr[wr_i].wr.ud.remote_qpn = rem_qpn[mn];
+		send_wr[wr_i].wr_id = send_seq[active_qp];	/* For signaled SENDs */
+
+#if HOTS_ENABLE_EXT_HDR == 1
+		/* Fields that do not fit in the immediate go in a trailer SGE */
+		rpc_ext_hdr_t *ext_hdr = &ext_hdr_buf[active_qp * HRD_SQ_DEPTH +
+			send_seq[active_qp] % HRD_SQ_DEPTH];
+
+		union rpc_imm _imm;
+		_imm.int_rep = imm;
+		union rpc_wire_imm wire_imm = rpc_imm_to_wire(_imm, ext_hdr);
+		if(unlikely(wire_imm.is_ext == 1)) {
+			sgl[1].addr = (uint64_t) ext_hdr;
+			sgl[1].length = RPC_EXT_HDR_BYTES;
+			send_wr[wr_i].num_sge = 2;
 		} else {
-			nb_pending[qp]++;
+			send_wr[wr_i].num_sge = 1;
+		}
+
+		send_wr[wr_i].imm_data = wire_imm.int_rep;
+#else
+		rpc_dassert(send_wr[wr_i].num_sge == 1);
+		send_wr[wr_i].imm_data = imm;
+#endif
+		send_wr[wr_i].send_flags = set_flags(active_qp, len);
+		send_wr_i++;
+	}
+
+	/* Post all assembled UD SENDs with one ibv_post_send() */
+	forceinline void ud_flush_sends()
+	{
+		int wr_i = send_wr_i;	/* Total number of messages assembled */
+		if(wr_i == 0) {
+			return;
+		}
+
+		rpc_dassert(wr_i > 0 && wr_i <= RPC_MAX_POSTLIST);
+		send_wr[wr_i - 1].next = NULL;	/* Breaker of chains */
+
+		struct ibv_send_wr *bad_wr;
+		int ret = ibv_post_send(cb->dgram_qp[active_qp], &send_wr[0], &bad_wr);
+		rpc_dassert_msg(ret == 0, "Rpc: ibv_post_send error\n");
+		rpc_stat_inc(stat_resp_post_send_calls, 1);
+		rpc_stat_inc(stat_num_send_wrs, wr_i);
+
+		/* Reset */
+		send_wr[wr_i - 1].next = &send_wr[wr_i]; /* Restore chain; safe. */
+		send_wr_i = 0;	/* Reset to start of wr array */
+
+		HRD_MOD_ADD(active_qp, info.num_qps);
+	}
+
+	/* Copy a message to the SHM ring to machine @mn, which is on this host */
+	forceinline void shm_send(int mn, uint8_t *buf, size_t len,
+		rpc_imm_int_t imm)
+	{
+		rpc_dassert(is_shm_peer[mn] && shm_tx_ring[mn] != NULL);
+		rpc_stat_inc(stat_num_shm_msgs, 1);
+
+#if HOTS_ENABLE_EXT_HDR == 1
+		/* Slots are formatted like UD packets, so convert the immediate */
+		rpc_ext_hdr_t ext_hdr;
+		union rpc_imm _imm;
+		_imm.int_rep = imm;
+		union rpc_wire_imm wire_imm = rpc_imm_to_wire(_imm, &ext_hdr);
+		bool success = rpc_shm_ring_push(shm_tx_ring[mn], wire_imm.int_rep,
+			buf, len, wire_imm.is_ext == 1 ? &ext_hdr : NULL);
+#else
+		bool success = rpc_shm_ring_push(shm_tx_ring[mn], imm, buf, len);
+#endif
+		if(unlikely(!success)) {
+			/* Like a UD drop at a RECV queue without RECVs */
+			stat_shm_ring_full++;
+		}
+	}
+
+	/*
+	 * Get a spare buffer for a non-inline SEND. check_defines() sizes the pool
+	 * so that this never runs out; we can't wait for SEND completions here
+	 * because the caller may have unposted SENDs.
+	 */
+	forceinline uint8_t* get_spare_buf()
+	{
+		if(unlikely(resp_batch.num_free_bufs == 0)) {
+			reap_send_comps();
+			reclaim_resp_bufs();
+			if(unlikely(resp_batch.num_free_bufs == 0)) {
+				printf("Rpc: Error. Worker %d: Out of spare SEND buffers.\n",
+					info.wrkr_gid);
+				exit(-1);
+			}
+		}
+
+		resp_batch.num_free_bufs--;
+		return resp_batch.free_bufs[resp_batch.num_free_bufs];
+	}
+
+	/*
+	 * Put @buf, which is about to be sent non-inline on the active QP, on the
+	 * busy list. It becomes spare once the SEND completes.
+	 */
+	forceinline void retire_busy_buf(uint8_t *buf)
+	{
+		int qp = active_qp;
+		rpc_dassert(busy_tail[qp] - busy_head[qp] < HRD_RQ_DEPTH);
+		rpc_busy_buf_t *busy = &busy_buf[qp][busy_tail[qp] % HRD_RQ_DEPTH];
+		busy->buf = buf;
+		busy->send_seq = send_seq[qp];	/* The SEND is not assembled yet */
+		busy_tail[qp]++;
+	}
+
+	/*
+	 * Move the buffer of @resp_mbuf, which is about to be sent non-inline on
+	 * the active QP, to the busy list, and give @resp_mbuf a spare buffer.
+	 */
+	forceinline void swap_resp_buf(hots_mbuf_t *resp_mbuf)
+	{
+		uint8_t *spare_buf = get_spare_buf();
+		retire_busy_buf(resp_mbuf->alloc_buf);
+		resp_mbuf->alloc_with_buf(spare_buf, resp_mbuf->alloc_len);
+	}
+
+	/* Return buffers of completed non-inline SENDs to the spare list */
+	inline void reclaim_resp_bufs()
+	{
+		for(int qp = 0; qp < info.num_qps; qp++) {
+			while(busy_head[qp] != busy_tail[qp]) {
+				size_t busy_i = busy_head[qp] % HRD_RQ_DEPTH;
+				rpc_busy_buf_t *busy = &busy_buf[qp][busy_i];
+				if(busy->send_seq >= send_seq_done[qp]) {
+					break;
+				}
+
+				rpc_dassert(resp_batch.num_free_bufs < HRD_RQ_DEPTH);
+				resp_batch.free_bufs[resp_batch.num_free_bufs] = busy->buf;
+				resp_batch.num_free_bufs++;
+				busy_head[qp]++;
+			}
 		}
+	}
 
+	/*
+	 * Compute the work request flags of the next SEND on @qp. The first SEND
+	 * of every RPC_UNSIG_BATCH SENDs is signaled. Completions are reaped by
+	 * the master loop. If the previous window's signaled SEND is not reaped
+	 * when the next window starts, the window is closed and SENDs go to the
+	 * QP's backlog. So a QP has fewer than 2 * RPC_UNSIG_BATCH SENDs that are
+	 * not known to be complete.
+	 */
+	forceinline uint32_t set_flags(int qp, size_t size)
+	{
+		rpc_dassert(!send_window_closed(qp));	/* Never waits */
+
+		uint32_t flag = 0;
+		if(nb_pending[qp] == 0) {
+			flag = IBV_SEND_SIGNALED;
+			signaled_seq[qp] = send_seq[qp];
+			signaled_pending[qp] = true;
+		}
+
+		flag |= (size <= RPC_MAX_INLINE ? IBV_SEND_INLINE : 0);
+		HRD_MOD_ADD(nb_pending[qp], RPC_UNSIG_BATCH);
+
+		send_seq[qp]++;
 		return flag;
 	}
 
+	/*
+	 * Reap the SEND completions of all QPs without blocking. A signaled SEND's
+	 * completion completes all SENDs before it on its QP.
+	 */
+	forceinline void reap_send_comps()
+	{
+#if RPC_SHM_ONLY == 0
+		for(int qp = 0; qp < info.num_qps; qp++) {
+			if(!signaled_pending[qp]) {
+				continue;
+			}
+
+			int comps = ibv_poll_cq(cb->dgram_send_cq[qp], 1, send_wc);
+			rpc_dassert(comps >= 0);
+			if(comps > 0) {
+				complete_signaled_send(qp);
+			}
+		}
+#endif
+	}
+
+	/* Block until the pending signaled SEND on @qp completes */
+	inline void wait_send_comp(int qp)
+	{
+		rpc_dassert(signaled_pending[qp]);
+		stat_send_stalls++;
+
+		int comps;
+		do {
+			comps = ibv_poll_cq(cb->dgram_send_cq[qp], 1, send_wc);
+		} while(comps == 0);
+
+		rpc_dassert(comps == 1);
+		complete_signaled_send(qp);
+	}
+
+	/* Retire @qp's signaled SEND, whose completion is in @send_wc */
+	forceinline void complete_signaled_send(int qp)
+	{
+		/* A failed SEND breaks the QP, so check even without debug asserts */
+		if(unlikely(send_wc[0].status != IBV_WC_SUCCESS)) {
+			printf("Rpc: Error. Worker %d: SEND on QP %d failed with status "
+				"%d.\n", info.wrkr_gid, qp, (int) send_wc[0].status);
+			exit(-1);
+		}
+
+		rpc_dassert(send_wc[0].wr_id == signaled_seq[qp]);
+		send_seq_done[qp] = send_wc[0].wr_id + 1;
+		signaled_pending[qp] = false;
+	}
+
 };
 
 #endif /* RPC_H */
@@ -12,16 +12,68 @@ int Rpc::send_reqs(int coro_id)
 #endif
 
 	rpc_dassert(coro_id > 0 && coro_id < info.num_coro);
+	send_req_batch(coro_id);
 
+#if RPC_ENABLE_LOCAL_REQS == 1
+	/*
+	 * If all requests were local, no response will arrive for this batch. The
+	 * slave still yields, so have the next poll_comps() return it.
+	 */
 	rpc_req_batch_t *req_batch = &req_batch_arr[coro_id];
+	if(req_batch->num_reqs_done == req_batch->num_reqs) {
+		rpc_dassert(num_local_done < RPC_MAX_CORO);
+		local_done_coro[num_local_done] = coro_id;
+		num_local_done++;
+	}
+#endif
+	
+	return 0;	/* Success, even though we don't have a fail case */
+}
+
+/*
+ * Send the one-way batch of coroutine @coro_id. The coroutine does not yield
+ * for it: the batch's responses are consumed by poll_comps(), and the batch
+ * is cleared by the next start_new_oneway_req().
+ */
+void Rpc::send_oneway_reqs(int coro_id)
+{
+	rpc_dassert(RPC_ENABLE_ONEWAY == 1);
+	rpc_dassert(coro_id > 0 && coro_id < info.num_coro);
+	rpc_dassert(!oneway_sent[coro_id]);
+
+	send_req_batch(coro_id + RPC_MAX_CORO);
+	oneway_sent[coro_id] = true;
+}
+
+/*
+ * Send future @fut of coroutine @coro_id. The coroutine does not yield for
+ * it, and waits for its responses with wait_futures().
+ */
+void Rpc::send_future(int coro_id, int fut)
+{
+#if RPC_MAX_FUTURES > 0
+	rpc_dassert(!future_sent[coro_id][fut]);
+
+	send_req_batch(future_batch(coro_id, fut));
+	future_sent[coro_id][fut] = true;
+#else
+	_unused(coro_id);
+	_unused(fut);
+	rpc_dassert(false);
+#endif
+}
+
+/* Send the coalesced requests of request batch @batch_id */
+void Rpc::send_req_batch(int batch_id)
+{
+	rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
 
 	int num_uniq_mn = req_batch->num_uniq_mn;
 	rpc_dassert(num_uniq_mn >= 1 && num_uniq_mn <= RPC_MAX_MSG_CORO);
-	stat_num_creqs += num_uniq_mn;
+	batch_start_tsc[batch_id] = rpc_lat_cycles();
 
-	/* Bookkeeping */
-	int wr_i = 0;
-	struct ibv_send_wr *bad_wr;
+	/* Responses to this batch's older requests are ignored from now on */
+	req_seq[batch_id] = (req_seq[batch_id] + 1) & ((1 << RPC_REQ_SEQ_BITS) - 1);
 
 	for(int msg_i = 0; msg_i < num_uniq_mn; msg_i++) {
 		rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[msg_i];
@@ -30,60 +82,413 @@ int Rpc::send_reqs(int coro_id)
 #endif
 		int resp_mn = cmsg->remote_mn;
 
-		/* Verify constant @sgl and @wr fields */
-		rpc_dassert(send_sgl[wr_i].lkey == lkey);
-		rpc_dassert(send_wr[wr_i].next == &send_wr[wr_i + 1]); /* +1 is valid */
-		rpc_dassert(send_wr[wr_i].wr.ud.remote_qkey == HRD_DEFAULT_QKEY);
-		rpc_dassert(send_wr[wr_i].opcode == IBV_WR_SEND_WITH_IMM);
-		rpc_dassert(send_wr[wr_i].num_sge == 1);
-		rpc_dassert(send_wr[wr_i].sg_list == &send_sgl[wr_i]);
-
-		/* Encode variable fields */
-		send_sgl[wr_i].length = cmsg->req_mbuf.length();
-		rpc_dassert(send_sgl[wr_i].length <= info.max_pkt_size);
-		send_sgl[wr_i].addr = (uint64_t) cmsg->req_mbuf.alloc_buf;
-
-		send_wr[wr_i].wr.ud.ah = ah[resp_mn];
-		send_wr[wr_i].wr.ud.remote_qpn = rem_qpn[resp_mn];
-		send_wr[wr_i].send_flags = set_flags(active_qp, send_sgl[wr_i].length);
-
-		/* Encode immediate */
-		union rpc_imm imm;
-		imm.is_req = 1;
-		imm.num_reqs = cmsg->num_centry;
-		imm.mchn_id = info.machine_id;	/* This machine's ID */
-		imm.coro_id = coro_id;
-		imm.config_id = 0;	/* XXX */
-		check_imm(imm);	/* Sanity check other fields */
-
-		send_wr[wr_i].imm_data = imm.int_rep;	/* Copy int representation */
-
-		rpc_dprintf("Rpc: Worker %d, coro %d sending request (batch) to "
-			"machine %d via QP %d, size = %d\n",
-			info.wrkr_gid, coro_id, resp_mn, active_qp, send_sgl[wr_i].length);
-
-		wr_i++;
-
-		/* Actually send requests. @wr_i = total number of messages assembled */
-		if(wr_i == info.postlist || msg_i == num_uniq_mn - 1) {
-			rpc_dassert(wr_i > 0 && wr_i <= RPC_MAX_POSTLIST); /* Need > 0 */
-			send_wr[wr_i - 1].next = NULL;	/* Breaker of chains */
-
-			int ret = ibv_post_send(cb->dgram_qp[active_qp],
-				&send_wr[0], &bad_wr);
-			rpc_dassert_msg(ret == 0, "Rpc: ibv_post_send error\n");
-			rpc_stat_inc(stat_resp_post_send_calls, 1);
-
-			/* Reset */
-			send_wr[wr_i - 1].next = &send_wr[wr_i]; /* Restore chain; safe. */
-			wr_i = 0;	/* Reset to start of wr array */
+#if RPC_ENABLE_LOCAL_REQS == 1
+		/* Handlers that may defer their response need the master coroutine */
+		if(resp_mn == info.machine_id &&
+				(req_batch->may_defer_mask & (1u << msg_i)) == 0) {
+			run_local_reqs(batch_id, cmsg);
+			continue;
+		}
+#endif
 
-			HRD_MOD_ADD(active_qp, info.num_qps);
-			/* XXX: Should we calculate post_send() postlist stats here */
+		stat_num_creqs++;
+
+		/* Forget any partial response from a previous use of this cmsg */
+		resp_reasm[batch_id][msg_i].reset();
+
+#if RPC_ENABLE_CREDITS == 1
+		int num_pkts = msg_pkts(cmsg->req_mbuf.length());
+		bool waits = (credit_wait_head[resp_mn] != credit_wait_tail[resp_mn]);
+		if(unlikely(waits || !has_credits(resp_mn, num_pkts))) {
+			/* Send it from poll_comps() when responses return credits */
+			size_t tail = credit_wait_tail[resp_mn];
+			rpc_dassert(tail - credit_wait_head[resp_mn] < RPC_MAX_BATCH);
+			rpc_cmsg_ref_t *wait =
+				&credit_wait[resp_mn][tail % RPC_MAX_BATCH];
+			wait->batch_id = batch_id;
+			wait->msg_i = msg_i;
+			credit_wait_tail[resp_mn]++;
+
+			num_credit_waits++;
+			req_batch->credit_wait_mask |= (1u << msg_i);
+			rpc_stat_inc(stat_credit_waits, 1);
+			continue;
 		}
+
+		credits[resp_mn] -= num_pkts;
+		req_batch->credits_used[msg_i] = num_pkts;
+#endif
+
+#if RPC_ENABLE_REQ_PACKING == 1
+		if(cmsg->req_mbuf.length() <= info.max_pkt_size) {
+			/* The master packs and sends it in poll_comps() */
+			if(num_pack_req[resp_mn] == 0) {
+				pack_mn_list[num_pack_mn] = resp_mn;
+				num_pack_mn++;
+			}
+
+			rpc_dassert(num_pack_req[resp_mn] < RPC_MAX_BATCH);
+			rpc_cmsg_ref_t *ref = &pack_req[resp_mn][num_pack_req[resp_mn]];
+			ref->batch_id = batch_id;
+			ref->msg_i = msg_i;
+			num_pack_req[resp_mn]++;
+			continue;
+		}
+#endif
+
+		send_req_cmsg(batch_id, cmsg);
 	}
-	
-	return 0;	/* Success, even though we don't have a fail case */
+
+#if RPC_ENABLE_DOORBELL_BATCHING == 0
+	ud_flush_sends();	/* Post any SENDs left over from the postlist */
+#endif
+
+#if RPC_ENABLE_RETX == 1
+	/* Arm the retransmission timer if we are waiting for any response */
+	retx_armed[batch_id] = (req_batch->num_reqs_done < req_batch->num_reqs);
+	retx_start_ms[batch_id] = retx_now_ms;
+#endif
+}
+
+/*
+ * Send (or resend) the coalesced request @cmsg of request batch @batch_id.
+ * The caller must flush the UD SENDs.
+ */
+void Rpc::send_req_cmsg(int batch_id, rpc_cmsg_t *cmsg)
+{
+	int resp_mn = cmsg->remote_mn;
+	size_t req_len = cmsg->req_mbuf.length();
+	rpc_dassert(req_len <= info.max_msg_size);
+
+	union rpc_imm imm;
+	imm.int_rep = req_imm(batch_id, cmsg);
+
+	rpc_dprintf("Rpc: Worker %d, batch %d sending request (batch) to "
+		"machine %d via %s, size = %lu\n", info.wrkr_gid, batch_id, resp_mn,
+		is_shm_peer[resp_mn] ? "SHM" : "UD", req_len);
+
+	if(unlikely(req_len > info.max_pkt_size)) {
+		send_frags(resp_mn, cmsg->req_mbuf.alloc_buf, req_len, imm.int_rep);
+		return;
+	}
+
+#if RPC_ENABLE_SHM_TRANSPORT == 1
+	if(is_shm_peer[resp_mn]) {
+		shm_send(resp_mn, cmsg->req_mbuf.alloc_buf, req_len, imm.int_rep);
+		return;
+	}
+#endif
+
+	ud_enqueue_send(resp_mn, cmsg->req_mbuf.alloc_buf, req_len, imm.int_rep);
+}
+
+/* Immediate for the coalesced request @cmsg of request batch @batch_id */
+rpc_imm_int_t Rpc::req_imm(int batch_id, rpc_cmsg_t *cmsg)
+{
+	union rpc_imm imm;
+	imm.int_rep = 0;
+	imm.is_req = 1;
+	imm.num_reqs = cmsg->num_centry;
+	imm.mchn_id = info.machine_id;	/* This machine's ID */
+	imm.coro_id = batch_id % RPC_MAX_CORO;
+	imm.batch_slot = batch_id / RPC_MAX_CORO;
+	imm.config_id = 0;	/* XXX */
+	imm.req_seq = req_seq[batch_id];
+	check_imm(imm);	/* Sanity check other fields */
+
+	return imm.int_rep;
+}
+
+/*
+ * Send the small coalesced requests that slaves queued for packing, with as
+ * many as possible per packet for each machine.
+ */
+void Rpc::send_packed_reqs()
+{
+	for(int i = 0; i < num_pack_mn; i++) {
+		int mn = pack_mn_list[i];
+		int num_msgs = num_pack_req[mn];
+		rpc_dassert(num_msgs > 0);
+
+		for(int msg_i = 0; msg_i < num_msgs; msg_i++) {
+			rpc_cmsg_ref_t *ref = &pack_req[mn][msg_i];
+			rpc_req_batch_t *req_batch = &req_batch_arr[ref->batch_id];
+			rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[ref->msg_i];
+			rpc_dassert(cmsg->remote_mn == mn);
+
+			rpc_pack_msg_t *msg = &pack_msg_arr[msg_i];
+			msg->buf = cmsg->req_mbuf.alloc_buf;
+			msg->len = cmsg->req_mbuf.length();
+			msg->imm = req_imm(ref->batch_id, cmsg);
+			msg->resp_mbuf = NULL;	/* Request mbufs are not reused early */
+		}
+
+		send_packed(mn, pack_msg_arr, num_msgs);
+
+#if RPC_ENABLE_CREDITS == 1
+		/* A packed packet uses one RECV: refund the credits of the others */
+		for(int msg_i = 0; msg_i < num_msgs; msg_i++) {
+			if(pack_msg_arr[msg_i].pkt_lead) {
+				continue;
+			}
+
+			rpc_cmsg_ref_t *ref = &pack_req[mn][msg_i];
+			rpc_req_batch_t *req_batch = &req_batch_arr[ref->batch_id];
+			rpc_dassert(req_batch->credits_used[ref->msg_i] == 1);
+			req_batch->credits_used[ref->msg_i] = 0;
+			credits[mn]++;
+		}
+#endif
+
+		num_pack_req[mn] = 0;
+	}
+
+	num_pack_mn = 0;
+}
+
+/*
+ * Send @num_msgs coalesced messages of the same type to machine @mn. Runs of
+ * messages that fit in a packet are copied into one packed packet; the rest
+ * are sent as usual. Messages must not need fragmentation.
+ */
+void Rpc::send_packed(int mn, rpc_pack_msg_t *msg_arr, int num_msgs)
+{
+	bool use_shm = (RPC_ENABLE_SHM_TRANSPORT == 1 && is_shm_peer[mn]);
+
+	int msg_i = 0;
+	while(msg_i < num_msgs) {
+		/* Find the messages that fit in the next packet */
+		size_t pkt_len = 0;
+		int num_in_pkt = 0;
+		while(msg_i + num_in_pkt < num_msgs &&
+				num_in_pkt < RPC_MAX_MSG_CORO) {
+			rpc_pack_msg_t *msg = &msg_arr[msg_i + num_in_pkt];
+			size_t len = sizeof(rpc_pack_hdr_t) + msg->len;
+			if(pkt_len + len > info.max_pkt_size) {
+				break;
+			}
+
+			pkt_len += len;
+			num_in_pkt++;
+		}
+
+		if(num_in_pkt <= 1) {
+			/* Not worth packing: send this message by itself */
+			rpc_pack_msg_t *msg = &msg_arr[msg_i];
+			rpc_dassert(msg->len <= info.max_pkt_size);
+			msg->pkt_lead = true;
+			msg_i++;
+
+			if(use_shm) {
+				shm_send(mn, msg->buf, msg->len, msg->imm);
+				continue;
+			}
+
+			if(msg->resp_mbuf != NULL && msg->len > RPC_MAX_INLINE) {
+				swap_resp_buf(msg->resp_mbuf);	/* @msg->buf is retired */
+			}
+
+			ud_enqueue_send(mn, msg->buf, msg->len, msg->imm);
+			continue;
+		}
+
+		/* Copy the messages into a packed packet */
+		uint8_t *pkt_buf = use_shm ? shm_stage_buf : get_spare_buf();
+		union rpc_imm pkt_imm;
+		pkt_imm.int_rep = 0;
+		pkt_imm.is_packed = 1;
+		pkt_imm.num_reqs = num_in_pkt;
+		pkt_imm.mchn_id = info.machine_id;
+
+		size_t pkt_off = 0;
+		for(int i = 0; i < num_in_pkt; i++) {
+			rpc_pack_msg_t *msg = &msg_arr[msg_i + i];
+			msg->pkt_lead = (i == 0);
+
+			union rpc_imm msg_imm;
+			msg_imm.int_rep = msg->imm;
+			rpc_dassert(i == 0 || msg_imm.is_req == pkt_imm.is_req);
+			pkt_imm.is_req = msg_imm.is_req;
+
+			rpc_pack_hdr_t *pack_hdr = (rpc_pack_hdr_t *) &pkt_buf[pkt_off];
+			pack_hdr->imm = msg->imm;
+			pack_hdr->len = msg->len;
+			pkt_off += sizeof(rpc_pack_hdr_t);
+
+			rte_memcpy(&pkt_buf[pkt_off], msg->buf, msg->len);
+			pkt_off += msg->len;
+		}
+
+		rpc_dassert(pkt_off == pkt_len);
+		rpc_stat_inc(stat_num_packed, num_in_pkt);
+		msg_i += num_in_pkt;
+
+		if(use_shm) {
+			shm_send(mn, pkt_buf, pkt_len, pkt_imm.int_rep);
+		} else {
+			retire_busy_buf(pkt_buf);
+			ud_enqueue_send(mn, pkt_buf, pkt_len, pkt_imm.int_rep);
+		}
+	}
+}
+
+/*
+ * Resend the coalesced requests of request batch @batch_id that have not
+ * received a response. Request mbufs are not reused until the coroutine
+ * clears the batch, so they still hold the requests.
+ */
+void Rpc::retransmit_reqs(int batch_id)
+{
+	rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
+	rpc_dassert(req_batch->num_reqs_done < req_batch->num_reqs);
+
+	for(int msg_i = 0; msg_i < req_batch->num_uniq_mn; msg_i++) {
+		rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[msg_i];
+		uint32_t skip_mask =
+			req_batch->resp_rcvd_mask | req_batch->credit_wait_mask;
+		if((skip_mask & (1u << msg_i)) != 0 ||
+				cmsg->remote_mn == info.machine_id) {
+			continue;	/* Local requests complete in send_reqs() */
+		}
+
+		stat_num_retx++;
+		send_req_cmsg(batch_id, cmsg);
+	}
+
+	ud_flush_sends();
+}
+
+/*
+ * Send coalesced requests that were waiting for credits, in FIFO order per
+ * remote machine, until credits run out again.
+ */
+void Rpc::send_credit_waits()
+{
+	for(int mn = 0; mn < info.num_machines; mn++) {
+		while(credit_wait_head[mn] != credit_wait_tail[mn]) {
+			rpc_cmsg_ref_t *wait =
+				&credit_wait[mn][credit_wait_head[mn] % RPC_MAX_BATCH];
+			rpc_req_batch_t *req_batch = &req_batch_arr[wait->batch_id];
+			rpc_cmsg_t *cmsg = &req_batch->cmsg_arr[wait->msg_i];
+			rpc_dassert(cmsg->remote_mn == mn);
+
+			int num_pkts = msg_pkts(cmsg->req_mbuf.length());
+			if(!has_credits(mn, num_pkts)) {
+				break;
+			}
+
+			credits[mn] -= num_pkts;
+			req_batch->credits_used[wait->msg_i] = num_pkts;
+			credit_wait_head[mn]++;
+			num_credit_waits--;
+			req_batch->credit_wait_mask &= ~(1u << wait->msg_i);
+
+			send_req_cmsg(wait->batch_id, cmsg);
+#if RPC_ENABLE_RETX == 1
+			/* Time out from now, not from when the request was queued */
+			retx_start_ms[wait->batch_id] = retx_now_ms;
+#endif
+		}
+	}
+
+	ud_flush_sends();
+}
+
+/*
+ * Save the coalesced response in @resp_mbuf, which answers the request with
+ * immediate @imm from machine @req_mn, for duplicate requests. Only needed
+ * for requests with non-idempotent types.
+ */
+void Rpc::cache_resp(int req_mn, union rpc_imm imm, hots_mbuf_t *resp_mbuf)
+{
+	rpc_resp_cache_t *cache = &resp_cache[remote_batch(req_mn, imm)];
+	if(unlikely(cache->buf == NULL)) {
+		cache->buf = (uint8_t *) memalign(64, info.max_msg_size);
+		assert(cache->buf != NULL);
+	}
+
+	cache->len = resp_mbuf->length();
+	rte_memcpy(cache->buf, resp_mbuf->alloc_buf, cache->len);
+	cache->req_seq = imm.req_seq;
+	cache->valid = true;
+}
+
+/*
+ * Run the requests in the coalesced message @cmsg, which is destined to this
+ * machine, and write the responses directly to the user's response buffers.
+ * This does what the master coroutine would do on receiving @cmsg from
+ * ourselves, except for coalescing and sending a response.
+ */
+void Rpc::run_local_reqs(int batch_id, rpc_cmsg_t *cmsg)
+{
+	rpc_req_batch_t *req_batch = &req_batch_arr[batch_id];
+	uint8_t *req_buf = cmsg->req_mbuf.alloc_buf;
+	size_t req_off = 0;	/* Offset into req_buf */
+
+	for(int i = 0; i < cmsg->num_centry; i++) {
+		rpc_dassert(is_aligned(req_off, sizeof(rpc_cmsg_reqhdr_t)));
+
+		/* Unmarshal the request header */
+		rpc_cmsg_reqhdr_t *cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &req_buf[req_off];
+		rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
+		uint32_t req_type = cmsg_reqhdr->req_type;
+		uint32_t req_len = cmsg_reqhdr->get_size();
+		req_off += sizeof(rpc_cmsg_reqhdr_t);
+
+		rpc_req_t *req = &req_batch->req_arr[cmsg_reqhdr->coro_seqnum];
+
+		rpc_dprintf("Rpc: Worker %d, batch %d running %s request locally. "
+			"Size = %u\n", info.wrkr_gid, batch_id,
+			rpc_type_to_string(req_type).c_str(), req_len);
+
+		/* Zero-copy requests get a response in this message's response mbuf */
+		if(req->zero_copy) {
+			req->resp_buf = cmsg->resp_mbuf.cur_buf;
+		}
+
+		/* Invoke the handler */
+		size_t resp_len;
+		size_t _handler_start = rpc_lat_cycles();
+#if RPC_ENABLE_BATCH_HANDLERS == 1
+		if(rpc_batch_handler[req_type] != NULL) {
+			/* A batch of one: local requests are run right away */
+			rpc_batch_req_t batch_req;
+			batch_req.req_buf = &req_buf[req_off];
+			batch_req.req_len = req_len;
+			batch_req.resp_buf = req->resp_buf;
+			rpc_batch_handler[req_type](&batch_req, 1,
+				rpc_handler_arg[req_type]);
+
+			req->resp_type = batch_req.resp_type;
+			resp_len = batch_req.resp_len;
+		} else
+#endif
+		{
+			rpc_dassert(rpc_handler[req_type] != NULL);
+			resp_len = rpc_handler[req_type](req->resp_buf, &req->resp_type,
+				&req_buf[req_off], req_len, rpc_handler_arg[req_type]);
+		}
+
+		rpc_lat_record(lat_handler[req_type],
+			rpc_lat_cycles() - _handler_start, 1);
+
+		rpc_dassert(is_aligned(resp_len, sizeof(uint64_t)));
+		rpc_dassert(req->max_resp_len >= resp_len);
+		req->resp_len = resp_len;
+
+		if(req->zero_copy) {
+			cmsg->resp_mbuf.cur_buf += resp_len;
+			rpc_dassert(cmsg->resp_mbuf.length() <= cmsg->resp_mbuf.alloc_len);
+		}
+
+		req_off += req_len;
+	}
+
+	rpc_dassert(req_off == cmsg->req_mbuf.length());
+
+	req_batch->num_reqs_done += cmsg->num_centry;
+	stat_num_local_reqs += cmsg->num_centry;
+	ld_num_resps_ever[batch_id] += cmsg->num_centry;
 }
 
 /*
@@ -100,75 +505,355 @@ int Rpc::send_resps()
 	rpc_dassert(num_cresps >= 1 && num_cresps <= HRD_RQ_DEPTH);	/* RECV bound */
 	rpc_stat_inc(stat_num_cresps, num_cresps);
 
-	struct ibv_send_wr *bad_wr;
-
-	/* Bookkeeping */
-	int wr_i = 0;
+#if RPC_ENABLE_RESP_PACKING == 1
+	/* Machines with > 1 response in this batch, and their response counts */
+	int num_mn_resps[HOTS_MAX_MACHINES] = {0};
+	int mn_list[HOTS_MAX_MACHINES];
+	int num_mn = 0;
+	bool can_pack = false;
+#endif
 
 	for(int resp_i = 0; resp_i < num_cresps; resp_i++) {
-		/* Verify constant fields */
-		rpc_dassert(send_sgl[wr_i].lkey == lkey);
-		rpc_dassert(send_wr[wr_i].next == &send_wr[wr_i + 1]); /* +1 is valid */
-		rpc_dassert(send_wr[wr_i].wr.ud.remote_qkey == HRD_DEFAULT_QKEY);
-		rpc_dassert(send_wr[wr_i].opcode == IBV_WR_SEND_WITH_IMM);
-		rpc_dassert(send_wr[wr_i].num_sge == 1);
-		rpc_dassert(send_wr[wr_i].sg_list == &send_sgl[wr_i]);
-
 		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_i];
 #if RPC_DEBUG_ASSERT == 1
 		check_coalesced_msg(cmsg->resp_mbuf.alloc_buf, cmsg->num_centry);
 #endif
 
 		int req_mn = cmsg->remote_mn;
+		uint8_t *resp_buf = cmsg->resp_mbuf.alloc_buf;
+		size_t resp_len = cmsg->resp_mbuf.length();
+		rpc_dassert(resp_len <= info.max_msg_size);
 
-		/* Encode variable fields */
-		send_wr[wr_i].wr.ud.ah = ah[req_mn];
-		send_wr[wr_i].wr.ud.remote_qpn = rem_qpn[req_mn];
+		rpc_dprintf("Rpc: Worker %d sending resp (batch) to machine %d via "
+			"%s\n", info.wrkr_gid, req_mn, is_shm_peer[req_mn] ? "SHM" : "UD");
 
-		send_sgl[wr_i].addr = (uintptr_t) cmsg->resp_mbuf.alloc_buf;
-		send_sgl[wr_i].length = cmsg->resp_mbuf.length();
-		rpc_dassert(send_sgl[wr_i].length <= info.max_pkt_size);
+		if(unlikely(resp_len > info.max_pkt_size)) {
+			/* Fragments are copied out, so the mbuf can be reused */
+			send_frags(req_mn, resp_buf, resp_len, cmsg->resp_imm);
+			continue;
+		}
 
-		send_wr[wr_i].send_flags = set_flags(active_qp, send_sgl[wr_i].length);
-		
-		if(send_sgl[wr_i].length > HRD_MAX_INLINE) {
-			rpc_dprintf("Worker %d: Response too large. Using non-inline buf\n",
-				info.wrkr_gid);
-			uint8_t *ni_buf =
-				resp_batch.non_inline_bufs[resp_batch.non_inline_index];
-			rte_memcpy((void *) ni_buf, (void *) send_sgl[wr_i].addr,
-				send_sgl[wr_i].length);
+#if RPC_ENABLE_RESP_PACKING == 1
+		/* Sent below, grouped by machine */
+		if(num_mn_resps[req_mn] == 0) {
+			mn_list[num_mn] = req_mn;
+			num_mn++;
+		} else {
+			can_pack = true;
+		}
+		num_mn_resps[req_mn]++;
+#else
+#if RPC_ENABLE_SHM_TRANSPORT == 1
+		if(is_shm_peer[req_mn]) {
+			/* The ring holds a copy, so no need for a non-inline buffer */
+			shm_send(req_mn, resp_buf, resp_len, cmsg->resp_imm);
+			continue;
+		}
+#endif
 
-			send_sgl[wr_i].addr = (uintptr_t) ni_buf;
-			HRD_MOD_ADD(resp_batch.non_inline_index, HRD_RQ_DEPTH);
+		if(resp_len > RPC_MAX_INLINE) {
+			/*
+			 * The NIC reads @resp_buf after ibv_post_send() returns, and the
+			 * cmsg's mbuf will be reused in the next round. Send @resp_buf
+			 * without copying and give the cmsg a spare buffer.
+			 */
+			rpc_dprintf("Worker %d: Response too large. Sending non-inline\n",
+				info.wrkr_gid);
+			swap_resp_buf(&cmsg->resp_mbuf);
 		}
 
 		/* Insert pre-encoded immediate */
-		send_wr[wr_i].imm_data = cmsg->resp_imm;
-
-		rpc_dprintf("Rpc: Worker %d sending resp (batch) to machine %d via "
-			"QP %d\n", info.wrkr_gid, req_mn, active_qp);
+		ud_enqueue_send(req_mn, resp_buf, resp_len, cmsg->resp_imm);
+#endif
+	}
 
-		wr_i++;
-		/* wr_i = total number of requests assembled */
-		if(wr_i == info.postlist || resp_i == num_cresps - 1) {
-			rpc_dassert(wr_i > 0); /* If not, how did we get here? */
-			send_wr[wr_i - 1].next = NULL;
-			
-			int ret = ibv_post_send(cb->dgram_qp[active_qp],
-				&send_wr[0], &bad_wr);
-			rpc_dassert_msg(ret == 0, "Rpc: ibv_post_send error\n");
+#if RPC_ENABLE_RESP_PACKING == 1
+	if(num_mn > 0) {
+		send_packed_resps(num_mn_resps, mn_list, num_mn, can_pack);
+	}
+#endif
 
-			rpc_stat_inc(stat_resp_post_send_calls, 1);
+	ud_flush_sends();	/* Post any SENDs left over from the postlist */
 	
-			/* Reset */
-			send_wr[wr_i - 1].next = &send_wr[wr_i]; /* Restore chain; safe */
-			wr_i = 0;
+	return 0;	/* Success, even though we don't have a fail case */
+}
+
+/*
+ * Send the unfragmented responses in resp_batch to the @num_mn machines in
+ * @mn_list. Machine @mn gets @num_mn_resps[mn] responses, which are packed if
+ * @can_pack is set, i.e., if some machine gets more than one.
+ */
+void Rpc::send_packed_resps(int *num_mn_resps, int *mn_list, int num_mn,
+	bool can_pack)
+{
+	if(!can_pack) {
+		/* Common case: one response per machine, sent in resp_batch order */
+		for(int resp_i = 0; resp_i < resp_batch.num_cresps; resp_i++) {
+			rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_i];
+			if(cmsg->resp_mbuf.length() <= info.max_pkt_size) {
+				rpc_pack_msg_t *msg = &pack_msg_arr[0];
+				msg->buf = cmsg->resp_mbuf.alloc_buf;
+				msg->len = cmsg->resp_mbuf.length();
+				msg->imm = cmsg->resp_imm;
+				msg->resp_mbuf = &cmsg->resp_mbuf;
+				send_packed(cmsg->remote_mn, msg, 1);
+			}
+		}
+
+		return;
+	}
+
+	/* Sort the responses by machine into pack_msg_arr */
+	int mn_off[HOTS_MAX_MACHINES];
+	int off = 0;
+	for(int i = 0; i < num_mn; i++) {
+		mn_off[mn_list[i]] = off;
+		off += num_mn_resps[mn_list[i]];
+	}
+	rpc_dassert(off <= HRD_RQ_DEPTH);
+
+	for(int resp_i = 0; resp_i < resp_batch.num_cresps; resp_i++) {
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_i];
+		if(cmsg->resp_mbuf.length() > info.max_pkt_size) {
+			continue;	/* Already sent as fragments */
+		}
+
+		rpc_pack_msg_t *msg = &pack_msg_arr[mn_off[cmsg->remote_mn]];
+		msg->buf = cmsg->resp_mbuf.alloc_buf;
+		msg->len = cmsg->resp_mbuf.length();
+		msg->imm = cmsg->resp_imm;
+		msg->resp_mbuf = &cmsg->resp_mbuf;
+		mn_off[cmsg->remote_mn]++;
+	}
+
+	off = 0;
+	for(int i = 0; i < num_mn; i++) {
+		int mn = mn_list[i];
+		send_packed(mn, &pack_msg_arr[off], num_mn_resps[mn]);
+		off += num_mn_resps[mn];
+	}
+}
+
+/*
+ * Queue a SEND on the active QP, whose signaling window is closed or which
+ * already has queued SENDs, and move on to the next QP. If the backlog is
+ * full, wait for the window to open like set_flags() used to.
+ */
+void Rpc::ud_backlog_send(int mn, const uint8_t *buf, size_t len,
+	rpc_imm_int_t imm)
+{
+	int qp = active_qp;
+	rpc_dassert(len <= info.max_pkt_size);
+
+	if(unlikely(backlog_tail[qp] - backlog_head[qp] == RPC_SEND_BACKLOG)) {
+		ud_flush_sends();	/* SENDs assembled before the window closed */
+		if(send_window_closed(qp)) {
+			wait_send_comp(qp);
+		}
+		drain_send_backlog(qp);
+		rpc_dassert(backlog_tail[qp] - backlog_head[qp] < RPC_SEND_BACKLOG);
+	}
+
+	size_t slot = backlog_tail[qp] % RPC_SEND_BACKLOG;
+	rpc_backlog_send_t *entry = &send_backlog[qp][slot];
+	entry->mn = mn;
+	entry->len = len;
+	entry->imm = imm;
+	rte_memcpy(&backlog_buf[(qp * RPC_SEND_BACKLOG + slot) * backlog_step],
+		buf, len);
+
+	backlog_tail[qp]++;
+	stat_send_backlog++;
+
+	/* Don't queue the following SENDs behind this QP */
+	if(active_qp == qp) {
+		if(send_wr_i > 0) {
+			ud_flush_sends();	/* Rotates the active QP */
+		} else {
 			HRD_MOD_ADD(active_qp, info.num_qps);
 		}
 	}
-	
-	return 0;	/* Success, even though we don't have a fail case */
+}
+
+/*
+ * Post the SENDs queued on @qp for as long as its signaling window is open.
+ * Called by the master loop after reaping SEND completions.
+ */
+void Rpc::drain_send_backlog(int qp)
+{
+	if(backlog_head[qp] == backlog_tail[qp] || send_window_closed(qp)) {
+		return;
+	}
+
+	ud_flush_sends();	/* Post SENDs assembled for another QP */
+	int saved_active_qp = active_qp;
+	active_qp = qp;
+
+	size_t head = backlog_head[qp];
+	while(head != backlog_tail[qp] && !send_window_closed(qp)) {
+		size_t slot = head % RPC_SEND_BACKLOG;
+		rpc_backlog_send_t *entry = &send_backlog[qp][slot];
+		uint8_t *buf = &backlog_buf[(qp * RPC_SEND_BACKLOG + slot) * backlog_step];
+
+		if(entry->len > RPC_MAX_INLINE) {
+			/* The NIC reads non-inline data after posting: use a spare buffer */
+			uint8_t *spare_buf = get_spare_buf();
+			rte_memcpy(spare_buf, buf, entry->len);
+			retire_busy_buf(spare_buf);
+			buf = spare_buf;
+		}
+
+		ud_assemble_send(entry->mn, buf, entry->len, entry->imm);
+		head++;
+
+		if(send_wr_i == info.postlist) {
+			ud_flush_sends();
+			active_qp = qp;	/* Undo the rotation */
+		}
+	}
+
+	ud_flush_sends();
+	backlog_head[qp] = head;	/* Inline data is copied by now */
+	active_qp = saved_active_qp;
+}
+
+/*
+ * Send the coalesced message @msg, which is larger than max_pkt_size, to
+ * machine @mn as a sequence of fragments. Each fragment is copied to a spare
+ * buffer with an rpc_frag_hdr_t in front, so @msg can be reused right away.
+ * All fragments carry the message's immediate with @is_frag set.
+ */
+void Rpc::send_frags(int mn, const uint8_t *msg, size_t msg_len,
+	rpc_imm_int_t imm)
+{
+	rpc_dassert(msg_len > info.max_pkt_size && msg_len <= info.max_msg_size);
+
+	union rpc_imm frag_imm;
+	frag_imm.int_rep = imm;
+	frag_imm.is_frag = 1;
+
+	size_t num_frags = (msg_len + frag_data_size - 1) / frag_data_size;
+	rpc_dassert(num_frags > 1 && num_frags <= RPC_MAX_FRAGS);
+	rpc_stat_inc(stat_num_frags, num_frags);
+
+	for(size_t frag_i = 0; frag_i < num_frags; frag_i++) {
+		size_t frag_off = frag_i * frag_data_size;
+		size_t data_len = (msg_len - frag_off < frag_data_size) ?
+			msg_len - frag_off : frag_data_size;
+		size_t frag_len = sizeof(rpc_frag_hdr_t) + data_len;
+
+		/* The SHM ring copies the fragment, so one staging buffer suffices */
+		bool use_shm = (RPC_ENABLE_SHM_TRANSPORT == 1 && is_shm_peer[mn]);
+		uint8_t *frag_buf = use_shm ? shm_stage_buf : get_spare_buf();
+
+		rpc_frag_hdr_t *frag_hdr = (rpc_frag_hdr_t *) frag_buf;
+		frag_hdr->msg_len = msg_len;
+		frag_hdr->frag_off = frag_off;
+		frag_hdr->frag_idx = frag_i;
+		frag_hdr->num_frags = num_frags;
+		frag_hdr->reserved = 0;
+		rte_memcpy(&frag_buf[sizeof(rpc_frag_hdr_t)], &msg[frag_off],
+			data_len);
+
+		if(use_shm) {
+			shm_send(mn, frag_buf, frag_len, frag_imm.int_rep);
+		} else {
+			retire_busy_buf(frag_buf);
+			ud_enqueue_send(mn, frag_buf, frag_len, frag_imm.int_rep);
+		}
+	}
+}
+
+/*
+ * Copy a received fragment to its message's reassembly buffer. Requests are
+ * reassembled per remote request batch; responses are reassembled into the
+ * batch's response mbuf for the source machine. Return the reassembled
+ * message and set @msg_len if this was the last missing fragment, else NULL.
+ */
+uint8_t* Rpc::reassemble_frag(union rpc_imm imm, const uint8_t *frag_buf,
+	size_t frag_len, size_t *msg_len)
+{
+	rpc_frag_hdr_t *frag_hdr = (rpc_frag_hdr_t *) frag_buf;
+	size_t data_len = frag_len - sizeof(rpc_frag_hdr_t);
+	rpc_dassert(frag_len > sizeof(rpc_frag_hdr_t));
+	rpc_dassert(frag_hdr->msg_len <= info.max_msg_size);
+	rpc_dassert(frag_hdr->frag_off + data_len <= frag_hdr->msg_len);
+	rpc_dassert(frag_hdr->frag_idx < frag_hdr->num_frags &&
+		frag_hdr->num_frags <= RPC_MAX_FRAGS);
+
+	rpc_reasm_t *reasm;
+	if(imm.is_req == 1) {
+		rpc_dassert(req_reasm != NULL);
+		reasm = &req_reasm[remote_batch(imm.mchn_id, imm)];
+		if(reasm->buf == NULL) {
+			reasm->buf = (uint8_t *) memalign(64, info.max_msg_size);
+			assert(reasm->buf != NULL);
+			reasm->reset();
+		}
+	} else {
+		int batch_id = rpc_imm_batch(imm);
+		int cmsg_i = req_batch_arr[batch_id].cmsg_for_mc[imm.mchn_id];
+		rpc_dassert(cmsg_i >= 0 && cmsg_i < RPC_MAX_MSG_CORO);
+		reasm = &resp_reasm[batch_id][cmsg_i];
+	}
+
+	if(unlikely(reasm->req_seq != imm.req_seq)) {
+		/* A fragment of a newer message: the older one is not needed */
+		if(reasm->frags_rcvd != 0) {
+			stat_reasm_restarts++;
+		}
+
+		reasm->reset();
+		reasm->req_seq = imm.req_seq;
+	}
+
+	uint64_t frag_bit = 1ull << frag_hdr->frag_idx;
+	if(unlikely((reasm->frag_bitmap & frag_bit) != 0)) {
+		/*
+		 * A duplicate from a retransmission. Fragments of a message are
+		 * identical across retransmissions, so keep the one we have.
+		 */
+		return NULL;
+	}
+
+	rte_memcpy(&reasm->buf[frag_hdr->frag_off],
+		&frag_buf[sizeof(rpc_frag_hdr_t)], data_len);
+	reasm->frag_bitmap |= frag_bit;
+	reasm->frags_rcvd++;
+
+	if(reasm->frags_rcvd < frag_hdr->num_frags) {
+		return NULL;
+	}
+
+	reasm->reset();
+	*msg_len = frag_hdr->msg_len;
+	return reasm->buf;
+}
+
+/*
+ * Retransmit the outstanding requests of slave request batches that have
+ * waited for RPC_RETX_TIMEOUT_MS. Called every RPC_RETX_CHECK_STEP calls to
+ * poll_comps(), which also sets the coarse clock used to timestamp batches.
+ */
+void Rpc::retx_check_timeouts()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	retx_now_ms = (now.tv_sec - rpc_init_time.tv_sec) * 1000 +
+		(now.tv_nsec - rpc_init_time.tv_nsec) / 1000000;
+
+	for(int coro_i = 1; coro_i < info.num_coro; coro_i++) {
+		for(int b = 0; b < RPC_BATCHES_PER_CORO; b++) {
+			int batch_i = coro_i + b * RPC_MAX_CORO;
+			if(retx_armed[batch_i] &&
+					retx_now_ms - retx_start_ms[batch_i] >= RPC_RETX_TIMEOUT_MS) {
+				rpc_dprintf("Rpc: Worker %d retransmitting requests for "
+					"batch %d\n", info.wrkr_gid, batch_i);
+				retransmit_reqs(batch_i);
+				retx_start_ms[batch_i] = retx_now_ms;
+			}
+		}
+	}
 }
 
 void Rpc::ld_check_packet_loss()
@@ -221,6 +906,642 @@ void Rpc::ld_check_packet_loss()
 	}
 }
 
+/*
+ * Process the coalesced message @wc_buf of @wc_len bytes with immediate
+ * @wc_imm. @recv_wc is the message's UD RECV completion if it lies in a RECV
+ * buffer, else NULL. A completed slave coroutine is appended to the list that
+ * ends at @cur_comp_coro.
+ */
+forceinline void Rpc::process_msg(union rpc_imm wc_imm, uint8_t *wc_buf,
+	size_t wc_len, struct ibv_wc *recv_wc, int *cur_comp_coro)
+{
+	check_imm(wc_imm);
+
+	uint32_t _is_req = wc_imm.is_req;
+	uint32_t _num_reqs = wc_imm.num_reqs;	/* or number of resps */
+	uint32_t _mchn_id = wc_imm.mchn_id;	/* Remote machine's ID */
+	uint32_t _coro_id = wc_imm.coro_id;
+	uint32_t _config_id __attribute__((unused)) = wc_imm.config_id;
+
+	rpc_dassert(_mchn_id < (unsigned) info.num_machines);
+	rpc_dassert(_coro_id < (unsigned) info.num_coro);
+
+#if RPC_ENABLE_RETX == 1
+	if(_is_req == 0 && unlikely(!is_resp_expected(wc_imm))) {
+		/* A duplicate response to a retransmitted request, or a late one */
+		stat_stale_resps++;
+		return;
+	}
+#endif
+
+	/* Process a fragmented message only when it is complete */
+	if(unlikely(wc_imm.is_frag == 1)) {
+		wc_buf = reassemble_frag(wc_imm, wc_buf, wc_len, &wc_len);
+		if(wc_buf == NULL) {
+			return;
+		}
+	}
+
+#if RPC_DEBUG_ASSERT == 1
+	check_coalesced_msg(wc_buf, _num_reqs);
+#endif
+
+	if(_is_req == 0) {
+		// Handle a new response
+		rpc_dassert(_coro_id != RPC_MASTER_CORO_ID);
+
+		int _batch_id = rpc_imm_batch(wc_imm);
+		rpc_req_batch_t *req_batch = &req_batch_arr[_batch_id];
+		req_batch->num_reqs_done += _num_reqs;
+
+		int _cmsg_i = req_batch->cmsg_for_mc[_mchn_id];
+		req_batch->resp_rcvd_mask |= (1u << _cmsg_i);
+
+		/* Includes waits for credits and retransmissions */
+		size_t _rtt = rpc_lat_cycles() - batch_start_tsc[_batch_id];
+		rpc_lat_record(lat_mn[_mchn_id], _rtt, 1);
+
+#if RPC_ENABLE_CREDITS == 1
+		/* The response returns the credits used by the request */
+		credits[_mchn_id] += req_batch->credits_used[_cmsg_i];
+		req_batch->credits_used[_cmsg_i] = 0;
+		rpc_dassert(credits[_mchn_id] <= peer_credits());
+#endif
+
+		bool _batch_done = (req_batch->num_reqs_done == req_batch->num_reqs);
+		if(_batch_done) {
+			retx_armed[_batch_id] = false;
+			rpc_lat_record(lat_batch, _rtt, 1);
+		}
+
+#if RPC_ENABLE_ONEWAY == 1
+		if(unlikely(wc_imm.batch_slot == RPC_ONEWAY_SLOT)) {
+			/* The response only acknowledges the one-way batch */
+			return;
+		}
+#endif
+
+		if(_batch_done && batch_wakes_coro(_coro_id, wc_imm.batch_slot)) {
+			/* Record completed coroutine */
+			rpc_dprintf("Rpc: Worker %d received all responses "
+				"for coroutine %d\n", info.wrkr_gid, _coro_id);
+
+			next_coro[*cur_comp_coro] = _coro_id;
+			*cur_comp_coro = _coro_id;
+
+#if RPC_MSR_MAX_BATCH_LATENCY == 1
+			/*
+			 * Save the latency of the completed batch if it exceeds the
+			 * current maximum batch latency for this coroutine.
+			 */
+			struct timespec *_mbl_start = &max_batch_lat_start[_coro_id];
+			struct timespec _mbl_end;
+			clock_gettime(CLOCK_REALTIME, &_mbl_end);
+			double _mbl_usec =
+				(_mbl_end.tv_sec - _mbl_start->tv_sec) * 1000000 +
+				(double) (_mbl_end.tv_nsec - _mbl_start->tv_nsec) / 1000;
+
+			if(_mbl_usec > max_batch_lat_coro[_coro_id]) {
+				max_batch_lat_coro[_coro_id] = _mbl_usec;
+			}
+#endif
+		}
+
+#if RPC_ENABLE_ZERO_COPY_RESP == 1
+		if(req_batch->num_zero_copy > 0) {
+			int cmsg_i = req_batch->cmsg_for_mc[_mchn_id];
+			rpc_dassert(cmsg_i >= 0 && cmsg_i < RPC_MAX_MSG_CORO);
+			hots_mbuf_t *resp_mbuf = &req_batch->cmsg_arr[cmsg_i].resp_mbuf;
+
+			/*
+			 * Keep the RECV buffer until the coroutine releases it, unless
+			 * that would hold too many buffers or RECVs are already waiting
+			 * to be reposted behind held ones.
+			 */
+			int recv_i = -1;
+			if(recv_wc != NULL && wc_imm.is_frag == 0) {
+				recv_i = recv_index(recv_wc->wr_id);
+				if(recv_hold[recv_i] == 0 && (num_recvs_held >= recv_hold_max ||
+						recvs_to_post >= recv_slack)) {
+					stat_hold_copies++;
+					recv_i = -1;
+				}
+			}
+
+			if(recv_i >= 0) {
+				if(recv_hold[recv_i] == 0) {
+					num_recvs_held++;
+				}
+				recv_hold[recv_i]++;
+
+				rpc_dassert(req_batch->num_held_recvs < RPC_MAX_MSG_CORO);
+				req_batch->held_recv[req_batch->num_held_recvs] = recv_i;
+				req_batch->num_held_recvs++;
+			} else if(wc_buf != resp_mbuf->alloc_buf) {
+				/*
+				 * SHM ring slots are released at the end of poll_comps(),
+				 * and RECVs over the cap are reposted, so move the response
+				 * to this machine's response mbuf. Reassembled responses
+				 * are already there.
+				 */
+				rpc_dassert(wc_len <= resp_mbuf->alloc_len);
+
+				rte_memcpy(resp_mbuf->alloc_buf, wc_buf, wc_len);
+				wc_buf = resp_mbuf->alloc_buf;
+			}
+		}
+#endif
+
+		/* Fill in the slave coroutines's response buffers */
+		size_t wc_off = 0;	/* Byte index into the coalesced resp */
+		rpc_cmsg_reqhdr_t *cmsg_reqhdr;
+		for(int i = 0; i < (int) _num_reqs; i++) {
+			rpc_dassert(is_aligned(wc_off, sizeof(rpc_cmsg_reqhdr_t)));
+			cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &wc_buf[wc_off];
+
+			rpc_dprintf("Rpc: Worker %d received %s response from "
+				"machine %d. Size = %u (coalesced size = %lu)\n",
+				info.wrkr_gid,
+				rpc_type_to_string(cmsg_reqhdr->resp_type).c_str(),
+				_mchn_id, (unsigned) cmsg_reqhdr->get_size(), wc_len);
+
+			/* Unmarshal the request header */
+			rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
+			int _coro_seqnum = cmsg_reqhdr->coro_seqnum;
+			rpc_dassert(_coro_seqnum >= 0 &&
+				_coro_seqnum <= req_batch->num_reqs);
+
+			/* Copy the response data to the user's buffer */
+			rpc_req_t *req = &req_batch->req_arr[_coro_seqnum];
+			size_t resp_len = cmsg_reqhdr->get_size();
+			rpc_dassert(req->max_resp_len >= resp_len);
+			uint8_t *resp_data = &wc_buf[wc_off + sizeof(rpc_cmsg_reqhdr_t)];
+			if(req->zero_copy) {
+				req->resp_buf = resp_data;
+			} else {
+				rte_memcpy(req->resp_buf, resp_data, resp_len);
+			}
+
+			/* Copy response metadata */
+			req->resp_len = resp_len;
+			req->resp_type = cmsg_reqhdr->resp_type;
+			rpc_lat_record(lat_req_type[req->_cmsg_reqhdr->req_type], _rtt, 1);
+
+			wc_off += sizeof(rpc_cmsg_reqhdr_t) + resp_len;
+		}
+		rpc_dassert(wc_off == wc_len);
+
+		/* Record coroutine progress for packet loss detection */
+		ld_num_resps_ever[_coro_id] += _num_reqs;
+	} else {
+		// Handle a new request
+		rpc_dassert(wc_len > 0);	/* Requests cannot be 0-byte */
+
+#if RPC_ENABLE_RETX == 1
+		rpc_resp_cache_t *cache = &resp_cache[remote_batch(_mchn_id, wc_imm)];
+		if(unlikely(cache->valid &&
+				!rpc_req_seq_newer(wc_imm.req_seq, cache->req_seq))) {
+			/*
+			 * A retransmitted request that we have already handled. If it
+			 * was for the latest batch, resend the cached response, or run
+			 * the requests again if they are all idempotent. Older batches
+			 * have already completed at the requester.
+			 */
+			stat_dup_reqs++;
+			if(wc_imm.req_seq != cache->req_seq || cache->pending) {
+				return;
+			}
+
+			if(cache->non_idempotent) {
+				hots_mbuf_t *resp_mbuf = start_new_resp(_mchn_id,
+					_num_reqs, wc_imm.int_rep);
+				rte_memcpy(resp_mbuf->cur_buf, cache->buf, cache->len);
+				resp_mbuf->cur_buf += cache->len;
+				return;
+			}
+		}
+
+		bool non_idempotent = false;	/* Cache the response if set */
+#endif
+
+#if RPC_ENABLE_BATCH_HANDLERS == 1
+		/* Keep all of this message's batched requests in one run */
+		if(unlikely(num_batch_ent + (int) _num_reqs > RPC_MAX_BATCH_REQS)) {
+			run_batch_reqs();
+		}
+		int num_batched = 0;	/* Requests of this message given to batch_ent */
+#endif
+
+		/* Initialize a new RPC message for the master */
+		int resp_cmsg_i = resp_batch.num_cresps;	/* The response started below */
+		hots_mbuf_t *resp_mbuf = start_new_resp(_mchn_id, _num_reqs,
+			wc_imm.int_rep); /* Converts req Imm to response Imm */
+
+		/* Process the requests */
+		size_t wc_off = 0;	/* Offset into wc_buf */
+		rpc_cmsg_reqhdr_t *cmsg_reqhdr;
+
+		for(int i = 0; i < (int) _num_reqs; i++) {
+			rpc_dassert(is_aligned(wc_off, sizeof(rpc_cmsg_reqhdr_t)));
+			rpc_dassert(is_aligned(resp_mbuf->cur_buf,
+				sizeof(rpc_cmsg_reqhdr_t)));
+
+			/* Unmarshal the request header */
+			cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &wc_buf[wc_off];
+			rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
+			uint32_t req_type = cmsg_reqhdr->req_type;
+			uint32_t req_len = cmsg_reqhdr->get_size();
+#if RPC_ENABLE_RETX == 1
+			non_idempotent |=
+				(rpc_handler_flags[req_type] & RPC_HANDLER_NON_IDEMPOTENT) != 0;
+#endif
+
+			rpc_dprintf("Rpc: Worker %d received %s req from machine %d. "
+				"Size = %u (coalesced size = %lu, %d reqs)\n",
+				info.wrkr_gid,
+				rpc_type_to_string(cmsg_reqhdr->req_type).c_str(),
+				_mchn_id, req_len, wc_len, (int) _num_reqs);
+
+			/* Copy the request header to the response */
+			rpc_cmsg_reqhdr_t *cmsg_resphdr = (rpc_cmsg_reqhdr_t *)
+				resp_mbuf->cur_buf;
+			*((uint64_t *) cmsg_resphdr) = *(uint64_t *) cmsg_reqhdr;
+			resp_mbuf->cur_buf += sizeof(rpc_cmsg_reqhdr_t);
+			wc_off += sizeof(rpc_cmsg_reqhdr_t);
+
+#if RPC_ENABLE_BATCH_HANDLERS == 1
+			if(rpc_batch_handler[req_type] != NULL) {
+				/* Reserve the response slot; run_batch_reqs() fills it */
+				rpc_dassert(num_batch_ent < RPC_MAX_BATCH_REQS);
+				rpc_batch_ent_t *ent = &batch_ent[num_batch_ent];
+				ent->req_hdr = cmsg_reqhdr;
+				ent->resp_hdr = cmsg_resphdr;
+				num_batch_ent++;
+				num_batched++;
+
+				if(!batch_type_used[req_type]) {
+					batch_type_used[req_type] = true;
+					batch_type_list[num_batch_types] = req_type;
+					num_batch_types++;
+				}
+
+				size_t max_resp_len = rpc_batch_max_resp_len[req_type];
+				cmsg_resphdr->set_size(max_resp_len);
+				wc_off += req_len;
+				resp_mbuf->cur_buf += max_resp_len;
+				rpc_dassert(resp_mbuf->length() <= resp_mbuf->alloc_len);
+				continue;
+			}
+#endif
+
+			/* Invoke the handler, which may defer its response */
+			rpc_dassert(rpc_handler[req_type] != NULL);
+			defer_seqnum = cmsg_reqhdr->coro_seqnum;
+			size_t _handler_start = rpc_lat_cycles();
+			size_t resp_len = rpc_handler[req_type](
+				resp_mbuf->cur_buf, &cmsg_resphdr->resp_type,
+				&wc_buf[wc_off], req_len, rpc_handler_arg[req_type]);
+			rpc_lat_record(lat_handler[req_type],
+				rpc_lat_cycles() - _handler_start, 1);
+			defer_seqnum = -1;
+			cmsg_resphdr->set_size(resp_len);	/* cmsg_resphdr is valid */
+
+			rpc_dassert(is_aligned(resp_len, sizeof(uint64_t)));
+
+			wc_off += req_len;
+			resp_mbuf->cur_buf += resp_len;
+			
+			/* Ensure that we don't overflow the response buffer */
+			rpc_dassert(resp_mbuf->length() <= resp_mbuf->alloc_len);
+		}
+
+		rpc_dassert(wc_off == wc_len);
+
+#if RPC_ENABLE_RETX == 1
+		/* Remember the request to detect duplicates */
+		cache->valid = true;
+		cache->pending = false;
+		cache->non_idempotent = non_idempotent;
+		cache->req_seq = wc_imm.req_seq;
+#endif
+
+		if(unlikely(defer_slot >= 0)) {
+			/* Hold the response back; it is moved out of resp_batch later */
+			rpc_dassert(deferred_arr[defer_slot].resp_i == resp_cmsg_i);
+			deferred_new[num_deferred_new] = defer_slot;
+			num_deferred_new++;
+			defer_slot = -1;
+
+#if RPC_ENABLE_RETX == 1
+			cache->pending = true;
+			cache->deferred = true;
+#endif
+		}
+
+#if RPC_ENABLE_BATCH_HANDLERS == 1
+		if(num_batched > 0) {
+			/* run_batch_reqs() completes and caches the response */
+			rpc_dassert(num_batch_cmsg < HRD_RQ_DEPTH);
+			batch_cmsg_list[num_batch_cmsg] = resp_cmsg_i;
+			num_batch_cmsg++;
+#if RPC_ENABLE_RETX == 1
+			cache->pending = true;
+#endif
+			return;
+		}
+#endif
+
+#if RPC_ENABLE_RETX == 1
+		if(non_idempotent && !cache->pending) {
+			cache_resp(_mchn_id, wc_imm, resp_mbuf);
+		}
+#endif
+	}
+}
+
+/*
+ * Defer the response to the request whose handler is running. The handler
+ * must return the exact length of the response, and may write some of it
+ * now. The response is completed later with complete_deferred_resp(), e.g.,
+ * from the master coroutine or from another request's handler. Only
+ * handlers registered with RPC_HANDLER_MAY_DEFER can defer.
+ */
+int Rpc::defer_resp()
+{
+	if(unlikely(defer_seqnum < 0)) {
+		printf("Rpc: Error. Worker %d: Response deferred outside a handler "
+			"run by poll_comps(). Was the handler registered with "
+			"RPC_HANDLER_MAY_DEFER?\n", info.wrkr_gid);
+		exit(-1);
+	}
+
+	if(defer_slot == -1) {
+		/* The first deferred response in this coalesced response */
+		if(unlikely(num_deferred_free == 0)) {
+			printf("Rpc: Error. Worker %d: Too many deferred responses.\n",
+				info.wrkr_gid);
+			exit(-1);
+		}
+
+		num_deferred_free--;
+		defer_slot = deferred_free[num_deferred_free];
+
+		int resp_i = resp_batch.num_cresps - 1;
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_i];
+		rpc_deferred_t *dfr = &deferred_arr[defer_slot];
+		dfr->msg = cmsg->resp_mbuf.alloc_buf;
+		dfr->resp_i = resp_i;
+		dfr->remote_mn = cmsg->remote_mn;
+		dfr->resp_imm = cmsg->resp_imm;
+		dfr->num_centry = cmsg->num_centry;
+		dfr->num_pending = 0;
+	}
+
+	deferred_arr[defer_slot].num_pending++;
+	int token = defer_slot * RPC_MAX_MSG_CORO + defer_seqnum;
+	defer_seqnum = -1;	/* A request can defer only once */
+	return token;
+}
+
+/* The header of deferred response @token in its coalesced response */
+rpc_cmsg_reqhdr_t* Rpc::deferred_resp_hdr(int token)
+{
+	int slot = token / RPC_MAX_MSG_CORO;
+	int coro_seqnum = token % RPC_MAX_MSG_CORO;
+	rpc_dassert(slot >= 0 && slot < RPC_MAX_DEFERRED);
+
+	rpc_deferred_t *dfr = &deferred_arr[slot];
+	rpc_dassert(dfr->num_pending > 0);
+
+	/* Batch handlers may have moved the responses, so search for it */
+	size_t off = 0;
+	for(int i = 0; i < dfr->num_centry; i++) {
+		rpc_cmsg_reqhdr_t *resp_hdr = (rpc_cmsg_reqhdr_t *) &dfr->msg[off];
+		rpc_dassert(resp_hdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
+		if(resp_hdr->coro_seqnum == coro_seqnum) {
+			return resp_hdr;
+		}
+
+		off += sizeof(rpc_cmsg_reqhdr_t) + resp_hdr->get_size();
+	}
+
+	assert(false);
+	return NULL;
+}
+
+/*
+ * The buffer for the response of deferred response @token. It has room for the
+ * response length that the handler returned, and is valid until the response
+ * is completed.
+ */
+uint8_t* Rpc::get_deferred_resp_buf(int token)
+{
+	return (uint8_t *) deferred_resp_hdr(token) + sizeof(rpc_cmsg_reqhdr_t);
+}
+
+/*
+ * Complete deferred response @token. The coalesced response is sent by the
+ * next poll_comps() once all of its deferred responses are complete.
+ */
+void Rpc::complete_deferred_resp(int token, rpc_resptype_t resp_type)
+{
+	deferred_resp_hdr(token)->resp_type = resp_type;
+
+	int slot = token / RPC_MAX_MSG_CORO;
+	rpc_deferred_t *dfr = &deferred_arr[slot];
+	dfr->num_pending--;
+	if(dfr->num_pending == 0) {
+		rpc_dassert(num_deferred_done < RPC_MAX_DEFERRED);
+		deferred_done[num_deferred_done] = slot;
+		num_deferred_done++;
+	}
+}
+
+/*
+ * Move the coalesced responses with deferred responses out of resp_batch, whose
+ * mbufs are reused in the next poll_comps().
+ */
+void Rpc::hold_deferred_resps()
+{
+	/* In decreasing resp_i order, so the swap below moves no held response */
+	for(int i = num_deferred_new - 1; i >= 0; i--) {
+		rpc_deferred_t *dfr = &deferred_arr[deferred_new[i]];
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[dfr->resp_i];
+		if(unlikely(dfr->buf == NULL)) {
+			dfr->buf = (uint8_t *) memalign(64, info.max_msg_size);
+			assert(dfr->buf != NULL);
+		}
+
+		dfr->len = cmsg->resp_mbuf.length();
+		rte_memcpy(dfr->buf, cmsg->resp_mbuf.alloc_buf, dfr->len);
+		dfr->msg = dfr->buf;
+		dfr->resp_i = -1;
+
+		/* Fill the hole in resp_batch with the last response */
+		int last_i = resp_batch.num_cresps - 1;
+		if(cmsg != &resp_batch.cmsg_arr[last_i]) {
+			rpc_cmsg_t temp = *cmsg;
+			*cmsg = resp_batch.cmsg_arr[last_i];
+			resp_batch.cmsg_arr[last_i] = temp;
+		}
+
+		resp_batch.cmsg_arr[last_i].resp_mbuf.reset();
+		resp_batch.num_cresps--;
+	}
+
+	num_deferred_new = 0;
+}
+
+/* Add the held coalesced responses that are now complete to resp_batch */
+void Rpc::send_deferred_resps()
+{
+	while(num_deferred_done > 0 && resp_batch.num_cresps < HRD_RQ_DEPTH) {
+		num_deferred_done--;
+		int slot = deferred_done[num_deferred_done];
+		rpc_deferred_t *dfr = &deferred_arr[slot];
+		rpc_dassert(dfr->num_pending == 0 && dfr->msg == dfr->buf);
+
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[resp_batch.num_cresps];
+		resp_batch.num_cresps++;
+		cmsg->remote_mn = dfr->remote_mn;
+		cmsg->num_centry = dfr->num_centry;
+		cmsg->resp_imm = dfr->resp_imm;
+
+		hots_mbuf_t *resp_mbuf = &cmsg->resp_mbuf;
+		rpc_dassert(resp_mbuf->length() == 0);
+		rte_memcpy(resp_mbuf->cur_buf, dfr->buf, dfr->len);
+		resp_mbuf->cur_buf += dfr->len;
+
+#if RPC_ENABLE_RETX == 1
+		union rpc_imm resp_imm;
+		resp_imm.int_rep = dfr->resp_imm;
+		rpc_resp_cache_t *cache =
+			&resp_cache[remote_batch(dfr->remote_mn, resp_imm)];
+		rpc_dassert(cache->deferred && cache->req_seq == resp_imm.req_seq);
+		cache->pending = false;
+		cache->deferred = false;
+		if(cache->non_idempotent) {
+			cache_resp(dfr->remote_mn, resp_imm, resp_mbuf);
+		}
+#endif
+
+		deferred_free[num_deferred_free] = slot;
+		num_deferred_free++;
+	}
+}
+
+/*
+ * Run the batch handlers for the requests waiting in batch_ent, one call per
+ * request type, and finish the coalesced responses that have these requests.
+ * The requests' RECV buffers or SHM slots must not have been released yet.
+ */
+void Rpc::run_batch_reqs()
+{
+	rpc_dassert(num_batch_ent > 0 && num_batch_types > 0);
+
+	for(int type_i = 0; type_i < num_batch_types; type_i++) {
+		int req_type = batch_type_list[type_i];
+		batch_type_used[req_type] = false;
+
+		int num_reqs = 0;
+		for(int i = 0; i < num_batch_ent; i++) {
+			rpc_cmsg_reqhdr_t *req_hdr = batch_ent[i].req_hdr;
+			if(req_hdr->req_type != req_type) {
+				continue;
+			}
+
+			rpc_batch_req_t *req = &batch_req_arr[num_reqs];
+			req->req_buf = (uint8_t *) req_hdr + sizeof(rpc_cmsg_reqhdr_t);
+			req->req_len = req_hdr->get_size();
+			req->resp_buf = (uint8_t *) batch_ent[i].resp_hdr +
+				sizeof(rpc_cmsg_reqhdr_t);
+			num_reqs++;
+		}
+
+		rpc_dassert(num_reqs > 0);
+		size_t handler_start = rpc_lat_cycles();
+		rpc_batch_handler[req_type](batch_req_arr, num_reqs,
+			rpc_handler_arg[req_type]);
+
+		/* Charge each request an equal share of the call */
+		rpc_lat_record(lat_handler[req_type],
+			(rpc_lat_cycles() - handler_start) / num_reqs, num_reqs);
+		rpc_stat_inc(stat_batch_calls, 1);
+		rpc_stat_inc(stat_batch_reqs, num_reqs);
+
+		/* Record the responses in batch_ent, in the same order */
+		int req_i = 0;
+		for(int i = 0; i < num_batch_ent; i++) {
+			rpc_batch_ent_t *ent = &batch_ent[i];
+			if(ent->req_hdr->req_type != req_type) {
+				continue;
+			}
+
+			rpc_batch_req_t *req = &batch_req_arr[req_i];
+			rpc_dassert(is_aligned(req->resp_len, sizeof(uint64_t)));
+			rpc_dassert(req->resp_len <= rpc_batch_max_resp_len[req_type]);
+			ent->resp_type = req->resp_type;
+			ent->resp_len = req->resp_len;
+			req_i++;
+		}
+	}
+
+	/*
+	 * Close the gaps left by responses shorter than their reserved slot. The
+	 * responses' entries are in batch_ent in message order.
+	 */
+	int ent_i = 0;
+	for(int i = 0; i < num_batch_cmsg; i++) {
+		rpc_cmsg_t *cmsg = &resp_batch.cmsg_arr[batch_cmsg_list[i]];
+		uint8_t *resp_buf = cmsg->resp_mbuf.alloc_buf;
+		size_t src_off = 0, dst_off = 0;
+
+		for(int j = 0; j < cmsg->num_centry; j++) {
+			rpc_cmsg_reqhdr_t *resp_hdr =
+				(rpc_cmsg_reqhdr_t *) &resp_buf[src_off];
+			size_t slot_len = resp_hdr->get_size();
+			size_t resp_len = slot_len;
+
+			if(ent_i < num_batch_ent && batch_ent[ent_i].resp_hdr == resp_hdr) {
+				resp_hdr->resp_type = batch_ent[ent_i].resp_type;
+				resp_len = batch_ent[ent_i].resp_len;
+				resp_hdr->set_size(resp_len);
+				ent_i++;
+			}
+
+			if(dst_off != src_off) {
+				memmove(&resp_buf[dst_off], &resp_buf[src_off],
+					sizeof(rpc_cmsg_reqhdr_t) + resp_len);
+			}
+
+			src_off += sizeof(rpc_cmsg_reqhdr_t) + slot_len;
+			dst_off += sizeof(rpc_cmsg_reqhdr_t) + resp_len;
+		}
+
+		rpc_dassert(src_off == cmsg->resp_mbuf.length());
+		cmsg->resp_mbuf.cur_buf = &resp_buf[dst_off];
+
+#if RPC_ENABLE_RETX == 1
+		union rpc_imm resp_imm;
+		resp_imm.int_rep = cmsg->resp_imm;
+		rpc_resp_cache_t *cache =
+			&resp_cache[remote_batch(cmsg->remote_mn, resp_imm)];
+		rpc_dassert(cache->pending && cache->req_seq == resp_imm.req_seq);
+		if(!cache->deferred) {
+			cache->pending = false;
+			if(cache->non_idempotent) {
+				cache_resp(cmsg->remote_mn, resp_imm, &cmsg->resp_mbuf);
+			}
+		}
+#endif
+	}
+
+	rpc_dassert(ent_i == num_batch_ent);
+	num_batch_ent = 0;
+	num_batch_types = 0;
+	num_batch_cmsg = 0;
+}
+
 coro_id_t* Rpc::poll_comps()
 {
 	// Loss detection - check if a coroutine has not made progress for too long.
@@ -231,15 +1552,63 @@ coro_id_t* Rpc::poll_comps()
 		ld_check_packet_loss();
 		ld_iters = 0;
 	}
+
+#if RPC_ENABLE_RETX == 1
+	retx_iters++;
+	if(unlikely(retx_iters == RPC_RETX_CHECK_STEP)) {
+		retx_check_timeouts();
+		retx_iters = 0;
+	}
+#endif
+
+	/* Reap SEND completions here so that posting SENDs rarely waits */
+	reap_send_comps();
+	for(int qp = 0; qp < info.num_qps; qp++) {
+		if(unlikely(backlog_head[qp] != backlog_tail[qp])) {
+			drain_send_backlog(qp);
+		}
+	}
+
+#if RPC_ENABLE_REQ_PACKING == 1
+	/* Assemble the requests queued by slaves; they are posted below */
+	if(num_pack_mn > 0) {
+		send_packed_reqs();
+	}
+#endif
 	
 	/* Poll for completions */
 	long long poll_recv_cq_start = rpc_get_cycles();
-	int cq_comps = ibv_poll_cq(cb->dgram_recv_cq[0], HRD_RQ_DEPTH, wc);
+#if RPC_SHM_ONLY == 0
+	int ud_comps = ibv_poll_cq(cb->dgram_recv_cq[0], HRD_RQ_DEPTH, wc);
+#else
+	int ud_comps = 0;
+#endif
 	tot_cycles_poll_recv_cq += rpc_get_cycles() - poll_recv_cq_start;
 
-	if(cq_comps == 0) {
+	/*
+	 * Append completions from SHM rings after the UD completions. The total is
+	 * bounded by HRD_RQ_DEPTH, which bounds the number of responses we can
+	 * create in this round.
+	 */
+	int cq_comps = ud_comps;
+#if RPC_ENABLE_SHM_TRANSPORT == 1
+	for(int i = 0; i < num_shm_peers && cq_comps < HRD_RQ_DEPTH; i++) {
+		int mn = shm_peer_list[i];
+		rpc_dassert(shm_rx_polled[mn] == 0);
+
+		int shm_comps = rpc_shm_ring_poll(shm_rx_ring[mn], &wc[cq_comps],
+			HRD_RQ_DEPTH - cq_comps);
+		shm_rx_polled[mn] = shm_comps;
+		cq_comps += shm_comps;
+	}
+#endif
+
+	if(cq_comps == 0 && num_local_done == 0 && num_deferred_done == 0) {
 		rpc_stat_inc(stat_wasted_poll_cq, 1);
 
+		/* Post requests that slaves queued since the last poll */
+		ud_flush_sends();
+
 		/* Return a loop with only the master coroutine */
 		next_coro[RPC_MASTER_CORO_ID] = RPC_MASTER_CORO_ID;
 		return next_coro;
@@ -249,170 +1618,90 @@ coro_id_t* Rpc::poll_comps()
 	int cur_comp_coro = RPC_MASTER_CORO_ID;	/* For completed coroutines */
 	resp_batch.clear();
 
-#if RPC_ENABLE_MICA_PREFETCH == 1
+	/* Coroutines whose requests were all local are already complete */
+	for(int i = 0; i < num_local_done; i++) {
+		next_coro[cur_comp_coro] = local_done_coro[i];
+		cur_comp_coro = local_done_coro[i];
+	}
+	num_local_done = 0;
+
+#if RPC_ENABLE_PREFETCH == 1
 	for(int comp_i = 0; comp_i < cq_comps; comp_i++) {
 		uint8_t *wc_buf = (uint8_t *) (wc[comp_i].wr_id + HOTS_GRH_BYTES);
 		union rpc_imm wc_imm;
+#if HOTS_ENABLE_EXT_HDR == 1
+		size_t wc_len = wc[comp_i].byte_len - HOTS_GRH_BYTES;
+		wc_imm = rpc_imm_from_wire(wc[comp_i].imm_data, wc_buf, &wc_len);
+#else
 		wc_imm.int_rep = wc[comp_i].imm_data;
+#endif
 		uint32_t _is_req = wc_imm.is_req;
 		uint32_t _num_reqs = wc_imm.num_reqs;
 
-		if(_is_req == 1) {
-			prefetch_mica(wc_buf, _num_reqs);
+		/* Fragments and packed packets are not prefetched */
+		if(_is_req == 1 && wc_imm.is_frag == 0 && wc_imm.is_packed == 0) {
+			prefetch_reqs(wc_buf, _num_reqs);
 		}
 	}
 #endif
 
 	for(int comp_i = 0; comp_i < cq_comps; comp_i++) {
-		/* Unmarshal the completion's immediate */
-		union rpc_imm wc_imm;
-		wc_imm.int_rep = wc[comp_i].imm_data;
-		check_imm(wc_imm);;
-
-		uint32_t _is_req = wc_imm.is_req;
-		uint32_t _num_reqs = wc_imm.num_reqs;	/* or number of resps */
-		uint32_t _mchn_id = wc_imm.mchn_id;	/* Remote machine's ID */
-		uint32_t _coro_id = wc_imm.coro_id;
-		uint32_t _config_id __attribute__((unused)) = wc_imm.config_id;
-
-		rpc_dassert(_mchn_id < (unsigned) info.num_machines);
-		rpc_dassert(_coro_id < (unsigned) info.num_coro);
-
 		/* Interpret the received buffer */
 		uint8_t *wc_buf = (uint8_t *) (wc[comp_i].wr_id + HOTS_GRH_BYTES);
 		rpc_dassert(is_aligned(wc_buf, 64));
 
-#if RPC_DEBUG_ASSERT == 1
-		check_coalesced_msg(wc_buf, _num_reqs);
-#endif
-
 		/* wc.byte_len includes GRH, whether or not GRH is DMA-ed */
 		size_t wc_len = wc[comp_i].byte_len - HOTS_GRH_BYTES;
-		rpc_dassert(wc_len >= 0 && wc_len <= info.max_pkt_size);
-
-		if(_is_req == 0) {
-			// Handle a new response
-			rpc_dassert(_coro_id != RPC_MASTER_CORO_ID);
 
-			rpc_req_batch_t *req_batch = &req_batch_arr[_coro_id];
-			req_batch->num_reqs_done += _num_reqs;
-
-			if(req_batch->num_reqs_done == req_batch->num_reqs) {
-				/* Record completed coroutine */
-				rpc_dprintf("Rpc: Worker %d received all responses "
-					"for coroutine %d\n", info.wrkr_gid, _coro_id);
-
-				next_coro[cur_comp_coro] = _coro_id;
-				cur_comp_coro = _coro_id;
-
-#if RPC_MSR_MAX_BATCH_LATENCY == 1
-				/*
-				 * Save the latency of the completed batch if it exceeds the
-				 * current maximum batch latency for this coroutine.
-				 */
-				struct timespec *_mbl_start = &max_batch_lat_start[_coro_id];
-				struct timespec _mbl_end;
-				clock_gettime(CLOCK_REALTIME, &_mbl_end);
-				double _mbl_usec =
-					(_mbl_end.tv_sec - _mbl_start->tv_sec) * 1000000 +
-					(double) (_mbl_end.tv_nsec - _mbl_start->tv_nsec) / 1000;
-
-				if(_mbl_usec > max_batch_lat_coro[_coro_id]) {
-					max_batch_lat_coro[_coro_id] = _mbl_usec;
-				}
+		/* Unmarshal the completion's immediate */
+		union rpc_imm wc_imm;
+#if HOTS_ENABLE_EXT_HDR == 1
+		wc_imm = rpc_imm_from_wire(wc[comp_i].imm_data, wc_buf, &wc_len);
+#else
+		wc_imm.int_rep = wc[comp_i].imm_data;
 #endif
-			}
+		rpc_dassert(wc_len >= 0 && wc_len <= info.max_pkt_size);
 
-			/* Fill in the slave coroutines's response buffers */
-			size_t wc_off = 0;	/* Byte index into the coalesced resp */
-			rpc_cmsg_reqhdr_t *cmsg_reqhdr;
-			for(int i = 0; i < (int) _num_reqs; i++) {
-				rpc_dassert(is_aligned(wc_off, sizeof(rpc_cmsg_reqhdr_t)));
-				cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &wc_buf[wc_off];
-
-				rpc_dprintf("Rpc: Worker %d received %s response from "
-					"machine %d. Size = %u (coalesced size = %lu)\n",
-					info.wrkr_gid,
-					rpc_type_to_string(cmsg_reqhdr->resp_type).c_str(),
-					_mchn_id, cmsg_reqhdr->size, wc_len);
-
-				/* Unmarshal the request header */
-				rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
-				int _coro_seqnum = cmsg_reqhdr->coro_seqnum;
-				rpc_dassert(_coro_seqnum >= 0 &&
-					_coro_seqnum <= req_batch->num_reqs);
-
-				/* Copy the response data to the user's buffer */
-				rpc_req_t *req = &req_batch->req_arr[_coro_seqnum];
-				rpc_dassert(req->max_resp_len >= cmsg_reqhdr->size);
-				rte_memcpy(req->resp_buf,
-					&wc_buf[wc_off + sizeof(rpc_cmsg_reqhdr_t)],
-					cmsg_reqhdr->size);
-
-				/* Copy response metadata */
-				req->resp_len = cmsg_reqhdr->size;
-				req->resp_type = cmsg_reqhdr->resp_type;
-
-				wc_off += sizeof(rpc_cmsg_reqhdr_t) + cmsg_reqhdr->size;
+		/*
+		 * Zero-copy responses can stay in UD RECV buffers, not in SHM slots
+		 * or SRQ buffers, which are reposted below.
+		 */
+		struct ibv_wc *recv_wc = (comp_i < ud_comps &&
+			RPC_ENABLE_SRQ == 0) ? &wc[comp_i] : NULL;
+
+		if(unlikely(wc_imm.is_packed == 1)) {
+			/* Coalesced messages of different coroutines in one packet */
+			size_t wc_off = 0;
+			for(int i = 0; i < (int) wc_imm.num_reqs; i++) {
+				rpc_pack_hdr_t *pack_hdr = (rpc_pack_hdr_t *) &wc_buf[wc_off];
+				wc_off += sizeof(rpc_pack_hdr_t);
+
+				union rpc_imm msg_imm;
+				msg_imm.int_rep = pack_hdr->imm;
+				process_msg(msg_imm, &wc_buf[wc_off], pack_hdr->len, recv_wc,
+					&cur_comp_coro);
+				wc_off += pack_hdr->len;
 			}
-			rpc_dassert(wc_off == wc_len);
 
-			/* Record coroutine progress for packet loss detection */
-			ld_num_resps_ever[_coro_id] += _num_reqs;
+			rpc_dassert(wc_off == wc_len);
 		} else {
-			// Handle a new request
-			rpc_dassert(wc_len > 0);	/* Requests cannot be 0-byte */
-
-			/* Initialize a new RPC message for the master */
-			hots_mbuf_t *resp_mbuf = start_new_resp(_mchn_id, _num_reqs,
-				wc_imm.int_rep); /* Converts req Imm to response Imm */
-
-			/* Process the requests */
-			size_t wc_off = 0;	/* Offset into wc_buf */
-			rpc_cmsg_reqhdr_t *cmsg_reqhdr;
-
-			for(int i = 0; i < (int) _num_reqs; i++) {
-				rpc_dassert(is_aligned(wc_off, sizeof(rpc_cmsg_reqhdr_t)));
-				rpc_dassert(is_aligned(resp_mbuf->cur_buf,
-					sizeof(rpc_cmsg_reqhdr_t)));
-
-				/* Unmarshal the request header */
-				cmsg_reqhdr = (rpc_cmsg_reqhdr_t *) &wc_buf[wc_off];
-				rpc_dassert(cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
-				uint32_t req_type = cmsg_reqhdr->req_type;
-				uint32_t req_len = cmsg_reqhdr->size;
-
-				rpc_dprintf("Rpc: Worker %d received %s req from machine %d. "
-					"Size = %u (coalesced size = %lu, %d reqs)\n",
-					info.wrkr_gid,
-					rpc_type_to_string(cmsg_reqhdr->req_type).c_str(),
-					_mchn_id, cmsg_reqhdr->size, wc_len, (int) _num_reqs);
-
-				/* Copy the request header to the response */
-				rpc_cmsg_reqhdr_t *cmsg_resphdr = (rpc_cmsg_reqhdr_t *)
-					resp_mbuf->cur_buf;
-				*((uint64_t *) cmsg_resphdr) = *(uint64_t *) cmsg_reqhdr;
-				resp_mbuf->cur_buf += sizeof(rpc_cmsg_reqhdr_t);
-				wc_off += sizeof(rpc_cmsg_reqhdr_t);
-
-				/* Invoke the handler */
-				rpc_dassert(rpc_handler[req_type] != NULL);
-				size_t resp_len = rpc_handler[req_type](
-					resp_mbuf->cur_buf, &cmsg_resphdr->resp_type,
-					&wc_buf[wc_off], req_len, rpc_handler_arg[req_type]);
-				cmsg_resphdr->size = resp_len;	/* cmsg_resphdr is valid */
-
-				rpc_dassert(is_aligned(resp_len, sizeof(uint64_t)));
+			process_msg(wc_imm, wc_buf, wc_len, recv_wc, &cur_comp_coro);
+		}
+	}
 
-				wc_off += req_len;
-				resp_mbuf->cur_buf += resp_len;
-				
-				/* Ensure that we don't overflow the response buffer */
-				rpc_dassert(resp_mbuf->length() <= resp_mbuf->alloc_len);
-			}
+#if RPC_ENABLE_BATCH_HANDLERS == 1
+	/* The batched requests are still in the polled buffers */
+	if(num_batch_ent > 0) {
+		run_batch_reqs();
+	}
+#endif
 
-			rpc_dassert(wc_off == wc_len);
-		}
+	if(unlikely(num_deferred_new > 0)) {
+		hold_deferred_resps();
+	}
+
+	if(unlikely(num_deferred_done > 0)) {
+		send_deferred_resps();
 	}
 
 	/*
@@ -420,22 +1709,61 @@ coro_id_t* Rpc::poll_comps()
 	 * anymore because (a) the polled requests have been processed by the
 	 * master and results have been stored into corresponding @resp_buf's,
 	 * and (b) the polled responses have been copied to slave coroutine
-	 * @resp_buf's.
+	 * @resp_buf's. The same holds for polled SHM ring slots.
 	 */
-	recvs_to_post += cq_comps;
-	if(recvs_to_post >= recv_slack) {
+#if RPC_ENABLE_SRQ == 1
+	if(srq_recvs_to_post + ud_comps > HRD_RQ_DEPTH) {
+		srq_post_recvs();
+	}
+
+	for(int comp_i = 0; comp_i < ud_comps; comp_i++) {
+		srq_add_recv(&wc[comp_i]);
+	}
+
+	if(srq_recvs_to_post >= RPC_SRQ_POST_BATCH) {
+		long long post_recv_start = rpc_get_cycles();
+		srq_post_recvs();
+		tot_cycles_post_recv += rpc_get_cycles() - post_recv_start;
+	}
+#elif RPC_SHM_ONLY == 0
+	recvs_to_post += ud_comps;
+	int num_postable = postable_recvs();	/* Excludes held RECV buffers */
+	if(num_postable >= recv_slack) {
 		long long post_recv_start = rpc_get_cycles();
 #if RPC_ENABLE_MODDED_DRIVER == 1
-		post_recvs_fast(recvs_to_post);
+		post_recvs_fast(num_postable);
 #else
-		post_recvs(recvs_to_post);
+		post_recvs(num_postable);
 #endif
-		recvs_to_post = 0;
+		recvs_to_post -= num_postable;
 		tot_cycles_post_recv += rpc_get_cycles() - post_recv_start;
 	}
+#endif
 
+#if RPC_ENABLE_SHM_TRANSPORT == 1
+	for(int i = 0; i < num_shm_peers; i++) {
+		int mn = shm_peer_list[i];
+		if(shm_rx_polled[mn] > 0) {
+			rpc_shm_ring_release(shm_rx_ring[mn], shm_rx_polled[mn]);
+			shm_rx_polled[mn] = 0;
+		}
+	}
+#endif
+
+#if RPC_ENABLE_CREDITS == 1
+	if(unlikely(num_credit_waits > 0)) {
+		send_credit_waits();
+	}
+#endif
+
+	/*
+	 * With doorbell batching, the SENDs for responses are appended to the
+	 * requests queued by slaves, and all are posted together.
+	 */
 	if(resp_batch.num_cresps > 0) {
 		send_resps();
+	} else {
+		ud_flush_sends();
 	}
 
 	next_coro[cur_comp_coro] = RPC_MASTER_CORO_ID;	/* Create the loop */
@@ -12,11 +12,141 @@
 #define RPC_LOSS_DETECTION_MS 1000  
 #define RPC_LOSS_DETECTION_STEP 10000
 
+/*
+ * Packet loss recovery. A slave's coalesced requests that have not received a
+ * response within RPC_RETX_TIMEOUT_MS are retransmitted. Responders detect
+ * duplicates using the request sequence number in the immediate. A duplicate
+ * that contains a request of a non-idempotent type gets the cached response;
+ * otherwise, the handlers run again.
+ */
+#define RPC_ENABLE_RETX 1
+#define RPC_RETX_TIMEOUT_MS 5
+#define RPC_RETX_CHECK_STEP 1000	/* poll_comps() calls between timer reads */
+
+/* Flags for registering a request type's handler */
+#define RPC_HANDLER_NON_IDEMPOTENT 1	/* Must not run twice for a request */
+#define RPC_HANDLER_MAY_DEFER 2	/* The handler may call defer_resp() */
+
+/*
+ * Credit-based flow control. A requester may have at most peer_credits()
+ * request packets outstanding at each remote machine, which bounds the RECVs
+ * that a machine needs for requests (see Rpc::required_recvs()). A response
+ * returns the credits of its request. Coalesced requests without enough
+ * credits wait in FIFO order and are sent from poll_comps().
+ */
+#define RPC_ENABLE_CREDITS 1
+#define RPC_MAX_CREDITS 8	/* Max credits per remote machine */
+
 // Optimizations
 #define RPC_ENABLE_MODDED_DRIVER 1
 #define RPC_UNSIG_BATCH 128
+
+/*
+ * SENDs per QP that are queued, with a copy of their data, instead of waiting
+ * for a SEND completion when the QP's signaling window is closed. The master
+ * loop posts them after reaping SEND completions.
+ */
+#define RPC_SEND_BACKLOG 64
 #define RPC_MAX_POSTLIST 64
-#define RPC_ENABLE_MICA_PREFETCH 1
+
+/*
+ * Before running the handlers in poll_comps(), invoke the prefetch handlers
+ * (see Rpc::register_prefetch_handler()) of all received requests.
+ */
+#define RPC_ENABLE_PREFETCH 1
+
+/*
+ * send_reqs() only assembles the UD SENDs for requests. The master coroutine
+ * posts them in poll_comps() together with its responses, so there are a few
+ * postlist-sized ibv_post_send()s per master loop instead of one per slave.
+ */
+#define RPC_ENABLE_DOORBELL_BATCHING 1
+
+/*
+ * The master packs small coalesced requests of different slave coroutines to
+ * the same machine into one packet (see rpc_pack_hdr_t). Packing is done when
+ * the master posts the requests, so it needs doorbell batching.
+ */
+#define RPC_ENABLE_REQ_PACKING 1
+
+#if RPC_ENABLE_REQ_PACKING == 1
+	static_assert(RPC_ENABLE_DOORBELL_BATCHING == 1,
+		"RPC_ENABLE_REQ_PACKING requires RPC_ENABLE_DOORBELL_BATCHING");
+#endif
+
+/*
+ * The master packs small coalesced responses to different coroutines of the
+ * same machine in a response batch into one packet.
+ */
+#define RPC_ENABLE_RESP_PACKING 1
+
+/*
+ * Run requests for this machine in send_reqs() by invoking the handler directly
+ * instead of sending them to ourselves through the NIC.
+ */
+#define RPC_ENABLE_LOCAL_REQS 1
+
+/*
+ * Allow batch handlers, which get all requests of their type from a
+ * poll_comps() pass in one call (see rpc_batch_req_t). At most
+ * RPC_MAX_BATCH_REQS requests wait for batch handlers at a time.
+ */
+#define RPC_ENABLE_BATCH_HANDLERS 1
+#define RPC_MAX_BATCH_REQS 512
+
+/*
+ * Deferred responses. A handler that cannot respond right away calls
+ * Rpc::defer_resp() and completes the response later. The coalesced response
+ * is held back until all of its deferred responses complete, and at most
+ * RPC_MAX_DEFERRED coalesced responses can be held back at a time.
+ */
+#define RPC_MAX_DEFERRED 256
+
+/*
+ * One-way requests. Each slave has a second request batch whose coalesced
+ * requests are sent like the regular ones (credits, packing, retransmission),
+ * but whose responses only acknowledge them to the Rpc: they are not copied
+ * out and the slave does not wait for them. See Rpc::start_new_oneway_req().
+ */
+#define RPC_ENABLE_ONEWAY 1
+
+/*
+ * Allow requests with a NULL @resp_buf, whose responses are not copied out of
+ * the RECV buffer. See rpc_req_t.
+ */
+#define RPC_ENABLE_ZERO_COPY_RESP 1
+
+/*
+ * Use shared-memory rings instead of the NIC for machines that are on the same
+ * host as this RPC endpoint (i.e., for multiple machine IDs per host). With
+ * RPC_SHM_ONLY, all machines must be on this host and no RDMA device is used.
+ */
+#define RPC_ENABLE_SHM_TRANSPORT 0
+#define RPC_SHM_ONLY 0
+
+#if RPC_SHM_ONLY == 1
+	static_assert(RPC_ENABLE_SHM_TRANSPORT == 1,
+		"RPC_SHM_ONLY requires RPC_ENABLE_SHM_TRANSPORT");
+#endif
+
+/*
+ * Shared RECV queue. All Rpc endpoints of a process on a port RECV from one
+ * SRQ with RPC_SRQ_DEPTH RECVs instead of HRD_RQ_DEPTH RECVs each, and
+ * repost the RECVs they consume in chains of at least RPC_SRQ_POST_BATCH.
+ * The SRQ is sized for the packets in flight on average, not in the worst
+ * case: a packet that finds it empty is dropped and later retransmitted.
+ * Zero-copy responses are copied out of SRQ buffers.
+ */
+#define RPC_ENABLE_SRQ 0
+#define RPC_SRQ_DEPTH 8192
+#define RPC_SRQ_POST_BATCH 32
+
+#if RPC_ENABLE_SRQ == 1
+	static_assert(RPC_ENABLE_RETX == 1,
+		"RPC_ENABLE_SRQ requires RPC_ENABLE_RETX");
+	static_assert(RPC_ENABLE_MODDED_DRIVER == 0 && RPC_SHM_ONLY == 0,
+		"RPC_ENABLE_SRQ needs regular RECV posting on an RDMA device");
+#endif
 
 #if RPC_ENABLE_MODDED_DRIVER == 1
 	static_assert(HRD_RQ_DEPTH == 256 || HRD_RQ_DEPTH == 512 ||
@@ -35,6 +165,13 @@
 #define RPC_COLLECT_STATS 0
 #define RPC_COLLECT_TIMER_INFO 0
 
+/*
+ * Latency histograms (see rpc_lat_hist_t): RTT of request batches, of
+ * coalesced requests by destination machine, and of requests by type, and
+ * handler time by request type. About two rdtsc's per request.
+ */
+#define RPC_COLLECT_LAT_HIST 1
+
 // Debug macros
 #define rpc_dprintf(fmt, ...) \
 	do { \
@@ -56,29 +193,85 @@
 #define rpc_get_cycles() 0
 #endif
 
+#if RPC_COLLECT_LAT_HIST == 1
+#define rpc_lat_cycles() hrd_get_cycles()
+#else
+#define rpc_lat_cycles() 0
+#endif
+#define rpc_lat_record(hist, cycles, weight) \
+	do {if (RPC_COLLECT_LAT_HIST) (hist).record(cycles, weight);} while (0)
+
 // RPC constants
 
 /* Maximum pkt size can be 4096 bytes, but I'm paranoid about way conflicts */
 #define RPC_MAX_MAX_PKT_SIZE 4032
 #define RPC_MAX_QPS 3	/* Maximum QPs per port */
 
-/* Buffer sizes */
-#define RPC_RECV_BUF_SIZE M_32	/* Space for RECVs */
-#define RPC_MBUF_SPACE M_32	/* Registered hugepages for req/resp mbufs */
-#define RPC_NON_INLINE_SPACE M_32	/* Registered memory for non-inline resps */
+/*
+ * Coalesced messages larger than max_pkt_size are sent as multiple fragments.
+ * Each fragment carries an rpc_frag_hdr_t. Single requests and responses are
+ * limited by the 12-bit size (in 8-byte words) of rpc_cmsg_reqhdr_t.
+ */
+#define RPC_MAX_MAX_MSG_SIZE (64 * 1024)
+#define RPC_MAX_REQ_SIZE (((1 << 12) - 1) * sizeof(uint64_t))
+
+/*
+ * Buffer sizes. Registered memory for mbufs (and spare response buffers) is
+ * computed from max_msg_size at runtime.
+ */
+#define RPC_RECV_BUF_SIZE (RPC_ENABLE_SRQ == 1 ? 0 : M_32)	/* Space for RECVs */
 
-#define RPC_MAX_CORO 32	/* Coroutines per RPC endpoint, including master */
+/* Coroutines per RPC endpoint, including master */
+#define RPC_MAX_CORO (HOTS_ENABLE_EXT_HDR == 1 ? 64 : 32)
 #define RPC_MASTER_CORO_ID 0	/* The only coroutine allowed to send resps */
 #define RPC_MAX_MSG_CORO 16	/* Max outstanding messages per slave coroutine.
 							 * Needed for RECV maintenance. */
 
+/*
+ * Futures. Besides its regular and one-way batches, a slave has RPC_MAX_FUTURES
+ * request batches that it sends without yielding, and waits on later with
+ * Rpc::wait_futures().
+ */
+#define RPC_MAX_FUTURES 2
+
+/*
+ * Request batches: batch slot s of coroutine c is c + s * RPC_MAX_CORO. Slot
+ * 0 is the regular batch, slot 1 the one-way batch, and slot 2 + f future f.
+ */
+#define RPC_ONEWAY_SLOT 1
+#define RPC_FUTURE_SLOT(fut) (2 + (fut))
+#define RPC_MAX_BATCH (RPC_FUTURE_SLOT(RPC_MAX_FUTURES) * RPC_MAX_CORO)
+#define RPC_BATCHES_PER_CORO \
+	(RPC_ENABLE_ONEWAY == 1 || RPC_MAX_FUTURES > 0 ? \
+	RPC_FUTURE_SLOT(RPC_MAX_FUTURES) : 1)
+static_assert(RPC_MAX_BATCH <= 256, "");	/* rpc_cmsg_ref_t::batch_id */
+
 #define RPC_MIN_RECV_SLACK 32
 #define RPC_INVALID_MN -1	/* An invalid worker number */
 
 // Immediate data formatting
 #define RPC_IS_REQ_BITS 1
-#define RPC_NUM_REQS_BITS 5	/* Max requests in the coalesced message = 31 */
-#define RPC_CONFIG_ID_BITS 4	/* XXX too low: Max 16 reconfigurations */
+#define RPC_IS_FRAG_BITS 1
+#define RPC_IS_PACKED_BITS 1
+#define RPC_BATCH_SLOT_BITS 2
+#define RPC_IS_EXT_BITS 1
+#define RPC_CONFIG_ID_BITS 1	/* XXX too low: Max 2 reconfigurations */
+#define RPC_REQ_SEQ_BITS 8	/* Sequence number of a slave's request batch */
+static_assert(RPC_FUTURE_SLOT(RPC_MAX_FUTURES) <= (1 << RPC_BATCH_SLOT_BITS),
+	"");
+
+/* Widths of the fields that move to rpc_ext_hdr_t when they do not fit */
+#define RPC_IMM_NUM_REQS_BITS 5	/* Max requests in the coalesced message = 31 */
+#define RPC_IMM_MCHN_ID_BITS 7
+#define RPC_IMM_CORO_ID_BITS 5
+
+#if HOTS_ENABLE_EXT_HDR == 1
+#define RPC_NUM_REQS_BITS 8
+typedef uint64_t rpc_imm_int_t;
+#else
+#define RPC_NUM_REQS_BITS RPC_IMM_NUM_REQS_BITS
+typedef uint32_t rpc_imm_int_t;
+#endif
 
 /* RPC_NUM_REQS_BITS is used to hold @num_reqs, which is 1-based */
 static_assert(RPC_MAX_MSG_CORO <= ((1 << RPC_NUM_REQS_BITS) - 1), "");
@@ -87,19 +280,162 @@ static_assert(RPC_MAX_MSG_CORO <= ((1 << RPC_NUM_REQS_BITS) - 1), "");
 /*
  * num_reqs is the number of requests in the coalesced request, which is equal
  * to the number of responses in the corresponding coalesced reply.
+ *
+ * This is the 32-bit IB immediate, except with HOTS_ENABLE_EXT_HDR, where the
+ * fields are wider and the immediate on the wire is an rpc_wire_imm.
  */
 union rpc_imm {
+	struct {
+		rpc_imm_int_t is_req :RPC_IS_REQ_BITS;
+		rpc_imm_int_t num_reqs :RPC_NUM_REQS_BITS;
+		rpc_imm_int_t config_id :RPC_CONFIG_ID_BITS;	/* Unused for now */
+		rpc_imm_int_t batch_slot :RPC_BATCH_SLOT_BITS;	/* See RPC_MAX_BATCH */
+		rpc_imm_int_t mchn_id :HOTS_MCHN_ID_BITS; /* Source machine: for reply */
+		rpc_imm_int_t coro_id :HOTS_CORO_ID_BITS;
+		rpc_imm_int_t is_frag :RPC_IS_FRAG_BITS;	/* Payload has rpc_frag_hdr_t */
+		rpc_imm_int_t req_seq :RPC_REQ_SEQ_BITS;	/* Copied to the response */
+		rpc_imm_int_t is_packed :RPC_IS_PACKED_BITS;	/* See rpc_pack_hdr_t */
+		rpc_imm_int_t is_ext :RPC_IS_EXT_BITS;	/* Wire only: see rpc_wire_imm */
+	};
+
+	rpc_imm_int_t int_rep;
+};
+static_assert(sizeof(union rpc_imm) == sizeof(rpc_imm_int_t), "");
+static_assert(RPC_IS_REQ_BITS + RPC_NUM_REQS_BITS + RPC_CONFIG_ID_BITS +
+	RPC_BATCH_SLOT_BITS + HOTS_MCHN_ID_BITS + HOTS_CORO_ID_BITS +
+	RPC_IS_FRAG_BITS + RPC_REQ_SEQ_BITS + RPC_IS_PACKED_BITS +
+	RPC_IS_EXT_BITS <= 8 * sizeof(rpc_imm_int_t), "");
+
+#if HOTS_ENABLE_EXT_HDR == 1
+/*
+ * The 32-bit IB immediate. If @num_reqs, @mchn_id or @coro_id of a packet's
+ * rpc_imm does not fit, they are zero here, @is_ext is set, and the packet
+ * ends with an rpc_ext_hdr_t that holds them. The extension header is not
+ * counted in max_pkt_size.
+ */
+union rpc_wire_imm {
 	struct {
 		uint32_t is_req :RPC_IS_REQ_BITS;
-		uint32_t num_reqs :RPC_NUM_REQS_BITS;
-		uint32_t config_id :RPC_CONFIG_ID_BITS;	/* Unused for now */
-		uint32_t mchn_id :HOTS_MCHN_ID_BITS; /* Source machine: for reply */
-		uint32_t coro_id :HOTS_CORO_ID_BITS;
+		uint32_t num_reqs :RPC_IMM_NUM_REQS_BITS;
+		uint32_t config_id :RPC_CONFIG_ID_BITS;
+		uint32_t batch_slot :RPC_BATCH_SLOT_BITS;
+		uint32_t mchn_id :RPC_IMM_MCHN_ID_BITS;
+		uint32_t coro_id :RPC_IMM_CORO_ID_BITS;
+		uint32_t is_frag :RPC_IS_FRAG_BITS;
+		uint32_t req_seq :RPC_REQ_SEQ_BITS;
+		uint32_t is_packed :RPC_IS_PACKED_BITS;
+		uint32_t is_ext :RPC_IS_EXT_BITS;
 	};
 
 	uint32_t int_rep;
 };
-static_assert(sizeof(union rpc_imm) == sizeof(uint32_t), ""); /* IB immediate */
+static_assert(sizeof(union rpc_wire_imm) == sizeof(uint32_t), "");
+static_assert(RPC_IS_REQ_BITS + RPC_IMM_NUM_REQS_BITS + RPC_CONFIG_ID_BITS +
+	RPC_BATCH_SLOT_BITS + RPC_IMM_MCHN_ID_BITS + RPC_IMM_CORO_ID_BITS +
+	RPC_IS_FRAG_BITS + RPC_REQ_SEQ_BITS + RPC_IS_PACKED_BITS +
+	RPC_IS_EXT_BITS == 32, "");
+
+/* Trailer of packets with @is_ext set in the immediate. Not aligned. */
+struct rpc_ext_hdr_t {
+	uint16_t mchn_id;
+	uint8_t coro_id;
+	uint8_t num_reqs;
+};
+static_assert(sizeof(rpc_ext_hdr_t) == sizeof(uint32_t), "");
+static_assert(bit_capacity(16) >= HOTS_MAX_MACHINES, "");
+static_assert(HOTS_CORO_ID_BITS <= 8 && RPC_NUM_REQS_BITS <= 8, "");
+
+#define RPC_EXT_HDR_BYTES sizeof(rpc_ext_hdr_t)
+
+/*
+ * Convert @imm to a wire immediate. If the packet needs an extension header,
+ * fill in @ext_hdr and set @is_ext in the returned immediate.
+ */
+static inline union rpc_wire_imm rpc_imm_to_wire(union rpc_imm imm,
+	rpc_ext_hdr_t *ext_hdr)
+{
+	union rpc_wire_imm wire_imm;
+	wire_imm.int_rep = 0;
+	wire_imm.is_req = imm.is_req;
+	wire_imm.config_id = imm.config_id;
+	wire_imm.batch_slot = imm.batch_slot;
+	wire_imm.is_frag = imm.is_frag;
+	wire_imm.req_seq = imm.req_seq;
+	wire_imm.is_packed = imm.is_packed;
+
+	if(likely(imm.num_reqs < bit_capacity(RPC_IMM_NUM_REQS_BITS) &&
+			imm.mchn_id < bit_capacity(RPC_IMM_MCHN_ID_BITS) &&
+			imm.coro_id < bit_capacity(RPC_IMM_CORO_ID_BITS))) {
+		wire_imm.num_reqs = imm.num_reqs;
+		wire_imm.mchn_id = imm.mchn_id;
+		wire_imm.coro_id = imm.coro_id;
+		return wire_imm;
+	}
+
+	wire_imm.is_ext = 1;
+	ext_hdr->mchn_id = imm.mchn_id;
+	ext_hdr->coro_id = imm.coro_id;
+	ext_hdr->num_reqs = imm.num_reqs;
+	return wire_imm;
+}
+
+/*
+ * Convert the wire immediate @wire_rep of a received packet with @*len bytes
+ * at @buf. If the packet has an extension header, remove it from @*len.
+ */
+static inline union rpc_imm rpc_imm_from_wire(uint32_t wire_rep,
+	const uint8_t *buf, size_t *len)
+{
+	union rpc_wire_imm wire_imm;
+	wire_imm.int_rep = wire_rep;
+
+	union rpc_imm imm;
+	imm.int_rep = 0;
+	imm.is_req = wire_imm.is_req;
+	imm.config_id = wire_imm.config_id;
+	imm.batch_slot = wire_imm.batch_slot;
+	imm.is_frag = wire_imm.is_frag;
+	imm.req_seq = wire_imm.req_seq;
+	imm.is_packed = wire_imm.is_packed;
+
+	if(likely(wire_imm.is_ext == 0)) {
+		imm.num_reqs = wire_imm.num_reqs;
+		imm.mchn_id = wire_imm.mchn_id;
+		imm.coro_id = wire_imm.coro_id;
+		return imm;
+	}
+
+	rpc_ext_hdr_t ext_hdr;
+	*len -= RPC_EXT_HDR_BYTES;
+	memcpy(&ext_hdr, &buf[*len], RPC_EXT_HDR_BYTES);
+	imm.num_reqs = ext_hdr.num_reqs;
+	imm.mchn_id = ext_hdr.mchn_id;
+	imm.coro_id = ext_hdr.coro_id;
+	return imm;
+}
+#else
+#define RPC_EXT_HDR_BYTES 0
+#endif
+
+/* UD SENDs: a payload SGE, and an SGE for the extension header if needed */
+#define RPC_SEND_SGES (HOTS_ENABLE_EXT_HDR == 1 ? 2 : 1)
+static_assert(RPC_SEND_SGES <= HRD_DGRAM_MAX_SEND_SGE, "");
+
+/* Max payload of an inline SEND, leaving room for an extension header */
+#define RPC_MAX_INLINE (HRD_MAX_INLINE - RPC_EXT_HDR_BYTES)
+
+/* The request batch (see RPC_MAX_BATCH) of a message with immediate @imm */
+static inline int rpc_imm_batch(union rpc_imm imm)
+{
+	return imm.coro_id + imm.batch_slot * RPC_MAX_CORO;
+}
+
+/* True iff request sequence number @seq is newer than @prev_seq (wraps) */
+static inline bool rpc_req_seq_newer(uint32_t seq, uint32_t prev_seq)
+{
+	uint32_t diff = (seq - prev_seq) & ((1 << RPC_REQ_SEQ_BITS) - 1);
+	return diff != 0 && diff < (1 << (RPC_REQ_SEQ_BITS - 1));
+}
 
 // Messaging interface
 typedef uint8_t rpc_reqtype_t;
@@ -113,16 +449,77 @@ struct rpc_cmsg_reqhdr_t {
 	};
 	uint8_t coro_seqnum;
 	uint8_t magic :4;
-	uint16_t size :12; /* Size of request/resp (bytes) excluding header */
+	uint16_t size_qw :12; /* Size of request/resp (8-byte words) excl. header */
+
+	/* Size of request/resp (bytes) excluding header */
+	size_t get_size() const
+	{
+		return size_qw * sizeof(uint64_t);
+	}
+
+	void set_size(size_t size)
+	{
+		rpc_dassert(size % sizeof(uint64_t) == 0 && size <= RPC_MAX_REQ_SIZE);
+		size_qw = size / sizeof(uint64_t);
+	}
 };
 static_assert(sizeof(rpc_cmsg_reqhdr_t) == sizeof(uint32_t), "");
 
+/*
+ * Header of a fragment of a coalesced message larger than max_pkt_size. The
+ * fragment's data follows the header.
+ */
+struct rpc_frag_hdr_t {
+	uint32_t msg_len;	/* Length of the full coalesced message */
+	uint32_t frag_off;	/* Offset of this fragment's data in the message */
+	uint16_t frag_idx;
+	uint16_t num_frags;
+	uint32_t reserved;	/* Keeps fragment data 8-byte aligned */
+};
+static_assert(sizeof(rpc_frag_hdr_t) == 16, "");
+
+/*
+ * A packed packet (imm.is_packed) carries coalesced messages for different
+ * coroutines, all of the same type (requests or responses) and to the same
+ * machine. The packet's imm.num_reqs is the number of coalesced messages,
+ * each of which is preceded by an rpc_pack_hdr_t with its own immediate.
+ */
+struct rpc_pack_hdr_t {
+	rpc_imm_int_t imm;	/* Immediate of the coalesced message */
+	uint32_t len;	/* Length of the coalesced message */
+};
+static_assert(sizeof(rpc_pack_hdr_t) % sizeof(rpc_cmsg_reqhdr_t) == 0, "");
+
+/* A coalesced message to be sent, possibly in a packed packet */
+struct rpc_pack_msg_t {
+	uint8_t *buf;
+	size_t len;
+	rpc_imm_int_t imm;
+	hots_mbuf_t *resp_mbuf;	/* For responses: swapped if sent non-inline */
+	bool pkt_lead;	/* Set by send_packed(): first message in its packet */
+};
+
+/* Reassembly state for a fragmented coalesced message */
+struct rpc_reasm_t {
+	uint8_t *buf;	/* Destination of the reassembled message */
+	uint64_t frag_bitmap;	/* Fragments received so far */
+	int frags_rcvd;
+	uint32_t req_seq;	/* Request sequence number of the message */
+
+	void reset()
+	{
+		frag_bitmap = 0;
+		frags_rcvd = 0;
+	}
+};
+#define RPC_MAX_FRAGS 64	/* Bits in rpc_reasm_t::frag_bitmap */
+
 /* A coalesced message */
 struct rpc_cmsg_t {
 	int remote_mn;	/* The remote machine */
-	uint32_t resp_imm;	/* Saved immediate at responder; unused at requester */
-
 	int num_centry;	/* Number of coalesced requests (or responses) in the msg */
+	rpc_imm_int_t resp_imm;	/* Saved immediate at responder; unused at requester */
+
 	hots_mbuf_t req_mbuf;	/* Buffer for coalesced requests */
 	hots_mbuf_t resp_mbuf;	/* Buffer for the coalesced response */
 };
@@ -138,6 +535,10 @@ static_assert(sizeof(rpc_cmsg_t) <= 64, "");	/* Just for performance */
  * 2. req_buf and resp_buf below are different from req_mbuf and resp_mbuf
  *    in the coalesced message structure (rpc_cmsg_t). req->req_buf is a pointer
  *    into cmsg->req_mbuf. req->resp_buf is a user-owned buffer. 
+ * 3. Zero-copy responses: If the user passes resp_buf = NULL, the response is
+ *    not copied. On completion, resp_buf points to the response inside the RPC
+ *    layer's RECV buffer (only 4-byte aligned). It stays valid until the next
+ *    clear_req_batch() or release_resps() by this coroutine.
  */
 struct rpc_req_t {
 	/* The RPC user appends the request here: */
@@ -152,21 +553,22 @@ struct rpc_req_t {
 	hots_mbuf_t *_cmsg_req_mbuf;	/* Bump this on freeze()ing */
 	rpc_cmsg_reqhdr_t *_cmsg_reqhdr;	/* Put req_len here on freeze()ing */
 
-	uint8_t *resp_buf;	/* User-supplied */
+	uint8_t *resp_buf;	/* User-supplied, or set by RPC for zero-copy */
 	size_t max_resp_len;	/* Size of the user-supplied buffer */
+	bool zero_copy;	/* True iff the user supplied a NULL resp_buf */
 
 	size_t resp_len;	/* Actual response size */
 	rpc_resptype_t resp_type;
 
 	/* Append _req_len bytes to this request */
-	inline void freeze(size_t _req_len)
+	void freeze(size_t _req_len)
 	{
 		rpc_dassert(_req_len % sizeof(uint64_t) == 0);
 		rpc_dassert(_cmsg_reqhdr != NULL && _cmsg_req_mbuf != NULL);
 
 		/* Fill in size field of the coalesced message's request header */
 		rpc_dassert(_cmsg_reqhdr->magic == RPC_CMSG_REQ_HDR_MAGIC);
-		_cmsg_reqhdr->size = _req_len;
+		_cmsg_reqhdr->set_size(_req_len);
 		
 		req_len = _req_len;	/* Local req_len is currently unused */
 		_cmsg_req_mbuf->cur_buf += _req_len;	
@@ -175,7 +577,7 @@ struct rpc_req_t {
 	}
 
 	/* Bytes available to an RPC user */
-	inline size_t available_bytes()
+	size_t available_bytes()
 	{
 		return _cmsg_req_mbuf->available_bytes();
 	}
@@ -193,13 +595,29 @@ struct rpc_req_batch_t {
 	int cmsg_for_mc[HOTS_MAX_MACHINES];
 	rpc_cmsg_t cmsg_arr[RPC_MAX_MSG_CORO];
 
+	/* Coalesced messages that have received a response: for retransmission */
+	uint32_t resp_rcvd_mask;
+	uint32_t credit_wait_mask;	/* Coalesced messages waiting for credits */
+	uint32_t may_defer_mask;	/* Coalesced messages that cannot run locally */
+	uint8_t credits_used[RPC_MAX_MSG_CORO];	/* Returned by each response */
+
+	/* Zero-copy responses */
+	int num_zero_copy;	/* Number of zero-copy requests in this batch */
+	int num_held_recvs;	/* RECV buffers held by this batch's responses */
+	int held_recv[RPC_MAX_MSG_CORO];	/* Indices of held RECV buffers */
+
 	/* Reset the used coalesced message - for runtime use */
-	inline void clear()
+	void clear()
 	{
 		/* Clearing should only be done after receiving all completions */
 		rpc_dassert(num_reqs_done == num_reqs);
+		rpc_dassert(num_held_recvs == 0);	/* Released by the Rpc */
+		rpc_dassert(credit_wait_mask == 0);	/* All requests were sent */
 		num_reqs = 0;
 		num_reqs_done = 0;
+		resp_rcvd_mask = 0;
+		may_defer_mask = 0;
+		num_zero_copy = 0;
 
 		for(int i = 0; i < num_uniq_mn; i++) {
 			rpc_dassert(cmsg_for_mc[cmsg_arr[i].remote_mn] != -1);
@@ -215,16 +633,91 @@ struct rpc_req_batch_t {
 	}
 };
 
+static_assert(RPC_MAX_MSG_CORO <= 32, "");	/* For resp_rcvd_mask */
+
+/*
+ * The last coalesced request handled for a remote (machine, request batch).
+ * If it had non-idempotent requests, its response is kept for answering
+ * retransmitted requests without running the handlers again.
+ */
+struct rpc_resp_cache_t {
+	bool valid;
+	bool pending;	/* The response for @req_seq is not complete yet */
+	bool deferred;	/* ...because it has deferred responses */
+	bool non_idempotent;	/* @buf holds the response once it is complete */
+	uint32_t req_seq;	/* Sequence number of the request */
+	uint8_t *buf;	/* Copy of the coalesced response; allocated on first use */
+	size_t len;
+};
+
+/*
+ * A request given to a batch handler. The handler writes the response to
+ * @resp_buf, which has room for the max_resp_len given at registration, and
+ * sets @resp_type and @resp_len.
+ */
+struct rpc_batch_req_t {
+	const uint8_t *req_buf;
+	size_t req_len;
+	uint8_t *resp_buf;
+	rpc_resptype_t resp_type;
+	size_t resp_len;
+};
+
+/* A received request that waits for its batch handler */
+struct rpc_batch_ent_t {
+	rpc_cmsg_reqhdr_t *req_hdr;	/* The request follows its header */
+	rpc_cmsg_reqhdr_t *resp_hdr;	/* Response slot in the coalesced resp */
+	rpc_resptype_t resp_type;	/* Set after the batch handler runs */
+	size_t resp_len;
+};
+
+/*
+ * A coalesced response with deferred responses. A deferred response's token
+ * is (slot * RPC_MAX_MSG_CORO + coro_seqnum) of its request.
+ */
+struct rpc_deferred_t {
+	uint8_t *msg;	/* Current location of the coalesced response */
+	uint8_t *buf;	/* Holds it after poll_comps(); allocated on first use */
+	size_t len;
+	int resp_i;	/* Index into resp_batch.cmsg_arr until held */
+	int remote_mn;
+	rpc_imm_int_t resp_imm;
+	int num_centry;
+	int num_pending;	/* Deferred responses not completed yet */
+};
+
+/* A slave coroutine's coalesced request, e.g., waiting for credits */
+struct rpc_cmsg_ref_t {
+	uint8_t batch_id;	/* See RPC_MAX_BATCH */
+	uint8_t msg_i;	/* Index into the batch's cmsg_arr */
+};
+
+/* A response buffer that is in use by a non-inline SEND */
+struct rpc_busy_buf_t {
+	uint8_t *buf;
+	size_t send_seq;	/* Sequence number of the SEND on its QP */
+};
+
+/* A SEND queued in a QP's backlog. Its data is in Rpc::backlog_buf. */
+struct rpc_backlog_send_t {
+	int mn;	/* Destination machine */
+	size_t len;
+	rpc_imm_int_t imm;
+};
+
 /* One @rpc_resp_batch_t structure per Rpc object (for the master coro) */
 struct rpc_resp_batch_t {
 	int num_cresps;	/* Number of coalesced responses == used cmsg_arr entries */
 	rpc_cmsg_t cmsg_arr[HRD_RQ_DEPTH];
 
-	/* For copying large responses. Not needed for requests - see Rpc README */
-	uint8_t *non_inline_bufs[HRD_RQ_DEPTH];
-	int non_inline_index;
+	/*
+	 * Spare response buffers to swap with response mbufs that are sent
+	 * non-inline. Not needed for requests - see Rpc README.
+	 */
+	uint8_t *free_bufs[HRD_RQ_DEPTH];
+	int num_free_bufs;
 
-	inline void clear()
+	void clear()
 	{
 		/* Reset the coalesced response mbufs */
 		for(int i = 0; i < num_cresps; i++) {
@@ -235,6 +728,50 @@ struct rpc_resp_batch_t {
 	}
 };
 
+/*
+ * A latency histogram in TSC cycles. Bucket b > 0 counts samples in
+ * [2^(b - 1), 2^b), so percentiles are accurate to a factor of 2.
+ */
+#define RPC_LAT_HIST_BUCKETS 40	/* Last bucket: >= 2^38 cycles (~1 minute) */
+struct rpc_lat_hist_t {
+	size_t count[RPC_LAT_HIST_BUCKETS];
+	size_t num_samples;
+	size_t tot_cycles;
+
+	void reset()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	/* Record @weight samples of @cycles cycles each */
+	forceinline void record(size_t cycles, size_t weight)
+	{
+		int bucket = (cycles == 0) ? 0 : 64 - __builtin_clzll(cycles);
+		if(unlikely(bucket >= RPC_LAT_HIST_BUCKETS)) {
+			bucket = RPC_LAT_HIST_BUCKETS - 1;
+		}
+
+		count[bucket] += weight;
+		num_samples += weight;
+		tot_cycles += cycles * weight;
+	}
+
+	/* Upper bound in cycles of the bucket that holds percentile @pct */
+	size_t percentile(double pct) const
+	{
+		size_t rank = (size_t) (pct / 100 * num_samples);
+		size_t seen = 0;
+		for(int bucket = 0; bucket < RPC_LAT_HIST_BUCKETS; bucket++) {
+			seen += count[bucket];
+			if(seen > rank) {
+				return (size_t) 1 << bucket;
+			}
+		}
+
+		return (size_t) 1 << (RPC_LAT_HIST_BUCKETS - 1);
+	}
+};
+
 /* RPC constructor arguments */
 struct rpc_args {
 	// Constructor args
@@ -250,7 +787,16 @@ struct rpc_args {
 	int num_qps;	/* Number of QPs to use per port */
 	int numa_node;	/* Socket to allocate hugepages from */
 	int postlist;	/* Maximum postlist size; larger batches use > 1 send()s. */
-	size_t max_pkt_size;	/* Mbuf size for holding coalesced reqs/resps */
+	size_t max_pkt_size;	/* Maximum size of a packet on the wire */
+	size_t max_msg_size;	/* Mbuf size for holding coalesced reqs/resps */
+
+	/*
+	 * Request batches that slaves use besides the regular one. They size the
+	 * RECV and credit budgets, so apps that need fewer should lower them after
+	 * construction. The defaults allow all batches.
+	 */
+	int num_futures;	/* Futures used per slave, at most RPC_MAX_FUTURES */
+	bool use_oneway;	/* Slaves use the one-way batch */
 
 	// Derived
 	int num_machines;	/* Total machines in cluster */
@@ -261,13 +807,15 @@ struct rpc_args {
 		int num_coro,
 		int base_port_index, int num_ports,
 		int num_qps, int numa_node, int postlist,
-		int max_pkt_size) :
+		int max_pkt_size, int max_msg_size = 0) :
 		wrkr_gid(wrkr_gid), wrkr_lid(wrkr_lid),
 		num_workers(num_workers), workers_per_machine(workers_per_machine),
 		num_coro(num_coro),
 		base_port_index(base_port_index), num_ports(num_ports),
 		num_qps(num_qps), numa_node(numa_node), postlist(postlist),
-		max_pkt_size(max_pkt_size) {
+		max_pkt_size(max_pkt_size),
+		max_msg_size(max_msg_size == 0 ? max_pkt_size : max_msg_size),
+		num_futures(RPC_MAX_FUTURES), use_oneway(RPC_ENABLE_ONEWAY == 1) {
 
 		assert(num_workers > workers_per_machine);
 		assert(num_workers % workers_per_machine == 0);
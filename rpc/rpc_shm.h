@@ -0,0 +1,176 @@
+// Shared-memory transport for RPC endpoints on the same host
+
+#ifndef RPC_SHM_H
+#define RPC_SHM_H
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "libhrd/hrd.h"
+#include "hots.h"
+#include "rpc/rpc_defs.h"
+#include "mica/util/barrier.h"
+
+/*
+ * A single-producer single-consumer ring of packets between two RPC endpoints
+ * on the same host. Ring (src_mn, dst_mn, lid) carries packets from worker
+ * @lid of machine @src_mn to worker @lid of machine @dst_mn, exactly like the
+ * UD QP it replaces.
+ *
+ * Each slot holds the 32-bit RPC immediate, the packet length, and the packet
+ * itself (with its extension header, if any). The packet starts at a 64-byte
+ * aligned address, so the consumer can hand out a slot to the RPC datapath as
+ * if it were a RECV buffer.
+ *
+ * The producer only writes @tail and the consumer only writes @head. We rely on
+ * x86's TSO, so only compiler barriers are needed.
+ */
+#define RPC_SHM_RING_SLOTS HRD_RQ_DEPTH	/* Same capacity as a RECV queue */
+#define RPC_SHM_RING_READY 0x3185	/* Set by the consumer after reset */
+#define RPC_SHM_SLOT_BUF_SIZE \
+	(RPC_MAX_MAX_PKT_SIZE + (RPC_EXT_HDR_BYTES > 0 ? 64 : 0))
+
+struct rpc_shm_slot_t {
+	uint32_t imm;	/* Immediate, formatted like the UD immediate */
+	uint32_t len;	/* Packet length, including any extension header */
+	uint8_t pad[64 - 2 * sizeof(uint32_t)];
+
+	uint8_t buf[RPC_SHM_SLOT_BUF_SIZE];
+};
+static_assert(sizeof(rpc_shm_slot_t) % 64 == 0, "");
+
+struct rpc_shm_ring_t {
+	volatile size_t tail;	/* Written by the producer */
+	uint8_t pad_1[64 - sizeof(size_t)];
+
+	volatile size_t head;	/* Written by the consumer */
+	volatile size_t ready;	/* Written by the consumer */
+	uint8_t pad_2[64 - 2 * sizeof(size_t)];
+
+	rpc_shm_slot_t slot[RPC_SHM_RING_SLOTS];
+};
+static_assert(sizeof(rpc_shm_ring_t) % 64 == 0, "");
+
+/* SHM key for the ring from (@src_mn, @lid) to (@dst_mn, @lid) */
+static inline int rpc_shm_ring_key(int src_mn, int dst_mn, int lid)
+{
+	assert(src_mn >= 0 && src_mn < HOTS_MAX_MACHINES);
+	assert(dst_mn >= 0 && dst_mn < HOTS_MAX_MACHINES);
+	assert(lid >= 0 && lid < HOTS_MAX_SERVER_THREADS);
+
+	int key = RPC_SHM_RING_BASE_SHM_KEY +
+		((src_mn * HOTS_MAX_MACHINES) + dst_mn) * HOTS_MAX_SERVER_THREADS + lid;
+	assert(key < RPC_SHM_RING_MAX_SHM_KEY);
+	return key;
+}
+
+/*
+ * Create or attach to the ring with SHM key @shm_key. Both endpoints call this,
+ * so whoever comes first creates the (zeroed) ring.
+ */
+static rpc_shm_ring_t* rpc_shm_ring_get(int shm_key)
+{
+	int shmid = shmget(shm_key, sizeof(rpc_shm_ring_t), IPC_CREAT | 0666);
+	if(shmid == -1) {
+		hrd_red_printf("Rpc: SHM ring error: shmget() failed for key %d: %s\n",
+			shm_key, strerror(errno));
+		exit(-1);
+	}
+
+	void *buf = shmat(shmid, NULL, 0);
+	if(buf == (void *) -1) {
+		hrd_red_printf("Rpc: SHM ring error: shmat() failed for key %d\n",
+			shm_key);
+		exit(-1);
+	}
+
+	assert(is_aligned(buf, 64));
+	return (rpc_shm_ring_t *) buf;
+}
+
+/* Consumer-side reset. Must be done before the producer pushes any packet. */
+static void rpc_shm_ring_reset(rpc_shm_ring_t *ring)
+{
+	ring->ready = 0;
+	ring->head = 0;
+	ring->tail = 0;
+	::mica::util::memory_barrier();
+	ring->ready = RPC_SHM_RING_READY;
+}
+
+/* Producer-side wait for the consumer to reset the ring */
+static void rpc_shm_ring_wait_ready(rpc_shm_ring_t *ring)
+{
+	while(ring->ready != RPC_SHM_RING_READY) {
+		usleep(20000);
+	}
+}
+
+/*
+ * Copy a packet of @len bytes into the ring, followed by @ext_hdr if it is
+ * non-NULL. Return false if the ring is full, which the caller treats like a
+ * UD packet drop.
+ */
+#if HOTS_ENABLE_EXT_HDR == 1
+forceinline bool rpc_shm_ring_push(rpc_shm_ring_t *ring, uint32_t imm,
+	const uint8_t *buf, size_t len, const rpc_ext_hdr_t *ext_hdr)
+#else
+forceinline bool rpc_shm_ring_push(rpc_shm_ring_t *ring, uint32_t imm,
+	const uint8_t *buf, size_t len)
+#endif
+{
+	rpc_dassert(len <= RPC_MAX_MAX_PKT_SIZE);
+
+	size_t tail = ring->tail;
+	if(unlikely(tail - ring->head == RPC_SHM_RING_SLOTS)) {
+		return false;
+	}
+
+	rpc_shm_slot_t *slot = &ring->slot[tail % RPC_SHM_RING_SLOTS];
+	memcpy(slot->buf, buf, len);
+#if HOTS_ENABLE_EXT_HDR == 1
+	if(unlikely(ext_hdr != NULL)) {
+		memcpy(&slot->buf[len], ext_hdr, RPC_EXT_HDR_BYTES);
+		len += RPC_EXT_HDR_BYTES;
+	}
+#endif
+	slot->imm = imm;
+	slot->len = len;
+
+	::mica::util::memory_barrier();	/* Publish the slot before the tail */
+	ring->tail = tail + 1;
+	return true;
+}
+
+/*
+ * Fill up to @max_comps completions from the ring into @wc, formatted like
+ * UD RECV completions (wr_id is the GRH address and byte_len includes the
+ * GRH). The slots stay owned by the consumer until rpc_shm_ring_release().
+ */
+forceinline int rpc_shm_ring_poll(rpc_shm_ring_t *ring, struct ibv_wc *wc,
+	int max_comps)
+{
+	size_t head = ring->head;
+	size_t avail = ring->tail - head;
+	::mica::util::memory_barrier();	/* Read the tail before the slots */
+
+	int comps = (avail < (size_t) max_comps) ? (int) avail : max_comps;
+	for(int i = 0; i < comps; i++) {
+		rpc_shm_slot_t *slot = &ring->slot[(head + i) % RPC_SHM_RING_SLOTS];
+		wc[i].wr_id = (uint64_t) slot->buf - HOTS_GRH_BYTES;
+		wc[i].imm_data = slot->imm;
+		wc[i].byte_len = slot->len + HOTS_GRH_BYTES;
+		wc[i].status = IBV_WC_SUCCESS;
+	}
+
+	return comps;
+}
+
+/* Return @num_slots polled slots to the producer */
+forceinline void rpc_shm_ring_release(rpc_shm_ring_t *ring, size_t num_slots)
+{
+	::mica::util::memory_barrier();	/* Finish reading before releasing */
+	ring->head += num_slots;
+}
+
+#endif /* RPC_SHM_H */
@@ -11,6 +11,7 @@
 // Subsystems
 #define RPC_LOCKSERVER_REQ 1	/* Lock server */
 #define RPC_LOGGER_REQ 2		/* Logger */
+#define RPC_PROCSERVER_REQ 3	/* Stored procedures */
 
 
 // Datastores. If the RPC type for a store is n, then types n + 1, and n + 2
@@ -20,10 +21,7 @@
 #define RPC_PRIMARY_DS_REQ_SPACING 10
 
 
-// MICA datastores. All RPC types larger than RPC_MICA_REQ_BASE must be MICA
-// requests. This is required for prefetching in the RPC datapath.
-
-#define RPC_MICA_REQ_BASE 20
+// MICA datastores
 
 /* dist-kv */
 #define RPC_MICA_REQ 20
@@ -51,6 +49,8 @@ static std::string rpc_type_to_string(int rpc_type)
 			return std::string("RPC_LOCKSERVER_REQ");
 		case RPC_LOGGER_REQ:
 			return std::string("RPC_LOGGER_REQ");
+		case RPC_PROCSERVER_REQ:
+			return std::string("RPC_PROCSERVER_REQ");
 		case RPC_MICA_REQ:
 			return std::string("RPC_MICA_REQ-primary");
 		case RPC_MICA_REQ + 1:
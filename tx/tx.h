@@ -5,6 +5,7 @@
 #include <vector>
 #include <set>
 #include <climits>
+#include <algorithm>
 
 #include "hots.h"
 #include "tx/tx_defs.h"
@@ -13,6 +14,7 @@
 #include "datastore/ds.h"
 #include "logger/logger.h"
 #include "lockserver/lockserver.h"
+#include "procserver/procserver.h"
 #include "mappings/mappings.h"
 
 class Tx {
@@ -38,9 +40,14 @@ private:
 	log_record_t *local_log_record;	/* Local log record for this coroutine */
 
 	// Tracking info
-	rpc_req_t *tx_req_arr[RPC_MAX_MSG_CORO];
+	rpc_req_t *tx_req_arr[TX_MAX_WAVE_REQS];	/* Requests of current wave */
+#if RPC_ENABLE_ZERO_COPY_RESP == 0
+	hots_hdr_t wave_hdr_arr[TX_MAX_WAVE_REQS];	/* Header-only responses */
+#endif
+	uint32_t wave_fut_mask;	/* Futures sent in the current wave */
 	tx_status_t tx_status;
 	bool lockserver_locked;	/* Have we locked at the lock server? */
+	uint64_t commit_ts;	/* TicToc commit timestamp */
 
 	/* Read/Write sets */
 	std::vector<tx_rwset_item_t> read_set;
@@ -55,6 +62,10 @@ private:
 	 */
 	std::set<std::pair<rpc_reqtype_t, hots_key_t>> key_set;
 
+	/* Stored procedures: response, and write set objects of prepared txns */
+	procsrv_resp_t proc_resp;
+	hots_obj_t proc_obj_arr[PROCSERVER_MAX_KEYS];
+
 	// Stats
 	long long stat_lockserver_lock_req;
 	long long stat_lockserver_lock_req_success;
@@ -67,6 +78,96 @@ private:
 		yield(coro_arr[nc]);
 	}
 
+	/* Release the responses of the current wave, including its futures */
+	forceinline void wave_release()
+	{
+		rpc->release_resps(coro_id);
+#if RPC_MAX_FUTURES > 0
+		for(int fut = 0; fut < RPC_MAX_FUTURES; fut++) {
+			if((wave_fut_mask & (1u << fut)) != 0) {
+				rpc->clear_future(coro_id, fut);
+			}
+		}
+#endif
+		wave_fut_mask = 0;
+	}
+
+	/* Start a new wave of requests */
+	forceinline void wave_clear()
+	{
+		wave_release();
+		rpc->clear_req_batch(coro_id);
+	}
+
+	/*
+	 * Start request @req_i of the current wave. Requests fill the regular
+	 * batch first, and then the futures in order.
+	 */
+	forceinline rpc_req_t* wave_start_req(size_t req_i,
+		rpc_reqtype_t req_type, int resp_mn, uint8_t *resp_buf,
+		size_t max_resp_len)
+	{
+		tx_dassert(req_i < TX_MAX_WAVE_REQS);
+		rpc_req_t *req;
+
+#if RPC_MAX_FUTURES > 0
+		int batch_i = (int) (req_i / RPC_MAX_MSG_CORO);
+		if(batch_i > 0) {
+			req = rpc->start_new_future_req(coro_id, batch_i - 1,
+				req_type, resp_mn, resp_buf, max_resp_len);
+			tx_req_arr[req_i] = req;
+			return req;
+		}
+#endif
+
+		req = rpc->start_new_req(coro_id, req_type, resp_mn,
+			resp_buf, max_resp_len);
+		tx_req_arr[req_i] = req;
+		return req;
+	}
+
+	/*
+	 * Response buffer for wave request @req_i, whose response is only a
+	 * header. With zero-copy responses, the header is read in place from the
+	 * RPC layer's buffers until wave_release().
+	 */
+	forceinline uint8_t* wave_hdr_buf(size_t req_i)
+	{
+		tx_dassert(req_i < TX_MAX_WAVE_REQS);
+#if RPC_ENABLE_ZERO_COPY_RESP == 1
+		_unused(req_i);
+		return NULL;
+#else
+		return (uint8_t *) &wave_hdr_arr[req_i];
+#endif
+	}
+
+	/* Send the @num_reqs requests of the current wave and wait for them all */
+	forceinline void wave_send(coro_yield_t &yield, size_t num_reqs)
+	{
+		tx_dassert(num_reqs >= 1 && num_reqs <= TX_MAX_WAVE_REQS);
+
+#if RPC_MAX_FUTURES > 0
+		/* Send the futures first: they do not make us yield */
+		int num_fut = (int) ((num_reqs - 1) / RPC_MAX_MSG_CORO);
+		for(int fut = 0; fut < num_fut; fut++) {
+			rpc->send_future(coro_id, fut);
+			wave_fut_mask |= (1u << fut);
+		}
+#endif
+
+		rpc->send_reqs(coro_id);
+		tx_yield(yield);
+
+#if RPC_MAX_FUTURES > 0
+		/* The regular batch is done. Wait for the futures that are not. */
+		if(wave_fut_mask != 0 &&
+				rpc->wait_futures(coro_id, wave_fut_mask, true)) {
+			tx_yield(yield);
+		}
+#endif
+	}
+
 	/* tx_lockserver.h */
 	forceinline bool send_lockserver_req(coro_yield_t &yield,
 		locksrv_reqtype_t req_type);
@@ -85,6 +186,7 @@ public:
 
 		if(mappings->use_lock_server) {
 			assert(TX_ENABLE_LOCK_SERVER == 1);
+			assert(TX_ENABLE_TICTOC == 0);	/* TicToc needs per-key locks */
 		}
 
 		/* Get coroutine info from Rpc */
@@ -102,8 +204,9 @@ public:
 
 		/* Initialize Tx fields */
 		tx_status = tx_status_t::aborted;
-		read_set.reserve(RPC_MAX_MSG_CORO);
-		write_set.reserve(RPC_MAX_MSG_CORO);
+		read_set.reserve(TX_MAX_KEYS);
+		write_set.reserve(TX_MAX_KEYS);
+		wave_fut_mask = 0;
 
 		lockserver_locked = false;
 
@@ -162,6 +265,7 @@ public:
 				mappings->get_backup_mn_from_primary(item.primary_mn, i);
 		}
 
+		tx_dassert(read_set.size() + write_set.size() < TX_MAX_KEYS);
 		read_set.push_back(item);
 		return item.primary_mn;
 	}
@@ -198,12 +302,23 @@ public:
 				mappings->get_backup_mn_from_primary(item.primary_mn, i);
 		}
 
+		tx_dassert(read_set.size() + write_set.size() < TX_MAX_KEYS);
 		write_set.push_back(item);
 		return item.primary_mn;
 	}
 
+	/* Primary machine of @key, e.g., to check if a txn is single-partition */
+	forceinline int get_primary_mn(hots_key_t key)
+	{
+		return mappings->get_primary_mn(ds_keyhash(key));
+	}
+
 	// User API
 
+	/* tx_proc.h */
+	forceinline tx_status_t run_proc(coro_yield_t &yield, int primary_mn,
+		int proc_id, const void *params, size_t params_len, void *out);
+
 	/* tx_execute.h */
 	forceinline tx_status_t do_read(coro_yield_t &yield);
 
@@ -232,6 +347,15 @@ public:
 		tx_dassert(item.obj->val_size % sizeof(uint64_t) == 0);
 	}
 
+	/* Record the TicToc timestamps of the bucket version read in execute */
+	forceinline void record_tictoc_ts(tx_rwset_item_t &item)
+	{
+		if(TX_ENABLE_TICTOC == 1) {
+			item.exec_wts = hots_tictoc_wts(item.obj->hdr);
+			item.exec_rts = hots_tictoc_rts(item.obj->hdr);
+		}
+	}
+
 	/* tx_commit.h */
 	forceinline void send_updates_to_replicas(coro_yield_t &yield,
 		std::vector<int> replica_vec);
@@ -239,9 +363,21 @@ public:
 	forceinline void abort(coro_yield_t &yield);
 	forceinline bool validate(coro_yield_t &yield);
 
+	/* tx_tictoc.h */
+	forceinline bool tictoc_lock_write_set(coro_yield_t &yield);
+	forceinline bool tictoc_validate(coro_yield_t &yield);
+	forceinline bool tictoc_prepare(coro_yield_t &yield);
+
 	/* tx_logger.h */
 	forceinline bool log(coro_yield_t &yield);
 
+	/* Size of the update requests sent to primaries during commit */
+	static size_t put_req_size(size_t val_size)
+	{
+		return TX_ENABLE_TICTOC == 1 ? ds_tictoc_put_req_size(val_size) :
+			ds_put_req_size(val_size);
+	}
+
 	/*
 	 * Returns the maximum RPC-level packet size (inclusive of coalesced
 	 * message request headers) generated by a transaction that updates
@@ -261,7 +397,7 @@ public:
 		assert(ds_put_req_size(val_size) == 3 * sizeof(uint64_t) + val_size);
 
 		size_t max_put_req_size = num_keys *
-			(sizeof(rpc_cmsg_reqhdr_t) + ds_put_req_size(val_size));
+			(sizeof(rpc_cmsg_reqhdr_t) + put_req_size(val_size));
 
 		size_t max_log_record_size = sizeof(uint64_t) + /* Log record header */
 			sizeof(rpc_cmsg_reqhdr_t) + /* One message in the batch */
@@ -274,6 +410,33 @@ public:
 		}
 	}
 
+	/*
+	 * Returns the maximum coalesced message size generated by a transaction
+	 * that accesses @num_keys keys with value size up to @val_size. This
+	 * equals max_pkt_size() for transactions with up to RPC_MAX_MSG_CORO keys.
+	 * Wider transactions coalesce up to RPC_MAX_MSG_CORO requests of a batch
+	 * into one message, so apps pass this as the Rpc's @max_msg_size and let
+	 * the RPC subsystem fragment larger messages.
+	 */
+	static size_t max_msg_size(int num_keys, size_t val_size)
+	{
+		size_t reqs_per_msg = std::min(num_keys, RPC_MAX_MSG_CORO);
+		size_t max_put_msg_size = reqs_per_msg *
+			(sizeof(rpc_cmsg_reqhdr_t) + put_req_size(val_size));
+
+		/* A log message contains log records for one backup */
+		size_t keys_per_record = std::min(num_keys, LOGGER_KEYS_PER_RECORD);
+		size_t num_records = (num_keys + LOGGER_KEYS_PER_RECORD - 1) /
+			LOGGER_KEYS_PER_RECORD;
+		size_t max_log_msg_size =
+			std::min(num_records, (size_t) RPC_MAX_MSG_CORO) *
+			(sizeof(uint64_t) + /* Log record header */
+			sizeof(rpc_cmsg_reqhdr_t) +
+			keys_per_record * (3 * sizeof(uint64_t) + val_size));
+
+		return std::max(max_put_msg_size, max_log_msg_size);
+	}
+
 	// Stats
 	std::string get_stats()
 	{
@@ -306,5 +469,7 @@ public:
 #include "tx_logger.h"
 #include "tx_execute.h"
 #include "tx_commit.h"
+#include "tx_tictoc.h"
+#include "tx_proc.h"
 
 #endif /* TX_H */
@@ -1,7 +1,12 @@
 #ifndef TX_COMMIT_H
 #define TX_COMMIT_H
 
-/* Send update messages to all replicas in @replica_vec in one batch */
+/*
+ * Send update messages to all replicas in @replica_vec, in as few waves as
+ * possible. Updates to only the primaries are sent one-way if they fit in one
+ * batch: the keys stay locked until the updates are applied, so we need not
+ * wait for them.
+ */
 forceinline void Tx::send_updates_to_replicas(coro_yield_t &yield,
 	std::vector<int> replica_vec)
 {
@@ -9,52 +14,76 @@ forceinline void Tx::send_updates_to_replicas(coro_yield_t &yield,
 	tx_dassert(replica_vec.size() >= 1 &&
 		replica_vec.size() <= HOTS_MAX_BACKUPS);
 
-	size_t req_i = 0;
-	rpc->clear_req_batch(coro_id);
+	size_t num_writes = write_set.size();
+	size_t num_reqs = replica_vec.size() * num_writes;
 
-	for(int repl_i : replica_vec) {
-		tx_dassert(repl_i >= 0 && repl_i < mappings->num_replicas);
+	bool oneway = TX_ENABLE_ONEWAY == 1 && replica_vec.size() == 1 &&
+		replica_vec[0] == 0 && num_reqs <= RPC_MAX_MSG_CORO &&
+		rpc->oneway_ready(coro_id);
 
-		for(size_t w_i = 0; w_i < write_set.size(); w_i++) {
-			tx_rwset_item_t &item = write_set[w_i];
+	/* Request r updates key r % num_writes at replica_vec[r / num_writes] */
+	for(size_t wave_base = 0; wave_base < num_reqs;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_reqs - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			size_t r = wave_base + req_i;
+			int repl_i = replica_vec[r / num_writes];
+			tx_dassert(repl_i >= 0 && repl_i < mappings->num_replicas);
+
+			tx_rwset_item_t &item = write_set[r % num_writes];
 
 			int repl_mn = (repl_i == 0) ? item.primary_mn :
 				item.backup_mn[repl_i - 1];
 			uint16_t rpc_reqtype = item.rpc_reqtype + repl_i;
 
-			rpc_req_t *req = rpc->start_new_req(coro_id,
-				rpc_reqtype, repl_mn,
-				(uint8_t *) item.obj->val, sizeof(uint64_t));	/* Small resp */
+			rpc_req_t *req = oneway ?
+				rpc->start_new_oneway_req(coro_id, rpc_reqtype, repl_mn) :
+				wave_start_req(req_i, rpc_reqtype, repl_mn,
+					(uint8_t *) item.obj->val, sizeof(uint64_t)); /* Small */
+
+			/* With TicToc, primaries unlock the key's bucket at commit_ts */
+			bool tictoc = TX_ENABLE_TICTOC == 1 && repl_i == 0;
 
-			tx_dassert(req_i < RPC_MAX_MSG_CORO);
-			tx_req_arr[req_i] = req;
-			req_i++;
-	
 			size_t size_req;
 			if(item.write_mode != tx_write_mode_t::del) {
 				/* Insert or update */
-				size_req = ds_forge_generic_put_req(req, caller_id,
-					item.key, item.keyhash, item.obj, ds_reqtype_t::put);
+				size_req = tictoc ?
+					ds_forge_tictoc_put_req(req, caller_id,
+						item.key, item.keyhash, item.obj, commit_ts) :
+					ds_forge_generic_put_req(req, caller_id,
+						item.key, item.keyhash, item.obj, ds_reqtype_t::put);
 			} else {
 				/* Delete */
-				size_req = ds_forge_generic_get_req(req, caller_id,
-					item.key, item.keyhash, ds_reqtype_t::del);
+				size_req = tictoc ?
+					ds_forge_tictoc_get_req(req, caller_id, item.key,
+						item.keyhash, ds_reqtype_t::tictoc_del, 0, commit_ts) :
+					ds_forge_generic_get_req(req, caller_id,
+						item.key, item.keyhash, ds_reqtype_t::del);
 			}
 			
 			req->freeze(size_req);
 		}
-	}
 
-	tx_dassert(req_i <= RPC_MAX_MSG_CORO);
-	rpc->send_reqs(coro_id);
-	tx_yield(yield);
+		if(oneway) {
+			rpc->send_oneway_reqs(coro_id);
+			return;
+		}
 
-	/* Check the responses */
-	for(size_t _req_i = 0; _req_i < req_i; _req_i++) {
-		uint16_t resp_type = tx_req_arr[_req_i]->resp_type; _unused(resp_type);
-		tx_dassert(resp_type == (uint16_t) ds_resptype_t::put_success ||
-			resp_type == (uint16_t) ds_resptype_t::del_success);
+		wave_send(yield, wave_size);
+
+		/* Check the responses */
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			uint16_t resp_type = tx_req_arr[req_i]->resp_type;
+			_unused(resp_type);
+			tx_dassert(resp_type == (uint16_t) ds_resptype_t::put_success ||
+				resp_type == (uint16_t) ds_resptype_t::del_success);
+		}
 	}
+
+	wave_release();
 }
 
 /* Run the commit phase of this transaction */
@@ -62,7 +91,15 @@ forceinline tx_status_t Tx::commit(coro_yield_t &yield)
 {
 	tx_dassert(tx_status == tx_status_t::in_progress);
 
-	if(TX_ENABLE_LOCK_SERVER == 1 && mappings->use_lock_server) {
+	if(TX_ENABLE_TICTOC == 1) {
+		/* Lock the write set and validate the read set at a commit ts */
+		bool prepare_success = tictoc_prepare(yield);
+		if(!prepare_success) {
+			abort(yield);
+			tx_dassert(tx_status == tx_status_t::aborted);
+			return tx_status_t::aborted;
+		}
+	} else if(TX_ENABLE_LOCK_SERVER == 1 && mappings->use_lock_server) {
 		/* If we're using lockserver, we must have successfully locked */
 		tx_dassert(lockserver_locked);
 	} else {
@@ -108,25 +145,11 @@ forceinline tx_status_t Tx::commit(coro_yield_t &yield)
 	replica_vec.clear();
 
 	if(mappings->num_backups > 0) {
-		/* Can we send the (W * f) messages to backups in one batch? */
-		bool backups_in_one_batch =
-			(write_set.size() * mappings->num_backups) <= RPC_MAX_MSG_CORO;
-
-		// Send to backups
-		if(backups_in_one_batch) {
-			/* Send to all backups in one batch */
-			for(int repl_i = 1; repl_i < mappings->num_replicas; repl_i++) {
-				replica_vec.push_back(repl_i);
-			}
-			send_updates_to_replicas(yield, replica_vec);
-		} else {
-			/* Send to each backup in a separate batch */
-			for(int repl_i = 1; repl_i < mappings->num_replicas; repl_i++) {
-				replica_vec.clear();
-				replica_vec.push_back(repl_i);
-				send_updates_to_replicas(yield, replica_vec);
-			}
+		/* Send to all backups together; large write sets take several waves */
+		for(int repl_i = 1; repl_i < mappings->num_replicas; repl_i++) {
+			replica_vec.push_back(repl_i);
 		}
+		send_updates_to_replicas(yield, replica_vec);
 	}
 
 	// Send to primary
@@ -173,153 +196,149 @@ forceinline void Tx::abort(coro_yield_t &yield)
 	 * If we are here, lockserver is not being used so we need to individually
 	 * unlock the write set keys that we successfully locked. Insert mode keys
 	 * that were successfully (temporarily) inserted were also marked locked
-	 * during execution.
+	 * during execution. Unlocks cannot fail, so send them one-way if possible.
 	 */
-	rpc->clear_req_batch(coro_id);
-
-	size_t req_i = 0;	/* Separate index bc we will skip some write set keys */
-
+	size_t num_locked = 0;
 	for(size_t i = 0; i < write_set.size(); i++) {
-		tx_rwset_item_t &item = write_set[i];
-		if(!item.exec_ws_locked) {
-			continue;
+		if(write_set[i].exec_ws_locked) {
+			num_locked++;
 		}
-
-		rpc_req_t *req = rpc->start_new_req(coro_id,
-			item.rpc_reqtype, item.primary_mn,
-			(uint8_t *) &item.obj->hdr, sizeof(uint64_t)); /* Small resps */
-
-		tx_req_arr[req_i] = req;
-		req_i++;
-
-		size_t size_req = ds_forge_generic_get_req(req, caller_id,
-			item.key, item.keyhash, ds_reqtype_t::unlock);
-		req->freeze(size_req);
 	}
 
 	/* Nothing to unlock */
-	if(req_i == 0) {
+	if(num_locked == 0) {
 		return;
 	}
 
-	rpc->send_reqs(coro_id);
-	tx_yield(yield);
+	bool oneway = TX_ENABLE_ONEWAY == 1 && num_locked <= RPC_MAX_MSG_CORO &&
+		rpc->oneway_ready(coro_id);
 
-	req_i = 0;
+	size_t i = 0;	/* Separate index bc we will skip some write set keys */
 
-	/* Check the response */
-	for(size_t i = 0; i < write_set.size(); i++) {
-		tx_rwset_item_t &item = write_set[i];
-		if(!item.exec_ws_locked) {
-			continue;
+	for(size_t wave_base = 0; wave_base < num_locked;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_locked - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			while(!write_set[i].exec_ws_locked) {
+				i++;
+			}
+
+			tx_rwset_item_t &item = write_set[i];
+			i++;
+
+			rpc_req_t *req = oneway ?
+				rpc->start_new_oneway_req(coro_id,
+					item.rpc_reqtype, item.primary_mn) :
+				wave_start_req(req_i, item.rpc_reqtype, item.primary_mn,
+					(uint8_t *) &item.obj->hdr, sizeof(uint64_t)); /* Small */
+
+			size_t size_req = ds_forge_generic_get_req(req, caller_id,
+				item.key, item.keyhash, ds_reqtype_t::unlock);
+			req->freeze(size_req);
+		}
+
+		if(oneway) {
+			rpc->send_oneway_reqs(coro_id);
+			return;
 		}
 
-		tx_dassert(tx_req_arr[req_i]->resp_type ==
-			(uint16_t) ds_resptype_t::unlock_success);
+		wave_send(yield, wave_size);
 
-		req_i++;
+		/* Check the responses */
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			tx_dassert(tx_req_arr[req_i]->resp_type ==
+				(uint16_t) ds_resptype_t::unlock_success);
+		}
 	}
+
+	wave_release();
 }
 
-/* Validate keys. For now, we re-read full objects during validation. */
+/*
+ * Validate keys. The datastore returns only the current header of each key's
+ * bucket (or slot, with FixedTable slot locks), whose version changes with
+ * every modification of the bucket (or key).
+ */
 bool Tx::validate(coro_yield_t &yield)
 {
-	tx_dassert(read_set.size() > 0 && read_set.size() <= RPC_MAX_MSG_CORO);
+	size_t num_reads = read_set.size();
+	tx_dassert(num_reads > 0 && num_reads <= TX_MAX_KEYS);
 
-	/* Send requests */
-	rpc->clear_req_batch(coro_id);
+	// The loop below may only clear validation_success; success can be
+	// returned only after inspecting all keys.
+	bool validation_success = true;
 
-	for(size_t i = 0; i < read_set.size(); i++) {
-		tx_rwset_item_t &item = read_set[i];
+	for(size_t wave_base = 0; wave_base < num_reads && validation_success;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_reads - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
 
-		/* The object should be sane if it existed during execute */
-		if(item.exec_rs_exists) {
-			tx_dassert(item.obj != NULL);
-			tx_dassert(item.obj->hdr.canary == HOTS_VERSION_CANARY);
-		}
+		/* Send requests */
+		wave_clear();
 
-		/*
-		 * Use the object as the validation response destination - this
-		 * corrupts the application object, but that's OK since the app gives
-		 * up the buffer on calling commit().
-		 */
-		rpc_req_t *req = rpc->start_new_req(coro_id,
-			item.rpc_reqtype, item.primary_mn,
-			(uint8_t *) &item.obj->hdr, sizeof(hots_obj_t));
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			tx_rwset_item_t &item = read_set[wave_base + req_i];
 
-		tx_req_arr[i] = req;
+			/* The object should be sane if it existed during execute */
+			if(item.exec_rs_exists) {
+				tx_dassert(item.obj != NULL);
+				tx_dassert(item.obj->hdr.canary == HOTS_VERSION_CANARY);
+			}
 
-		size_t size_req = ds_forge_generic_get_req(req, caller_id,
-			item.key, item.keyhash, ds_reqtype_t::get_rdonly);
-		req->freeze(size_req);
-	}
+			/*
+			 * We only need the header of the response, so don't copy it out
+			 * of the RPC layer's buffers
+			 */
+			rpc_req_t *req = wave_start_req(req_i,
+				item.rpc_reqtype, item.primary_mn,
+				wave_hdr_buf(req_i), sizeof(hots_hdr_t));
 
-	rpc->send_reqs(coro_id);
-	tx_yield(yield);
-
-	// Check the response.
-	// The loop below may only return false; true can be returned only after
-	// inspecting all keys.
-	for(size_t i = 0; i < read_set.size(); i++) {
-		tx_rwset_item_t &item = read_set[i];
-		ds_resptype_t resp_type = (ds_resptype_t) tx_req_arr[i]->resp_type;
-		tx_dassert(resp_type == ds_resptype_t::get_rdonly_success ||
-			resp_type == ds_resptype_t::get_rdonly_not_found ||
-			resp_type == ds_resptype_t::get_rdonly_locked);
-
-		if(item.exec_rs_exists) {
-			// This key existed during execution
-			if(resp_type == ds_resptype_t::get_rdonly_success) {
-				/* If it still exists, sanity-check the object */
-				tx_dassert(item.obj->hdr.canary == HOTS_VERSION_CANARY);
-				tx_dassert(item.obj->val_size == tx_req_arr[i]->resp_len -
-					sizeof(hots_hdr_t)); /* Size cannot have changed */
-
-				/*
-				 * If the object has a different version now, fail.
-				 * IMPORTANT: This check ignores the "locked" bit of the
-				 * header. If the key's bucket was locked but the datastore
-				 * returned success, it means that the bucket was locked by this
-				 * coroutine, so validation should succeed.
-			 	 */
-				if(item.obj->hdr.version != item.exec_rs_version) {
-					return false;
-				}
-			} else {
-				/*
-				 * The object is either locked (get_rdonly_locked), or it has
-				 * been deleted since we read it (get_rdonly_not_found).
-				 */
-				return false;
+			size_t size_req = ds_forge_generic_get_req(req, caller_id,
+				item.key, item.keyhash, ds_reqtype_t::validate);
+			req->freeze(size_req);
+		}
+
+		wave_send(yield, wave_size);
+
+		/* Check the responses */
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			tx_rwset_item_t &item = read_set[wave_base + req_i];
+			rpc_req_t *req = tx_req_arr[req_i];
+			ds_resptype_t resp_type = (ds_resptype_t) req->resp_type;
+			tx_dassert(resp_type == ds_resptype_t::validate_success ||
+				resp_type == ds_resptype_t::validate_locked);
+
+			if(resp_type == ds_resptype_t::validate_locked) {
+				/* The bucket is locked by some other coroutine */
+				validation_success = false;
+				break;
 			}
-		} else {
-			/* A key that didn't exist during execute shouldn't exist now */
-			if(resp_type == ds_resptype_t::get_rdonly_not_found) {
-				tx_dassert(tx_req_arr[i]->resp_len == sizeof(uint64_t));
-
-				/*
-				 * We ignore the "locked" bit here. See comment for
-				 * successfully-read keys above.
-				 */
-				if(item.obj->hdr.version != item.exec_rs_version) {
-					/*
-					 * This key, or some other key in this key's bucket, was
-					 * inserted and deleted by other transactions.
-					 */
-					return false;
-				}
 
-			} else {
-				/*
-				 * The key either exists now, or its bucket is locked by some
-				 * other coroutine.
-				 */
-				return false;
+			/* Header of the key's bucket at the primary */
+			tx_dassert(req->resp_len == sizeof(hots_hdr_t));
+			hots_hdr_t *resp_hdr = (hots_hdr_t *) req->resp_buf;
+
+			/*
+			 * If the bucket has a different version now, the key may have
+			 * been modified, deleted, or (if it did not exist) inserted, so
+			 * fail. IMPORTANT: This check ignores the "locked" bit of the
+			 * header. If the key's bucket was locked but the datastore
+			 * returned success, it means that the bucket was locked by this
+			 * coroutine, so validation should succeed.
+			 */
+			if(resp_hdr->version != item.exec_rs_version) {
+				validation_success = false;
+				break;
 			}
 		}
 	}
 
-	return true;
+	/* Done with the zero-copy responses */
+	wave_release();
+	return validation_success;
 }
 
 #endif /* TX_COMMIT_H */
@@ -11,6 +11,33 @@
 
 #define TX_ENABLE_LOCK_SERVER 0
 
+/*
+ * Use TicToc-style timestamp OCC instead of FaSST's OCC (see tx_tictoc.h).
+ * Write set keys are locked at commit instead of during execution, and read
+ * set keys are validated at a commit timestamp computed from the timestamps
+ * of the versions read, so many read-write conflicts commit instead of
+ * aborting. Only FixedTable datastores support TicToc requests.
+ */
+#define TX_ENABLE_TICTOC 0
+
+/*
+ * Send updates to primaries during commit, and unlocks during abort, as
+ * one-way RPCs (see Rpc::start_new_oneway_req()) when the coroutine's previous
+ * one-way batch has been acknowledged. The coroutine does not wait for them.
+ */
+#define TX_ENABLE_ONEWAY 1
+
+/*
+ * Wide transactions. A request batch holds at most RPC_MAX_MSG_CORO requests,
+ * so each phase of a transaction is sent in waves: a wave fills the
+ * coroutine's regular batch and its RPC_MAX_FUTURES futures, and all of them
+ * are in flight together. A phase with up to TX_MAX_WAVE_REQS requests takes
+ * one round trip.
+ */
+#define TX_MAX_KEYS 256	/* Max keys (read set + write set) per transaction */
+#define TX_WAVE_BATCHES (1 + RPC_MAX_FUTURES)
+#define TX_MAX_WAVE_REQS (TX_WAVE_BATCHES * RPC_MAX_MSG_CORO)
+
 // Debug macros
 #define tx_dprintf(fmt, ...) \
 	do { \
@@ -66,7 +93,11 @@ struct tx_rwset_item_t {
 	uint64_t exec_rs_version;
 
 	/* Write set tracking */
-	bool exec_ws_locked;	/* True iff we locked this key during execute */
+	bool exec_ws_locked;	/* True iff we locked this key */
+
+	/* TicToc tracking for both sets (TX_ENABLE_TICTOC) */
+	uint64_t exec_wts;	/* wts of the version read during execute */
+	uint64_t exec_rts;	/* rts of that version; may be smaller than real */
 
 	tx_rwset_item_t(rpc_reqtype_t rpc_reqtype, hots_key_t key, hots_obj_t *obj,
 		tx_write_mode_t write_mode = tx_write_mode_t::ignore) :
@@ -6,7 +6,7 @@ forceinline tx_status_t Tx::do_read(coro_yield_t &yield)
 {
 	tx_dassert(tx_status == tx_status_t::in_progress);
 
-	tx_dassert(read_set.size() + write_set.size() <= RPC_MAX_MSG_CORO);
+	tx_dassert(read_set.size() + write_set.size() <= TX_MAX_KEYS);
 	tx_dassert(rs_index <= read_set.size());
 	tx_dassert(ws_index <= write_set.size());
 
@@ -26,156 +26,195 @@ forceinline tx_status_t Tx::do_read(coro_yield_t &yield)
 	}
 #endif
 
-	rpc->clear_req_batch(coro_id);
-	size_t req_i = 0;	/* Separate index bc we'll fetch both read, write set */
-	
-	/* Read the read set */
-	for(size_t i = rs_index; i < read_set.size(); i++) {
-		tx_rwset_item_t &item = read_set[i];
-
-		rpc_req_t *req = rpc->start_new_req(coro_id,
-			item.rpc_reqtype, item.primary_mn,
-			(uint8_t *) &item.obj->hdr, sizeof(hots_obj_t));
+	size_t num_rs = read_set.size() - rs_index;	/* Read set keys to read */
+	size_t num_keys = num_rs + (write_set.size() - ws_index);
+	tx_dassert(num_keys > 0);
 
-		tx_req_arr[req_i] = req;
-		req_i++;
-
-		size_t size_req = ds_forge_generic_get_req(req, caller_id,
-			item.key, item.keyhash, ds_reqtype_t::get_rdonly);
-		req->freeze(size_req);
-	}
-
-	/* Read + lock the write set */
-	for(size_t i = ws_index; i < write_set.size(); i++) {
-		tx_rwset_item_t &item = write_set[i];
-
-		rpc_req_t *req = rpc->start_new_req(coro_id,
-			item.rpc_reqtype, item.primary_mn,
-			(uint8_t *) &item.obj->hdr, sizeof(hots_obj_t));
+	/*
+	 * Read the keys in waves of up to TX_MAX_WAVE_REQS requests. Key k is the
+	 * k-th unread read set key if k < num_rs, else a write set key.
+	 */
+	for(size_t wave_base = 0; wave_base < num_keys;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_keys - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			size_t k = wave_base + req_i;
+
+			if(k < num_rs) {
+				/* Read a read set key */
+				tx_rwset_item_t &item = read_set[rs_index + k];
+
+				rpc_req_t *req = wave_start_req(req_i,
+					item.rpc_reqtype, item.primary_mn,
+					(uint8_t *) &item.obj->hdr, sizeof(hots_obj_t));
+
+				size_t size_req = ds_forge_generic_get_req(req, caller_id,
+					item.key, item.keyhash, ds_reqtype_t::get_rdonly);
+				req->freeze(size_req);
+				continue;
+			}
 
-		tx_req_arr[req_i] = req;
-		req_i++;
+			/* Read + lock a write set key */
+			tx_rwset_item_t &item = write_set[ws_index + (k - num_rs)];
+
+			rpc_req_t *req = wave_start_req(req_i,
+				item.rpc_reqtype, item.primary_mn,
+				(uint8_t *) &item.obj->hdr, sizeof(hots_obj_t));
+
+			size_t size_req;
+			/*
+			 * In the execute phase, updates and deletes are handled alike,
+			 * except that datastores with per-key locks must lock the bucket
+			 * for deletes. With TicToc, they are locked during commit
+			 * (tictoc_prepare()).
+			 */
+			if(item.write_mode != tx_write_mode_t::insert) {
+				/* Update or delete */
+				ds_reqtype_t get_type = TX_ENABLE_TICTOC == 1 ?
+					ds_reqtype_t::get_rdonly :
+					(item.write_mode == tx_write_mode_t::del ?
+						ds_reqtype_t::get_for_del : ds_reqtype_t::get_for_upd);
+				size_req = ds_forge_generic_get_req(req, caller_id,
+					item.key, item.keyhash, get_type);
+			} else {
+				/* Insert */
+				size_req = ds_forge_generic_get_req(req, caller_id,
+					item.key, item.keyhash, ds_reqtype_t::lock_for_ins);
+			}
 
-		size_t size_req;
-		/* In the execute phase, update and delete keys are handled similarly */
-		if(item.write_mode != tx_write_mode_t::insert) {
-			/* Update or delete */
-			size_req = ds_forge_generic_get_req(req, caller_id,
-				item.key, item.keyhash, ds_reqtype_t::get_for_upd);
-		} else {
-			/* Insert */
-			size_req = ds_forge_generic_get_req(req, caller_id,
-				item.key, item.keyhash, ds_reqtype_t::lock_for_ins);
+			req->freeze(size_req);
 		}
-		
-		req->freeze(size_req);
-	}
-
-	tx_dassert(req_i > 0 && req_i <= RPC_MAX_MSG_CORO);
 
-	rpc->send_reqs(coro_id);
-	tx_yield(yield);
-
-	req_i = 0;
+		wave_send(yield, wave_size);
+
+		/*
+		 * a. Sanity-check the response.
+		 * b. Record read set versions for validation.
+		 * c. Record locking status of all write set keys to unlock on abort.
+		 */
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			size_t k = wave_base + req_i;
+			rpc_req_t *req = tx_req_arr[req_i];
+			ds_resptype_t resp_type = (ds_resptype_t) req->resp_type;
+
+			if(k < num_rs) {
+				tx_rwset_item_t &item = read_set[rs_index + k];
+
+				/* Hdr of successfully read keys may be locked (bkt collision) */
+				switch(resp_type) {
+					case ds_resptype_t::get_rdonly_success:
+						/* Response contains header and value */
+						item.obj->val_size = req->resp_len - sizeof(hots_hdr_t);
+						check_item(item);	/* Checks @val_size */
+
+						/* Save fields needed for validation */
+						item.exec_rs_exists = true;
+						item.exec_rs_version = item.obj->hdr.version;
+						record_tictoc_ts(item);
+						break;
+					case ds_resptype_t::get_rdonly_not_found:
+						/* Need not abort if a rdonly key is not found */
+						tx_dassert(req->resp_len == sizeof(uint64_t));
+
+						item.obj->val_size = 0;
+
+						/* Save fields needed for validation */
+						item.exec_rs_exists = false;
+						item.exec_rs_version = item.obj->hdr.version;
+						record_tictoc_ts(item);
+						break;
+					case ds_resptype_t::get_rdonly_locked:
+						tx_dassert(req->resp_len == 0);
+						tx_status = tx_status_t::must_abort;
+						break;
+					default:
+						printf("Tx: Unknown response type %u for read set key "
+							"%" PRIu64 "\n.", req->resp_type, item.key);
+				}
+
+				continue;
+			}
 
-	/*
-	 * a. Sanity-check the response.
-	 * b. Record read set versions for validation.
-	 * c. Record locking status of all write set keys to unlock on abort.
-	 */
-	for(size_t i = rs_index; i < read_set.size(); i++) {
-		tx_rwset_item_t &item = read_set[i];
-		ds_resptype_t resp_type = (ds_resptype_t) tx_req_arr[req_i]->resp_type;
-
-		/* Hdr for successfully read keys need not be locked (bkt collison) */
-		switch(resp_type) {
-			case ds_resptype_t::get_rdonly_success:
-				/* Response contains header and value */
-				item.obj->val_size =
-					tx_req_arr[req_i]->resp_len - sizeof(hots_hdr_t);
-				check_item(item);	/* Checks @val_size */
-
-				/* Save fields needed for validation */
-				item.exec_rs_exists = true;
-				item.exec_rs_version = item.obj->hdr.version;
-				break;
-			case ds_resptype_t::get_rdonly_not_found:
-				/* Txn need not be aborted if a rdonly key is not found. */
-				tx_dassert(tx_req_arr[req_i]->resp_len == sizeof(uint64_t));
-
-				item.obj->val_size = 0;
-
-				/* Save fields needed for validation */
-				item.exec_rs_exists = false;
-				item.exec_rs_version = item.obj->hdr.version;
-				break;
-			case ds_resptype_t::get_rdonly_locked:
-				tx_dassert(tx_req_arr[req_i]->resp_len == 0);
-				tx_status = tx_status_t::must_abort;
-				break;
-			default:
-				printf("Tx: Unknown response type %u for read set key "
-					"%" PRIu64 "\n.", tx_req_arr[req_i]->resp_type, item.key);
+			tx_rwset_item_t &item = write_set[ws_index + (k - num_rs)];
+
+			if(item.write_mode != tx_write_mode_t::insert) {
+				// Update or delete
+				switch(resp_type) {
+					case ds_resptype_t::get_for_upd_success:
+						tx_dassert(item.obj->hdr.locked == 1);
+
+						item.obj->val_size = req->resp_len - sizeof(hots_hdr_t);
+						check_item(item); /* Checks @val_size */
+
+						item.exec_ws_locked = true;	/* Unlock on abort */
+						break;
+					case ds_resptype_t::get_rdonly_success:
+						/* TicToc: the key is read but not locked */
+						tx_dassert(TX_ENABLE_TICTOC == 1);
+						item.obj->val_size = req->resp_len - sizeof(hots_hdr_t);
+						check_item(item); /* Checks @val_size */
+
+						item.exec_ws_locked = false;	/* Locked at commit */
+						record_tictoc_ts(item);
+						break;
+					case ds_resptype_t::get_for_upd_not_found:
+					case ds_resptype_t::get_for_upd_locked:
+					case ds_resptype_t::get_rdonly_not_found:
+					case ds_resptype_t::get_rdonly_locked:
+						tx_dassert(req->resp_type ==
+							(uint16_t) ds_resptype_t::get_rdonly_not_found ||
+							req->resp_len == 0);
+
+						item.exec_ws_locked = false;	/* Don't unlock */
+						tx_status = tx_status_t::must_abort;
+						break;
+					default:
+						printf("Tx: Unknown response type %u for write set "
+							"(non-insert) key %" PRIu64 "\n.",
+							req->resp_type, item.key);
+						exit(-1);
+				}
+			} else {
+				// Insert
+				switch(resp_type) {
+					case ds_resptype_t::lock_for_ins_success:
+						tx_dassert(item.obj->hdr.locked == 1);
+						tx_dassert(req->resp_len ==
+							sizeof(hots_hdr_t));	/* Just the header */
+						item.exec_ws_locked = true;	/* Delete on abort */
+						record_tictoc_ts(item);
+						break;
+					case ds_resptype_t::lock_for_ins_exists:
+					case ds_resptype_t::lock_for_ins_locked:
+						tx_dassert(req->resp_len == 0);
+						tx_status = tx_status_t::must_abort;
+						item.exec_ws_locked = false; /* Don't unlock on abort */
+						break;
+					default:
+						printf("Tx: Unknown response type %u for write set "
+							"(insert) key %" PRIu64 "\n.",
+							req->resp_type, item.key);
+						exit(-1);
+				}
+			}
 		}
 
-		req_i++;
-	}
-
-	for(size_t i = ws_index; i < write_set.size(); i++) {
-		tx_rwset_item_t &item = write_set[i];
-		ds_resptype_t resp_type = (ds_resptype_t) tx_req_arr[req_i]->resp_type;
-
-		if(item.write_mode != tx_write_mode_t::insert) {
-			// Update or delete
-			switch(resp_type) {
-				case ds_resptype_t::get_for_upd_success:
-					tx_dassert(item.obj->hdr.locked == 1);
-
-					item.obj->val_size = 
-						tx_req_arr[req_i]->resp_len - sizeof(hots_hdr_t);
-					check_item(item); /* Checks @val_size */
-			
-					item.exec_ws_locked = true;	/* Mark for unlock on abort */
-					break;
-				case ds_resptype_t::get_for_upd_not_found:
-				case ds_resptype_t::get_for_upd_locked:
-					tx_dassert(tx_req_arr[req_i]->resp_len == 0);
-
-					item.exec_ws_locked = false;	/* Don't unlock on abort */
-					tx_status = tx_status_t::must_abort;
-					break;
-				default:
-					printf("Tx: Unknown response type %u for write set "
-						"(non-insert) key %" PRIu64 "\n.",
-						tx_req_arr[req_i]->resp_type, item.key);
-					exit(-1);
-			}
-		} else {
-			// Insert
-			switch(resp_type) {
-				case ds_resptype_t::lock_for_ins_success:
-					tx_dassert(item.obj->hdr.locked == 1);
-					tx_dassert(tx_req_arr[req_i]->resp_len ==
-						sizeof(hots_hdr_t));	/* Just the header */
-					item.exec_ws_locked = true;	/* Mark for delete on abort */
-					break;
-				case ds_resptype_t::lock_for_ins_exists:
-				case ds_resptype_t::lock_for_ins_locked:
-					tx_dassert(tx_req_arr[req_i]->resp_len == 0);
-					tx_status = tx_status_t::must_abort;
-					item.exec_ws_locked = false; /* Don't unlock on abort */
-					break;
-				default:
-					printf("Tx: Unknown response type %u for write set "
-						"(insert) key %" PRIu64 "\n.",
-						tx_req_arr[req_i]->resp_type, item.key);
-					exit(-1);
+		if(tx_status == tx_status_t::must_abort) {
+			/* Don't lock the keys of later waves; abort() must skip them */
+			for(size_t k = std::max(wave_base + wave_size, num_rs);
+					k < num_keys; k++) {
+				write_set[ws_index + (k - num_rs)].exec_ws_locked = false;
 			}
-		}
 
-		req_i++;
+			break;
+		}
 	}
 
+	wave_release();
+
 	/*
 	 * These indices only make sense if we return ex_success, so no need to
 	 * update them in error cases.
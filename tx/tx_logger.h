@@ -1,79 +1,112 @@
 #ifndef TX_LOGGER_H
 #define TX_LOGGER_H
 
+/*
+ * Send the log records of this transaction to all backups. The write set is
+ * split into records of up to LOGGER_KEYS_PER_RECORD keys, and all records
+ * are sent to each backup's Logger.
+ */
 forceinline bool Tx::log(coro_yield_t &yield)
 {
 	/* Tx::commit() for read-only txns should finish without logging */
 	tx_dassert(write_set.size() >= 0);
+	tx_dassert((int) write_set.size() <= logger->get_max_tx_keys());
 
-	tx_dassert(RPC_MAX_MSG_CORO >= mappings->num_backups); /* 1 msg per backup */
+	size_t num_writes = write_set.size();
+	size_t num_backups = (size_t) mappings->num_backups;
+	size_t num_records = (num_writes + LOGGER_KEYS_PER_RECORD - 1) /
+		LOGGER_KEYS_PER_RECORD;
 
-	// Serialize the write set into the log record sent to all backups
-	local_log_record->mchn_id = mappings->machine_id;
-	local_log_record->coro_id = coro_id;
-	local_log_record->num_keys = write_set.size();
-	size_t req_len = sizeof(uint64_t);	/* Log record header */
+	/* Request r sends record (r / num_backups) to backup (r % num_backups) */
+	size_t num_reqs = num_records * num_backups;
+	tx_dassert(num_reqs > 0);
 
-	uint8_t *_buf = local_log_record->buf;
-
-	for(size_t i = 0; i < write_set.size(); i++) {
-		// Construct the log entry for this key. @item.obj contains a valid
-		// HoTS object that has been checked using @check_item().
-		tx_dassert(is_aligned(_buf, sizeof(uint64_t)));
-
-		tx_rwset_item_t &item = write_set[i];
-
-		/* Add the key */
-		((uint64_t *) _buf)[0] = item.key;
-		_buf += sizeof(uint64_t);
-		req_len += sizeof(uint64_t);
-
-		/* Append val size, header, and value by memcpy-ing the object */
-
-		// XXX - Need to add req_type, and delete flag for deleted objects.
-		// There is enough space in the object's @val_size field for this.
-		size_t obj_size = hots_obj_size(item.obj->val_size);
-			
-		rte_memcpy((void *) _buf, &item.obj, obj_size);
-		_buf += obj_size;
-		req_len += obj_size;
-	}
+	uint64_t resp_buf;	/* Logger responses are 0-byte so we don't need them */
+	size_t cur_record = num_records;	/* The record in @local_log_record */
+	size_t req_len = 0;
+
+	for(size_t wave_base = 0; wave_base < num_reqs;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_reqs - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			size_t record_id = (wave_base + req_i) / num_backups;
+			int back_i = (int) ((wave_base + req_i) % num_backups);
+
+			if(record_id != cur_record) {
+				// Serialize this record's write set keys into the local log
+				// record, which is copied into the requests for all backups
+				size_t key_lo = record_id * LOGGER_KEYS_PER_RECORD;
+				size_t key_hi = std::min(num_writes,
+					key_lo + LOGGER_KEYS_PER_RECORD);
+
+				local_log_record->mchn_id = mappings->machine_id;
+				local_log_record->coro_id = coro_id;
+				local_log_record->record_id = record_id;
+				local_log_record->num_records = num_records;
+				local_log_record->num_keys = key_hi - key_lo;
+				req_len = sizeof(uint64_t);	/* Log record header */
+
+				uint8_t *_buf = local_log_record->buf;
+
+				for(size_t i = key_lo; i < key_hi; i++) {
+					// Construct the log entry for this key. @item.obj
+					// contains a valid HoTS object that has been checked
+					// using @check_item().
+					tx_dassert(is_aligned(_buf, sizeof(uint64_t)));
+
+					tx_rwset_item_t &item = write_set[i];
+
+					/* Add the key */
+					((uint64_t *) _buf)[0] = item.key;
+					_buf += sizeof(uint64_t);
+					req_len += sizeof(uint64_t);
+
+					/* Append val size, header, and value: copy the object */
+
+					// XXX - Need to add req_type, and delete flag for deleted
+					// objects. There is enough space in the object's
+					// @val_size field for this.
+					size_t obj_size = hots_obj_size(item.obj->val_size);
+
+					rte_memcpy((void *) _buf, (void *) item.obj, obj_size);
+					_buf += obj_size;
+					req_len += obj_size;
+				}
 
 #if TX_DEBUG_ASSERT == 1
-	local_log_record->magic = log_magic;
-	local_log_record->debug_size = req_len;
+				local_log_record->magic = log_magic;
+				local_log_record->debug_size = req_len;
 #endif
+				cur_record = record_id;
+			}
 
-	rpc->clear_req_batch(coro_id);
-
-	uint64_t resp_buf;	/* Logger responses are 0-byte so we don't need them */
-	rpc_req_t *rpc_req[HOTS_MAX_BACKUPS];
+			int log_mn = mappings->get_log_mn(back_i);
+			rpc_req_t *req = wave_start_req(req_i, RPC_LOGGER_REQ, log_mn,
+				(uint8_t *) &resp_buf, sizeof(uint64_t));	/* Small resps */
 
-	for(int back_i = 0; back_i < mappings->num_backups; back_i++) {
-		int log_mn = mappings->get_log_mn(back_i);
+			tx_dassert(req != NULL && req->req_buf != NULL);
+			tx_dassert(is_aligned(req->req_buf, sizeof(uint32_t)));
 
-		rpc_req[back_i] = rpc->start_new_req(coro_id,
-			RPC_LOGGER_REQ, log_mn,
-			(uint8_t *) &resp_buf, sizeof(uint64_t));	/* Small resps */
+			rte_memcpy((void *) req->req_buf,
+				(void *) local_log_record, req_len);
+			req->freeze(req_len);
+		}
 
-		tx_dassert(rpc_req[back_i] != NULL && rpc_req[back_i]->req_buf != NULL);
-		tx_dassert(is_aligned(rpc_req[back_i]->req_buf, sizeof(uint32_t)));
+		wave_send(yield, wave_size);
 
-		rte_memcpy((void *) rpc_req[back_i]->req_buf,
-			(void *) local_log_record, req_len);
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			logger_resptype_t resp_type =
+				(logger_resptype_t) tx_req_arr[req_i]->resp_type;
+			_unused(resp_type);
 
-		rpc_req[back_i]->freeze(req_len);
+			tx_dassert(resp_type == logger_resptype_t::success);
+		}
 	}
 
-	rpc->send_reqs(coro_id);
-	tx_yield(yield);
-
-	for(int back_i = 0; back_i < mappings->num_backups; back_i++) {
-		logger_resptype_t resp_type =
-			(logger_resptype_t ) rpc_req[back_i]->resp_type; _unused(resp_type);
-
-		tx_dassert(resp_type == logger_resptype_t::success);
-	}
+	wave_release();
 
 	/* XXX: For now, logging always succeeds */
 	return true;
@@ -0,0 +1,82 @@
+#ifndef TX_PROC_H
+#define TX_PROC_H
+
+/*
+ * Run this transaction as stored procedure @proc_id at @primary_mn, which
+ * must be the primary of all keys that the procedure accesses. The
+ * procedure's output is copied to @out if it is not NULL.
+ *
+ * Without backups, this takes one round trip. Otherwise, the primary returns
+ * the locked write set, which is logged and committed like an executed write
+ * set. The transaction must be started and must not have added keys.
+ */
+forceinline tx_status_t Tx::run_proc(coro_yield_t &yield, int primary_mn,
+	int proc_id, const void *params, size_t params_len, void *out)
+{
+	tx_dassert(tx_status == tx_status_t::in_progress);
+	tx_dassert(read_set.size() == 0 && write_set.size() == 0);
+	tx_dassert(TX_ENABLE_TICTOC == 0 && !mappings->use_lock_server);
+	tx_dassert(params_len <= PROCSERVER_MAX_PARAMS &&
+		params_len % sizeof(uint64_t) == 0);
+
+	wave_clear();
+	rpc_req_t *req = wave_start_req(0, RPC_PROCSERVER_REQ, primary_mn,
+		(uint8_t *) &proc_resp, sizeof(procsrv_resp_t));
+
+	procsrv_req_t *ps_req = (procsrv_req_t *) req->req_buf;
+	ps_req->caller_id = caller_id;
+	ps_req->proc_id = proc_id;
+	ps_req->commit_at_primary = (mappings->num_backups == 0) ? 1 : 0;
+	ps_req->params_len = params_len;
+	rte_memcpy((void *) ps_req->params, params, params_len);
+	req->freeze(procsrv_req_size(params_len));
+
+	wave_send(yield, 1);
+	procsrv_resptype_t resp_type = (procsrv_resptype_t) req->resp_type;
+	wave_release();
+
+	if(resp_type == procsrv_resptype_t::aborted) {
+		tx_status = tx_status_t::aborted;
+		return tx_status_t::aborted;
+	}
+
+	if(out != NULL) {
+		rte_memcpy(out, (void *) proc_resp.out, proc_resp.out_len);
+	}
+
+	if(resp_type == procsrv_resptype_t::committed) {
+		tx_dassert(proc_resp.num_writes == 0);
+		tx_status = tx_status_t::committed;
+		return tx_status_t::committed;
+	}
+
+	/* Prepared: the primary holds the write set locks for our caller ID */
+	tx_dassert(resp_type == procsrv_resptype_t::prepared);
+	tx_dassert(proc_resp.num_writes > 0 &&
+		proc_resp.num_writes <= PROCSERVER_MAX_KEYS);
+
+	uint8_t *_buf = proc_resp.writes;
+	for(size_t i = 0; i < proc_resp.num_writes; i++) {
+		procsrv_write_t *write = (procsrv_write_t *) _buf;
+		_buf += sizeof(procsrv_write_t);
+
+		hots_obj_t *obj = &proc_obj_arr[i];
+		obj->val_size = write->val_size;
+		obj->hdr = write->hdr;
+		rte_memcpy((void *) obj->val, (void *) _buf, write->val_size);
+		_buf += write->val_size;
+
+		int mn = add_to_write_set(write->rpc_reqtype, write->key, obj,
+			static_cast<tx_write_mode_t>(write->write_mode));
+		_unused(mn);
+		tx_dassert(mn == primary_mn);
+
+		write_set.back().exec_ws_locked = true;
+		check_item(write_set.back());
+	}
+
+	/* The read set is empty, so this only logs and sends the updates */
+	return commit(yield);
+}
+
+#endif /* TX_PROC_H */
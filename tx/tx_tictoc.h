@@ -0,0 +1,184 @@
+#ifndef TX_TICTOC_H
+#define TX_TICTOC_H
+
+/*
+ * TicToc-style commit (TX_ENABLE_TICTOC). Each bucket header holds the write
+ * timestamp (wts) of its current version and the read timestamp (rts) until
+ * which that version is known to be valid. A transaction commits at a
+ * timestamp that is valid for all the versions it read, and only read set
+ * keys whose rts is smaller than the commit timestamp need to be extended.
+ *
+ * This works at bucket granularity, like FaSST's OCC: a version is the version
+ * of the key's bucket.
+ */
+
+/*
+ * Lock the write set keys that are not locked yet (i.e., updates and deletes),
+ * and check that their buckets were not modified since execute. The rts
+ * returned with the lock is final until we unlock, so record it.
+ */
+forceinline bool Tx::tictoc_lock_write_set(coro_yield_t &yield)
+{
+	size_t num_writes = write_set.size();
+	bool lock_success = true;
+
+	for(size_t wave_base = 0; wave_base < num_writes && lock_success;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_writes - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		/* Inserts were locked during execute; skip them but keep indexing */
+		size_t num_reqs = 0;
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			tx_rwset_item_t &item = write_set[wave_base + req_i];
+			if(item.write_mode == tx_write_mode_t::insert) {
+				tx_dassert(item.exec_ws_locked);
+				continue;
+			}
+
+			/* We only need the header, so use a zero-copy response */
+			rpc_req_t *req = wave_start_req(num_reqs,
+				item.rpc_reqtype, item.primary_mn, wave_hdr_buf(num_reqs),
+				sizeof(hots_hdr_t));
+
+			size_t size_req = ds_forge_generic_get_req(req, caller_id,
+				item.key, item.keyhash, ds_reqtype_t::tictoc_lock);
+			req->freeze(size_req);
+			num_reqs++;
+		}
+
+		if(num_reqs == 0) {
+			continue;
+		}
+
+		wave_send(yield, num_reqs);
+
+		/* Record all successful locks before giving up so abort() unlocks */
+		size_t resp_i = 0;
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			tx_rwset_item_t &item = write_set[wave_base + req_i];
+			if(item.write_mode == tx_write_mode_t::insert) {
+				continue;
+			}
+
+			rpc_req_t *req = tx_req_arr[resp_i];
+			resp_i++;
+
+			if(req->resp_type == (uint16_t) ds_resptype_t::tictoc_failed) {
+				tx_dassert(req->resp_len == 0);
+				lock_success = false;
+				continue;
+			}
+
+			tx_dassert(req->resp_type ==
+				(uint16_t) ds_resptype_t::tictoc_success);
+			tx_dassert(req->resp_len == sizeof(hots_hdr_t));
+			item.exec_ws_locked = true;	/* Unlock on abort */
+
+			hots_hdr_t *resp_hdr = (hots_hdr_t *) req->resp_buf;
+			tx_dassert(resp_hdr->locked == 1);
+
+			/* The bucket was modified after we read it */
+			if(hots_tictoc_wts(*resp_hdr) != item.exec_wts) {
+				lock_success = false;
+				continue;
+			}
+
+			item.exec_rts = hots_tictoc_rts(*resp_hdr);
+		}
+
+		tx_dassert(resp_i == num_reqs);
+	}
+
+	/* Done with the zero-copy responses */
+	wave_release();
+	return lock_success;
+}
+
+/*
+ * Check that the read set versions are valid at @commit_ts, extending their
+ * rts at the primaries if needed.
+ */
+forceinline bool Tx::tictoc_validate(coro_yield_t &yield)
+{
+	/* Collect read set keys whose known rts is too small */
+	size_t num_extend = 0;
+	for(size_t i = 0; i < read_set.size(); i++) {
+		if(read_set[i].exec_rts < commit_ts) {
+			num_extend++;
+		}
+	}
+
+	bool validation_success = true;
+	size_t i = 0;	/* Separate index bc we will skip some read set keys */
+
+	for(size_t wave_base = 0; wave_base < num_extend && validation_success;
+			wave_base += TX_MAX_WAVE_REQS) {
+		size_t wave_size = std::min(num_extend - wave_base,
+			(size_t) TX_MAX_WAVE_REQS);
+		wave_clear();
+
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			while(read_set[i].exec_rts >= commit_ts) {
+				i++;
+			}
+
+			tx_rwset_item_t &item = read_set[i];
+			i++;
+
+			rpc_req_t *req = wave_start_req(req_i,
+				item.rpc_reqtype, item.primary_mn,
+				(uint8_t *) &item.obj->hdr, sizeof(uint64_t)); /* Small */
+
+			size_t size_req = ds_forge_tictoc_get_req(req, caller_id,
+				item.key, item.keyhash, ds_reqtype_t::tictoc_validate,
+				item.exec_wts, commit_ts);
+			req->freeze(size_req);
+		}
+
+		wave_send(yield, wave_size);
+
+		/* Check the responses */
+		for(size_t req_i = 0; req_i < wave_size; req_i++) {
+			uint16_t resp_type = tx_req_arr[req_i]->resp_type;
+			tx_dassert(resp_type == (uint16_t) ds_resptype_t::tictoc_success ||
+				resp_type == (uint16_t) ds_resptype_t::tictoc_failed);
+
+			if(resp_type == (uint16_t) ds_resptype_t::tictoc_failed) {
+				/* Newer version, or locked by another coroutine */
+				validation_success = false;
+				break;
+			}
+		}
+	}
+
+	wave_release();
+	return validation_success;
+}
+
+/*
+ * Lock the write set, compute the commit timestamp, and validate the read set.
+ * On failure, the caller must abort.
+ */
+forceinline bool Tx::tictoc_prepare(coro_yield_t &yield)
+{
+	if(!tictoc_lock_write_set(yield)) {
+		return false;
+	}
+
+	/* Write after the last reads of written keys, and after all read writes */
+	commit_ts = 0;
+	for(size_t i = 0; i < write_set.size(); i++) {
+		commit_ts = std::max(commit_ts, write_set[i].exec_rts + 1);
+	}
+
+	for(size_t i = 0; i < read_set.size(); i++) {
+		commit_ts = std::max(commit_ts, read_set[i].exec_wts);
+	}
+
+	tx_dassert(commit_ts <= HOTS_TICTOC_MAX_TS);
+	return tictoc_validate(yield);
+}
+
+#endif /* TX_TICTOC_H */
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "util/hots_coro.h"
+
+/*
+ * hots_coro_switch(save_sp = %rdi, load_sp = %rsi). The registers that the
+ * System V ABI leaves to the caller are saved by the compiler at the call.
+ */
+asm(".text\n"
+	".globl hots_coro_switch\n"
+	".type hots_coro_switch, @function\n"
+	"hots_coro_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size hots_coro_switch, .-hots_coro_switch\n");
+
+#define HOTS_CORO_SAVED_REGS 6	/* Pushed by hots_coro_switch */
+
+namespace hots_coro {
+
+__thread context *cur_ctx = NULL;
+__thread void *main_sp = NULL;
+
+/* Free stacks by size. Coroutines are created at init, so a lock is fine. */
+static std::mutex stack_lock;
+static std::map<size_t, std::vector<uint8_t *>> free_stacks;
+
+/* Get a stack of @size bytes with a guard page below it */
+uint8_t *stack_get(size_t size)
+{
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	assert(size > 0 && size % page_size == 0);
+
+	std::lock_guard<std::mutex> guard(stack_lock);
+	std::vector<uint8_t *> &free_vec = free_stacks[size];
+
+	if(free_vec.empty()) {
+		/* Map a batch of stacks, each above its own guard page */
+		size_t slot_size = page_size + size;
+		uint8_t *map = (uint8_t *) mmap(NULL,
+			slot_size * HOTS_CORO_STACKS_PER_MAP, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(map == MAP_FAILED) {
+			printf("HoTS coro: Failed to map coroutine stacks. Exiting.\n");
+			exit(-1);
+		}
+
+		for(int i = HOTS_CORO_STACKS_PER_MAP - 1; i >= 0; i--) {
+			uint8_t *slot = &map[i * slot_size];
+			if(mprotect(slot, page_size, PROT_NONE) != 0) {
+				printf("HoTS coro: Failed to protect guard page. Exiting.\n");
+				exit(-1);
+			}
+
+			free_vec.push_back(slot + page_size);
+		}
+	}
+
+	uint8_t *stack = free_vec.back();
+	free_vec.pop_back();
+	return stack;
+}
+
+/* Return a stack from stack_get() to the pool */
+void stack_put(uint8_t *stack, size_t size)
+{
+	std::lock_guard<std::mutex> guard(stack_lock);
+	free_stacks[size].push_back(stack);
+}
+
+/* The first code that a coroutine runs, on its own stack */
+void coro_entry()
+{
+	context *ctx = cur_ctx;
+
+	yield_type yield;
+	ctx->fn(yield);
+
+	/* Go back to the code outside coroutines for good */
+	ctx->done = true;
+	cur_ctx = NULL;
+	hots_coro_switch(&ctx->sp, main_sp);
+
+	assert(false);	/* A finished coroutine is never resumed */
+	__builtin_unreachable();
+}
+
+call_type::call_type(std::function<void(yield_type &)> fn, attributes attrs)
+{
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	size_t stack_size = (attrs.size + page_size - 1) / page_size * page_size;
+
+	ctx = new context();
+	ctx->fn = std::move(fn);
+	ctx->stack = stack_get(stack_size);
+	ctx->stack_size = stack_size;
+	ctx->done = false;
+
+	/*
+	 * Make the first switch to this coroutine "return" into coro_entry()
+	 * with the stack aligned as if coro_entry() was called: 16-byte aligned
+	 * before the (fake, zero) return address.
+	 */
+	uintptr_t top = (uintptr_t) (ctx->stack + stack_size) & ~(uintptr_t) 15;
+	void **sp = (void **) top;
+	*(--sp) = NULL;	/* Return address of coro_entry() */
+	*(--sp) = (void *) &coro_entry;	/* Return address of hots_coro_switch() */
+	for(int i = 0; i < HOTS_CORO_SAVED_REGS; i++) {
+		*(--sp) = NULL;
+	}
+
+	ctx->sp = (void *) sp;
+}
+
+void call_type::destroy()
+{
+	if(ctx == NULL) {
+		return;
+	}
+
+	assert(ctx != cur_ctx);	/* A coroutine cannot destroy itself */
+	stack_put(ctx->stack, ctx->stack_size);
+	delete ctx;
+	ctx = NULL;
+}
+
+}	/* namespace hots_coro */
@@ -0,0 +1,164 @@
+/*
+ * A minimal symmetric coroutine engine for x86-64, used instead of boost's
+ * symmetric_coroutine when HOTS_ENABLE_FAST_CORO is set (see hots.h). It
+ * implements the subset of boost's interface that HoTS uses:
+ *
+ * 1. call_type(func, attributes(fpu_not_preserved)) creates a coroutine that
+ *    runs func(yield) on a pooled stack.
+ * 2. call_type::operator()() runs a coroutine from outside all coroutines.
+ * 3. yield(other) switches directly to coroutine @other, and yield() returns
+ *    to the code that started the first coroutine. A coroutine whose function
+ *    returns also goes back there.
+ *
+ * A switch saves only the callee-saved registers, like fpu_not_preserved in
+ * boost. Stacks are carved out of large mappings, with a guard page below
+ * each stack, and are reused when coroutines are destroyed. Unlike boost,
+ * destroying a suspended coroutine does not unwind its stack.
+ */
+
+#ifndef HOTS_CORO_H
+#define HOTS_CORO_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+#define HOTS_CORO_STACK_SIZE (64 * 1024)	/* Default, like boost */
+#define HOTS_CORO_STACKS_PER_MAP 32	/* Stacks carved out of one mmap() */
+
+/* Save the callee-saved registers on the current stack, store the stack
+ * pointer in @save_sp, and resume the context whose stack pointer is @load_sp */
+extern "C" void hots_coro_switch(void **save_sp, void *load_sp);
+
+namespace hots_coro {
+
+enum flag_fpu_t {
+	fpu_not_preserved = 0,
+	fpu_preserved = 1	/* Unsupported */
+};
+
+struct attributes {
+	size_t size;	/* Stack size in bytes */
+	flag_fpu_t do_fpu;
+
+	attributes(flag_fpu_t _do_fpu, size_t _size = HOTS_CORO_STACK_SIZE)
+		: size(_size), do_fpu(_do_fpu)
+	{
+		/* The FPU control words are shared by all coroutines of a thread */
+		assert(_do_fpu == fpu_not_preserved);
+	}
+};
+
+class yield_type;
+
+struct context {
+	void *sp;	/* Saved stack pointer while the coroutine is not running */
+	std::function<void(yield_type &)> fn;
+	uint8_t *stack;	/* Lowest usable address of the stack */
+	size_t stack_size;
+	bool done;	/* @fn returned */
+};
+
+/* Stack pool */
+uint8_t *stack_get(size_t size);
+void stack_put(uint8_t *stack, size_t size);
+
+/* The running coroutine, or NULL outside coroutines */
+extern __thread context *cur_ctx;
+
+/* The stack pointer of the code outside coroutines, saved while they run */
+extern __thread void *main_sp;
+
+class call_type {
+public:
+	call_type() : ctx(NULL) {}
+
+	call_type(std::function<void(yield_type &)> fn,
+		attributes attrs = attributes(fpu_not_preserved));
+
+	call_type(call_type &&other) : ctx(other.ctx)
+	{
+		other.ctx = NULL;
+	}
+
+	call_type& operator=(call_type &&other)
+	{
+		if(this != &other) {
+			destroy();
+			ctx = other.ctx;
+			other.ctx = NULL;
+		}
+
+		return *this;
+	}
+
+	call_type(const call_type &) = delete;
+	call_type& operator=(const call_type &) = delete;
+
+	~call_type()
+	{
+		destroy();
+	}
+
+	/* Run the coroutine until everything yields back to the caller */
+	inline void operator()()
+	{
+		assert(ctx != NULL && !ctx->done);
+		assert(cur_ctx == NULL);	/* Use yield(other) inside coroutines */
+
+		cur_ctx = ctx;
+		hots_coro_switch(&main_sp, ctx->sp);
+	}
+
+	/* Check if the coroutine can still be resumed */
+	inline explicit operator bool() const
+	{
+		return ctx != NULL && !ctx->done;
+	}
+
+private:
+	friend class yield_type;
+	context *ctx;
+
+	void destroy();
+};
+
+class yield_type {
+public:
+	yield_type(const yield_type &) = delete;
+	yield_type& operator=(const yield_type &) = delete;
+
+	/*
+	 * Switch to coroutine @other. Defined in the class but not declared
+	 * inline, so gcc may keep cold calls out of line without -Winline errors.
+	 */
+	void operator()(const call_type &other)
+	{
+		context *self = cur_ctx;
+		context *next = other.ctx;
+		assert(next != NULL && !next->done);
+		if(next == self) {
+			return;
+		}
+
+		cur_ctx = next;
+		hots_coro_switch(&self->sp, next->sp);
+	}
+
+	/* Return to the code outside coroutines */
+	void operator()()
+	{
+		context *self = cur_ctx;
+		cur_ctx = NULL;
+		hots_coro_switch(&self->sp, main_sp);
+	}
+
+private:
+	friend void coro_entry();
+	yield_type() {}
+};
+
+}	/* namespace hots_coro */
+
+#endif /* HOTS_CORO_H */